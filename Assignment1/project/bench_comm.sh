@@ -0,0 +1,17 @@
+#!/bin/bash
+#
+# Times the per-step exchange of every mpi_hh communication backend on one
+# node for a range of process counts and prints the results as CSV:
+#
+#   backend,ranks,us_per_step
+#
+# Usage: ./bench_comm.sh [PROCESS_COUNTS...]   (default: 2 4 8)
+#
+# Extra mpirun options (e.g. '--oversubscribe') can be passed in MPIRUN_ARGS.
+
+counts=${@:-2 4 8}
+
+echo "backend,ranks,us_per_step"
+for np in $counts; do
+  mpirun $MPIRUN_ARGS -np $np ./mpi_hh --comm-bench | grep -v '^backend,'
+done
@@ -0,0 +1,214 @@
+#ifndef BALANCE_H
+#define BALANCE_H
+
+#include "dendr_store.h"
+
+#include <mpi.h>
+#include <stdio.h>
+
+// Fixed cost of stepping a dendrite (seeding and drawing its current), in
+// compartment-steps. bench_hh puts a 1-compartment dendriteStep at about 7
+// times the per compartment cost of a long one.
+#define DENDRITE_OVERHEAD 6
+
+// Weight of the previous intervals in the smoothed rate of a rank.
+#define BALANCE_SMOOTHING 0.5
+
+// Smallest relative drop of the busiest rank's expected time that is worth
+// migrating dendrites for.
+#define BALANCE_MIN_GAIN 0.02
+
+/**
+ * Dendrite to rank assignment of mpi_hh and the measurements used to adjust
+ * it.
+ *
+ * Dendrites may have different compartment counts, so giving every rank the
+ * same number of dendrites does not give them the same work, and ranks may
+ * not run at the same speed. Every rank owns a contiguous range of dendrites;
+ * each interval the ranks measure the CPU time their dendrites took and how
+ * long they then waited in the reduction, and balanceRepartition moves the
+ * range boundaries so that the expected time (compartments, plus
+ * DENDRITE_OVERHEAD per dendrite, times the smoothed ns per compartment-step
+ * of each rank) is the same everywhere. CPU time, unlike wall time, does not
+ * grow when a rank shares its core with others. balanceMigrate then ships
+ * whole dendrites to their new owners. Dendrites keep their global index, and
+ * with it their random seeds, so the simulation does not depend on where a
+ * dendrite is computed.
+ */
+typedef struct Balance {
+  MPI_Comm world;       // Communicator of the ranks sharing the dendrites.
+  int rank;             // Rank of this process in `world'.
+  int size;             // Number of processes in `world'.
+  int num_dendrs;       // Number of dendrites in the whole simulation.
+  int *comps;           // Compartments of every dendrite, dummy and soma too.
+  int max_comps;        // Largest entry of `comps' (the row length of stores).
+  int *bounds;          // Rank r owns dendrites [bounds[r], bounds[r+1]).
+
+  // Measurements of this rank over the current interval.
+  double dendr_time;    // CPU seconds spent on the dendrites.
+  double wait_time;     // Seconds spent in the reduction.
+  double comp_steps;    // Compartment-steps computed, see balanceWork.
+
+  // Measurements of every rank, filled by balanceGather: dendr_time,
+  // wait_time and comp_steps of rank r at stats[3 * r].
+  double *stats;
+
+  // Ns per compartment-step of every rank, smoothed over the intervals with
+  // BALANCE_SMOOTHING; 0 until the rank has timed some dendrites.
+  double *rate;
+} Balance;
+
+/**
+ * Name: dendriteComps
+ *
+ * Description:
+ * Compartment count of dendrite `dendrite'. With a `spread' of 0 every
+ * dendrite has `num_comps' compartments; otherwise the counts are spread
+ * uniformly over num_comps * [1 - spread, 1 + spread], using a hash of the
+ * dendrite index so that every rank and every run agrees on them.
+ *
+ * Parameters:
+ * @param dendrite    (INPUT) global index of the dendrite
+ * @param num_comps   (INPUT) mean number of compartments
+ * @param spread      (INPUT) relative spread, from 0 to 1
+ *
+ * Returns:
+ * @return int        simulated compartments of the dendrite (at least 1)
+ */
+int dendriteComps( int dendrite, int num_comps, double spread );
+
+/**
+ * Name: balanceOpen
+ *
+ * Description:
+ * Sets up the even split of the dendrites used before any measurement: every
+ * rank gets the same number of dendrites. Collective.
+ *
+ * Parameters:
+ * @param bal         (OUTPUT) assignment to set up
+ * @param world       (INPUT) ranks sharing the dendrites
+ * @param num_dendrs  (INPUT) number of dendrites
+ * @param num_comps   (INPUT) mean number of simulated compartments
+ * @param spread      (INPUT) relative spread of the compartment counts
+ *
+ * Returns:
+ * @return int        0 if there was a problem, nonzero otherwise
+ */
+int balanceOpen( Balance *bal, MPI_Comm world, int num_dendrs, int num_comps,
+                 double spread );
+
+/**
+ * Name: balanceWork
+ *
+ * Description:
+ * Cost of one step of dendrites [first, last), in compartment-steps: their
+ * simulated compartments plus DENDRITE_OVERHEAD each. This is what a rank
+ * adds to `comp_steps' per step.
+ *
+ * Parameters:
+ * @param bal       (INPUT) assignment
+ * @param first     (INPUT) first dendrite
+ * @param last      (INPUT) one past the last dendrite
+ *
+ * Returns:
+ * @return double   cost of the dendrites
+ */
+double balanceWork( const Balance *bal, int first, int last );
+
+/**
+ * Name: balanceCpuTime
+ *
+ * Description:
+ * CPU time of the calling thread, for timing the dendrites. Time the thread
+ * was not running, e.g. while other ranks had its core, is not counted.
+ *
+ * Returns:
+ * @return double   seconds
+ */
+double balanceCpuTime( void );
+
+/**
+ * Name: balanceGather
+ *
+ * Description:
+ * Shares the measurements of the current interval between all the ranks,
+ * folds them into the smoothed rates and starts a new interval. Collective.
+ *
+ * Parameters:
+ * @param bal       (INOUT) assignment
+ */
+void balanceGather( Balance *bal );
+
+/**
+ * Name: balanceReport
+ *
+ * Description:
+ * Prints, per rank, the dendrites and compartments owned, the measured ns per
+ * compartment-step, and the CPU time spent on the dendrites and the time
+ * spent waiting in the reduction per simulated ms, for the interval last
+ * gathered.
+ *
+ * Parameters:
+ * @param bal       (INPUT) assignment, after balanceGather
+ * @param out       (INPUT) where to print
+ * @param title     (INPUT) heading of the table
+ * @param ms        (INPUT) simulated ms covered by the interval
+ */
+void balanceReport( const Balance *bal, FILE *out, const char *title,
+                    int ms );
+
+/**
+ * Name: balanceRepartition
+ *
+ * Description:
+ * Computes new range boundaries from the smoothed rates so that each rank's
+ * work (see balanceWork) times its ns per compartment-step is as even as
+ * possible. Ranks that have not timed any dendrites yet are taken to run at
+ * the mean rate of the others, and with no rates at all the work is split
+ * evenly. While there are at least as many dendrites as ranks, every rank
+ * keeps one. The boundaries only move when that shortens the busiest rank's
+ * expected time by BALANCE_MIN_GAIN. Every rank computes the same
+ * boundaries.
+ *
+ * Parameters:
+ * @param bal         (INPUT) assignment, after balanceGather
+ * @param new_bounds  (OUTPUT) `size' + 1 boundaries
+ *
+ * Returns:
+ * @return int        nonzero if any boundary moved
+ */
+int balanceRepartition( const Balance *bal, int *new_bounds );
+
+/**
+ * Name: balanceMigrate
+ *
+ * Description:
+ * Moves every dendrite to the rank `new_bounds' assigns it to. `store' is
+ * replaced by a store of the same type holding the new range of this rank;
+ * for STORE_MMAP it is backed by `path'. Collective.
+ *
+ * Parameters:
+ * @param bal           (INOUT) assignment, takes `new_bounds'
+ * @param store         (INOUT) dendrite state of this rank
+ * @param new_bounds    (INPUT) boundaries from balanceRepartition
+ * @param path          (INPUT) backing file of the new store (STORE_MMAP)
+ * @param block_dendrs  (INPUT) dendrites per block of the new store
+ *
+ * Returns:
+ * @return int          0 if there was a problem, nonzero otherwise
+ */
+int balanceMigrate( Balance *bal, DendrStore *store, const int *new_bounds,
+                    const char *path, int block_dendrs );
+
+/**
+ * Name: balanceClose
+ *
+ * Description:
+ * Frees what balanceOpen allocated.
+ *
+ * Parameters:
+ * @param bal       (INOUT) assignment
+ */
+void balanceClose( Balance *bal );
+
+#endif
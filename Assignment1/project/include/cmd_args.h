@@ -1,12 +1,52 @@
 #ifndef CMD_ARGS_H
 #define CMD_ARGS_H
 
+#include "constants.h"
+#include "dendr_store.h"
+
+/**
+ * What a run writes out. Flags, so that they can be combined.
+ */
+typedef enum OutputMode {
+  OUTPUT_TRACE  = 1,  // The soma Vm trace (.dat) and its plot.
+  OUTPUT_SPIKES = 2,  // Spike times (.spk) and spike train statistics.
+  OUTPUT_BOTH   = 3
+} OutputMode;
+
+/**
+ * When the plot of the trace is drawn.
+ */
+typedef enum PlotMode {
+  PLOT_NOW = 0,   // Run gnuplot at the end of the run.
+  PLOT_DEFER,     // Queue it in PLOT_MANIFEST for hh_plot.
+  PLOT_NONE       // Don't plot.
+} PlotMode;
+
 /**
  * Container for values given in the command line.
  */
 typedef struct CmdArgs {
   int num_dendrs; // The number of dendrites to simulate.
   int num_comps;  // The number of compartments per dendrite.
+
+  StoreType storage;              // Where dendrite state is kept.
+  char state_file[ FNAME_LEN ];   // Backing file for STORE_MMAP, "" for auto.
+  int block_dendrs;               // Dendrites per block, 0 for auto.
+
+  Precision precision;            // Precision of the dendrite state.
+  int guard_interval;             // ms between accuracy checks, 0 disables.
+
+  OutputMode output;              // What gets written out.
+  PlotMode plot;                  // When the trace is plotted.
+
+  char comm[16];                  // mpi_hh exchange backend (see comm.h).
+  int comm_bench;                 // Benchmark the backends instead (mpi_hh).
+  double comp_spread;             // Relative spread of compartment counts.
+  int rebalance;                  // ms between rebalancing (mpi_hh), 0 never.
+
+  int timers;                     // Time the phases of the run.
+  int perf;                       // Report hardware performance counters.
+  int status;                     // Publish live progress for hh_top.
 } CmdArgs;
 
 /**
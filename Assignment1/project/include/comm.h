@@ -0,0 +1,136 @@
+#ifndef COMM_H
+#define COMM_H
+
+#include <mpi.h>
+
+// Number of exchanges timed per backend by the communication benchmark.
+#define COMM_BENCH_STEPS 20000
+
+/**
+ * Name: SomaUpdate
+ *
+ * Description:
+ * Integrates the soma over one step given the total current injected by all
+ * of the dendrites, and returns its new Vm. Called by a backend on every rank
+ * that integrates the soma.
+ *
+ * Parameters:
+ * @param ctx       (INOUT) soma state, as passed to the backend
+ * @param current   (INPUT) total dendritic current
+ *
+ * Returns:
+ * @return double   new soma Vm
+ */
+typedef double (*SomaUpdate)( void *ctx, double current );
+
+/**
+ * A way of doing the per-step exchange of mpi_hh: summing the partial
+ * dendritic currents of every rank into the soma and handing the resulting
+ * soma Vm back to every rank.
+ *
+ * Backends are selected with commSelect and used through the function
+ * pointers, the same way rk4Step is handed its `derivs'.
+ */
+typedef struct CommBackend {
+  const char *name;     // Name used on the command line.
+
+  /**
+   * Sets up the backend on `world'; `soma_rank' integrates the soma. Returns
+   * 0 if there was a problem, nonzero otherwise. Collective.
+   */
+  int (*open)( struct CommBackend *comm, MPI_Comm world, int soma_rank );
+
+  /**
+   * Contributes `partial' to the soma current, has the soma integrated with
+   * `update' and returns the new soma Vm. Collective.
+   */
+  double (*exchange)( struct CommBackend *comm, double partial,
+                      SomaUpdate update, void *ctx );
+
+  /**
+   * Releases what `open' set up. Collective.
+   */
+  void (*close)( struct CommBackend *comm );
+
+  MPI_Comm world;       // Communicator the exchange runs on.
+  int rank;             // Rank of this process in `world'.
+  int size;             // Number of processes in `world'.
+  int soma_rank;        // Rank that integrates the soma.
+
+  // Backend private state.
+  MPI_Request request;  // Persistent (or pending) reduction.
+  double send;          // Send buffer of the reduction.
+  double recv;          // Receive buffer of the reduction.
+  MPI_Win win;          // Window holding the soma current and Vm.
+  double *win_buf;      // Memory behind `win' on this rank.
+  MPI_Comm node;        // Ranks sharing this node's memory, or MPI_COMM_NULL.
+  MPI_Comm leaders;     // Rank 0 of every node (MPI_COMM_NULL elsewhere).
+  int node_rank;        // Rank of this process in `node'.
+  int node_size;        // Number of processes in `node'.
+} CommBackend;
+
+/**
+ * Name: commSelect
+ *
+ * Description:
+ * Fills `comm' with the backend called `name'. The available backends are:
+ *
+ *   blocking    MPI_Reduce of the currents to the soma rank followed by an
+ *               MPI_Bcast of the new Vm.
+ *   persistent  A persistent MPI_Allreduce (MPI_Allreduce_init, MPI 4) or,
+ *               with older MPI libraries, an MPI_Iallreduce; every rank
+ *               integrates its own copy of the soma, so no Vm is sent.
+ *   rma         One-sided: every rank MPI_Accumulates its current into a
+ *               window on the soma rank and reads the new Vm back with MPI_Get.
+ *   shm         The ranks of a node write their currents into an
+ *               MPI_Win_allocate_shared window; the node leader adds them up
+ *               after a node barrier, allreduces the node sums with the other
+ *               leaders, integrates the soma and stores the Vm in the window
+ *               for the rest of the node to read.
+ *
+ * Parameters:
+ * @param comm      (OUTPUT) backend to fill
+ * @param name      (INPUT) name of the backend
+ *
+ * Returns:
+ * @return int      0 if there is no such backend, nonzero otherwise
+ */
+int commSelect( CommBackend *comm, const char *name );
+
+/**
+ * Name: commNodeAlloc
+ *
+ * Description:
+ * Allocates `bytes' for this rank in a window shared by all of the ranks on
+ * its node (MPI_Win_allocate_shared), so that data kept there can be read by
+ * the node's other ranks without messages. Only available once the `shm'
+ * backend is open. Collective over the node; release with MPI_Win_free.
+ *
+ * Parameters:
+ * @param comm      (INPUT) open `shm' backend
+ * @param bytes     (INPUT) bytes wanted by this rank
+ * @param base      (OUTPUT) start of this rank's memory
+ * @param win       (OUTPUT) window owning the memory
+ *
+ * Returns:
+ * @return int      0 if there is no node communicator or the allocation
+ *                  failed, nonzero otherwise
+ */
+int commNodeAlloc( CommBackend *comm, MPI_Aint bytes, void *base,
+                   MPI_Win *win );
+
+/**
+ * Name: commBackendName
+ *
+ * Description:
+ * Enumerates the names accepted by commSelect.
+ *
+ * Parameters:
+ * @param i             (INPUT) index of the backend, starting from 0
+ *
+ * Returns:
+ * @return const char*  name of the backend, NULL past the last one
+ */
+const char *commBackendName( int i );
+
+#endif
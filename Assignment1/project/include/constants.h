@@ -10,6 +10,15 @@
 #define DENDRCONDCOMP 1000  // Lateral compartmental conductance, nS
 #define DENDRCONDDISTR 100  // Deviation of compartmental conductance, nS
 
+#define SPIKE_THRESHOLD 0   // Soma Vm an action potential must cross, mV
+
+// Accuracy guard of the mixed precision mode.
+#define GUARD_INTERVAL 10   // Default time between checks, ms
+#define GUARD_VM_TOL 0.5    // Largest tolerated soma Vm deviation, mV
+#define GUARD_SPIKE_TOL 0.05 // Largest tolerated spike time deviation, ms
+#define GUARD_MAX_SPIKES 8  // Spikes compared per check
+#define GUARD_SAMPLE 64     // Dendrites shadowed in double precision
+
 #define FNAME_LEN 80        // Filename lengths.
 
 #endif
@@ -0,0 +1,198 @@
+#ifndef DENDR_STORE_H
+#define DENDR_STORE_H
+
+#include <stddef.h>
+
+/**
+ * Where the dendrite compartment potentials are kept.
+ */
+typedef enum StoreType {
+  STORE_MEM  = 0,   // Anonymous memory (the original malloc'ed layout).
+  STORE_MMAP = 1,   // A file mapped into memory; lets the state exceed RAM.
+  STORE_USER = 2    // Memory owned by the caller, see dendrStoreAttach.
+} StoreType;
+
+/**
+ * Precision of the dendrite compartment state. The soma is always simulated
+ * in double precision.
+ */
+typedef enum Precision {
+  PREC_DOUBLE = 0,  // Compartment potentials are doubles.
+  PREC_MIXED  = 1   // Compartment potentials are floats.
+} Precision;
+
+/**
+ * Container for the potentials of every compartment of every dendrite.
+ *
+ * The potentials are laid out dendrite after dendrite in one contiguous
+ * region, so that a block of consecutive dendrites is also a contiguous range
+ * of memory (and, for STORE_MMAP, of the backing file).
+ */
+typedef struct DendrStore {
+  StoreType type;     // Backend in use.
+  Precision precision; // Type of each compartment potential.
+  int num_dendrs;     // Number of dendrites stored.
+  int num_comps;      // Compartments per dendrite (including dummy and soma).
+  int block_dendrs;   // Dendrites processed per block.
+  size_t elem_bytes;  // Bytes taken by a single compartment.
+  size_t row_bytes;   // Bytes taken by a single dendrite.
+  size_t bytes;       // Bytes taken by all of the dendrites.
+  void *data;         // Start of the compartment potentials.
+  int fd;             // Backing file descriptor (STORE_MMAP only).
+  char *path;         // Backing file name (STORE_MMAP only).
+} DendrStore;
+
+/**
+ * Name: dendrStoreOpen
+ *
+ * Description:
+ * Allocates storage for `num_dendrs' dendrites of `num_comps' compartments and
+ * sets every compartment to the resting potential.
+ *
+ * For STORE_MMAP the state is kept in the file `path', which is created (or
+ * truncated) here and removed by dendrStoreClose.
+ *
+ * A store of no dendrites is valid and has no memory behind it: `data' is
+ * left NULL and nothing is mapped.
+ *
+ * Parameters:
+ * @param store         (OUTPUT) store to initialize
+ * @param type          (INPUT) backend to use
+ * @param precision     (INPUT) type of the compartment potentials
+ * @param path          (INPUT) backing file, ignored for STORE_MEM
+ * @param num_dendrs    (INPUT) number of dendrites
+ * @param num_comps     (INPUT) compartments per dendrite
+ * @param block_dendrs  (INPUT) dendrites per block, 0 picks a default
+ *
+ * Returns:
+ * @return int          0 if there was a problem, nonzero otherwise
+ */
+int dendrStoreOpen( DendrStore *store, StoreType type, Precision precision,
+                    const char *path, int num_dendrs, int num_comps,
+                    int block_dendrs );
+
+/**
+ * Name: dendrStoreAttach
+ *
+ * Description:
+ * Like dendrStoreOpen, but keeps the state in `data', which the caller
+ * allocated (at least `num_dendrs' * `num_comps' compartments) and releases
+ * after dendrStoreClose. Used to place the state in memory that other
+ * processes can see, such as an MPI shared memory window.
+ *
+ * Parameters:
+ * @param store         (OUTPUT) store to initialize
+ * @param precision     (INPUT) type of the compartment potentials
+ * @param data          (INPUT) memory to keep the potentials in
+ * @param num_dendrs    (INPUT) number of dendrites
+ * @param num_comps     (INPUT) compartments per dendrite
+ * @param block_dendrs  (INPUT) dendrites per block, 0 picks a default
+ */
+void dendrStoreAttach( DendrStore *store, Precision precision, void *data,
+                       int num_dendrs, int num_comps, int block_dendrs );
+
+/**
+ * Name: dendrStoreRow
+ *
+ * Description:
+ * Returns the compartment potentials of a single dendrite. Only valid for a
+ * PREC_DOUBLE store; use dendrStoreRowF for PREC_MIXED.
+ *
+ * Parameters:
+ * @param store       (INPUT) store holding the dendrite
+ * @param dendrite    (INPUT) index of the dendrite
+ *
+ * Returns:
+ * @return double*    the `num_comps' potentials of the dendrite
+ */
+static inline double *dendrStoreRow( DendrStore *store, int dendrite )
+{
+  return (double*) store->data + (size_t) dendrite * store->num_comps;
+}
+
+/**
+ * Name: dendrStoreRowF
+ *
+ * Description:
+ * Returns the compartment potentials of a single dendrite of a PREC_MIXED
+ * store.
+ *
+ * Parameters:
+ * @param store       (INPUT) store holding the dendrite
+ * @param dendrite    (INPUT) index of the dendrite
+ *
+ * Returns:
+ * @return float*     the `num_comps' potentials of the dendrite
+ */
+static inline float *dendrStoreRowF( DendrStore *store, int dendrite )
+{
+  return (float*) store->data + (size_t) dendrite * store->num_comps;
+}
+
+/**
+ * Name: dendrStoreRowConst
+ *
+ * Description:
+ * Read only version of dendrStoreRow, for a store reached through a const
+ * pointer such as the one hh_sim_dendrites returns.
+ *
+ * Parameters:
+ * @param store       (INPUT) store holding the dendrite
+ * @param dendrite    (INPUT) index of the dendrite
+ *
+ * Returns:
+ * @return double*    the `num_comps' potentials of the dendrite
+ */
+static inline const double *dendrStoreRowConst( const DendrStore *store,
+                                                int dendrite )
+{
+  return (const double*) store->data + (size_t) dendrite * store->num_comps;
+}
+
+/**
+ * Name: dendrStoreRowFConst
+ *
+ * Description:
+ * Read only version of dendrStoreRowF.
+ *
+ * Parameters:
+ * @param store       (INPUT) store holding the dendrite
+ * @param dendrite    (INPUT) index of the dendrite
+ *
+ * Returns:
+ * @return float*     the `num_comps' potentials of the dendrite
+ */
+static inline const float *dendrStoreRowFConst( const DendrStore *store,
+                                                int dendrite )
+{
+  return (const float*) store->data + (size_t) dendrite * store->num_comps;
+}
+
+/**
+ * Name: dendrStorePrefetch
+ *
+ * Description:
+ * Asks the kernel to start reading the block of dendrites beginning at
+ * `first' so that it is resident by the time it is processed. Does nothing
+ * for STORE_MEM or an empty store.
+ *
+ * Parameters:
+ * @param store     (INPUT) store holding the dendrites
+ * @param first     (INPUT) first dendrite of the block
+ */
+void dendrStorePrefetch( DendrStore *store, int first );
+
+/**
+ * Name: dendrStoreClose
+ *
+ * Description:
+ * Releases the storage and, for STORE_MMAP, removes the backing file. The
+ * memory of a STORE_USER store is left to the caller. An empty store, with
+ * no mapping, is fine too.
+ *
+ * Parameters:
+ * @param store     (INOUT) store to release
+ */
+void dendrStoreClose( DendrStore *store );
+
+#endif
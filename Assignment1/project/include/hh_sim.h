@@ -0,0 +1,193 @@
+/*
+  Embeddable interface to the Hodgkin Huxley (HH) simplified compartamental
+  neuron model.
+
+  A simulation is created from an HHConfig, advanced any number of integration
+  steps at a time and inspected in place between calls, without going through
+  files. seq_hh is a client of this interface; link against libhh.a or
+  libhh.so to drive the model from another program.
+
+    HHConfig config;
+    HHSim *sim;
+
+    hh_config_default( &config );
+    config.num_dendrs = 15;
+    config.num_comps  = 10;
+
+    sim = hh_sim_create( &config );
+    while (hh_sim_time( sim ) < 100.0) {
+      hh_sim_advance( sim, STEPS );
+      printf( "%f\n", hh_sim_soma( sim )[0] );
+    }
+    hh_sim_destroy( sim );
+*/
+
+#ifndef HH_SIM_H
+#define HH_SIM_H
+
+#include "constants.h"
+#include "dendr_store.h"
+#include "spikes.h"
+#include "status.h"
+
+#include <stdio.h>
+
+/**
+ * Parameters of a simulation.
+ */
+typedef struct HHConfig {
+  int num_dendrs;           // The number of dendrites to simulate.
+  int num_comps;            // The number of compartments per dendrite.
+  StoreType storage;        // Where dendrite state is kept.
+  const char *state_file;   // Backing file for STORE_MMAP.
+  int block_dendrs;         // Dendrites per block, 0 for auto.
+  Precision precision;      // Precision of the dendrite state.
+  int guard_interval;       // ms between accuracy checks (PREC_MIXED only).
+  FILE *spike_file;         // Where spike times are streamed, or NULL.
+  Status *status;           // Where progress is published, or NULL.
+} HHConfig;
+
+/**
+ * A running simulation. Only accessible through the functions below.
+ */
+typedef struct HHSim HHSim;
+
+/**
+ * Name: hh_config_default
+ *
+ * Description:
+ * Fills `config' with the defaults used by seq_hh: one dendrite of one
+ * compartment, double precision state in memory, no spike file.
+ *
+ * Parameters:
+ * @param config    (OUTPUT) configuration to fill
+ */
+void hh_config_default( HHConfig *config );
+
+/**
+ * Name: hh_sim_create
+ *
+ * Description:
+ * Allocates a simulation and puts the soma and every compartment at rest.
+ * `config' is copied; it need not outlive the call, but `state_file' and
+ * `spike_file' must.
+ *
+ * Parameters:
+ * @param config    (INPUT) simulation parameters
+ *
+ * Returns:
+ * @return HHSim*   the new simulation, NULL if it could not be created
+ */
+HHSim *hh_sim_create( const HHConfig *config );
+
+/**
+ * Name: hh_sim_advance
+ *
+ * Description:
+ * Advances the simulation by `n_steps' integration steps of 1/STEPS ms.
+ *
+ * Parameters:
+ * @param sim       (INOUT) simulation
+ * @param n_steps   (INPUT) number of steps to take
+ */
+void hh_sim_advance( HHSim *sim, long n_steps );
+
+/**
+ * Name: hh_sim_time
+ *
+ * Description:
+ * Returns the simulated time.
+ *
+ * Parameters:
+ * @param sim       (INPUT) simulation
+ *
+ * Returns:
+ * @return double   simulated time, ms
+ */
+double hh_sim_time( const HHSim *sim );
+
+/**
+ * Name: hh_sim_steps
+ *
+ * Description:
+ * Returns the number of integration steps taken so far.
+ *
+ * Parameters:
+ * @param sim       (INPUT) simulation
+ *
+ * Returns:
+ * @return long     steps taken
+ */
+long hh_sim_steps( const HHSim *sim );
+
+/**
+ * Name: hh_sim_soma
+ *
+ * Description:
+ * Returns the NUMVAR soma state variables (Vm, n, m, h) in place. The pointer
+ * stays valid until the simulation is destroyed.
+ *
+ * Parameters:
+ * @param sim           (INPUT) simulation
+ *
+ * Returns:
+ * @return double*      soma state, Vm first
+ */
+const double *hh_sim_soma( const HHSim *sim );
+
+/**
+ * Name: hh_sim_dendrites
+ *
+ * Description:
+ * Returns the compartment state in place, read only. Use dendrStoreRowConst
+ * (or dendrStoreRowFConst for PREC_MIXED) to reach a single dendrite; each row
+ * has num_comps + 2 entries, the first being a dummy and the last the soma Vm.
+ *
+ * Parameters:
+ * @param sim             (INPUT) simulation
+ *
+ * Returns:
+ * @return DendrStore*    compartment state
+ */
+const DendrStore *hh_sim_dendrites( const HHSim *sim );
+
+/**
+ * Name: hh_sim_spikes
+ *
+ * Description:
+ * Returns the spikes detected so far and their statistics.
+ *
+ * Parameters:
+ * @param sim             (INPUT) simulation
+ *
+ * Returns:
+ * @return SpikeStats*    spike statistics
+ */
+const SpikeStats *hh_sim_spikes( const HHSim *sim );
+
+/**
+ * Name: hh_sim_guard
+ *
+ * Description:
+ * Returns the accuracy checks done on a PREC_MIXED simulation and how many of
+ * them were out of tolerance.
+ *
+ * Parameters:
+ * @param sim         (INPUT) simulation
+ * @param checks      (OUTPUT) number of checks done
+ * @param warnings    (OUTPUT) number of checks out of tolerance
+ */
+void hh_sim_guard( const HHSim *sim, int *checks, int *warnings );
+
+/**
+ * Name: hh_sim_destroy
+ *
+ * Description:
+ * Releases everything held by the simulation. Does not close `spike_file'.
+ *
+ * Parameters:
+ * @param sim       (INPUT) simulation, may be NULL
+ */
+void hh_sim_destroy( HHSim *sim );
+
+#endif
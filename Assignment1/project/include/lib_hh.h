@@ -31,6 +31,27 @@
 double dendriteStep( double *v_d, int seed, int num_comps, double delta_t,
                      double v_m );
 
+/**
+ * Name: dendriteStepF
+ *
+ * Description:
+ * Single precision version of dendriteStep, used by the mixed precision mode.
+ * The compartment potentials are stored and integrated as floats; the current
+ * injected into the soma is returned as a double so that it can be summed in
+ * double precision.
+ *
+ * Parameters:
+ * @param v_d           (INOUT) membrane potential
+ * @param seed          (INPUT) seed for random number generator
+ * @param num_comps     (INPUT) number of compartments in dendrite
+ * @param delta_t       (INPUT) integration time step size
+ * @param v_m           (INPUT) soma Vm
+ * Returns:
+ * @return double       current injected by this dendrite into soma
+ */
+double dendriteStepF( float *v_d, int seed, int num_comps, double delta_t,
+                      double v_m );
+
 /**
  * Name: rk4Step
  *
@@ -83,4 +104,17 @@ void soma( double *dydx, double *y, double *param );
  */
 void dendrite( double *y, double *dydx, double *param );
 
+/**
+ * Name: dendriteF
+ *
+ * Description:
+ * Single precision version of dendrite.
+ *
+ * Parameters:
+ * @param dydx    (OUTPUT) where to store dydx
+ * @param y       (INPUT)  compartment potential
+ * @param param   (INPUT)  compartment parameters, laid out as for dendrite
+ */
+void dendriteF( float *dydx, float *y, float *param );
+
 #endif 
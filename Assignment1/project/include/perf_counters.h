@@ -0,0 +1,134 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include "phase_timer.h"
+
+#include <stdio.h>
+#include <stdint.h>
+
+/**
+ * Hardware events counted with perf_event_open.
+ */
+typedef enum PerfEvent {
+  PERF_CYCLES = 0,      // CPU cycles.
+  PERF_INSTRUCTIONS,    // Instructions retired.
+  PERF_LLC_MISSES,      // Last level cache misses.
+  PERF_BRANCH_MISSES,   // Mispredicted branches.
+  NUM_PERF_EVENTS
+} PerfEvent;
+
+/**
+ * A reading (or difference of readings) of the counters.
+ */
+typedef struct PerfCounts {
+  uint64_t value[ NUM_PERF_EVENTS ];  // Count of each event.
+  unsigned valid;                     // Bit e set if event e was counted.
+} PerfCounts;
+
+/**
+ * Counters of the thread that opened them. Events the kernel or the hardware
+ * do not support are left out; the rest keep working.
+ */
+typedef struct PerfCounters {
+  int fd[ NUM_PERF_EVENTS ];      // Counter of each event, -1 if unavailable.
+  unsigned valid;                 // Bit e set if fd[e] is open.
+  PerfCounts last;                // Reading at the last phase switch.
+  PerfCounts phase[ NUM_PHASES ]; // Counts charged to each phase.
+} PerfCounters;
+
+/**
+ * Name: perfCountersOpen
+ *
+ * Description:
+ * Opens and starts the counters for the calling thread, user space only. When
+ * some or all events cannot be counted (no PMU in a virtual machine,
+ * perf_event_paranoid, no kernel support) a note is printed on stderr and
+ * those events are reported as unavailable.
+ *
+ * Parameters:
+ * @param perf      (OUTPUT) counters to open
+ *
+ * Returns:
+ * @return int      number of events being counted
+ */
+int perfCountersOpen( PerfCounters *perf );
+
+/**
+ * Name: perfCountersRead
+ *
+ * Description:
+ * Reads the current value of every open counter.
+ *
+ * Parameters:
+ * @param perf      (INPUT) open counters
+ * @param counts    (OUTPUT) their values
+ */
+void perfCountersRead( const PerfCounters *perf, PerfCounts *counts );
+
+/**
+ * Name: perfCountsDiff
+ *
+ * Description:
+ * Computes `end' - `start', event by event.
+ *
+ * Parameters:
+ * @param end       (INPUT) later reading
+ * @param start     (INPUT) earlier reading
+ * @param diff      (OUTPUT) difference, may be `end' or `start'
+ */
+void perfCountsDiff( const PerfCounts *end, const PerfCounts *start,
+                     PerfCounts *diff );
+
+/**
+ * Name: perfCountersByPhase
+ *
+ * Description:
+ * Charges the counts to the phase timers' phases from now on, so that every
+ * phase switch of the calling thread reads the counters. Only useful with the
+ * phase timers running; each switch costs a read per event.
+ *
+ * Parameters:
+ * @param perf      (INOUT) open counters
+ */
+void perfCountersByPhase( PerfCounters *perf );
+
+/**
+ * Name: perfCountsPrint
+ *
+ * Description:
+ * Prints one line with the counts, IPC and the misses per unit of `work'
+ * (e.g. compartment-steps). Unavailable events are printed as "n/a".
+ *
+ * Parameters:
+ * @param out       (INPUT) where to print
+ * @param label     (INPUT) what was counted
+ * @param counts    (INPUT) counts to print
+ * @param work      (INPUT) units of work done while counting, 0 for none
+ */
+void perfCountsPrint( FILE *out, const char *label, const PerfCounts *counts,
+                      double work );
+
+/**
+ * Name: perfCountersPrintPhases
+ *
+ * Description:
+ * Prints the counts charged to each phase by perfCountersByPhase.
+ *
+ * Parameters:
+ * @param out       (INPUT) where to print
+ * @param perf      (INPUT) counters
+ */
+void perfCountersPrintPhases( FILE *out, const PerfCounters *perf );
+
+/**
+ * Name: perfCountersClose
+ *
+ * Description:
+ * Stops charging phases and closes the counters.
+ *
+ * Parameters:
+ * @param perf      (INOUT) counters to close
+ */
+void perfCountersClose( PerfCounters *perf );
+
+#endif
@@ -0,0 +1,217 @@
+#ifndef PHASE_TIMER_H
+#define PHASE_TIMER_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+  #include <x86intrin.h>
+#else
+  #include <time.h>
+#endif
+
+/**
+ * Phases of a run that are timed separately. Time is charged to the innermost
+ * phase only, so nested phases (the RNG within the dendrites, the soma within
+ * an MPI exchange) are not counted twice and all phases add up to the time
+ * between phaseTimersStart and phaseTimersCollect.
+ */
+typedef enum Phase {
+  PHASE_OTHER = 0,  // Everything outside the phases below.
+  PHASE_SETUP,      // Allocating and initializing the state.
+  PHASE_DENDRITES,  // Integrating the dendrite compartments.
+  PHASE_RNG,        // Drawing the current injected into the dendrites.
+  PHASE_SOMA,       // Integrating the soma.
+  PHASE_SPIKES,     // Spike detection and the mixed precision guard.
+  PHASE_COMM,       // Waiting on the MPI exchange of the soma current and Vm.
+  PHASE_OUTPUT,     // Writing the results out.
+  NUM_PHASES
+} Phase;
+
+/**
+ * Time spent in each phase by one process, summed over its threads.
+ */
+typedef struct PhaseTimes {
+  double seconds[ NUM_PHASES ];  // Time charged to each phase.
+  long calls[ NUM_PHASES ];      // Number of times each phase was entered.
+  double total;                  // Sum of `seconds'.
+} PhaseTimes;
+
+/**
+ * Accumulators of one thread. Only touched by that thread until collected.
+ */
+typedef struct PhaseLocal {
+  uint64_t ticks[ NUM_PHASES ];  // Clock ticks charged to each phase.
+  long calls[ NUM_PHASES ];      // Entries into each phase.
+  Phase current;                 // Phase being timed.
+  uint64_t start;                // When `current' was entered (or resumed).
+} PhaseLocal;
+
+// Runtime switch, set by phaseTimersStart.
+extern int phase_timers_on;
+
+// Accumulators of the calling thread, NULL until it first enters a phase.
+extern _Thread_local PhaseLocal *phase_local;
+
+// Called on every phase switch with the phase being left, when set. Used to
+// charge hardware counters to phases (see perf_counters.h).
+extern void (*phase_hook)( Phase prev );
+
+/**
+ * Name: PHASE_BEGIN / PHASE_END
+ *
+ * Description:
+ * Bracket the code of phase `p' within a single block:
+ *
+ *   PHASE_BEGIN( PHASE_SOMA );
+ *   ...
+ *   PHASE_END( PHASE_SOMA );
+ *
+ * They compile to nothing unless PHASE_TIMERS is defined, and to a test of
+ * phase_timers_on when timers were compiled in but not started.
+ */
+#ifdef PHASE_TIMERS
+  #define PHASE_BEGIN( p ) Phase phase_prev_##p = phaseSwitch( (p), 1 )
+  #define PHASE_END( p )   phaseSwitch( phase_prev_##p, 0 )
+#else
+  #define PHASE_BEGIN( p )
+  #define PHASE_END( p )
+#endif
+
+/**
+ * Name: phaseNow
+ *
+ * Description:
+ * Reads the clock used by the timers: the time stamp counter on x86,
+ * CLOCK_MONOTONIC in ns elsewhere.
+ */
+static inline uint64_t phaseNow( void )
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+#endif
+}
+
+/**
+ * Name: phaseRegister
+ *
+ * Description:
+ * Creates the accumulators of the calling thread. Used by phaseSwitch.
+ *
+ * Returns:
+ * @return PhaseLocal*  accumulators of the calling thread
+ */
+PhaseLocal *phaseRegister( void );
+
+/**
+ * Name: phaseSwitch
+ *
+ * Description:
+ * Charges the time since the last switch to the current phase of the calling
+ * thread and makes `next' the current phase. Used by PHASE_BEGIN/PHASE_END.
+ *
+ * Parameters:
+ * @param next      (INPUT) phase to switch to
+ * @param enter     (INPUT) nonzero when entering `next', 0 when returning to it
+ *
+ * Returns:
+ * @return Phase    the phase that was current before
+ */
+static inline Phase phaseSwitch( Phase next, int enter )
+{
+  PhaseLocal *local;
+  uint64_t now;
+  Phase prev;
+
+  if (!phase_timers_on) {
+    return PHASE_OTHER;
+  }
+
+  local = phase_local ? phase_local : phaseRegister();
+  now   = phaseNow();
+  prev  = local->current;
+
+  local->ticks[ prev ] += now - local->start;
+  local->calls[ next ] += enter;
+  local->current = next;
+  local->start   = now;
+
+  if (phase_hook) {
+    phase_hook( prev );
+  }
+
+  return prev;
+}
+
+/**
+ * Name: phaseTimersStart
+ *
+ * Description:
+ * Turns the timers on. Prints a warning and leaves them off if the program
+ * was built without PHASE_TIMERS.
+ *
+ * Returns:
+ * @return int      0 if the timers are not available, nonzero otherwise
+ */
+int phaseTimersStart( void );
+
+/**
+ * Name: phaseTimersCollect
+ *
+ * Description:
+ * Turns the timers off and sums the accumulators of every thread that
+ * entered a phase. Must be called when no other thread is in a phase.
+ *
+ * Parameters:
+ * @param times     (OUTPUT) time spent in each phase
+ */
+void phaseTimersCollect( PhaseTimes *times );
+
+/**
+ * Name: phaseName
+ *
+ * Description:
+ * Name of a phase, as used in the table and the JSON file.
+ */
+const char *phaseName( Phase phase );
+
+/**
+ * Name: phaseTimersPrint
+ *
+ * Description:
+ * Prints a table of the time spent in each phase. With several processes
+ * (`count' > 1) the mean and the maximum over the processes are shown.
+ *
+ * Parameters:
+ * @param out       (INPUT) where to print
+ * @param times     (INPUT) phase times of each process
+ * @param count     (INPUT) number of processes
+ */
+void phaseTimersPrint( FILE *out, const PhaseTimes *times, int count );
+
+/**
+ * Name: phaseTimersWriteJson
+ *
+ * Description:
+ * Writes the phase times of every process to `path' as JSON:
+ *
+ *   { "phases": [ "other", ... ],
+ *     "processes": [ { "total": s, "seconds": [ ... ], "calls": [ ... ] } ] }
+ *
+ * Parameters:
+ * @param path      (INPUT) file to write
+ * @param times     (INPUT) phase times of each process
+ * @param count     (INPUT) number of processes
+ *
+ * Returns:
+ * @return int      0 if there was a problem, nonzero otherwise
+ */
+int phaseTimersWriteJson( const char *path, const PhaseTimes *times,
+                          int count );
+
+#endif
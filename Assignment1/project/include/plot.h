@@ -1,6 +1,16 @@
 #ifndef PLOT_H
 #define PLOT_H
 
+#include "phase_timer.h"
+
+#include <stdio.h>
+
+// Where runs queue their plots with '--plot defer', for hh_plot to render.
+#define PLOT_MANIFEST "graphs/plots.manifest"
+
+// Longest plot title, gnuplot escapes included.
+#define PLOT_TITLE_LEN 512
+
 /**
  * Container for information included in plot.
  */
@@ -11,6 +21,8 @@ typedef struct PlotInfo {
   int num_dendrs;   // The number of dendrites simulated.
   double exec_time; // How long the program took to execute.
   int slaves;       // How many slave processes were involved.
+  const PhaseTimes *phases; // Time spent in each phase, summed over the
+                            // ranks of mpi_hh, NULL if not timed.
 } PlotInfo;
 
 /**
@@ -29,4 +41,42 @@ typedef struct PlotInfo {
  */
 void plotData( PlotInfo *pinfo, char *data_name, char *image_name );
 
+/**
+ * Name: plotDefer
+ *
+ * Description:
+ * Queues the plot of `data_name' into `image_name' instead of running
+ * gnuplot: one line is appended to `manifest', holding the image, data file
+ * and title separated by tabs. Runs sharing a manifest may append at the same
+ * time. hh_plot renders the queued plots later, in bulk.
+ *
+ * Parameters:
+ * @param pinfo         information included in the plot
+ * @param manifest      file the plot is queued in
+ * @param data_name     name of the data file to plot
+ * @param image_name    name of the image file to plot to
+ *
+ * Returns:
+ * @return int          0 if there was a problem, nonzero otherwise
+ */
+int plotDefer( PlotInfo *pinfo, const char *manifest, const char *data_name,
+               const char *image_name );
+
+/**
+ * Name: plotWrite
+ *
+ * Description:
+ * Writes the gnuplot commands that plot `data_name' with `title' to an open
+ * gnuplot. Every setting used is given, so plots can follow each other in
+ * one long-lived gnuplot process.
+ *
+ * Parameters:
+ * @param gnuplot       gnuplot's standard input
+ * @param title         plot title, with gnuplot escapes
+ * @param data_name     name of the data file to plot
+ * @param image_name    PNG file to plot to, NULL for the screen
+ */
+void plotWrite( FILE *gnuplot, const char *title, const char *data_name,
+                const char *image_name );
+
 #endif
@@ -0,0 +1,118 @@
+#ifndef PREC_GUARD_H
+#define PREC_GUARD_H
+
+#include "constants.h"
+#include "dendr_store.h"
+
+/**
+ * Accuracy guard for the mixed precision mode.
+ *
+ * Every `interval' milliseconds the soma state and a fixed sample of at most
+ * GUARD_SAMPLE dendrites, evenly spread over all of them, are copied into a
+ * double precision shadow simulation, which is then stepped alongside the
+ * mixed precision one for a millisecond. The sampled dendrites are also
+ * stepped again in single precision, so that the rounding error of the sample
+ * is known exactly; scaled up to all the dendrites it is added to the mixed
+ * precision soma current to drive the shadow soma. With no more dendrites
+ * than GUARD_SAMPLE the shadow is a complete double precision run. At the end
+ * of the millisecond the soma Vm traces and the spike times of the two runs
+ * are compared and a warning is printed if they differ by more than
+ * GUARD_VM_TOL or GUARD_SPIKE_TOL.
+ */
+typedef struct PrecGuard {
+  int interval;               // Milliseconds between checks, 0 disables.
+  int active;                 // Whether the shadow runs this millisecond.
+  int num_dendrs;             // Number of dendrites simulated.
+  int num_comps;              // Compartments per dendrite.
+  int sample;                 // Number of dendrites shadowed.
+  double *shadow;             // Double precision state of the sample.
+  float *shadow_f;            // Single precision state of the sample.
+  double y[NUMVAR];           // Double precision soma state.
+  double soma_params[3];      // Soma parameters of the shadow.
+  double v_prev[2];           // Previous Vm of the mixed and shadow runs.
+  double max_dev;             // Worst Vm deviation in this check.
+  int num_spikes[2];          // Spikes of the mixed and shadow runs.
+  double spikes[2][ GUARD_MAX_SPIKES ]; // Spike times of both runs.
+  int checks;                 // Number of checks done.
+  int warnings;               // Number of checks that failed.
+} PrecGuard;
+
+/**
+ * Name: precGuardOpen
+ *
+ * Description:
+ * Sets up the guard and allocates the shadow state of the sampled dendrites,
+ * which does not grow with the number of dendrites.
+ *
+ * Parameters:
+ * @param guard       (OUTPUT) guard to initialize
+ * @param interval    (INPUT) milliseconds between checks, 0 disables the guard
+ * @param num_dendrs  (INPUT) number of dendrites
+ * @param num_comps   (INPUT) compartments per dendrite
+ * @param delta_t     (INPUT) integration time step size
+ *
+ * Returns:
+ * @return int        0 if there was a problem, nonzero otherwise
+ */
+int precGuardOpen( PrecGuard *guard, int interval, int num_dendrs,
+                   int num_comps, double delta_t );
+
+/**
+ * Name: precGuardBegin
+ *
+ * Description:
+ * Called at the start of every simulated millisecond. If a check is due, the
+ * shadow simulation is restarted from the current mixed precision state.
+ *
+ * Parameters:
+ * @param guard     (INOUT) guard
+ * @param store     (INPUT) mixed precision dendrite state
+ * @param y         (INPUT) soma state
+ * @param t_ms      (INPUT) millisecond about to be simulated
+ */
+void precGuardBegin( PrecGuard *guard, DendrStore *store, double *y,
+                     int t_ms );
+
+/**
+ * Name: precGuardStep
+ *
+ * Description:
+ * Advances the shadow simulation by one step and compares its soma Vm to the
+ * one of the mixed precision simulation, which must already have been
+ * advanced. Does nothing unless a check is running.
+ *
+ * Parameters:
+ * @param guard     (INOUT) guard
+ * @param step      (INPUT) integration step within the millisecond
+ * @param t         (INPUT) simulated time at the end of the step, ms
+ * @param current   (INPUT) dendrite current of the mixed precision step
+ * @param v_m       (INPUT) soma Vm of the mixed precision simulation
+ */
+void precGuardStep( PrecGuard *guard, int step, double t, double current,
+                    double v_m );
+
+/**
+ * Name: precGuardEnd
+ *
+ * Description:
+ * Called at the end of every simulated millisecond. Finishes a running check
+ * and warns on stderr if the deviation exceeded the tolerances.
+ *
+ * Parameters:
+ * @param guard     (INOUT) guard
+ * @param t_ms      (INPUT) millisecond that was simulated
+ */
+void precGuardEnd( PrecGuard *guard, int t_ms );
+
+/**
+ * Name: precGuardClose
+ *
+ * Description:
+ * Releases the shadow state.
+ *
+ * Parameters:
+ * @param guard     (INOUT) guard
+ */
+void precGuardClose( PrecGuard *guard );
+
+#endif
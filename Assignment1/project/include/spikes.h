@@ -0,0 +1,122 @@
+#ifndef SPIKES_H
+#define SPIKES_H
+
+#include "constants.h"
+
+#include <stdio.h>
+
+/**
+ * Online spike detector and spike train statistics.
+ *
+ * The soma Vm is fed in one integration step at a time. Spikes are detected as
+ * upward crossings of SPIKE_THRESHOLD, timed to a fraction of a step, and
+ * written to an event file as they happen. Firing rate and inter-spike
+ * interval (ISI) statistics are accumulated in constant memory, so that no Vm
+ * trace needs to be stored or written.
+ */
+typedef struct SpikeStats {
+  FILE *events;     // Where spike times are written, NULL for none.
+  double v_prev;    // Vm at the end of the previous step.
+  long count;       // Number of spikes seen.
+  double first;     // Time of the first spike, ms.
+  double last;      // Time of the most recent spike, ms.
+  double isi_mean;  // Running mean of the ISIs, ms.
+  double isi_m2;    // Running sum of squared ISI deviations (Welford).
+  double isi_min;   // Shortest ISI, ms.
+  double isi_max;   // Longest ISI, ms.
+} SpikeStats;
+
+/**
+ * Name: spikeCrossing
+ *
+ * Description:
+ * Checks whether Vm crossed SPIKE_THRESHOLD upwards during a step and, if so,
+ * computes the crossing time by linear interpolation between the two ends of
+ * the step.
+ *
+ * Parameters:
+ * @param v_prev    (INPUT) Vm at the start of the step
+ * @param v         (INPUT) Vm at the end of the step
+ * @param t         (INPUT) simulated time at the end of the step, ms
+ * @param dt        (INPUT) length of the step, ms
+ * @param t_spike   (OUTPUT) time of the crossing, if any
+ *
+ * Returns:
+ * @return int      nonzero if the threshold was crossed, 0 otherwise
+ */
+static inline int spikeCrossing( double v_prev, double v, double t, double dt,
+                                 double *t_spike )
+{
+  if (v_prev < SPIKE_THRESHOLD && v >= SPIKE_THRESHOLD) {
+    *t_spike = t - dt * (v - SPIKE_THRESHOLD) / (v - v_prev);
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * Name: spikeStatsInit
+ *
+ * Description:
+ * Resets the statistics. If `events' is not NULL, a header is written to it
+ * and every detected spike is appended as it happens.
+ *
+ * Parameters:
+ * @param stats     (OUTPUT) statistics to initialize
+ * @param events    (INPUT) event file, or NULL
+ * @param v0        (INPUT) initial soma Vm
+ */
+void spikeStatsInit( SpikeStats *stats, FILE *events, double v0 );
+
+/**
+ * Name: spikeStatsAdd
+ *
+ * Description:
+ * Records a spike that happened at time `t'.
+ *
+ * Parameters:
+ * @param stats     (INOUT) statistics
+ * @param t         (INPUT) time of the spike, ms
+ */
+void spikeStatsAdd( SpikeStats *stats, double t );
+
+/**
+ * Name: spikeStatsUpdate
+ *
+ * Description:
+ * Feeds the soma Vm at the end of an integration step to the detector.
+ *
+ * Parameters:
+ * @param stats     (INOUT) statistics
+ * @param t         (INPUT) simulated time at the end of the step, ms
+ * @param dt        (INPUT) length of the step, ms
+ * @param v         (INPUT) soma Vm at the end of the step
+ */
+static inline void spikeStatsUpdate( SpikeStats *stats, double t, double dt,
+                                     double v )
+{
+  double t_spike;
+
+  if (spikeCrossing( stats->v_prev, v, t, dt, &t_spike )) {
+    spikeStatsAdd( stats, t_spike );
+  }
+  stats->v_prev = v;
+}
+
+/**
+ * Name: spikeStatsReport
+ *
+ * Description:
+ * Prints the spike count, firing rate and ISI statistics to `out', prefixing
+ * each line with `prefix' (e.g. "# " to write them as comments).
+ *
+ * Parameters:
+ * @param stats     (INPUT) statistics
+ * @param out       (INPUT) where to print
+ * @param prefix    (INPUT) string printed at the start of every line
+ * @param sim_time  (INPUT) simulated time, ms
+ */
+void spikeStatsReport( const SpikeStats *stats, FILE *out, const char *prefix,
+                       double sim_time );
+
+#endif
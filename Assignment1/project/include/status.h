@@ -0,0 +1,129 @@
+#ifndef STATUS_H
+#define STATUS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+// Shared memory objects are named STATUS_PREFIX followed by the pid of the
+// process publishing; they show up under /dev/shm.
+#define STATUS_PREFIX "/hh_status."
+
+// Identifies a status segment and the layout of StatusShared.
+#define STATUS_MAGIC    0x48485354u  // "HHST"
+#define STATUS_VERSION  1
+
+// Steps between updates of the step rate, which needs the clock.
+#define STATUS_RATE_STEPS 1000
+
+/**
+ * Progress of a run as seen by hh_top. It lives in a POSIX shared memory
+ * segment; the run is the only writer. The counters are written with relaxed
+ * atomics every step and read the same way, so a reader may see a step count
+ * and a Vm from consecutive steps but never a torn value, and the writer never
+ * waits for anyone.
+ */
+typedef struct StatusShared {
+  _Atomic uint32_t magic;   // STATUS_MAGIC once the fields below are set.
+  uint32_t version;         // STATUS_VERSION.
+  int32_t pid;              // Process publishing.
+  int32_t ranks;            // MPI ranks of the run, 1 for seq_hh.
+  int32_t num_dendrs;       // Dendrites simulated.
+  int32_t num_comps;        // Compartments per dendrite.
+  int32_t sim_ms;           // ms the run will simulate.
+  int32_t steps_per_ms;     // Integration steps per ms.
+  double started;           // Wall clock time the run started, s since epoch.
+
+  _Atomic int64_t step;           // Integration steps taken.
+  _Atomic int64_t spikes;         // Spikes detected so far.
+  _Atomic double vm;              // Soma Vm after the last step, mV.
+  _Atomic double steps_per_sec;   // Recent step rate.
+  _Atomic int32_t done;           // Nonzero once the main loop is over.
+} StatusShared;
+
+/**
+ * The writer's handle on a status segment.
+ */
+typedef struct Status {
+  StatusShared *shared;     // Mapped segment, NULL when not publishing.
+  char name[32];            // Name of the shared memory object.
+  int64_t rate_step;        // Step of the last rate update.
+  double rate_ns;           // Clock at the last rate update.
+} Status;
+
+/**
+ * Name: statusOpen
+ *
+ * Description:
+ * Creates the status segment of this process, STATUS_PREFIX<pid>. On failure
+ * a warning is printed and `status' is left unpublished, so the run can go on.
+ *
+ * Parameters:
+ * @param status      (OUTPUT) handle to set up
+ * @param ranks       (INPUT) MPI ranks of the run
+ * @param num_dendrs  (INPUT) dendrites simulated
+ * @param num_comps   (INPUT) compartments per dendrite
+ * @param sim_ms      (INPUT) ms the run will simulate
+ *
+ * Returns:
+ * @return int        0 if the segment could not be created, nonzero otherwise
+ */
+int statusOpen( Status *status, int ranks, int num_dendrs, int num_comps,
+                int sim_ms );
+
+/**
+ * Name: statusRate
+ *
+ * Description:
+ * Updates the step rate from the clock. Used by statusStep.
+ *
+ * Parameters:
+ * @param status    (INOUT) handle
+ * @param step      (INPUT) steps taken
+ */
+void statusRate( Status *status, int64_t step );
+
+/**
+ * Name: statusStep
+ *
+ * Description:
+ * Publishes the progress after an integration step. Costs a test when the
+ * segment is not published and a few plain stores when it is.
+ *
+ * Parameters:
+ * @param status    (INOUT) handle, may be NULL
+ * @param step      (INPUT) steps taken
+ * @param vm        (INPUT) soma Vm
+ * @param spikes    (INPUT) spikes detected so far
+ */
+static inline void statusStep( Status *status, int64_t step, double vm,
+                               int64_t spikes )
+{
+  StatusShared *shared;
+
+  if (status == NULL || (shared = status->shared) == NULL) {
+    return;
+  }
+
+  atomic_store_explicit( &shared->step, step, memory_order_relaxed );
+  atomic_store_explicit( &shared->vm, vm, memory_order_relaxed );
+  atomic_store_explicit( &shared->spikes, spikes, memory_order_relaxed );
+
+  if (step - status->rate_step >= STATUS_RATE_STEPS) {
+    statusRate( status, step );
+  }
+}
+
+/**
+ * Name: statusClose
+ *
+ * Description:
+ * Marks the run as done and removes the segment. Readers that have it mapped
+ * keep their view of the final counters.
+ *
+ * Parameters:
+ * @param status    (INOUT) handle
+ */
+void statusClose( Status *status );
+
+#endif
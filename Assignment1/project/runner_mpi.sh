@@ -46,4 +46,7 @@ module load openmpi
 # indicated by the -n option. If these do not, your results will
 # not be valid or you may have wasted resources that others could
 # have used.
-mpirun -np $SLURM_NPROCS mpi_hh -d 15 -c 10
+#
+# The plot is only queued so that the job does not wait for gnuplot; run
+# ./hh_plot once the jobs are done to draw all of them.
+mpirun -np $SLURM_NPROCS mpi_hh -d 15 -c 10 --plot defer
@@ -41,4 +41,7 @@
 # indicated by the -n option. If these do not, your results will
 # not be valid or you may have wasted resources that others could
 # have used.
-./seq_hh -d 15 -c 10
+#
+# The plot is only queued so that the job does not wait for gnuplot; run
+# ./hh_plot once the jobs are done to draw all of them.
+./seq_hh -d 15 -c 10 --plot defer
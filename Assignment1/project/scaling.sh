@@ -0,0 +1,122 @@
+#!/bin/bash
+#
+# Strong and weak scaling study of mpi_hh on one machine, without SLURM.
+#
+# Every problem is first run with seq_hh to get the baseline time T1, then with
+# 'mpirun -np K mpi_hh' for every K given. The 'Execution time:' each run
+# reports is parsed and turned into
+#
+#   strong scaling:  speedup = T1 / TK,  efficiency = speedup / K
+#   weak scaling:    efficiency = T1(d) / TK(K * d),  speedup = K * efficiency
+#
+# where in weak scaling the number of dendrites grows with the ranks. A table
+# is printed and every run is appended to a CSV file:
+#
+#   study,ranks,dendrites,compartments,seconds,speedup,efficiency
+#
+# Runs write their spike files under the work directory; no traces or plots
+# are written.
+#
+# Usage: ./scaling.sh [-s strong|weak|both] [-n "RANKS..."] [-d "DENDRITES..."]
+#                     [-c COMPARTMENTS] [-r REPEATS] [-o CSV] [-w WORK_DIR]
+#
+# Extra mpirun options (e.g. '--oversubscribe') can be passed in MPIRUN_ARGS.
+
+study=both
+ranks="1 2 4"
+dendrites="16"
+comps=10
+repeats=1
+csv=scaling.csv
+work=scaling_runs
+
+while getopts "s:n:d:c:r:o:w:h" opt; do
+  case $opt in
+    s) study=$OPTARG ;;
+    n) ranks=$OPTARG ;;
+    d) dendrites=$OPTARG ;;
+    c) comps=$OPTARG ;;
+    r) repeats=$OPTARG ;;
+    o) csv=$OPTARG ;;
+    w) work=$OPTARG ;;
+    *) sed -n '2,23p' "$0"; exit 1 ;;
+  esac
+done
+
+case $study in
+  strong|weak|both) ;;
+  *) echo "Unknown study '$study'!" >&2; exit 1 ;;
+esac
+
+bin=$(cd "$(dirname "$0")" && pwd)
+csv=$(realpath -m "$csv")
+mkdir -p "$work" || exit 1
+cd "$work" || exit 1
+
+# Prints the best execution time, in seconds, of $repeats runs of a command.
+best_time() {
+  local best="" t i
+  for ((i = 0; i < repeats; i++)); do
+    t=$("$@" -o spikes 2>/dev/null |
+        sed -n 's/^Execution time: \([0-9.]*\) seconds\./\1/p')
+    if [ -z "$t" ]; then
+      echo "Run failed: $*" >&2
+      return 1
+    fi
+    if [ -z "$best" ] || awk "BEGIN { exit !($t < $best) }"; then
+      best=$t
+    fi
+  done
+  echo "$best"
+}
+
+# Runs one problem on $1 ranks, or sequentially for 0.
+run() {
+  if [ "$1" -eq 0 ]; then
+    best_time "$bin/seq_hh" -d "$2" -c "$comps"
+  else
+    best_time mpirun $MPIRUN_ARGS -np "$1" "$bin/mpi_hh" -d "$2" -c "$comps"
+  fi
+}
+
+# Records one result: study ranks dendrites seconds baseline_seconds.
+report() {
+  local speedup efficiency
+  speedup=$(awk "BEGIN { printf \"%.3f\", $5 / $4 }")
+  if [ "$1" = strong ]; then
+    efficiency=$(awk "BEGIN { printf \"%.3f\", $speedup / $2 }")
+  else
+    efficiency=$(awk "BEGIN { printf \"%.3f\", $5 / $4 }")
+    speedup=$(awk "BEGIN { printf \"%.3f\", $efficiency * $2 }")
+  fi
+  printf "%-7s %6s %10s %6s %10s %8s %10s\n" \
+         "$1" "$2" "$3" "$comps" "$4" "$speedup" "$efficiency"
+  echo "$1,$2,$3,$comps,$4,$speedup,$efficiency" >> "$csv"
+}
+
+[ -f "$csv" ] ||
+  echo "study,ranks,dendrites,compartments,seconds,speedup,efficiency" > "$csv"
+
+printf "%-7s %6s %10s %6s %10s %8s %10s\n" \
+       study ranks dendrites comps seconds speedup efficiency
+
+for d in $dendrites; do
+  t1=$(run 0 "$d") || exit 1
+  echo "# seq_hh -d $d -c $comps: $t1 s"
+
+  if [ $study != weak ]; then
+    for k in $ranks; do
+      tk=$(run "$k" "$d") || exit 1
+      report strong "$k" "$d" "$tk" "$t1"
+    done
+  fi
+
+  if [ $study != strong ]; then
+    for k in $ranks; do
+      tk=$(run "$k" $((d * k))) || exit 1
+      report weak "$k" $((d * k)) "$tk" "$t1"
+    done
+  fi
+done
+
+echo "# Results appended to $csv"
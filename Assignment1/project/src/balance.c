@@ -0,0 +1,340 @@
+#include "balance.h"
+
+#include <math.h>
+#include <time.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Number of measurements every rank shares per interval.
+#define NUM_STATS 3
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+int dendriteComps( int dendrite, int num_comps, double spread )
+{
+  unsigned h = (unsigned) dendrite;
+  double u;
+  long comps;
+
+  if (spread <= 0) {
+    return num_comps;
+  }
+
+  // Integer hash, good enough to scatter consecutive indices.
+  h ^= h >> 16; h *= 0x7feb352du;
+  h ^= h >> 15; h *= 0x846ca68bu;
+  h ^= h >> 16;
+  u = h / 4294967296.0;
+
+  comps = lround( num_comps * (1.0 - spread + 2.0 * spread * u) );
+  return comps < 1 ? 1 : (int) comps;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+int balanceOpen( Balance *bal, MPI_Comm world, int num_dendrs, int num_comps,
+                 double spread )
+{
+  int d, r;
+
+  memset( bal, 0, sizeof(Balance) );
+  bal->world      = world;
+  bal->num_dendrs = num_dendrs;
+  MPI_Comm_rank( world, &bal->rank );
+  MPI_Comm_size( world, &bal->size );
+
+  bal->comps  = malloc( num_dendrs * sizeof(int) );
+  bal->bounds = malloc( (bal->size + 1) * sizeof(int) );
+  bal->stats  = malloc( NUM_STATS * bal->size * sizeof(double) );
+  bal->rate   = calloc( bal->size, sizeof(double) );
+  if (bal->comps == NULL || bal->bounds == NULL || bal->stats == NULL ||
+      bal->rate == NULL) {
+    fprintf( stderr, "Can't allocate the dendrite assignment!\n" );
+    balanceClose( bal );
+    return 0;
+  }
+
+  // The first compartment is a dummy and the last is connected to the soma.
+  for (d = 0; d < num_dendrs; d++) {
+    bal->comps[d] = dendriteComps( d, num_comps, spread ) + 2;
+    if (bal->comps[d] > bal->max_comps) {
+      bal->max_comps = bal->comps[d];
+    }
+  }
+  if (bal->max_comps == 0) {
+    bal->max_comps = num_comps + 2;
+  }
+
+  // Split the dendrites as evenly as possible; rank r owns [bounds[r],
+  // bounds[r+1]).
+  for (r = 0; r <= bal->size; r++) {
+    bal->bounds[r] = (int) ((long) r * num_dendrs / bal->size);
+  }
+
+  return 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+double balanceWork( const Balance *bal, int first, int last )
+{
+  double work = 0.0;
+  int d;
+
+  for (d = first; d < last; d++) {
+    work += bal->comps[d] - 2 + DENDRITE_OVERHEAD;
+  }
+  return work;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+double balanceCpuTime( void )
+{
+  struct timespec ts;
+
+  clock_gettime( CLOCK_THREAD_CPUTIME_ID, &ts );
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+void balanceGather( Balance *bal )
+{
+  double local[ NUM_STATS ], rate;
+  int r;
+
+  local[0] = bal->dendr_time;
+  local[1] = bal->wait_time;
+  local[2] = bal->comp_steps;
+  MPI_Allgather( local, NUM_STATS, MPI_DOUBLE, bal->stats, NUM_STATS,
+                 MPI_DOUBLE, bal->world );
+
+  // Ranks without dendrites this interval keep their last rate.
+  for (r = 0; r < bal->size; r++) {
+    if (bal->stats[ NUM_STATS * r + 2 ] > 0) {
+      rate = 1e9 * bal->stats[ NUM_STATS * r ] /
+             bal->stats[ NUM_STATS * r + 2 ];
+      bal->rate[r] = bal->rate[r] > 0 ? BALANCE_SMOOTHING * bal->rate[r] +
+                                        (1.0 - BALANCE_SMOOTHING) * rate
+                                      : rate;
+    }
+  }
+
+  bal->dendr_time = 0.0;
+  bal->wait_time  = 0.0;
+  bal->comp_steps = 0.0;
+}
+
+/**
+ * Name: nsPerComp
+ *
+ * Description:
+ * Measured ns per compartment-step of rank `r' in the last interval. Ranks
+ * that had no dendrites are assumed to be as fast as the average of the
+ * others.
+ */
+static double nsPerComp( const Balance *bal, int r )
+{
+  double time = 0.0, steps = 0.0;
+  int q;
+
+  if (bal->stats[ NUM_STATS * r + 2 ] > 0) {
+    return 1e9 * bal->stats[ NUM_STATS * r ] / bal->stats[ NUM_STATS * r + 2 ];
+  }
+
+  for (q = 0; q < bal->size; q++) {
+    time  += bal->stats[ NUM_STATS * q ];
+    steps += bal->stats[ NUM_STATS * q + 2 ];
+  }
+  return steps > 0 ? 1e9 * time / steps : 1.0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+void balanceReport( const Balance *bal, FILE *out, const char *title,
+                    int ms )
+{
+  long comps;
+  int d, r;
+
+  fprintf( out, "\n%s\n", title );
+  fprintf( out, "%6s %10s %13s %13s %16s %16s\n", "Rank", "Dendrites",
+           "Compartments", "ns/comp-step", "Dendr. CPU ms/ms", "Wait ms/ms" );
+
+  for (r = 0; r < bal->size; r++) {
+    comps = 0;
+    for (d = bal->bounds[r]; d < bal->bounds[r + 1]; d++) {
+      comps += bal->comps[d] - 2;
+    }
+
+    fprintf( out, "%6d %10d %13ld %13.2f %16.3f %16.3f\n", r,
+             bal->bounds[r + 1] - bal->bounds[r], comps, nsPerComp( bal, r ),
+             1e3 * bal->stats[ NUM_STATS * r ] / ms,
+             1e3 * bal->stats[ NUM_STATS * r + 1 ] / ms );
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+int balanceRepartition( const Balance *bal, int *new_bounds )
+{
+  double total, cost, speed_sum = 0.0, target = 0.0, done = 0.0;
+  double mean = 0.0, old_time = 0.0, new_time = 0.0, rank_time;
+  double *speed = malloc( bal->size * sizeof(double) );
+  int d, r, keep, known = 0, moved = 0;
+
+  memcpy( new_bounds, bal->bounds, (bal->size + 1) * sizeof(int) );
+  if (speed == NULL) {
+    return 0;
+  }
+
+  // A rank's share of the work is proportional to how fast it gets through
+  // its compartments. Ranks that have not timed any yet are taken to be as
+  // fast as the others on average, and with no rates at all every rank is
+  // as fast as any other.
+  for (r = 0; r < bal->size; r++) {
+    if (bal->rate[r] > 0) {
+      mean += bal->rate[r];
+      known++;
+    }
+  }
+  mean = known ? mean / known : 1.0;
+  for (r = 0; r < bal->size; r++) {
+    speed[r]   = 1.0 / (bal->rate[r] > 0 ? bal->rate[r] : mean);
+    speed_sum += speed[r];
+  }
+
+  total = balanceWork( bal, 0, bal->num_dendrs );
+
+  // Hand out the dendrites in order, moving on to the next rank once this
+  // one has its share. A dendrite goes to the rank its middle falls in.
+  // While there are enough dendrites every rank keeps at least one.
+  d = 0;
+  for (r = 0; r < bal->size - 1; r++) {
+    keep = bal->num_dendrs >= bal->size ? bal->size - 1 - r : 0;
+    target += total * speed[r] / speed_sum;
+    while (d < bal->num_dendrs - keep &&
+           done + 0.5 * (cost = balanceWork( bal, d, d + 1 )) < target) {
+      done += cost;
+      d++;
+    }
+    if (keep > 0 && d == new_bounds[r]) {
+      done += balanceWork( bal, d, d + 1 );
+      d++;
+    }
+    new_bounds[r + 1] = d;
+  }
+  new_bounds[ bal->size ] = bal->num_dendrs;
+
+  // Migrating costs a round of all-to-all messages, so small gains, such as
+  // those from noise in the rates, are not worth it.
+  for (r = 0; r < bal->size; r++) {
+    rank_time = balanceWork( bal, bal->bounds[r], bal->bounds[r + 1] ) /
+                speed[r];
+    old_time  = rank_time > old_time ? rank_time : old_time;
+    rank_time = balanceWork( bal, new_bounds[r], new_bounds[r + 1] ) /
+                speed[r];
+    new_time  = rank_time > new_time ? rank_time : new_time;
+  }
+  if (new_time < (1.0 - BALANCE_MIN_GAIN) * old_time) {
+    for (r = 0; r <= bal->size; r++) {
+      moved |= new_bounds[r] != bal->bounds[r];
+    }
+  }
+  if (!moved) {
+    memcpy( new_bounds, bal->bounds, (bal->size + 1) * sizeof(int) );
+  }
+
+  free( speed );
+  return moved;
+}
+
+/**
+ * Name: overlap
+ *
+ * Description:
+ * Length of the intersection of [a0, a1) and [b0, b1); its start goes to
+ * `start'.
+ */
+static int overlap( int a0, int a1, int b0, int b1, int *start )
+{
+  *start = a0 > b0 ? a0 : b0;
+  return (a1 < b1 ? a1 : b1) > *start ? (a1 < b1 ? a1 : b1) - *start : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+int balanceMigrate( Balance *bal, DendrStore *store, const int *new_bounds,
+                    const char *path, int block_dendrs )
+{
+  int old_first = bal->bounds[ bal->rank ];
+  int old_last  = bal->bounds[ bal->rank + 1 ];
+  int new_first = new_bounds[ bal->rank ];
+  int new_last  = new_bounds[ bal->rank + 1 ];
+  int row = store->num_comps, start, len, q, ok = 1;
+  int *counts = malloc( 4 * bal->size * sizeof(int) );
+  int *send_counts = counts, *send_displs = counts + bal->size;
+  int *recv_counts = counts + 2 * bal->size;
+  int *recv_displs = counts + 3 * bal->size;
+  DendrStore next;
+
+  if (counts == NULL) {
+    fprintf( stderr, "Can't allocate the migration plan!\n" );
+    ok = 0;
+  } else if ((long) bal->num_dendrs * row > INT_MAX) {
+    // MPI_Alltoallv counts are ints.
+    fprintf( stderr, "Too much dendrite state to migrate in one go!\n" );
+    ok = 0;
+  } else if (!dendrStoreOpen( &next, store->type, store->precision, path,
+                              new_last - new_first, row, block_dendrs )) {
+    ok = 0;
+  }
+
+  // Every rank must agree before anyone starts the exchange.
+  MPI_Allreduce( MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_MIN, bal->world );
+  if (!ok) {
+    free( counts );
+    return 0;
+  }
+
+  // Both ranges are contiguous, so what goes from one rank to another is a
+  // single run of rows on either side.
+  for (q = 0; q < bal->size; q++) {
+    len = overlap( old_first, old_last, new_bounds[q], new_bounds[q + 1],
+                   &start );
+    send_counts[q] = len * row;
+    send_displs[q] = (start - old_first) * row;
+
+    len = overlap( bal->bounds[q], bal->bounds[q + 1], new_first, new_last,
+                   &start );
+    recv_counts[q] = len * row;
+    recv_displs[q] = (start - new_first) * row;
+  }
+
+  MPI_Alltoallv( store->data, send_counts, send_displs, MPI_DOUBLE,
+                 next.data, recv_counts, recv_displs, MPI_DOUBLE,
+                 bal->world );
+
+  dendrStoreClose( store );
+  *store = next;
+  memcpy( bal->bounds, new_bounds, (bal->size + 1) * sizeof(int) );
+
+  free( counts );
+  return 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+void balanceClose( Balance *bal )
+{
+  free( bal->comps );
+  free( bal->bounds );
+  free( bal->stats );
+  free( bal->rate );
+  bal->comps  = NULL;
+  bal->bounds = NULL;
+  bal->stats  = NULL;
+  bal->rate   = NULL;
+}
@@ -0,0 +1,371 @@
+/*
+  Microbenchmarks for the kernels in lib_hh.c.
+
+  Every kernel is timed over a grid of compartment counts and batch sizes (the
+  number of dendrites, or calls, per sample). After a few warmup samples each
+  configuration is sampled repeatedly and the median and 10th/90th percentiles
+  are reported as CSV, one line per configuration:
+
+    kernel,num_comps,batch,samples,ns_p10,ns_median,ns_p90,gflops,bytes
+
+  `ns_*' are nanoseconds per compartment-step, `gflops' is the rate achieved at
+  the median and `bytes' the state traffic per compartment-step.
+*/
+
+#include "lib_hh.h"
+#include "constants.h"
+
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Shortest a sample may be; calls are repeated within a sample until it lasts
+// at least this long so that the clock resolution does not matter.
+#define MIN_SAMPLE_NS 500000.0
+
+// Nominal floating point operations per compartment-step, counted from the
+// source with every exp() and division as one operation.
+#define FLOPS_DENDRITE   12   // dendrite(): the derivative of one compartment.
+#define FLOPS_DENDR_STEP 68   // 4 dendrite() calls, RK4 update, conductances.
+#define FLOPS_SOMA       66   // soma(): HH currents and gating derivatives.
+#define FLOPS_RK4        (3 * FLOPS_SOMA + 4 * 12)  // rk4Step() over soma().
+
+/**
+ * The kernels that can be benchmarked.
+ */
+typedef enum Kernel {
+  K_DENDRITE_STEP,    // dendriteStep() over `batch' dendrites.
+  K_DENDRITE_STEP_F,  // dendriteStepF() over `batch' dendrites.
+  K_DENDRITE,         // dendrite() on `batch' compartments.
+  K_SOMA,             // soma() `batch' times.
+  K_RK4_STEP,         // rk4Step() of the soma `batch' times.
+  NUM_KERNELS
+} Kernel;
+
+static const char *kernel_names[ NUM_KERNELS ] = {
+  "dendriteStep", "dendriteStepF", "dendrite", "soma", "rk4Step"
+};
+
+// Grid of the benchmark. Compartment counts do not apply to the single
+// compartment kernels.
+static const int grid_comps[]   = { 1, 10, 100, 1000 };
+static const int grid_batches[] = { 1, 16, 256 };
+
+#define GRID_LEN( a ) ((int) (sizeof(a) / sizeof((a)[0])))
+
+// Keeps the compiler from dropping the results of the kernels.
+static volatile double sink;
+
+/**
+ * Name: nowNs
+ *
+ * Description:
+ * Monotonic clock in nanoseconds.
+ */
+static double nowNs( void )
+{
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/**
+ * Name: cmpDouble
+ *
+ * Description:
+ * qsort comparison of doubles.
+ */
+static int cmpDouble( const void *a, const void *b )
+{
+  double x = *(const double*) a, y = *(const double*) b;
+
+  return (x > y) - (x < y);
+}
+
+/**
+ * Name: runKernel
+ *
+ * Description:
+ * Runs `iters' rounds of `kernel' over a batch and returns how long it took.
+ *
+ * Parameters:
+ * @param kernel      (INPUT) kernel to run
+ * @param num_comps   (INPUT) compartments per dendrite, dummy and soma too
+ * @param batch       (INPUT) dendrites or calls per round
+ * @param iters       (INPUT) rounds to run
+ * @param state       (INOUT) `batch' * `num_comps' doubles of state
+ * @param state_f     (INOUT) `batch' * `num_comps' floats of state
+ *
+ * Returns:
+ * @return double     elapsed nanoseconds
+ */
+static double runKernel( Kernel kernel, int num_comps, int batch, long iters,
+                         double *state, float *state_f )
+{
+  double dt = 1.0 / (double) STEPS;
+  double y[NUMVAR]  = { VREST, 0.037, 0.0148, 0.9959 };
+  double y0[NUMVAR], dydt[NUMVAR];
+  double soma_params[3] = { dt, 0.0, 0.0 };
+  double paramD[6] = { dt, 0.0, DENDRCONDCOMP, DENDRCONDCOMP, VREST, VREST };
+  double acc = 0.0, start;
+  long it;
+  int d;
+
+  start = nowNs();
+  for (it = 0; it < iters; it++) {
+    switch (kernel) {
+    case K_DENDRITE_STEP:
+      for (d = 0; d < batch; d++) {
+        acc += dendriteStep( state + (size_t) d * num_comps, (int) it + d + 1,
+                             num_comps, dt, VREST );
+      }
+      break;
+    case K_DENDRITE_STEP_F:
+      for (d = 0; d < batch; d++) {
+        acc += dendriteStepF( state_f + (size_t) d * num_comps,
+                              (int) it + d + 1, num_comps, dt, VREST );
+      }
+      break;
+    case K_DENDRITE:
+      for (d = 0; d < batch; d++) {
+        dendrite( dydt, state + d, paramD );
+        acc += dydt[0];
+      }
+      break;
+    case K_SOMA:
+      for (d = 0; d < batch; d++) {
+        soma( dydt, y, soma_params );
+        acc += dydt[0];
+      }
+      break;
+    case K_RK4_STEP:
+      for (d = 0; d < batch; d++) {
+        y0[0] = y[0]; y0[1] = y[1]; y0[2] = y[2]; y0[3] = y[3];
+        soma( dydt, y, soma_params );
+        rk4Step( y, y0, dydt, NUMVAR, soma_params, 1, soma );
+        acc += y[0];
+      }
+      break;
+    default:
+      break;
+    }
+  }
+  start = nowNs() - start;
+
+  sink = acc;
+  return start;
+}
+
+/**
+ * Name: benchOne
+ *
+ * Description:
+ * Benchmarks one kernel configuration and writes its CSV line.
+ *
+ * Parameters:
+ * @param out         (INPUT) where the CSV line goes
+ * @param kernel      (INPUT) kernel to benchmark
+ * @param num_comps   (INPUT) compartments per dendrite, dummy and soma too
+ * @param batch       (INPUT) dendrites or calls per round
+ * @param warmup      (INPUT) untimed samples
+ * @param reps        (INPUT) timed samples
+ *
+ * Returns:
+ * @return int        0 if there was a problem, nonzero otherwise
+ */
+static int benchOne( FILE *out, Kernel kernel, int num_comps, int batch,
+                     int warmup, int reps )
+{
+  size_t i, count = (size_t) batch * num_comps;
+  double *state    = malloc( count * sizeof(double) );
+  float *state_f   = malloc( count * sizeof(float) );
+  double *samples  = malloc( reps * sizeof(double) );
+  double work, flops, bytes, elapsed, median;
+  long iters;
+  int r;
+
+  if (state == NULL || state_f == NULL || samples == NULL) {
+    fprintf( stderr, "Can't allocate %zu compartments!\n", count );
+    free( state ); free( state_f ); free( samples );
+    return 0;
+  }
+
+  for (i = 0; i < count; i++) {
+    state[i]   = VREST;
+    state_f[i] = VREST;
+  }
+
+  // Compartment-steps done by one round, and their cost.
+  switch (kernel) {
+  case K_DENDRITE_STEP:
+    work  = (double) batch * (num_comps - 2);
+    flops = FLOPS_DENDR_STEP;
+    bytes = 4 * sizeof(double);   // State and its derivative, in and out.
+    break;
+  case K_DENDRITE_STEP_F:
+    work  = (double) batch * (num_comps - 2);
+    flops = FLOPS_DENDR_STEP;
+    bytes = 4 * sizeof(float);
+    break;
+  case K_DENDRITE:
+    work  = batch;
+    flops = FLOPS_DENDRITE;
+    bytes = 2 * sizeof(double);   // Vm in, derivative out.
+    break;
+  case K_SOMA:
+    work  = batch;
+    flops = FLOPS_SOMA;
+    bytes = 2 * NUMVAR * sizeof(double);
+    break;
+  default:
+    work  = batch;
+    flops = FLOPS_RK4;
+    bytes = 3 * NUMVAR * sizeof(double);  // y0 and dydt0 in, y out.
+    break;
+  }
+
+  // Find out how many rounds make a sample long enough; this doubles as the
+  // first warmup sample.
+  for (iters = 1; ; iters *= 2) {
+    if (runKernel( kernel, num_comps, batch, iters, state, state_f )
+        >= MIN_SAMPLE_NS) {
+      break;
+    }
+  }
+
+  for (r = 0; r < warmup; r++) {
+    runKernel( kernel, num_comps, batch, iters, state, state_f );
+  }
+  for (r = 0; r < reps; r++) {
+    elapsed = runKernel( kernel, num_comps, batch, iters, state, state_f );
+    samples[r] = elapsed / (iters * work);
+  }
+  qsort( samples, reps, sizeof(double), cmpDouble );
+
+  median = samples[ reps / 2 ];
+  fprintf( out, "%s,%d,%d,%d,%.3f,%.3f,%.3f,%.3f,%.0f\n",
+           kernel_names[kernel],
+           kernel <= K_DENDRITE_STEP_F ? num_comps - 2 : num_comps, batch, reps,
+           samples[ reps / 10 ], median, samples[ (reps * 9) / 10 ],
+           flops / median, bytes );
+  fflush( out );
+
+  free( state ); free( state_f ); free( samples );
+  return 1;
+}
+
+/**
+ * Name: usage
+ *
+ * Description:
+ * Prints the usage statement.
+ */
+static void usage( char *name )
+{
+  printf(
+"USAGE:\n"
+"  %s [-h] [-w WARMUP] [-r REPS] [-k KERNEL] [-o FILE]\n"
+"\n"
+"DESCRIPTION:\n"
+"  Times the kernels of lib_hh.c over a grid of compartment counts and batch\n"
+"  sizes and writes the median and 10th/90th percentile of the time per\n"
+"  compartment-step (ns), the GFLOP/s achieved at the median and the state\n"
+"  traffic per compartment-step (bytes) as CSV.\n"
+"\n"
+"OPTIONS:\n"
+"  -w, --warmup    Untimed samples per configuration. Defaults to 3.\n"
+"  -r, --reps      Timed samples per configuration. Defaults to 21.\n"
+"  -k, --kernel    Only benchmark this kernel (dendriteStep, dendriteStepF,\n"
+"                  dendrite, soma or rk4Step).\n"
+"  -o, --output    Write the CSV to FILE instead of the standard output.\n"
+"\n"
+, name );
+}
+
+/**
+ * Name: main
+ *
+ * Description:
+ * See usage statement (run program with '-h' flag).
+ *
+ * Parameters:
+ * @param argc    number of command line arguments
+ * @param argv    command line arguments
+ */
+int main( int argc, char **argv )
+{
+  int warmup = 3, reps = 21, only = -1;
+  int i, k, c, b;
+  FILE *out = stdout;
+
+  #define PARAM_EQUALS( sn, ln ) (strcmp( (sn), argv[i] ) == 0 ||\
+                                  strcmp( (ln), argv[i] ) == 0)
+
+  for (i = 1; i < argc; i += 2) {
+    if (PARAM_EQUALS( "-h", "--help" ) || i + 1 >= argc) {
+      usage( argv[0] );
+      return PARAM_EQUALS( "-h", "--help" ) ? 0 : 1;
+    } else if (PARAM_EQUALS( "-w", "--warmup" )) {
+      warmup = atoi( argv[i+1] );
+    } else if (PARAM_EQUALS( "-r", "--reps" )) {
+      reps = atoi( argv[i+1] );
+    } else if (PARAM_EQUALS( "-k", "--kernel" )) {
+      for (only = 0; only < NUM_KERNELS; only++) {
+        if (strcmp( kernel_names[only], argv[i+1] ) == 0) {
+          break;
+        }
+      }
+      if (only == NUM_KERNELS) {
+        fprintf( stderr, "Unknown kernel '%s'!\n", argv[i+1] );
+        return 1;
+      }
+    } else if (PARAM_EQUALS( "-o", "--output" )) {
+      if ((out = fopen( argv[i+1], "w" )) == NULL) {
+        fprintf( stderr, "Can't open %s file!\n", argv[i+1] );
+        return 1;
+      }
+    } else {
+      usage( argv[0] );
+      return 1;
+    }
+  }
+
+  if (warmup < 0) {
+    warmup = 0;
+  }
+  if (reps <= 0) {
+    reps = 1;
+  }
+
+  fprintf( out, "kernel,num_comps,batch,samples,ns_p10,ns_median,ns_p90,"
+                "gflops,bytes\n" );
+
+  for (k = 0; k < NUM_KERNELS; k++) {
+    if (only >= 0 && k != only) {
+      continue;
+    }
+
+    for (b = 0; b < GRID_LEN( grid_batches ); b++) {
+      if (k == K_DENDRITE_STEP || k == K_DENDRITE_STEP_F) {
+        // The dummy and soma compartments come on top of the simulated ones,
+        // as in the simulation.
+        for (c = 0; c < GRID_LEN( grid_comps ); c++) {
+          if (!benchOne( out, k, grid_comps[c] + 2, grid_batches[b], warmup,
+                         reps )) {
+            return 1;
+          }
+        }
+      } else if (!benchOne( out, k, 1, grid_batches[b], warmup, reps )) {
+        return 1;
+      }
+    }
+  }
+
+  if (out != stdout) {
+    fclose( out );
+  }
+
+  return 0;
+}
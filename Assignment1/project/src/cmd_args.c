@@ -1,4 +1,5 @@
 #include "cmd_args.h"
+#include "plot.h"
 
 #include <stdio.h>
 #include <string.h>
@@ -10,7 +11,11 @@ void usage( char *name )
 {
   printf(
 "USAGE:\n"
-"  %s [-h] [-d NUM_DENDR] [-c NUM_COMPARTMENTS]\n"
+"  %s [-h] [-d NUM_DENDR] [-c NUM_COMPARTMENTS] [-s mem|mmap]\n"
+"     [-f STATE_FILE] [-b BLOCK_DENDR] [-p double|mixed] [-g GUARD_MS]\n"
+"     [-o trace|spikes|both] [-m BACKEND] [--comm-bench] [-t]\n"
+"     [--perf] [--comp-spread SPREAD] [--rebalance REBALANCE_MS]\n"
+"     [--status] [--plot now|defer|none]\n"
 "\n"
 "DESCRIPTION:\n"
 "  Simulates a neuron using a Hodgkin Huxley simplified compartamental neuron\n"
@@ -49,6 +54,93 @@ void usage( char *name )
 "    The number of compartments per dendrite. Must be greater than 0. Default\n"
 "    is one.\n"
 "\n"
+"  -s, --storage\n"
+"    Where the dendrite compartment state is kept. 'mem' (the default) keeps\n"
+"    it in memory. 'mmap' keeps it in a memory-mapped file so that problems\n"
+"    larger than the memory of the node can be simulated; dendrites are then\n"
+"    processed in blocks and the next block is prefetched while the current\n"
+"    one is computed.\n"
+"\n"
+"  -f, --state-file\n"
+"    Backing file used by '-s mmap'. Defaults to the data file name with a\n"
+"    '.state' extension. The file is removed when the simulation ends.\n"
+"\n"
+"  -b, --block\n"
+"    The number of dendrites per block. Defaults to as many dendrites as fit\n"
+"    in 16 MB of state.\n"
+"\n"
+"  -p, --precision, --precision=double|mixed\n"
+"    Precision of the dendrite compartment state. 'double' (the default)\n"
+"    simulates everything in double precision. 'mixed' stores and integrates\n"
+"    the compartments in single precision, which halves the memory traffic of\n"
+"    the dendrites, while the soma and the current injected into it stay in\n"
+"    double precision.\n"
+"\n"
+"  -g, --guard\n"
+"    With '-p mixed', every GUARD_MS milliseconds of simulated time a double\n"
+"    precision shadow run is restarted from the current state and compared to\n"
+"    the mixed precision run for one millisecond. A warning is printed when\n"
+"    the soma Vm or the spike times deviate too much. The shadow needs a\n"
+"    double precision copy of the dendrite state. Defaults to 10; 0 disables\n"
+"    the check.\n"
+"\n"
+"  -o, --output\n"
+"    What to write out. 'trace' writes the soma Vm trace. 'spikes' detects\n"
+"    spikes while simulating and writes only their times, to\n"
+"    data/pWWdXXcYY_MMDDYY_HHMMSS.spk, followed by the firing rate and\n"
+"    inter-spike interval statistics; no trace is written or plotted.\n"
+"    'both' (the default) writes both files.\n"
+"\n"
+"  --plot\n"
+"    When the trace is plotted. 'now' (the default) runs gnuplot at the end\n"
+"    of the run. 'defer' only appends the plot to " PLOT_MANIFEST ",\n"
+"    for hh_plot to render later together with the plots of other runs, so\n"
+"    that the run does not wait for gnuplot. 'none' does not plot.\n"
+"\n"
+"  -m, --comm\n"
+"    mpi_hh only. How the ranks combine their dendrite currents into the soma\n"
+"    and share its Vm every step: 'blocking' (MPI_Reduce and MPI_Bcast, the\n"
+"    default), 'persistent' (a persistent or nonblocking MPI_Allreduce),\n"
+"    'rma' (MPI_Accumulate into a window on the soma rank) or 'shm' (ranks on\n"
+"    a node share their currents, and with '-s mem' their dendrite state,\n"
+"    through an MPI shared memory window; one leader per node talks to the\n"
+"    other nodes).\n"
+"\n"
+"  --comm-bench\n"
+"    mpi_hh only. Instead of simulating, time the per-step exchange of every\n"
+"    backend and print one CSV line per backend.\n"
+"\n"
+"  -t, --timers\n"
+"    Time the phases of the run (setup, dendrites, RNG, soma, spikes,\n"
+"    communication, output) and print a breakdown at exit. It is also written\n"
+"    to data/pWWdXXcYY_MMDDYY_HHMMSS.phases.json and added to the plot. Needs\n"
+"    a build with PHASE_TIMERS (the default; 'make TIMERS=0' leaves them out).\n"
+"\n"
+"  --perf\n"
+"    Count cycles, instructions, last level cache misses and branch misses\n"
+"    (perf_event_open) over the main loop and report the IPC and the misses\n"
+"    per compartment-step, for every rank of mpi_hh. With '-t' the counts are\n"
+"    also split by phase, at the cost of reading the counters on every phase\n"
+"    switch. Events that cannot be counted are reported as n/a.\n"
+"\n"
+"  --comp-spread\n"
+"    mpi_hh only. Gives the dendrites different compartment counts, spread\n"
+"    uniformly over NUM_COMPARTMENTS * [1 - SPREAD, 1 + SPREAD] (at least one\n"
+"    each), so that an even split of the dendrites is not an even split of\n"
+"    the work. Must be from 0 (the default, every dendrite the same) to 1.\n"
+"\n"
+"  --rebalance\n"
+"    mpi_hh only. Every REBALANCE_MS milliseconds of simulated time, measure\n"
+"    how long each rank took per compartment and how long it waited for the\n"
+"    others, and move dendrites between ranks so that they all finish\n"
+"    together. The per rank load is printed before and after. Defaults to 0,\n"
+"    which keeps the initial even split.\n"
+"\n"
+"  --status\n"
+"    Publish the progress of the run (step, simulated ms, steps per second,\n"
+"    soma Vm, spike count) in the shared memory segment /hh_status.PID while\n"
+"    it runs, for hh_top to show. The segment is removed at exit.\n"
+"\n"
 , name );
 }
 
@@ -61,6 +153,20 @@ int parseArgs( CmdArgs *cmd_args, int argc, char **argv )
   // Setup default values.
   cmd_args->num_dendrs = 1;
   cmd_args->num_comps  = 1;
+  cmd_args->storage    = STORE_MEM;
+  cmd_args->state_file[0] = '\0';
+  cmd_args->block_dendrs  = 0;
+  cmd_args->precision      = PREC_DOUBLE;
+  cmd_args->guard_interval = GUARD_INTERVAL;
+  cmd_args->output         = OUTPUT_BOTH;
+  cmd_args->plot           = PLOT_NOW;
+  strcpy( cmd_args->comm, "blocking" );
+  cmd_args->comm_bench     = 0;
+  cmd_args->comp_spread    = 0.0;
+  cmd_args->rebalance      = 0;
+  cmd_args->timers         = 0;
+  cmd_args->perf           = 0;
+  cmd_args->status         = 0;
 
   // Define a macro to make checking parameters easier.
   #define PARAM_EQUALS( sn, ln ) (strcmp( (sn), argv[i] ) == 0 ||\
@@ -95,6 +201,133 @@ int parseArgs( CmdArgs *cmd_args, int argc, char **argv )
         cmd_args->num_comps = 1;
       }
 
+      i += 2;
+    } else if (PARAM_EQUALS( "-s", "--storage" ) && i + 1 < argc) {
+      if (strcmp( argv[i+1], "mem" ) == 0) {
+        cmd_args->storage = STORE_MEM;
+      } else if (strcmp( argv[i+1], "mmap" ) == 0) {
+        cmd_args->storage = STORE_MMAP;
+      } else {
+        fprintf(stderr, "Unknown storage '%s'!\n", argv[i+1]);
+        usage( argv[0] );
+        return 0;
+      }
+
+      i += 2;
+    } else if (PARAM_EQUALS( "-f", "--state-file" ) && i + 1 < argc) {
+      strncpy( cmd_args->state_file, argv[i+1], FNAME_LEN - 1 );
+      cmd_args->state_file[ FNAME_LEN - 1 ] = '\0';
+
+      i += 2;
+    } else if (PARAM_EQUALS( "-b", "--block" ) && i + 1 < argc) {
+      cmd_args->block_dendrs = atoi( argv[i+1] );
+
+      if (cmd_args->block_dendrs < 0) {
+        fprintf(stderr, "Block size must not be negative!\n");
+        fprintf(stderr, "Block size defaults to automatic!\n");
+        cmd_args->block_dendrs = 0;
+      }
+
+      i += 2;
+    } else if (strncmp( "--precision=", argv[i], 12 ) == 0 ||
+               (PARAM_EQUALS( "-p", "--precision" ) && i + 1 < argc)) {
+      // Accept both '--precision mixed' and '--precision=mixed'.
+      char *value;
+      if (strncmp( "--precision=", argv[i], 12 ) == 0) {
+        value = argv[i] + 12;
+        i += 1;
+      } else {
+        value = argv[i+1];
+        i += 2;
+      }
+
+      if (strcmp( value, "double" ) == 0) {
+        cmd_args->precision = PREC_DOUBLE;
+      } else if (strcmp( value, "mixed" ) == 0) {
+        cmd_args->precision = PREC_MIXED;
+      } else {
+        fprintf(stderr, "Unknown precision '%s'!\n", value);
+        usage( argv[0] );
+        return 0;
+      }
+    } else if (PARAM_EQUALS( "-o", "--output" ) && i + 1 < argc) {
+      if (strcmp( argv[i+1], "trace" ) == 0) {
+        cmd_args->output = OUTPUT_TRACE;
+      } else if (strcmp( argv[i+1], "spikes" ) == 0) {
+        cmd_args->output = OUTPUT_SPIKES;
+      } else if (strcmp( argv[i+1], "both" ) == 0) {
+        cmd_args->output = OUTPUT_BOTH;
+      } else {
+        fprintf(stderr, "Unknown output '%s'!\n", argv[i+1]);
+        usage( argv[0] );
+        return 0;
+      }
+
+      i += 2;
+    } else if (strcmp( "--plot", argv[i] ) == 0 && i + 1 < argc) {
+      if (strcmp( argv[i+1], "now" ) == 0) {
+        cmd_args->plot = PLOT_NOW;
+      } else if (strcmp( argv[i+1], "defer" ) == 0) {
+        cmd_args->plot = PLOT_DEFER;
+      } else if (strcmp( argv[i+1], "none" ) == 0) {
+        cmd_args->plot = PLOT_NONE;
+      } else {
+        fprintf(stderr, "Unknown plot mode '%s'!\n", argv[i+1]);
+        usage( argv[0] );
+        return 0;
+      }
+
+      i += 2;
+    } else if (PARAM_EQUALS( "-m", "--comm" ) && i + 1 < argc) {
+      strncpy( cmd_args->comm, argv[i+1], sizeof(cmd_args->comm) - 1 );
+      cmd_args->comm[ sizeof(cmd_args->comm) - 1 ] = '\0';
+
+      i += 2;
+    } else if (strcmp( "--comm-bench", argv[i] ) == 0) {
+      cmd_args->comm_bench = 1;
+
+      i += 1;
+    } else if (strcmp( "--comp-spread", argv[i] ) == 0 && i + 1 < argc) {
+      cmd_args->comp_spread = atof( argv[i+1] );
+
+      if (cmd_args->comp_spread < 0 || cmd_args->comp_spread > 1) {
+        fprintf(stderr, "Compartment spread must be from 0 to 1!\n");
+        fprintf(stderr, "Compartment spread defaults to 0!\n");
+        cmd_args->comp_spread = 0.0;
+      }
+
+      i += 2;
+    } else if (strcmp( "--rebalance", argv[i] ) == 0 && i + 1 < argc) {
+      cmd_args->rebalance = atoi( argv[i+1] );
+
+      if (cmd_args->rebalance < 0) {
+        fprintf(stderr, "Rebalance interval must not be negative!\n");
+        fprintf(stderr, "Rebalance interval defaults to 0!\n");
+        cmd_args->rebalance = 0;
+      }
+
+      i += 2;
+    } else if (PARAM_EQUALS( "-t", "--timers" )) {
+      cmd_args->timers = 1;
+
+      i += 1;
+    } else if (strcmp( "--perf", argv[i] ) == 0) {
+      cmd_args->perf = 1;
+
+      i += 1;
+    } else if (strcmp( "--status", argv[i] ) == 0) {
+      cmd_args->status = 1;
+
+      i += 1;
+    } else if (PARAM_EQUALS( "-g", "--guard" ) && i + 1 < argc) {
+      cmd_args->guard_interval = atoi( argv[i+1] );
+
+      if (cmd_args->guard_interval < 0) {
+        fprintf(stderr, "Guard interval must not be negative!\n");
+        fprintf(stderr, "Guard interval defaults to %d!\n", GUARD_INTERVAL);
+        cmd_args->guard_interval = GUARD_INTERVAL;
+      }
+
       i += 2;
     } else {
       // Unknown parameter.
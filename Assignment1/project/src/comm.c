@@ -0,0 +1,307 @@
+#include "comm.h"
+
+#include <string.h>
+
+// Slots of the RMA window on the soma rank.
+#define WIN_CURRENT 0   // Sum of the currents accumulated this step.
+#define WIN_VM      1   // Soma Vm published for the next step.
+
+/**
+ * Name: commInit
+ *
+ * Description:
+ * Records the communicator layout common to every backend.
+ */
+static void commInit( CommBackend *comm, MPI_Comm world, int soma_rank )
+{
+  comm->world     = world;
+  comm->soma_rank = soma_rank;
+  comm->node      = MPI_COMM_NULL;
+  comm->leaders   = MPI_COMM_NULL;
+  MPI_Comm_rank( world, &comm->rank );
+  MPI_Comm_size( world, &comm->size );
+}
+
+/**
+ * Name: noClose
+ *
+ * Description:
+ * `close' of backends that hold nothing.
+ */
+static void noClose( CommBackend *comm )
+{
+  (void) comm;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// blocking: MPI_Reduce to the soma rank, MPI_Bcast of the new Vm.
+////////////////////////////////////////////////////////////////////////////////
+
+static int blockingOpen( CommBackend *comm, MPI_Comm world, int soma_rank )
+{
+  commInit( comm, world, soma_rank );
+  return 1;
+}
+
+static double blockingExchange( CommBackend *comm, double partial,
+                                SomaUpdate update, void *ctx )
+{
+  double total = 0.0, v_m = 0.0;
+
+  MPI_Reduce( &partial, &total, 1, MPI_DOUBLE, MPI_SUM, comm->soma_rank,
+              comm->world );
+  if (comm->rank == comm->soma_rank) {
+    v_m = update( ctx, total );
+  }
+  MPI_Bcast( &v_m, 1, MPI_DOUBLE, comm->soma_rank, comm->world );
+
+  return v_m;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// persistent: one allreduce per step; every rank integrates the soma itself.
+////////////////////////////////////////////////////////////////////////////////
+
+static int persistentOpen( CommBackend *comm, MPI_Comm world, int soma_rank )
+{
+  commInit( comm, world, soma_rank );
+
+#if MPI_VERSION >= 4
+  // The reduction is set up once and restarted every step.
+  if (MPI_Allreduce_init( &comm->send, &comm->recv, 1, MPI_DOUBLE, MPI_SUM,
+                          world, MPI_INFO_NULL, &comm->request )
+      != MPI_SUCCESS) {
+    return 0;
+  }
+#else
+  comm->request = MPI_REQUEST_NULL;
+#endif
+
+  return 1;
+}
+
+static double persistentExchange( CommBackend *comm, double partial,
+                                  SomaUpdate update, void *ctx )
+{
+  comm->send = partial;
+
+#if MPI_VERSION >= 4
+  MPI_Start( &comm->request );
+#else
+  // No persistent collectives before MPI 4; the nonblocking one is the
+  // closest match.
+  MPI_Iallreduce( &comm->send, &comm->recv, 1, MPI_DOUBLE, MPI_SUM,
+                  comm->world, &comm->request );
+#endif
+  MPI_Wait( &comm->request, MPI_STATUS_IGNORE );
+
+  // Every rank receives the same sum, so every copy of the soma stays the
+  // same and nothing needs to be broadcast.
+  return update( ctx, comm->recv );
+}
+
+static void persistentClose( CommBackend *comm )
+{
+#if MPI_VERSION >= 4
+  MPI_Request_free( &comm->request );
+#else
+  (void) comm;
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// rma: MPI_Accumulate into a window on the soma rank, MPI_Get of the new Vm.
+////////////////////////////////////////////////////////////////////////////////
+
+static int rmaOpen( CommBackend *comm, MPI_Comm world, int soma_rank )
+{
+  MPI_Aint bytes;
+
+  commInit( comm, world, soma_rank );
+
+  // Only the soma rank exposes memory.
+  bytes = comm->rank == soma_rank ? 2 * sizeof(double) : 0;
+  if (MPI_Win_allocate( bytes, sizeof(double), MPI_INFO_NULL, world,
+                        &comm->win_buf, &comm->win ) != MPI_SUCCESS) {
+    return 0;
+  }
+  if (comm->rank == soma_rank) {
+    comm->win_buf[ WIN_CURRENT ] = 0.0;
+    comm->win_buf[ WIN_VM ]      = 0.0;
+  }
+
+  // Open the first access epoch.
+  MPI_Win_fence( MPI_MODE_NOPRECEDE, comm->win );
+  return 1;
+}
+
+static double rmaExchange( CommBackend *comm, double partial,
+                           SomaUpdate update, void *ctx )
+{
+  double v_m;
+
+  MPI_Accumulate( &partial, 1, MPI_DOUBLE, comm->soma_rank, WIN_CURRENT, 1,
+                  MPI_DOUBLE, MPI_SUM, comm->win );
+  MPI_Win_fence( MPI_MODE_NOSTORE, comm->win );
+
+  // Every current has arrived; integrate the soma and publish its Vm.
+  if (comm->rank == comm->soma_rank) {
+    comm->win_buf[ WIN_VM ] = update( ctx, comm->win_buf[ WIN_CURRENT ] );
+    comm->win_buf[ WIN_CURRENT ] = 0.0;
+  }
+  MPI_Win_fence( MPI_MODE_NOPUT, comm->win );
+
+  if (comm->rank == comm->soma_rank) {
+    v_m = comm->win_buf[ WIN_VM ];
+  } else {
+    MPI_Get( &v_m, 1, MPI_DOUBLE, comm->soma_rank, WIN_VM, 1, MPI_DOUBLE,
+             comm->win );
+  }
+  // Completes the gets and opens the epoch of the next step.
+  MPI_Win_fence( 0, comm->win );
+
+  return v_m;
+}
+
+static void rmaClose( CommBackend *comm )
+{
+  MPI_Win_fence( MPI_MODE_NOSUCCEED, comm->win );
+  MPI_Win_free( &comm->win );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// shm: node local sums through a shared window, leaders allreduce across nodes.
+////////////////////////////////////////////////////////////////////////////////
+
+static int shmOpen( CommBackend *comm, MPI_Comm world, int soma_rank )
+{
+  MPI_Aint bytes;
+  int disp_unit;
+
+  commInit( comm, world, soma_rank );
+
+  // Keep the world order within each node so that the soma rank, rank 0 of
+  // its node, leads it.
+  MPI_Comm_split_type( world, MPI_COMM_TYPE_SHARED, comm->rank, MPI_INFO_NULL,
+                       &comm->node );
+  MPI_Comm_rank( comm->node, &comm->node_rank );
+  MPI_Comm_size( comm->node, &comm->node_size );
+  MPI_Comm_split( world, comm->node_rank == 0 ? 0 : MPI_UNDEFINED, comm->rank,
+                  &comm->leaders );
+
+  // The leader holds one slot per rank of the node for its current, followed
+  // by the Vm.
+  bytes = comm->node_rank == 0 ? (comm->node_size + 1) * sizeof(double) : 0;
+  if (MPI_Win_allocate_shared( bytes, sizeof(double), MPI_INFO_NULL,
+                               comm->node, &comm->win_buf, &comm->win )
+      != MPI_SUCCESS) {
+    return 0;
+  }
+  MPI_Win_shared_query( comm->win, 0, &bytes, &disp_unit, &comm->win_buf );
+
+  // The slots are plain loads and stores from here on; the window is only
+  // used for MPI_Win_sync.
+  MPI_Win_lock_all( MPI_MODE_NOCHECK, comm->win );
+  return 1;
+}
+
+static double shmExchange( CommBackend *comm, double partial,
+                           SomaUpdate update, void *ctx )
+{
+  double *slots = comm->win_buf;
+  double total;
+  int i;
+
+  slots[ comm->node_rank ] = partial;
+  MPI_Win_sync( comm->win );
+  MPI_Barrier( comm->node );
+
+  if (comm->node_rank == 0) {
+    MPI_Win_sync( comm->win );
+
+    total = 0.0;
+    for (i = 0; i < comm->node_size; i++) {
+      total += slots[i];
+    }
+    if (comm->size > comm->node_size) {
+      MPI_Allreduce( MPI_IN_PLACE, &total, 1, MPI_DOUBLE, MPI_SUM,
+                     comm->leaders );
+    }
+
+    // Every leader integrates its own copy of the soma, as in `persistent'.
+    slots[ comm->node_size ] = update( ctx, total );
+    MPI_Win_sync( comm->win );
+  }
+
+  // The slots are not written again before the next step's barrier, so one
+  // barrier per direction is enough.
+  MPI_Barrier( comm->node );
+  MPI_Win_sync( comm->win );
+
+  return slots[ comm->node_size ];
+}
+
+static void shmClose( CommBackend *comm )
+{
+  MPI_Win_unlock_all( comm->win );
+  MPI_Win_free( &comm->win );
+  if (comm->leaders != MPI_COMM_NULL) {
+    MPI_Comm_free( &comm->leaders );
+  }
+  MPI_Comm_free( &comm->node );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Table of the available backends.
+ */
+static const CommBackend backends[] = {
+  { .name = "blocking",   .open = blockingOpen,
+    .exchange = blockingExchange,   .close = noClose },
+  { .name = "persistent", .open = persistentOpen,
+    .exchange = persistentExchange, .close = persistentClose },
+  { .name = "rma",        .open = rmaOpen,
+    .exchange = rmaExchange,        .close = rmaClose },
+  { .name = "shm",        .open = shmOpen,
+    .exchange = shmExchange,        .close = shmClose }
+};
+
+#define NUM_BACKENDS ((int) (sizeof(backends) / sizeof(backends[0])))
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+int commSelect( CommBackend *comm, const char *name )
+{
+  int i;
+
+  for (i = 0; i < NUM_BACKENDS; i++) {
+    if (strcmp( backends[i].name, name ) == 0) {
+      *comm = backends[i];
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+const char *commBackendName( int i )
+{
+  return i >= 0 && i < NUM_BACKENDS ? backends[i].name : NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+int commNodeAlloc( CommBackend *comm, MPI_Aint bytes, void *base,
+                   MPI_Win *win )
+{
+  if (comm->node == MPI_COMM_NULL) {
+    return 0;
+  }
+
+  return MPI_Win_allocate_shared( bytes, sizeof(double), MPI_INFO_NULL,
+                                  comm->node, base, win ) == MPI_SUCCESS;
+}
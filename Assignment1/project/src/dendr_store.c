@@ -0,0 +1,191 @@
+#define _GNU_SOURCE
+
+#include "dendr_store.h"
+#include "constants.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// Amount of dendrite state each block should cover when no block size is
+// given. Large enough to amortize the madvise call, small enough that the
+// prefetched block does not evict the one being computed.
+#define DEFAULT_BLOCK_BYTES (16 << 20)
+
+/**
+ * Name: storeLayout
+ *
+ * Description:
+ * Fills in everything but the memory of a store.
+ */
+static void storeLayout( DendrStore *store, StoreType type,
+                         Precision precision, int num_dendrs, int num_comps,
+                         int block_dendrs )
+{
+  store->type       = type;
+  store->precision  = precision;
+  store->num_dendrs = num_dendrs;
+  store->num_comps  = num_comps;
+  store->elem_bytes = precision == PREC_MIXED ? sizeof(float) : sizeof(double);
+  store->row_bytes  = (size_t) num_comps * store->elem_bytes;
+  store->bytes      = (size_t) num_dendrs * store->row_bytes;
+  store->data       = NULL;
+  store->fd         = -1;
+  store->path       = NULL;
+
+  if (block_dendrs <= 0) {
+    block_dendrs = DEFAULT_BLOCK_BYTES / store->row_bytes;
+  }
+  if (block_dendrs <= 0) {
+    block_dendrs = 1;
+  }
+  if (block_dendrs > num_dendrs) {
+    block_dendrs = num_dendrs;
+  }
+  store->block_dendrs = block_dendrs;
+}
+
+/**
+ * Name: storeRest
+ *
+ * Description:
+ * Sets every compartment of a store to the resting potential.
+ */
+static void storeRest( DendrStore *store )
+{
+  size_t i, count;
+
+  count = (size_t) store->num_dendrs * store->num_comps;
+  if (store->precision == PREC_MIXED) {
+    for (i = 0; i < count; i++) {
+      ((float*) store->data)[i] = VREST;
+    }
+  } else {
+    for (i = 0; i < count; i++) {
+      ((double*) store->data)[i] = VREST;
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+int dendrStoreOpen( DendrStore *store, StoreType type, Precision precision,
+                    const char *path, int num_dendrs, int num_comps,
+                    int block_dendrs )
+{
+  storeLayout( store, type, precision, num_dendrs, num_comps, block_dendrs );
+
+  if (type == STORE_MMAP) {
+    store->fd = open( path, O_RDWR | O_CREAT | O_TRUNC, 0600 );
+    if (store->fd < 0) {
+      fprintf( stderr, "Can't open %s file!\n", path );
+      return 0;
+    }
+
+    // A rank may own no dendrites at all; there is nothing to map then, and
+    // mmap() would reject the empty length anyway.
+    if (store->bytes == 0) {
+      store->data = NULL;
+      store->path = strdup( path );
+      return 1;
+    }
+
+    if (ftruncate( store->fd, store->bytes ) != 0) {
+      fprintf( stderr, "Can't grow %s to %zu bytes!\n", path, store->bytes );
+      close( store->fd );
+      unlink( path );
+      return 0;
+    }
+
+    store->data = mmap( NULL, store->bytes, PROT_READ | PROT_WRITE,
+                        MAP_SHARED, store->fd, 0 );
+    if (store->data == MAP_FAILED) {
+      fprintf( stderr, "Can't map %s into memory!\n", path );
+      store->data = NULL;
+      close( store->fd );
+      unlink( path );
+      return 0;
+    }
+
+    // Every step sweeps the dendrites front to back, so tell the kernel to
+    // read ahead aggressively and drop pages behind us.
+    madvise( store->data, store->bytes, MADV_SEQUENTIAL );
+    store->path = strdup( path );
+  } else if (store->bytes == 0) {
+    store->data = NULL;
+  } else {
+    store->data = malloc( store->bytes );
+    if (store->data == NULL) {
+      fprintf( stderr, "Can't allocate %zu bytes of dendrite state!\n",
+               store->bytes );
+      return 0;
+    }
+  }
+
+  // Initialize the potential of each dendrite compartment to the rest voltage.
+  storeRest( store );
+
+  return 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+void dendrStoreAttach( DendrStore *store, Precision precision, void *data,
+                       int num_dendrs, int num_comps, int block_dendrs )
+{
+  storeLayout( store, STORE_USER, precision, num_dendrs, num_comps,
+               block_dendrs );
+  store->data = data;
+
+  storeRest( store );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+void dendrStorePrefetch( DendrStore *store, int first )
+{
+  size_t page, start, end;
+
+  if (store->type != STORE_MMAP || store->data == NULL ||
+      first >= store->num_dendrs) {
+    return;
+  }
+
+  // madvise() wants a page aligned start address.
+  page  = (size_t) sysconf( _SC_PAGESIZE );
+  start = (size_t) first * store->row_bytes;
+  end   = start + (size_t) store->block_dendrs * store->row_bytes;
+  if (end > store->bytes) {
+    end = store->bytes;
+  }
+  start -= start % page;
+
+  madvise( (char*) store->data + start, end - start, MADV_WILLNEED );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+void dendrStoreClose( DendrStore *store )
+{
+  if (store->type == STORE_MMAP) {
+    if (store->data) {
+      munmap( store->data, store->bytes );
+    }
+    if (store->fd >= 0) {
+      close( store->fd );
+    }
+    if (store->path) {
+      unlink( store->path );
+      free( store->path );
+    }
+  } else if (store->type == STORE_MEM) {
+    free( store->data );
+  }
+
+  store->data = NULL;
+  store->fd   = -1;
+  store->path = NULL;
+}
@@ -0,0 +1,305 @@
+/*
+  Batch renderer for plots queued with '--plot defer'.
+
+  Runs that defer their plot append one line to a manifest (PLOT_MANIFEST by
+  default) instead of starting gnuplot themselves:
+
+    IMAGE<tab>DATA<tab>TITLE
+
+  hh_plot takes over the manifest, so that runs finishing meanwhile start a
+  new one, and renders every queued plot with a few long-lived gnuplot
+  processes working in parallel, so that a sweep pays for gnuplot's start up
+  once per worker rather than once per run.
+*/
+
+#include "plot.h"
+#include "constants.h"
+
+#include <time.h>
+#include <stdio.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+/**
+ * A queued plot.
+ */
+typedef struct PlotJob {
+  char *image;  // PNG file to write.
+  char *data;   // Data file to plot.
+  char *title;  // Title, with gnuplot escapes.
+} PlotJob;
+
+/**
+ * Name: readManifest
+ *
+ * Description:
+ * Reads the plots queued in `path'. Malformed lines are reported and skipped.
+ *
+ * Returns:
+ * @return int    number of plots in `*jobs', -1 if the file can't be read
+ */
+static int readManifest( const char *path, PlotJob **jobs )
+{
+  char line[ 2 * FNAME_LEN + PLOT_TITLE_LEN + 8 ];
+  char *image, *data, *title;
+  int count = 0, size = 0, num = 0;
+  FILE *in;
+
+  *jobs = NULL;
+  if ((in = fopen( path, "r" )) == NULL) {
+    return -1;
+  }
+
+  while (fgets( line, sizeof(line), in ) != NULL) {
+    num++;
+    line[ strcspn( line, "\n" ) ] = '\0';
+    if ((image = strtok( line, "\t" )) == NULL ||
+        (data = strtok( NULL, "\t" )) == NULL ||
+        (title = strtok( NULL, "" )) == NULL) {
+      fprintf( stderr, "%s:%d: skipping malformed line\n", path, num );
+      continue;
+    }
+
+    if (count == size) {
+      size = size ? 2 * size : 64;
+      *jobs = realloc( *jobs, size * sizeof(PlotJob) );
+      if (*jobs == NULL) {
+        fprintf( stderr, "Can't allocate the plot queue!\n" );
+        fclose( in );
+        return -1;
+      }
+    }
+    (*jobs)[count].image = strdup( image );
+    (*jobs)[count].data  = strdup( data );
+    (*jobs)[count].title = strdup( title );
+    count++;
+  }
+
+  fclose( in );
+  return count;
+}
+
+/**
+ * Name: renderShare
+ *
+ * Description:
+ * Renders plots `worker', `worker' + `workers', ... through one gnuplot.
+ * Plots whose data file is gone are skipped.
+ *
+ * Returns:
+ * @return int    0 if gnuplot failed, nonzero otherwise
+ */
+static int renderShare( const PlotJob *jobs, int count, int worker,
+                        int workers )
+{
+  FILE *gnuplot;
+  int i;
+
+  if ((gnuplot = popen( "gnuplot", "w" )) == NULL) {
+    fprintf( stderr, "Could not start gnuplot process!\n" );
+    return 0;
+  }
+
+  for (i = worker; i < count; i += workers) {
+    if (access( jobs[i].data, R_OK ) != 0) {
+      fprintf( stderr, "Can't read %s, skipping its plot!\n", jobs[i].data );
+      continue;
+    }
+    plotWrite( gnuplot, jobs[i].title, jobs[i].data, jobs[i].image );
+  }
+
+  return pclose( gnuplot ) == 0;
+}
+
+/**
+ * Name: requeueShare
+ *
+ * Description:
+ * Appends the plots of share `worker' back to `manifest', in the format and
+ * the one-write-per-line way of plotDefer, so that the next hh_plot renders
+ * them again.
+ *
+ * Returns:
+ * @return int    number of plots queued again, -1 if the manifest can't be
+ *                opened
+ */
+static int requeueShare( const char *manifest, const PlotJob *jobs, int count,
+                         int worker, int workers )
+{
+  FILE *out;
+  int i, queued = 0;
+
+  if ((out = fopen( manifest, "a" )) == NULL) {
+    fprintf( stderr, "Can't open %s file!\n", manifest );
+    return -1;
+  }
+  setvbuf( out, NULL, _IONBF, 0 );
+
+  for (i = worker; i < count; i += workers) {
+    if (fprintf( out, "%s\t%s\t%s\n", jobs[i].image, jobs[i].data,
+                 jobs[i].title ) > 0) {
+      queued++;
+    }
+  }
+
+  fclose( out );
+  return queued;
+}
+
+/**
+ * Name: usage
+ *
+ * Description:
+ * Prints the usage statement.
+ */
+static void usage( char *name )
+{
+  printf(
+"USAGE:\n"
+"  %s [-h] [-j JOBS] [-k] [MANIFEST]\n"
+"\n"
+"DESCRIPTION:\n"
+"  Renders the PNG plots queued by runs with '--plot defer' in MANIFEST\n"
+"  (" PLOT_MANIFEST " by default). The manifest is taken over first, so\n"
+"  runs that finish meanwhile queue their plots for the next time. It is\n"
+"  removed once every plot was rendered; the plots of a gnuplot process\n"
+"  that failed are queued in MANIFEST again.\n"
+"\n"
+"OPTIONS:\n"
+"  -j, --jobs      Number of gnuplot processes rendering in parallel.\n"
+"                  Defaults to the number of online processors.\n"
+"  -k, --keep      Keep the manifest (renamed to MANIFEST.PID) after\n"
+"                  rendering.\n"
+"\n"
+, name );
+}
+
+/**
+ * Name: main
+ *
+ * Description:
+ * See usage statement (run program with '-h' flag).
+ *
+ * Parameters:
+ * @param argc    number of command line arguments
+ * @param argv    command line arguments
+ */
+int main( int argc, char **argv )
+{
+  const char *manifest = PLOT_MANIFEST;
+  char claimed[ PATH_MAX ];
+  PlotJob *jobs;
+  int workers = (int) sysconf( _SC_NPROCESSORS_ONLN );
+  int keep = 0, failed = 0, requeued = 0, lost = 0, count, status, w, i;
+  int *share_failed;
+  struct timespec start, stop;
+  pid_t pid, *pids;
+
+  #define PARAM_EQUALS( sn, ln ) (strcmp( (sn), argv[i] ) == 0 ||\
+                                  strcmp( (ln), argv[i] ) == 0)
+
+  for (i = 1; i < argc; i++) {
+    if (PARAM_EQUALS( "-h", "--help" )) {
+      usage( argv[0] );
+      return 0;
+    } else if (PARAM_EQUALS( "-j", "--jobs" ) && i + 1 < argc) {
+      workers = atoi( argv[++i] );
+    } else if (PARAM_EQUALS( "-k", "--keep" )) {
+      keep = 1;
+    } else if (argv[i][0] != '-') {
+      manifest = argv[i];
+    } else {
+      usage( argv[0] );
+      return 1;
+    }
+  }
+
+  // Take the manifest over; runs appending from now on start a new one.
+  snprintf( claimed, sizeof(claimed), "%s.%d", manifest, (int) getpid() );
+  if (rename( manifest, claimed ) != 0) {
+    printf( "No plots queued in %s.\n", manifest );
+    return 0;
+  }
+
+  if ((count = readManifest( claimed, &jobs )) < 0) {
+    fprintf( stderr, "Can't read %s file!\n", claimed );
+    return 1;
+  }
+  if (workers < 1) {
+    workers = 1;
+  }
+  if (workers > count) {
+    workers = count > 0 ? count : 1;
+  }
+
+  pids         = malloc( workers * sizeof(pid_t) );
+  share_failed = calloc( workers, sizeof(int) );
+  if (pids == NULL || share_failed == NULL) {
+    fprintf( stderr, "Can't allocate the gnuplot workers!\n" );
+    rename( claimed, manifest );
+    return 1;
+  }
+
+  clock_gettime( CLOCK_MONOTONIC, &start );
+
+  // One child per gnuplot, each with an interleaved share of the plots.
+  for (w = 0; w < workers; w++) {
+    if ((pids[w] = fork()) == 0) {
+      exit( renderShare( jobs, count, w, workers ) ? 0 : 1 );
+    } else if (pids[w] < 0) {
+      fprintf( stderr, "Could not start worker %d, rendering its share here!\n",
+               w );
+      share_failed[w] = !renderShare( jobs, count, w, workers );
+    }
+  }
+  while ((pid = wait( &status )) > 0) {
+    for (w = 0; w < workers && pids[w] != pid; w++)
+      ;
+    if (w < workers) {
+      share_failed[w] = !WIFEXITED( status ) || WEXITSTATUS( status ) != 0;
+    }
+  }
+
+  clock_gettime( CLOCK_MONOTONIC, &stop );
+  printf( "Rendered %d plots with %d gnuplot processes in %.2f s.\n", count,
+          workers, (stop.tv_sec - start.tv_sec) +
+                   (stop.tv_nsec - start.tv_nsec) * 1e-9 );
+
+  // gnuplot does not say which of its plots it got through, so the whole
+  // share of a failed worker is queued again.
+  for (w = 0; w < workers; w++) {
+    if (share_failed[w]) {
+      failed++;
+      if ((i = requeueShare( manifest, jobs, count, w, workers )) < 0) {
+        lost = 1;
+      } else {
+        requeued += i;
+      }
+    }
+  }
+
+  if (failed) {
+    fprintf( stderr, "%d gnuplot processes failed; %d plots are queued again "
+             "in %s.\n", failed, requeued, manifest );
+  }
+  if (lost) {
+    fprintf( stderr, "Some plots could not be queued again; run '%s %s' to "
+             "render them.\n", argv[0], claimed );
+  } else if (keep) {
+    printf( "Manifest kept as %s.\n", claimed );
+  } else {
+    unlink( claimed );
+  }
+
+  for (i = 0; i < count; i++) {
+    free( jobs[i].image ); free( jobs[i].data ); free( jobs[i].title );
+  }
+  free( jobs );
+  free( pids );
+  free( share_failed );
+
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,244 @@
+/*
+  Multiple Processor Systems. Spring 2009 (again, Spring 2010)
+  Professor Muhammad Shaaban
+  Author: Dmitri Yudanov (update: Dan Brandt)
+
+  Simulation driver for the Hodgkin Huxley (HH) simplified compartamental
+  neuron model. This is the main loop that used to live in seq_hh.c.
+*/
+
+#include "hh_sim.h"
+#include "lib_hh.h"
+#include "prec_guard.h"
+#include "phase_timer.h"
+
+#include <stdlib.h>
+
+/**
+ * Everything a running simulation needs.
+ */
+struct HHSim {
+  HHConfig config;          // Parameters the simulation was created with.
+  int num_comps;            // Compartments per dendrite, dummy and soma too.
+  long steps;               // Integration steps taken so far.
+  double y[NUMVAR];         // Soma state.
+  double soma_params[3];    // dt, injected current, dendritic current.
+  DendrStore dendr_volt;    // Compartment state.
+  PrecGuard guard;          // Checks the mixed precision mode against double.
+  SpikeStats spikes;        // Spikes detected while simulating.
+};
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+void hh_config_default( HHConfig *config )
+{
+  config->num_dendrs     = 1;
+  config->num_comps      = 1;
+  config->storage        = STORE_MEM;
+  config->state_file     = NULL;
+  config->block_dendrs   = 0;
+  config->precision      = PREC_DOUBLE;
+  config->guard_interval = GUARD_INTERVAL;
+  config->spike_file     = NULL;
+  config->status         = NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+HHSim *hh_sim_create( const HHConfig *config )
+{
+  HHSim *sim;
+
+  PHASE_BEGIN( PHASE_SETUP );
+  sim = malloc( sizeof(HHSim) );
+  if (sim == NULL) {
+    PHASE_END( PHASE_SETUP );
+    return NULL;
+  }
+
+  sim->config = *config;
+  sim->steps  = 0;
+
+  // The first compartment is a dummy and the last is connected to the soma.
+  sim->num_comps = config->num_comps + 2;
+
+  // Initialize 'y' with precomputed values from the HH model.
+  sim->y[0] = VREST;
+  sim->y[1] = 0.037;
+  sim->y[2] = 0.0148;
+  sim->y[3] = 0.9959;
+
+  // Setup parameters for the soma.
+  sim->soma_params[0] = 1.0 / (double) STEPS;  // dt
+  sim->soma_params[1] = 0.0;  // Direct current injection into soma is always
+                              // zero.
+  sim->soma_params[2] = 0.0;  // Dendritic current injected into soma. This is
+                              // the value that each step will update.
+
+  // Initialize the potential of each dendrite compartment to the rest voltage.
+  if (!dendrStoreOpen( &sim->dendr_volt, config->storage, config->precision,
+                       config->state_file, config->num_dendrs, sim->num_comps,
+                       config->block_dendrs )) {
+    free( sim );
+    PHASE_END( PHASE_SETUP );
+    return NULL;
+  }
+
+  if (!precGuardOpen( &sim->guard, config->precision == PREC_MIXED ?
+                                     config->guard_interval : 0,
+                      config->num_dendrs, sim->num_comps,
+                      sim->soma_params[0] )) {
+    dendrStoreClose( &sim->dendr_volt );
+    free( sim );
+    PHASE_END( PHASE_SETUP );
+    return NULL;
+  }
+
+  spikeStatsInit( &sim->spikes, config->spike_file, sim->y[0] );
+  PHASE_END( PHASE_SETUP );
+
+  return sim;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+void hh_sim_advance( HHSim *sim, long n_steps )
+{
+  int t_ms, step, dendrite, block, last;
+  int num_dendrs = sim->config.num_dendrs;
+  int num_comps  = sim->num_comps;
+  double current, y0[NUMVAR], dydt[NUMVAR];
+  double *y = sim->y, *soma_params = sim->soma_params;
+  DendrStore *dendr_volt = &sim->dendr_volt;
+
+  for (; n_steps > 0; n_steps--) {
+    // Millisecond being simulated (starting from 1) and integration step
+    // within it.
+    t_ms = sim->steps / STEPS + 1;
+    step = sim->steps % STEPS;
+
+    if (step == 0) {
+      PHASE_BEGIN( PHASE_SPIKES );
+      precGuardBegin( &sim->guard, dendr_volt, y, t_ms );
+      PHASE_END( PHASE_SPIKES );
+    }
+
+    PHASE_BEGIN( PHASE_DENDRITES );
+    soma_params[2] = 0.0;
+
+    // Loop over all the dendrites, one block at a time. The next block is
+    // prefetched before the current one is computed so that, when the state
+    // lives in a file, reading it overlaps with computation. Currents are
+    // still accumulated in dendrite order, so the sum is unchanged.
+    for (block = 0; block < num_dendrs; block += dendr_volt->block_dendrs) {
+      last = block + dendr_volt->block_dendrs;
+      if (last > num_dendrs) {
+        last = num_dendrs;
+      }
+      dendrStorePrefetch( dendr_volt, last );
+
+      for (dendrite = block; dendrite < last; dendrite++) {
+        // This will update Vm in all compartments and will give a new
+        // injected current value from last compartment into the soma.
+        if (dendr_volt->precision == PREC_MIXED) {
+          current = dendriteStepF( dendrStoreRowF( dendr_volt, dendrite ),
+                                   step + dendrite + 1,
+                                   num_comps,
+                                   soma_params[0],
+                                   y[0] );
+        } else {
+          current = dendriteStep( dendrStoreRow( dendr_volt, dendrite ),
+                                  step + dendrite + 1,
+                                  num_comps,
+                                  soma_params[0],
+                                  y[0] );
+        }
+
+        // Accumulate the current generated by the dendrite.
+        soma_params[2] += current;
+      }
+    }
+    PHASE_END( PHASE_DENDRITES );
+
+    PHASE_BEGIN( PHASE_SOMA );
+    // Store previous HH model parameters.
+    y0[0] = y[0]; y0[1] = y[1]; y0[2] = y[2]; y0[3] = y[3];
+
+    // This is the main HH computation. It updates the potential, Vm, of the
+    // soma, injects current, and calculates action potential. Good stuff.
+    soma(dydt, y, soma_params);
+    rk4Step(y, y0, dydt, NUMVAR, soma_params, 1, soma);
+    PHASE_END( PHASE_SOMA );
+
+    PHASE_BEGIN( PHASE_SPIKES );
+    // Look for spikes while the sub-millisecond Vm is still at hand.
+    spikeStatsUpdate( &sim->spikes, (t_ms - 1) + (step + 1) * soma_params[0],
+                      soma_params[0], y[0] );
+
+    precGuardStep( &sim->guard, step, (t_ms - 1) + (step + 1) * soma_params[0],
+                   soma_params[2], y[0] );
+    if (step == STEPS - 1) {
+      precGuardEnd( &sim->guard, t_ms );
+    }
+    PHASE_END( PHASE_SPIKES );
+
+    sim->steps++;
+    statusStep( sim->config.status, sim->steps, y[0], sim->spikes.count );
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+double hh_sim_time( const HHSim *sim )
+{
+  return (double) sim->steps / (double) STEPS;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+long hh_sim_steps( const HHSim *sim )
+{
+  return sim->steps;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+const double *hh_sim_soma( const HHSim *sim )
+{
+  return sim->y;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+const DendrStore *hh_sim_dendrites( const HHSim *sim )
+{
+  return &sim->dendr_volt;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+const SpikeStats *hh_sim_spikes( const HHSim *sim )
+{
+  return &sim->spikes;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+void hh_sim_guard( const HHSim *sim, int *checks, int *warnings )
+{
+  *checks   = sim->guard.checks;
+  *warnings = sim->guard.warnings;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+void hh_sim_destroy( HHSim *sim )
+{
+  if (sim == NULL) {
+    return;
+  }
+
+  precGuardClose( &sim->guard );
+  dendrStoreClose( &sim->dendr_volt );
+  free( sim );
+}
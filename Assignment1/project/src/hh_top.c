@@ -0,0 +1,215 @@
+/*
+  Live monitor for seq_hh and mpi_hh runs started with '--status'.
+
+  Every such run publishes its progress in a POSIX shared memory segment,
+  STATUS_PREFIX<pid> (see status.h). hh_top maps the segments read-only and
+  prints one line per run every few seconds, without disturbing the runs:
+
+    PID  RANKS  DENDR  COMPS  SIM MS  DONE  STEPS/S  ETA  VM  SPIKES  STATE
+*/
+
+#include "status.h"
+
+#include <time.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// Where the shared memory objects show up as files.
+#define SHM_DIR "/dev/shm"
+
+// Most runs shown at once.
+#define MAX_RUNS 64
+
+/**
+ * Name: showRun
+ *
+ * Description:
+ * Maps the status segment `name', prints its line and unmaps it.
+ *
+ * Returns:
+ * @return int    0 if there is no such segment (any more), nonzero otherwise
+ */
+static int showRun( const char *name )
+{
+  const StatusShared *shared;
+  double rate, left;
+  int64_t step, total;
+  const char *state;
+  int fd;
+
+  if ((fd = shm_open( name, O_RDONLY, 0 )) < 0) {
+    return 0;
+  }
+  shared = mmap( NULL, sizeof(StatusShared), PROT_READ, MAP_SHARED, fd, 0 );
+  close( fd );
+  if (shared == MAP_FAILED) {
+    return 0;
+  }
+
+  if (atomic_load_explicit( &shared->magic, memory_order_acquire )
+      != STATUS_MAGIC || shared->version != STATUS_VERSION) {
+    // Still being set up, or from another version.
+    munmap( (void *) shared, sizeof(StatusShared) );
+    return 1;
+  }
+
+  step  = atomic_load_explicit( &shared->step, memory_order_relaxed );
+  rate  = atomic_load_explicit( &shared->steps_per_sec, memory_order_relaxed );
+  total = (int64_t) shared->sim_ms * shared->steps_per_ms;
+  left  = rate > 0 ? (total - step) / rate : 0.0;
+
+  if (atomic_load_explicit( &shared->done, memory_order_relaxed )) {
+    state = "done";
+  } else if (kill( shared->pid, 0 ) != 0) {
+    state = "gone";
+  } else {
+    state = "running";
+  }
+
+  printf( "%8d %5d %7d %6d %8.2f %5.1f%% %10.0f %8.0f %9.3f %7ld  %s\n",
+          shared->pid, shared->ranks, shared->num_dendrs, shared->num_comps,
+          (double) step / shared->steps_per_ms,
+          total > 0 ? 100.0 * step / total : 0.0, rate, left,
+          atomic_load_explicit( &shared->vm, memory_order_relaxed ),
+          (long) atomic_load_explicit( &shared->spikes, memory_order_relaxed ),
+          state );
+
+  munmap( (void *) shared, sizeof(StatusShared) );
+  return 1;
+}
+
+/**
+ * Name: findRuns
+ *
+ * Description:
+ * Lists the status segments in SHM_DIR, as shared memory object names.
+ *
+ * Returns:
+ * @return int    number of names put in `names'
+ */
+static int findRuns( char names[][ 64 ], int max )
+{
+  const char *prefix = STATUS_PREFIX + 1;  // Without the leading '/'.
+  struct dirent *entry;
+  DIR *dir;
+  int count = 0;
+
+  if ((dir = opendir( SHM_DIR )) == NULL) {
+    return 0;
+  }
+  while (count < max && (entry = readdir( dir )) != NULL) {
+    if (strncmp( entry->d_name, prefix, strlen( prefix ) ) == 0) {
+      snprintf( names[ count++ ], 64, "/%.62s", entry->d_name );
+    }
+  }
+  closedir( dir );
+
+  return count;
+}
+
+/**
+ * Name: usage
+ *
+ * Description:
+ * Prints the usage statement.
+ */
+static void usage( char *name )
+{
+  printf(
+"USAGE:\n"
+"  %s [-h] [-i SECONDS] [-n COUNT] [PID ...]\n"
+"\n"
+"DESCRIPTION:\n"
+"  Shows the progress of seq_hh and mpi_hh runs started with '--status' on\n"
+"  this node: simulated time, share done, integration steps per second, time\n"
+"  left (s), soma Vm and spikes so far. Without PIDs every run found in\n"
+"  " SHM_DIR " is shown. The screen is redrawn when the output is a terminal;\n"
+"  otherwise (a log file, a batch job) the lines are appended.\n"
+"\n"
+"OPTIONS:\n"
+"  -i, --interval  Seconds between refreshes. Defaults to 2.\n"
+"  -n, --count     Refreshes before exiting, 0 (the default) for no limit.\n"
+"                  With PIDs, hh_top also exits once all of them are gone.\n"
+"\n"
+, name );
+}
+
+/**
+ * Name: main
+ *
+ * Description:
+ * See usage statement (run program with '-h' flag).
+ *
+ * Parameters:
+ * @param argc    number of command line arguments
+ * @param argv    command line arguments
+ */
+int main( int argc, char **argv )
+{
+  char names[ MAX_RUNS ][ 64 ];
+  double interval = 2.0;
+  int count = 0, num_pids = 0, num_runs, shown, refresh, i;
+  int tty = isatty( STDOUT_FILENO );
+  struct timespec pause;
+
+  #define PARAM_EQUALS( sn, ln ) (strcmp( (sn), argv[i] ) == 0 ||\
+                                  strcmp( (ln), argv[i] ) == 0)
+
+  for (i = 1; i < argc; i++) {
+    if (PARAM_EQUALS( "-h", "--help" )) {
+      usage( argv[0] );
+      return 0;
+    } else if (PARAM_EQUALS( "-i", "--interval" ) && i + 1 < argc) {
+      interval = atof( argv[++i] );
+    } else if (PARAM_EQUALS( "-n", "--count" ) && i + 1 < argc) {
+      count = atoi( argv[++i] );
+    } else if (argv[i][0] != '-' && atoi( argv[i] ) > 0 &&
+               num_pids < MAX_RUNS) {
+      snprintf( names[ num_pids++ ], 64, "%s%d", STATUS_PREFIX,
+                atoi( argv[i] ) );
+    } else {
+      usage( argv[0] );
+      return 1;
+    }
+  }
+
+  if (interval < 0.1) {
+    interval = 0.1;
+  }
+  pause.tv_sec  = (time_t) interval;
+  pause.tv_nsec = (long) ((interval - pause.tv_sec) * 1e9);
+
+  for (refresh = 0; count == 0 || refresh < count; refresh++) {
+    num_runs = num_pids > 0 ? num_pids : findRuns( names, MAX_RUNS );
+
+    if (tty) {
+      printf( "\033[H\033[2J" );
+    }
+    printf( "%8s %5s %7s %6s %8s %6s %10s %8s %9s %7s  %s\n", "PID", "RANKS",
+            "DENDR", "COMPS", "SIM MS", "DONE", "STEPS/S", "ETA S", "VM",
+            "SPIKES", "STATE" );
+
+    for (i = shown = 0; i < num_runs; i++) {
+      shown += showRun( names[i] );
+    }
+    if (shown == 0) {
+      printf( "No runs publishing their status.\n" );
+    }
+    fflush( stdout );
+
+    if (num_pids > 0 && shown == 0) {
+      break;
+    }
+    if (count == 0 || refresh + 1 < count) {
+      nanosleep( &pause, NULL );
+    }
+  }
+
+  return 0;
+}
@@ -17,6 +17,7 @@
 
 #include "lib_hh.h"
 #include "constants.h"
+#include "phase_timer.h"
 
 #include <math.h>
 #include <float.h>
@@ -45,11 +46,13 @@ double dendriteStep( double *v_d, int seed, int num_comps, double delta_t,
   vddt = (double*) malloc( sizeof(double) * (num_comps - 1) );
   paramD[0] = delta_t;
 
+  PHASE_BEGIN( PHASE_RNG );
   srand(seed);
 
   // Current injected at the tip of the dendrite
   cur = INJCURMEAN + INJCURMEAN*0.1 - 
         2*INJCURMEAN*0.1*((double)rand()/((double)RAND_MAX));
+  PHASE_END( PHASE_RNG );
   // Update somatic potential = potential of the last compartment
   v_d[num_comps-1] = v_m;
   
@@ -105,6 +108,88 @@ double dendriteStep( double *v_d, int seed, int num_comps, double delta_t,
   return current;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+double dendriteStepF( float *v_d, int seed, int num_comps, double delta_t,
+                      double v_m )
+{
+  int i;
+  float cur, y0, rk1, rk2, rk3, dydt, paramD[6], *vddt;
+  float const dt  = 1;
+  float const dt2 = dt/2;
+  float const dt6 = dt/6;
+
+  vddt = (float*) malloc( sizeof(float) * (num_comps - 1) );
+  paramD[0] = (float) delta_t;
+
+  PHASE_BEGIN( PHASE_RNG );
+  srand(seed);
+
+  // Current injected at the tip of the dendrite
+  cur = INJCURMEAN + INJCURMEAN*0.1 -
+        2*INJCURMEAN*0.1*((double)rand()/((double)RAND_MAX));
+  PHASE_END( PHASE_RNG );
+  // Update somatic potential = potential of the last compartment
+  v_d[num_comps-1] = (float) v_m;
+
+  // Loop over compartments
+  for( i=0; i < num_comps-2; i++ )
+  {/*This loop computes lateral dVm for 1st interation in RK4*/
+    if( i == 0 )
+    {// First compartment: inject current, doesn't have resistance from the left
+      paramD[1] = cur;
+      paramD[2] = 0;
+      paramD[3] = DENDRCONDCOMP + DENDRCONDDISTR/(num_comps-2-i);
+    }
+    else
+    {// For all others: inj cur = 0, gradualy rised conductance towards soma
+      paramD[1] = 0;
+      paramD[2] = DENDRCONDCOMP + DENDRCONDDISTR/(num_comps-1-i);
+      paramD[3] = DENDRCONDCOMP + DENDRCONDDISTR/(num_comps-2-i);
+    }
+    paramD[4] = v_d[i];
+    paramD[5] = v_d[i+2];
+    dendriteF((vddt+i),(v_d+i+1),paramD);
+  }
+
+  // Loop over compartments
+  for( i=0; i < num_comps-2; i++ )
+  {/*This loops performs bulk RK4 and increment lateral Vm*/
+    if( i == 0 )
+    {
+      paramD[1] = cur;
+      paramD[2] = 0;
+      paramD[3] = DENDRCONDCOMP + DENDRCONDDISTR/(num_comps-2-i);
+    }
+    else
+    {
+      paramD[1] = 0;
+      paramD[2] = DENDRCONDCOMP + DENDRCONDDISTR/(num_comps-1-i);
+      paramD[3] = DENDRCONDCOMP + DENDRCONDDISTR/(num_comps-2-i);
+    }
+    paramD[4] = v_d[i];
+    paramD[5] = v_d[i+2];
+
+    // RK4 on the single variable Vm, as rk4Step does with nv = 1.
+    y0  = v_d[i+1];
+    rk1 = vddt[i];
+    v_d[i+1] = y0 + dt2*rk1;
+    dendriteF(&dydt, (v_d+i+1), paramD);
+    rk2 = dydt;
+    v_d[i+1] = y0 + dt2*dydt;
+    dendriteF(&dydt, (v_d+i+1), paramD);
+    rk3 = dydt;
+    v_d[i+1] = y0 + dt*dydt;
+    dendriteF(&dydt, (v_d+i+1), paramD);
+    v_d[i+1] = y0 + dt6*(rk1+dydt+2*(rk2+rk3));
+  }
+  // Free malloced memory.
+  free( vddt );
+
+  // Calculate current injected by this dendrite into soma, in double.
+  return (double) paramD[3]*((double) v_d[i] - v_m);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
 void rk4Step( double *y, double *y0, double *dydt0, int nv, double *fp,
@@ -213,3 +298,21 @@ void dendrite( double *dydx, double *y, double *param )
   *dydx = dt*(I_inj + gBefore*yBefore - (gBefore + gAfter)**y + gAfter*yAfter -
           (gLd)*(*y-EL))/(Cd);
 }
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+void dendriteF( float *dydx, float *y, float *param )
+{
+  float const dt       = param[0];
+  float const I_inj    = param[1];
+  float const gBefore  = param[2];
+  float const gAfter   = param[3];
+  float const yBefore  = param[4];
+  float const yAfter   = param[5];
+  float const gLdF     = gLd;   // Keep the model constants from promoting
+  float const ELF      = EL;    // the arithmetic back to double.
+  float const CdF      = Cd;
+
+  *dydx = dt*(I_inj + gBefore*yBefore - (gBefore + gAfter)**y + gAfter*yAfter -
+          (gLdF)*(*y-ELF))/(CdF);
+}
@@ -17,13 +17,20 @@
 
 #include "plot.h"
 #include "lib_hh.h"
+#include "comm.h"
+#include "balance.h"
 #include "cmd_args.h"
 #include "constants.h"
+#include "dendr_store.h"
+#include "phase_timer.h"
+#include "perf_counters.h"
+#include "spikes.h"
+#include "status.h"
 
 #include <time.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <stdint.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 
@@ -43,16 +50,132 @@
   #define ISDEF_PLOT_PNG 0
 #endif
 
-typedef struct
+// Rank that integrates the soma and writes the results.
+#define SOMA_RANK 0
+
+/**
+ * Soma state of a rank that integrates the soma.
+ */
+typedef struct SomaState
+{
+    double y[NUMVAR];       // HH model state, Vm first.
+    double params[3];       // dt, injected current, dendritic current.
+} SomaState;
+
+/**
+ * Name: somaInit
+ *
+ * Description:
+ * Puts the soma at rest.
+ *
+ * Parameters:
+ * @param soma    (OUTPUT) soma to initialize
+ */
+static void somaInit( SomaState *soma )
 {
-    int dendr;
-    int step;
-    int num_comps;
-    double delta_t; // somaparams[0]
-    double v_m; // y[0]
-    uint8_t done;
-} comm_buffer_t;
+    // Initialize 'y' with precomputed values from the HH model.
+    soma->y[0] = VREST;
+    soma->y[1] = 0.037;
+    soma->y[2] = 0.0148;
+    soma->y[3] = 0.9959;
 
+    // Setup parameters for the soma.
+    soma->params[0] = 1.0 / (double) STEPS;  // dt
+    soma->params[1] = 0.0;  // Direct current injection into soma is always zero.
+    soma->params[2] = 0.0;  // Dendritic current injected into soma.
+}
+
+/**
+ * Name: somaUpdate
+ *
+ * Description:
+ * SomaUpdate handed to the communication backend: integrates the soma over
+ * one step with the total dendritic current.
+ *
+ * Parameters:
+ * @param ctx       (INOUT) the SomaState
+ * @param current   (INPUT) total dendritic current
+ *
+ * Returns:
+ * @return double   new soma Vm
+ */
+static double somaUpdate( void *ctx, double current )
+{
+    SomaState *state = ctx;
+    double y0[NUMVAR], dydt[NUMVAR];
+
+    PHASE_BEGIN( PHASE_SOMA );
+    state->params[2] = current;
+
+    // Store previous HH model parameters.
+    y0[0] = state->y[0]; y0[1] = state->y[1]; y0[2] = state->y[2]; y0[3] = state->y[3];
+
+    // This is the main HH computation. It updates the potential, Vm, of the
+    // soma, injects current, and calculates action potential. Good stuff.
+    soma(dydt, state->y, state->params);
+    rk4Step(state->y, y0, dydt, NUMVAR, state->params, 1, soma);
+    PHASE_END( PHASE_SOMA );
+
+    return state->y[0];
+}
+
+/**
+ * Name: commBench
+ *
+ * Description:
+ * Times COMM_BENCH_STEPS exchanges of every backend on MPI_COMM_WORLD and has
+ * rank 0 print one CSV line per backend with the time of the slowest rank.
+ */
+static void commBench( void )
+{
+    int rank, size;
+    const char *name;
+
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    if (rank == 0)
+    {
+        printf("backend,ranks,us_per_step\n");
+    }
+
+    for (int i = 0; (name = commBackendName(i)) != NULL; i++)
+    {
+        CommBackend comm;
+        SomaState soma;
+        double elapsed, slowest;
+
+        commSelect(&comm, name);
+        somaInit(&soma);
+        if (!comm.open(&comm, MPI_COMM_WORLD, SOMA_RANK))
+        {
+            if (rank == 0)
+            {
+                fprintf(stderr, "Could not set up the '%s' backend!\n", name);
+            }
+            continue;
+        }
+
+        // One untimed round so that connections are set up.
+        comm.exchange(&comm, 0.0, somaUpdate, &soma);
+        MPI_Barrier(MPI_COMM_WORLD);
+
+        elapsed = MPI_Wtime();
+        for (int step = 0; step < COMM_BENCH_STEPS; step++)
+        {
+            comm.exchange(&comm, 0.0, somaUpdate, &soma);
+        }
+        elapsed = MPI_Wtime() - elapsed;
+
+        comm.close(&comm);
+
+        MPI_Reduce(&elapsed, &slowest, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+        if (rank == 0)
+        {
+            printf("%s,%d,%f\n", name, size, 1e6 * slowest / COMM_BENCH_STEPS);
+        }
+    }
+}
 
 /**
  * Name: main
@@ -60,6 +183,14 @@ typedef struct
  * Description:
  * See usage statement (run program with '-h' flag).
  *
+ * Every rank simulates a contiguous share of the dendrites. At each step the
+ * ranks combine their dendrite currents into the soma, which is integrated by
+ * SOMA_RANK, and continue with its new Vm. How that exchange is done is up to
+ * the communication backend selected with '-m'.
+ *
+ * With '--rebalance' the ranks periodically measure their load and move
+ * dendrites between them (see balance.h).
+ *
  * Parameters:
  * @param argc    number of command line arguments
  * @param argv    command line arguments
@@ -69,32 +200,89 @@ int main( int argc, char **argv )
     // Init Variables
     CmdArgs cmd_args;                       // Command line arguments.
     int num_comps, num_dendrs;              // Simulation parameters.
+    int first, last;                        // Dendrites of this rank.
+    Balance bal;                            // Which rank owns which dendrites.
+    int *new_bounds;                        // Ranges proposed by rebalancing.
+    double local_work;                      // Work of this rank per step.
+    long local_sim;                         // Compartments of this rank.
+    double sim_comp_steps = 0.0;            // Compartment-steps simulated here.
+    int interval_start = 0, migrations = 0;
+    double tic;
     struct timeval start, stop, diff;       // Values used to measure time.
 
     double exec_time;  // How long we take.
 
-    // Accumulators used during dendrite simulation.
-    // NOTE: We depend on the compiler to handle the use of double[] variables as
-    //       double*.
-    double **dendr_volt;
-    double res[COMPTIME], y[NUMVAR], y0[NUMVAR], dydt[NUMVAR], soma_params[3];
+    // Dendrites of this rank, the soma and the Vm it produced each millisecond.
+    DendrStore dendr_volt;
+    MPI_Win state_win = MPI_WIN_NULL;   // Shared window holding `dendr_volt', if any.
+    double *state_mem;
+    SomaState soma;
+    double res[COMPTIME], v_m;
+    CommBackend comm;
 
     // Strings used to store filenames for the graph and data files.
     char time_str[14];
     char graph_fname[ FNAME_LEN ];
     char data_fname[ FNAME_LEN ];
+    char spike_fname[ FNAME_LEN ];
+    char phases_fname[ FNAME_LEN ];
+    char state_fname[ FNAME_LEN + 16 ];  // Room for the rank suffix.
+    char state_next[ FNAME_LEN + 24 ];   // Backing file after a migration.
 
-    FILE *data_file;  // The output file where we store the soma potential values.
-    FILE *graph_file; // File where graph will be saved.
+    FILE *data_file = NULL;  // The output file where we store the soma potential values.
+    FILE *graph_file;        // File where graph will be saved.
+    FILE *spike_file = NULL; // The output file where we store the spike times.
+    SpikeStats spikes;       // Spikes detected by the soma rank while simulating.
 
     PlotInfo pinfo;   // Info passed to the plotting functions.
+    PhaseTimes phases, *all_phases = NULL; // Where the time went, with '--timers'.
+    PhaseTimes run_phases;                 // The same, summed over the ranks.
+    PerfCounters perf;                     // Hardware counters, with '--perf'.
+    PerfCounts loop_counts, *all_counts = NULL; // What the main loop counted.
+    double *all_work = NULL;                    // Compartment-steps of each rank.
+    Status status = { 0 };                      // Live progress, with '--status'.
 
     //////////////////////////////////////////////////////////////////////////////
-    // Parse command line arguments.
+    // Initialize MPI and parse command line arguments.
     //////////////////////////////////////////////////////////////////////////////
 
+    int rc = MPI_Init( &argc, &argv );
+    if (rc != MPI_SUCCESS) {
+      fprintf( stderr, "Error starting MPI.\n" );
+      MPI_Abort( MPI_COMM_WORLD, rc );
+    }
+
+    int world_rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+
+    int world_size;
+    MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+
     if (!parseArgs( &cmd_args, argc, argv )) {
         // Something was wrong.
+        MPI_Finalize();
+        exit(1);
+    }
+
+    if (cmd_args.comm_bench) {
+        commBench();
+        MPI_Finalize();
+        return 0;
+    }
+
+    if (!commSelect(&comm, cmd_args.comm)) {
+        if (world_rank == SOMA_RANK) {
+            fprintf(stderr, "Unknown communication backend '%s'!\n", cmd_args.comm);
+        }
+        MPI_Finalize();
+        exit(1);
+    }
+
+    if (cmd_args.precision != PREC_DOUBLE) {
+        if (world_rank == SOMA_RANK) {
+            fprintf(stderr, "mpi_hh only supports '-p double'!\n");
+        }
+        MPI_Finalize();
         exit(1);
     }
 
@@ -102,59 +290,97 @@ int main( int argc, char **argv )
     num_dendrs = cmd_args.num_dendrs;
     num_comps  = cmd_args.num_comps;
 
-    printf( "Simulating %d dendrites with %d compartments per dendrite.\n",
-          num_dendrs, num_comps );
+    int write_trace  = (cmd_args.output & OUTPUT_TRACE) != 0 && world_rank == SOMA_RANK;
+    int write_spikes = (cmd_args.output & OUTPUT_SPIKES) != 0 && world_rank == SOMA_RANK;
+    int write_graph  = write_trace && ISDEF_PLOT_PNG && cmd_args.plot != PLOT_NONE;
 
     //////////////////////////////////////////////////////////////////////////////
     // Create files where results will be stored.
     //////////////////////////////////////////////////////////////////////////////
 
-    // Generate the graph and data file names.
+    // Generate the graph and data file names. Every rank uses the time of the
+    // soma rank so that their state files match up.
     time_t t = time(NULL);
     struct tm *tmp = localtime( &t );
     strftime( time_str, 14, "%m%d%y_%H%M%S", tmp );
+    MPI_Bcast(time_str, sizeof(time_str), MPI_CHAR, SOMA_RANK, MPI_COMM_WORLD);
 
     // The resulting filenames will resemble
     //    pWWdXXcYY_MoDaYe_HoMiSe.xxx
     // where 'WW' is the number of processes, 'XX' is the number of dendrites,
     // 'YY' the number of compartments, and 'MoDaYe...' the time at which this
     // simulation was run.
-    sprintf( graph_fname, "graphs/p1d%dc%d_%s.png",
-           num_dendrs, num_comps, time_str );
-    sprintf( data_fname,  "data/p1d%dc%d_%s.dat",
-           num_dendrs, num_comps, time_str );
-
-    // Verify that the graphs/ and data/ directories exist. Create them if they
-    // don't.
-    struct stat stat_buf;
-    stat( "graphs", &stat_buf );
-    if ((!S_ISDIR(stat_buf.st_mode)) && (mkdir( "graphs", 0700 ) != 0)) {
-    fprintf( stderr, "Could not create 'graphs' directory!\n" );
-    exit(1);
+    sprintf( graph_fname, "graphs/p%dd%dc%d_%s.png",
+           world_size, num_dendrs, num_comps, time_str );
+    sprintf( data_fname,  "data/p%dd%dc%d_%s.dat",
+           world_size, num_dendrs, num_comps, time_str );
+    sprintf( spike_fname, "data/p%dd%dc%d_%s.spk",
+           world_size, num_dendrs, num_comps, time_str );
+    sprintf( phases_fname, "data/p%dd%dc%d_%s.phases.json",
+           world_size, num_dendrs, num_comps, time_str );
+
+    // Every rank gets its own backing file when the state is memory-mapped.
+    if (cmd_args.state_file[0] != '\0') {
+        snprintf(state_fname, sizeof(state_fname), "%s.%d", cmd_args.state_file, world_rank);
+    } else {
+        snprintf(state_fname, sizeof(state_fname), "data/p%dd%dc%d_%s.state.%d",
+                 world_size, num_dendrs, num_comps, time_str, world_rank);
     }
 
-    stat( "data", &stat_buf );
-    if ((!S_ISDIR(stat_buf.st_mode)) && (mkdir( "data", 0700 ) != 0)) {
-    fprintf( stderr, "Could not create 'data' directory!\n" );
-    exit(1);
-    }
+    if (world_rank == SOMA_RANK) {
+        printf( "Simulating %d dendrites with %d compartments per dendrite "
+                "on %d processes (%s exchange).\n",
+                num_dendrs, num_comps, world_size, comm.name );
+
+        // Verify that the graphs/ and data/ directories exist. Create them if
+        // they don't.
+        struct stat stat_buf;
+        if ((stat( "graphs", &stat_buf ) != 0 || !S_ISDIR(stat_buf.st_mode)) &&
+            (mkdir( "graphs", 0700 ) != 0)) {
+            fprintf( stderr, "Could not create 'graphs' directory!\n" );
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
 
-    // Verify that we can open files where results will be stored.
-    if ((data_file = fopen(data_fname, "wb")) == NULL) {  
-    fprintf(stderr, "Can't open %s file!\n", data_fname);
-    exit(1);
-    } else {
-    printf( "\nData will be stored in %s\n", data_fname );
-    }
+        if ((stat( "data", &stat_buf ) != 0 || !S_ISDIR(stat_buf.st_mode)) &&
+            (mkdir( "data", 0700 ) != 0)) {
+            fprintf( stderr, "Could not create 'data' directory!\n" );
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
 
-    if (ISDEF_PLOT_PNG && (graph_file = fopen(graph_fname, "wb")) == NULL) {
-    fprintf(stderr, "Can't open %s file!\n", graph_fname);
-    exit(1);
-    } else {
-    printf( "Graph will be stored in %s\n", graph_fname );
-    fclose(graph_file);
+        // Verify that we can open files where results will be stored.
+        if (!write_trace) {
+            // No trace to save.
+        } else if ((data_file = fopen(data_fname, "wb")) == NULL) {
+            fprintf(stderr, "Can't open %s file!\n", data_fname);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        } else {
+            printf( "\nData will be stored in %s\n", data_fname );
+        }
+
+        if (!write_graph) {
+            // No graph to save.
+        } else if ((graph_file = fopen(graph_fname, "wb")) == NULL) {
+            fprintf(stderr, "Can't open %s file!\n", graph_fname);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        } else {
+            printf( "Graph will be %s %s\n",
+                    cmd_args.plot == PLOT_DEFER ? "queued for" : "stored in", graph_fname );
+            fclose(graph_file);
+        }
+
+        if (!write_spikes) {
+            // No spikes to save.
+        } else if ((spike_file = fopen(spike_fname, "wb")) == NULL) {
+            fprintf(stderr, "Can't open %s file!\n", spike_fname);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        } else {
+            printf( "Spikes will be stored in %s\n", spike_fname );
+        }
     }
 
+    // The directories must exist before anyone creates a state file.
+    MPI_Barrier(MPI_COMM_WORLD);
+
     //////////////////////////////////////////////////////////////////////////////
     // Initialize simulation parameters.
     //////////////////////////////////////////////////////////////////////////////
@@ -162,212 +388,339 @@ int main( int argc, char **argv )
     // The first compartment is a dummy and the last is connected to the soma.
     num_comps = num_comps + 2;
 
-    // Initialize 'y' with precomputed values from the HH model.
-    y[0] = VREST;
-    y[1] = 0.037;
-    y[2] = 0.0148;
-    y[3] = 0.9959;
-
-    // Setup parameters for the soma.
-    soma_params[0] = 1.0 / (double) STEPS;  // dt
-    soma_params[1] = 0.0;  // Direct current injection into soma is always zero.
-    soma_params[2] = 0.0;  // Dendritic current injected into soma. This is the
-                           // value that our simulation will update at each step.
+    somaInit(&soma);
 
-    printf( "\nIntegration step dt = %f\n", soma_params[0]);
+    if (world_rank == SOMA_RANK) {
+        printf( "\nIntegration step dt = %f\n", soma.params[0]);
+    }
 
     // Start the clock.
     gettimeofday( &start, NULL );
+    if (cmd_args.timers && !phaseTimersStart()) {
+        cmd_args.timers = 0;
+    }
 
-    // Initialize the potential of each dendrite compartment to the rest voltage.
-    dendr_volt = (double**) malloc( num_dendrs * sizeof(double*) );
-    if(dendr_volt == NULL)
-    {
-        return -1;
+    PHASE_BEGIN( PHASE_SETUP );
+
+    // Split the dendrites as evenly as possible; rank r owns [first, last).
+    // Rows of the state are as long as the longest dendrite.
+    if (!balanceOpen(&bal, MPI_COMM_WORLD, num_dendrs, num_comps - 2,
+                     cmd_args.comp_spread) ||
+        (new_bounds = malloc((world_size + 1) * sizeof(int))) == NULL) {
+        MPI_Abort(MPI_COMM_WORLD, 1);
     }
-    for (int i = 0; i < num_dendrs; i++) 
-    {
-        dendr_volt[i] = (double*) malloc( num_comps * sizeof(double) );
-        if(dendr_volt[i] == NULL)
-        {
-            return -1;
-        }
-        for (int j = 0; j < num_comps; j++) 
-        {
-            dendr_volt[i][j] = VREST;
-        }
+    first = bal.bounds[world_rank];
+    last  = bal.bounds[world_rank + 1];
+
+    local_work = balanceWork(&bal, first, last);
+    local_sim  = (long) (local_work - (double) DENDRITE_OVERHEAD * (last - first));
+
+    if (!comm.open(&comm, MPI_COMM_WORLD, SOMA_RANK)) {
+        fprintf(stderr, "Could not set up the '%s' backend!\n", comm.name);
+        MPI_Abort(MPI_COMM_WORLD, 1);
     }
 
+    // Initialize the potential of each dendrite compartment to the rest voltage.
+    // With the shm backend the in-memory state of all the ranks of a node is
+    // kept in one shared window instead of private copies; not when dendrites
+    // move between ranks, though.
+    if (cmd_args.storage == STORE_MEM && cmd_args.rebalance == 0 &&
+        commNodeAlloc(&comm, (MPI_Aint) (last - first) * bal.max_comps * sizeof(double),
+                      &state_mem, &state_win)) {
+        dendrStoreAttach(&dendr_volt, PREC_DOUBLE, state_mem, last - first,
+                         bal.max_comps, cmd_args.block_dendrs);
+    } else if (!dendrStoreOpen(&dendr_volt, cmd_args.storage, PREC_DOUBLE, state_fname,
+                               last - first, bal.max_comps, cmd_args.block_dendrs)) {
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    PHASE_END( PHASE_SETUP );
+
     //////////////////////////////////////////////////////////////////////////////
     // Main Computation
     //////////////////////////////////////////////////////////////////////////////
 
-    // Initialize MPI and MPI Variables
-    int rc = 0;
-    rc = MPI_Init( &argc, &argv );
-    if (rc != MPI_SUCCESS) {
-      fprintf( stderr, "Error starting MPI.\n" );
-      MPI_Abort( MPI_COMM_WORLD, rc );
+    // Record the initial potential value in our results array.
+    v_m = soma.y[0];
+    res[0] = v_m;
+    if (world_rank == SOMA_RANK) {
+        spikeStatsInit(&spikes, spike_file, v_m);
+
+        // The soma rank sees every step, so it publishes them for hh_top.
+        if (cmd_args.status &&
+            statusOpen(&status, world_size, num_dendrs, num_comps - 2, COMPTIME - 1)) {
+            printf("\nProgress is published in %s\n", status.name);
+        }
     }
 
-    printf("got here");
-    int world_rank;
-    MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+    if (cmd_args.perf) {
+        perfCountersOpen(&perf);
+        if (cmd_args.timers) {
+            perfCountersByPhase(&perf);
+        }
+        perfCountersRead(&perf, &loop_counts);
+    }
 
-    int world_size;
-    MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+    // Loop over milliseconds.
+    for (int t_ms = 1; t_ms < COMPTIME; t_ms++) {
+
+        // Loop over integration time steps in each millisecond.
+        for (int step = 0; step < STEPS; step++) {
+            double partial = 0.0;
+
+            PHASE_BEGIN( PHASE_DENDRITES );
+            tic = balanceCpuTime();
+            // Loop over the dendrites of this rank, one block at a time,
+            // prefetching the next block when the state lives in a file.
+            for (int block = 0; block < last - first; block += dendr_volt.block_dendrs) {
+                int block_end = block + dendr_volt.block_dendrs;
+                if (block_end > last - first) {
+                    block_end = last - first;
+                }
+                dendrStorePrefetch(&dendr_volt, block_end);
+
+                for (int d = block; d < block_end; d++) {
+                    // This will update Vm in all compartments and will give a
+                    // new injected current value from last compartment into
+                    // the soma. Seeds follow the global dendrite index.
+                    partial += dendriteStep( dendrStoreRow(&dendr_volt, d),
+                                             step + first + d + 1,
+                                             bal.comps[first + d],
+                                             soma.params[0],
+                                             v_m );
+                }
+            }
+            bal.dendr_time += balanceCpuTime() - tic;
+            bal.comp_steps += local_work;
+            sim_comp_steps += local_sim;
+            PHASE_END( PHASE_DENDRITES );
+
+            // Combine the currents of all ranks, integrate the soma and get
+            // its new Vm back. The soma is timed separately.
+            PHASE_BEGIN( PHASE_COMM );
+            tic = MPI_Wtime();
+            v_m = comm.exchange(&comm, partial, somaUpdate, &soma);
+            bal.wait_time += MPI_Wtime() - tic;
+            PHASE_END( PHASE_COMM );
+
+            if (world_rank == SOMA_RANK) {
+                // Look for spikes while the sub-millisecond Vm is still at hand.
+                PHASE_BEGIN( PHASE_SPIKES );
+                spikeStatsUpdate(&spikes, (t_ms - 1) + (step + 1) * soma.params[0],
+                                 soma.params[0], v_m);
+                PHASE_END( PHASE_SPIKES );
+
+                statusStep(&status, (long) (t_ms - 1) * STEPS + step + 1, v_m,
+                           spikes.count);
+            }
+        }
 
-    if(world_rank == 0)
-    {
-        // Loop over ms
-        for (int t_ms = 1; t_ms < COMPTIME; t_ms++) 
-        {
-            // Loop over steps
-            for (int step = 0; step < STEPS; step++) 
-            {
-                soma_params[2] = 0.0; 
-                // Loop over dendrites
-                for(int dendrite = 0; dendrite < num_dendrs; dendrite += (world_size - 1))
-                {
-
-                    // Put a dendrite on each processing node available
-                    for(int node = 1; node < world_size; node++)
-                    {
-                        comm_buffer_t commbuf;
-                        commbuf.dendr = dendrite + node - 1;
-                        commbuf.step = step;
-                        commbuf.num_comps = num_comps;
-                        commbuf.delta_t = soma_params[0];
-                        commbuf.v_m = y[0];
-                        commbuf.done = 0;
-    		            MPI_Send(&commbuf, sizeof(comm_buffer_t), MPI_CHAR, node, MPI_ANY_TAG, MPI_COMM_WORLD);
-                    } 
-
-                    // Get all the dendrite processing info back
-                    for(int node = 1; node < world_size; node++)
-                    {
-                        double current_c;
-                        MPI_Recv(&current_c, 1, MPI_DOUBLE, node, MPI_ANY_TAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-                        soma_params[2] += current_c;
-                    }
-
-
-                    if ((dendrite + world_size - 1) < num_dendrs && (dendrite + world_size - 1) != 0)
-			         {
-                        for(int node = 1; node < (num_dendrs - dendrite); node++)
-                        {
-                        	comm_buffer_t commbuf;
-                        	commbuf.dendr = dendrite + node - 1;
-                        	commbuf.step = step;
-                        	commbuf.num_comps = num_comps;
-                        	commbuf.delta_t = soma_params[0];
-                        	commbuf.v_m = y[0];
-                        	commbuf.done = 0;
-                        	MPI_Send(&commbuf, sizeof(comm_buffer_t), MPI_CHAR, node, MPI_ANY_TAG, MPI_COMM_WORLD);
-                        } 
-
-                        // Get all the dendrite processing info back
-                        for(int node = 1; node < (num_dendrs - (num_dendrs - dendrite)); node++)
-                        {
-                        	double current_c;
-                        	MPI_Recv(&current_c, 1, MPI_DOUBLE, node, MPI_ANY_TAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-                        	soma_params[2] += current_c;
-                        }
-
-                        break;
-                    }
+        // Record the membrane potential of the soma at this simulation step.
+        // Let's show where we are in terms of computation.
+        if (world_rank == SOMA_RANK) {
+            printf("\r%02d ms",t_ms); fflush(stdout);
+        }
+
+        res[t_ms] = v_m;
+
+        // Move dendrites to where they will be done soonest. Every rank
+        // computes the same new ranges from the same measurements.
+        if (cmd_args.rebalance > 0 && t_ms % cmd_args.rebalance == 0 &&
+            t_ms < COMPTIME - 1) {
+            balanceGather(&bal);
+            if (world_rank == SOMA_RANK) {
+                char title[64];
+                snprintf(title, sizeof(title), "\nLoad over %d-%d ms:",
+                         interval_start, t_ms);
+                balanceReport(&bal, stdout, title, t_ms - interval_start);
+            }
+            interval_start = t_ms;
+
+            if (balanceRepartition(&bal, new_bounds)) {
+                // The old and new stores coexist, so their files alternate.
+                if (migrations++ % 2 == 0) {
+                    snprintf(state_next, sizeof(state_next), "%s.b", state_fname);
+                } else {
+                    snprintf(state_next, sizeof(state_next), "%s", state_fname);
+                }
+                if (!balanceMigrate(&bal, &dendr_volt, new_bounds, state_next,
+                                    cmd_args.block_dendrs)) {
+                    MPI_Abort(MPI_COMM_WORLD, 1);
                 }
 
-                // Tell all processing nodes that work is done
-                for(int node = 1; node < world_size; node++)
-                {
-                    comm_buffer_t commbuf;
-                    commbuf.done = 1;
-                    MPI_Send(&commbuf, sizeof(comm_buffer_t), MPI_CHAR, node, MPI_ANY_TAG, MPI_COMM_WORLD);
-                } 
-
-                // Store previous HH model parameters.
-                y0[0] = y[0]; y0[1] = y[1]; y0[2] = y[2]; y0[3] = y[3];
-
-                // This is the main HH computation. It updates the potential, Vm, of the
-                // soma, injects current, and calculates action potential. Good stuff.
-                soma(dydt, y, soma_params);
-                rk4Step(y, y0, dydt, NUMVAR, soma_params, 1, soma);
+                first = bal.bounds[world_rank];
+                last  = bal.bounds[world_rank + 1];
+                local_work = balanceWork(&bal, first, last);
+                local_sim  = (long) (local_work - (double) DENDRITE_OVERHEAD * (last - first));
             }
         }
     }
-    else
-    {
-        comm_buffer_t commbuf;
-        MPI_Recv(&commbuf, sizeof(comm_buffer_t), MPI_CHAR, 0, MPI_ANY_TAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-        while(commbuf.done == 0)
-        {
-            // This will update Vm in all compartments and will give a new injected
-            // current value from last compartment into the soma.
-            double current = dendriteStep( dendr_volt[ commbuf.dendr ],
-                                           commbuf.step + commbuf.dendr + 1,
-                                           commbuf.num_comps,
-                                           commbuf.delta_t,
-                                           commbuf.v_m );
- 
-            // ASend back the current generated by the dendrite.
-            MPI_Send(&current, 1, MPI_DOUBLE, 0, MPI_ANY_TAG, MPI_COMM_WORLD);
-            MPI_Recv(&commbuf, sizeof(comm_buffer_t), MPI_CHAR, 0, MPI_ANY_TAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-        }
+
+    if (cmd_args.perf) {
+        PerfCounts end;
+        perfCountersRead(&perf, &end);
+        perfCountsDiff(&end, &loop_counts, &loop_counts);
     }
 
-    MPI_Finalize();
+    statusClose(&status);
 
     //////////////////////////////////////////////////////////////////////////////
     // Report results of computation.
     //////////////////////////////////////////////////////////////////////////////
 
-    // Stop the clock, compute how long the program was running and report that
-    // time.
-    gettimeofday( &stop, NULL );
-    timersub( &stop, &start, &diff );
-    exec_time = (double) (diff.tv_sec) + (double) (diff.tv_usec) * 0.000001;
-    printf("\n\nExecution time: %f seconds.\n", exec_time);
-
-    // Record the parameters for this simulation as well as data for gnuplot.
-    fprintf( data_file,
-           "# Vm for HH model. "
-           "Simulation time: %d ms, Integration step: %f ms, "
-           "Compartments: %d, Dendrites: %d, Execution time: %f s, "
-           "Slave processes: %d\n",
-           COMPTIME, soma_params[0], num_comps - 2, num_dendrs, exec_time,
-           0 );
-    fprintf( data_file, "# X Y\n");
-
-    for (int t_ms = 0; t_ms < COMPTIME; t_ms++) {
-        fprintf(data_file, "%d %f\n", t_ms, res[t_ms]);
+    if (world_rank == SOMA_RANK) {
+        // Stop the clock, compute how long the program was running and report
+        // that time.
+        gettimeofday( &stop, NULL );
+        timersub( &stop, &start, &diff );
+        exec_time = (double) (diff.tv_sec) + (double) (diff.tv_usec) * 0.000001;
+        printf("\n\nExecution time: %f seconds.\n", exec_time);
     }
-    fflush(data_file);  // Flush and close the data file so that gnuplot will
-    fclose(data_file);  // see it.
 
-    //////////////////////////////////////////////////////////////////////////////
-    // Plot results if approriate macro was defined.
-    //////////////////////////////////////////////////////////////////////////////
-    if (ISDEF_PLOT_PNG || ISDEF_PLOT_SCREEN) {
-    pinfo.sim_time = COMPTIME;
-    pinfo.int_step = soma_params[0];
-    pinfo.num_comps = num_comps - 2;
-    pinfo.num_dendrs = num_dendrs;
-    pinfo.exec_time = exec_time;
-    pinfo.slaves = 0;
+    // Report the load of every rank since the last rebalancing, or over the
+    // whole run, when it may be uneven.
+    if (cmd_args.rebalance > 0 || cmd_args.comp_spread > 0) {
+        balanceGather(&bal);
+        if (world_rank == SOMA_RANK) {
+            char title[64];
+            snprintf(title, sizeof(title), "Load over %d-%d ms:",
+                     interval_start, COMPTIME - 1);
+            balanceReport(&bal, stdout, title, COMPTIME - 1 - interval_start);
+        }
+    }
+
+    // Report the counters of every rank, per compartment-step of its own
+    // dendrites.
+    if (cmd_args.perf) {
+        if (world_rank == SOMA_RANK) {
+            all_counts = malloc(world_size * sizeof(PerfCounts));
+            all_work   = malloc(world_size * sizeof(double));
+        }
+        MPI_Gather(&loop_counts, sizeof(PerfCounts), MPI_BYTE,
+                   all_counts, sizeof(PerfCounts), MPI_BYTE,
+                   SOMA_RANK, MPI_COMM_WORLD);
+        MPI_Gather(&sim_comp_steps, 1, MPI_DOUBLE, all_work, 1, MPI_DOUBLE,
+                   SOMA_RANK, MPI_COMM_WORLD);
+
+        if (world_rank == SOMA_RANK) {
+            for (int r = 0; r < world_size; r++) {
+                char label[32];
+                snprintf(label, sizeof(label), "Rank %d main loop", r);
+                perfCountsPrint(stdout, label, &all_counts[r], all_work[r]);
+            }
+        }
+    }
+
+    PHASE_BEGIN( PHASE_OUTPUT );
+    if (world_rank == SOMA_RANK) {
+        if (write_spikes) {
+            spikeStatsReport(&spikes, stdout, "", COMPTIME - 1);
+            spikeStatsReport(&spikes, spike_file, "# ", COMPTIME - 1);
+            fclose(spike_file);
+        }
+
+        // Record the parameters for this simulation as well as data for gnuplot.
+        if (write_trace) {
+            fprintf( data_file,
+                   "# Vm for HH model. "
+                   "Simulation time: %d ms, Integration step: %f ms, "
+                   "Compartments: %d, Dendrites: %d, Execution time: %f s, "
+                   "Slave processes: %d\n",
+                   COMPTIME, soma.params[0], num_comps - 2, num_dendrs, exec_time,
+                   world_size - 1 );
+            fprintf( data_file, "# X Y\n");
+
+            for (int t_ms = 0; t_ms < COMPTIME; t_ms++) {
+                fprintf(data_file, "%d %f\n", t_ms, res[t_ms]);
+            }
+            fflush(data_file);  // Flush and close the data file so that gnuplot will
+            fclose(data_file);  // see it.
+        }
     }
+    PHASE_END( PHASE_OUTPUT );
+
+    // Gather where the time went on every rank. Plotting is not timed, so that
+    // the split can go into the plot.
+    if (cmd_args.timers) {
+        phaseTimersCollect(&phases);
+        if (world_rank == SOMA_RANK) {
+            all_phases = malloc(world_size * sizeof(PhaseTimes));
+        }
+        MPI_Gather(&phases, sizeof(PhaseTimes), MPI_BYTE,
+                   all_phases, sizeof(PhaseTimes), MPI_BYTE,
+                   SOMA_RANK, MPI_COMM_WORLD);
+
+        if (world_rank == SOMA_RANK) {
+            // The plot shows the split of the whole run, not of one rank.
+            memset(&run_phases, 0, sizeof(PhaseTimes));
+            for (int r = 0; r < world_size; r++) {
+                for (int p = 0; p < NUM_PHASES; p++) {
+                    run_phases.seconds[p] += all_phases[r].seconds[p];
+                    run_phases.calls[p]   += all_phases[r].calls[p];
+                }
+                run_phases.total += all_phases[r].total;
+            }
 
-    if (ISDEF_PLOT_PNG) {    plotData( &pinfo, data_fname, graph_fname ); }
-    if (ISDEF_PLOT_SCREEN) { plotData( &pinfo, data_fname, NULL ); }
+            phaseTimersPrint(stdout, all_phases, world_size);
+            if (phaseTimersWriteJson(phases_fname, all_phases, world_size)) {
+                printf("Phase times stored in %s\n", phases_fname);
+            }
+        }
+    }
+
+    if (cmd_args.perf) {
+        // Only the counters of the soma rank are split by phase.
+        if (cmd_args.timers && world_rank == SOMA_RANK) {
+            perfCountersPrintPhases(stdout, &perf);
+        }
+        perfCountersClose(&perf);
+    }
+
+    if (world_rank == SOMA_RANK) {
+
+        //////////////////////////////////////////////////////////////////////////
+        // Plot results if approriate macro was defined.
+        //////////////////////////////////////////////////////////////////////////
+        if (ISDEF_PLOT_PNG || ISDEF_PLOT_SCREEN) {
+            pinfo.sim_time = COMPTIME;
+            pinfo.int_step = soma.params[0];
+            pinfo.num_comps = num_comps - 2;
+            pinfo.num_dendrs = num_dendrs;
+            pinfo.exec_time = exec_time;
+            pinfo.slaves = world_size - 1;
+            pinfo.phases = all_phases ? &run_phases : NULL;
+        }
+
+        // There is nothing to plot without a trace. Deferred plots are left
+        // to hh_plot.
+        if (write_graph && cmd_args.plot == PLOT_DEFER) {
+            if (plotDefer( &pinfo, PLOT_MANIFEST, data_fname, graph_fname )) {
+                printf( "Plot queued in %s, render it with hh_plot\n", PLOT_MANIFEST );
+            }
+        } else if (write_graph) {
+            plotData( &pinfo, data_fname, graph_fname );
+        }
+        if (write_trace && ISDEF_PLOT_SCREEN && cmd_args.plot == PLOT_NOW) {
+            plotData( &pinfo, data_fname, NULL );
+        }
+    }
 
     //////////////////////////////////////////////////////////////////////////////
     // Free up allocated memory.
     //////////////////////////////////////////////////////////////////////////////
 
-    for(int i = 0; i < num_dendrs; i++) {
-        free(dendr_volt[i]);
+    free(all_phases);
+    free(all_counts);
+    free(all_work);
+    free(new_bounds);
+    balanceClose(&bal);
+    dendrStoreClose(&dendr_volt);
+    if (state_win != MPI_WIN_NULL) {
+        MPI_Win_free(&state_win);
     }
-    free(dendr_volt);
+
+    comm.close(&comm);
+
+    MPI_Finalize();
 
     return 0;
 }
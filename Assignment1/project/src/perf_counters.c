@@ -0,0 +1,227 @@
+#define _GNU_SOURCE
+
+#include "perf_counters.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+static const char *event_names[ NUM_PERF_EVENTS ] = {
+  "cycles", "instructions", "LLC misses", "branch misses"
+};
+
+static const uint64_t event_configs[ NUM_PERF_EVENTS ] = {
+  PERF_COUNT_HW_CPU_CYCLES,
+  PERF_COUNT_HW_INSTRUCTIONS,
+  PERF_COUNT_HW_CACHE_MISSES,
+  PERF_COUNT_HW_BRANCH_MISSES
+};
+
+// Counters charged on phase switches of this thread, see perfCountersByPhase.
+static _Thread_local PerfCounters *by_phase = NULL;
+
+/**
+ * Name: phaseHook
+ *
+ * Description:
+ * phase_hook installed by perfCountersByPhase: charges the counts since the
+ * last switch to the phase being left.
+ */
+static void phaseHook( Phase prev )
+{
+  PerfCounts now, diff;
+  int e;
+
+  if (by_phase == NULL) {
+    return;
+  }
+
+  perfCountersRead( by_phase, &now );
+  perfCountsDiff( &now, &by_phase->last, &diff );
+  for (e = 0; e < NUM_PERF_EVENTS; e++) {
+    by_phase->phase[ prev ].value[e] += diff.value[e];
+  }
+  by_phase->last = now;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+int perfCountersOpen( PerfCounters *perf )
+{
+  struct perf_event_attr attr;
+  int e, p, count = 0, err = 0;
+
+  memset( perf, 0, sizeof(PerfCounters) );
+
+  for (e = 0; e < NUM_PERF_EVENTS; e++) {
+    memset( &attr, 0, sizeof(attr) );
+    attr.size           = sizeof(attr);
+    attr.type           = PERF_TYPE_HARDWARE;
+    attr.config         = event_configs[e];
+    attr.disabled       = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv     = 1;
+
+    // This thread, on any CPU.
+    perf->fd[e] = syscall( SYS_perf_event_open, &attr, 0, -1, -1, 0 );
+    if (perf->fd[e] < 0) {
+      err = errno;
+      continue;
+    }
+
+    ioctl( perf->fd[e], PERF_EVENT_IOC_RESET, 0 );
+    ioctl( perf->fd[e], PERF_EVENT_IOC_ENABLE, 0 );
+    perf->valid |= 1u << e;
+    count++;
+  }
+
+  if (count < NUM_PERF_EVENTS) {
+    fprintf( stderr, "Hardware counters unavailable (%s):", strerror( err ) );
+    for (e = 0; e < NUM_PERF_EVENTS; e++) {
+      if (perf->fd[e] < 0) {
+        fprintf( stderr, " %s", event_names[e] );
+      }
+    }
+    fprintf( stderr, "; they will be reported as n/a.\n" );
+  }
+
+  for (p = 0; p < NUM_PHASES; p++) {
+    perf->phase[p].valid = perf->valid;
+  }
+  perfCountersRead( perf, &perf->last );
+
+  return count;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+void perfCountersRead( const PerfCounters *perf, PerfCounts *counts )
+{
+  int e;
+
+  counts->valid = perf->valid;
+  for (e = 0; e < NUM_PERF_EVENTS; e++) {
+    counts->value[e] = 0;
+    if ((perf->valid & (1u << e)) &&
+        read( perf->fd[e], &counts->value[e], sizeof(uint64_t) )
+        != sizeof(uint64_t)) {
+      counts->value[e] = 0;
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+void perfCountsDiff( const PerfCounts *end, const PerfCounts *start,
+                     PerfCounts *diff )
+{
+  int e;
+
+  diff->valid = end->valid & start->valid;
+  for (e = 0; e < NUM_PERF_EVENTS; e++) {
+    diff->value[e] = end->value[e] - start->value[e];
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+void perfCountersByPhase( PerfCounters *perf )
+{
+  if (perf->valid == 0) {
+    return;
+  }
+
+  perfCountersRead( perf, &perf->last );
+  by_phase   = perf;
+  phase_hook = phaseHook;
+}
+
+/**
+ * Name: printValue
+ *
+ * Description:
+ * Prints `value' formatted with `fmt', or "n/a" if `valid' is 0.
+ */
+static void printValue( FILE *out, const char *name, int valid,
+                        const char *fmt, double value )
+{
+  fprintf( out, "%s: ", name );
+  if (valid) {
+    fprintf( out, fmt, value );
+  } else {
+    fprintf( out, "n/a" );
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+void perfCountsPrint( FILE *out, const char *label, const PerfCounts *counts,
+                      double work )
+{
+  int has_cycles = (counts->valid >> PERF_CYCLES) & 1;
+  int has_instrs = (counts->valid >> PERF_INSTRUCTIONS) & 1;
+  int has_llc    = (counts->valid >> PERF_LLC_MISSES) & 1;
+  int has_branch = (counts->valid >> PERF_BRANCH_MISSES) & 1;
+  double cycles  = counts->value[ PERF_CYCLES ];
+  double instrs  = counts->value[ PERF_INSTRUCTIONS ];
+
+  fprintf( out, "%s: ", label );
+  printValue( out, "cycles", has_cycles, "%.0f", cycles );
+  printValue( out, ", instructions", has_instrs, "%.0f", instrs );
+  printValue( out, ", IPC", has_cycles && has_instrs && cycles > 0, "%.3f",
+              cycles > 0 ? instrs / cycles : 0.0 );
+
+  if (work > 0) {
+    printValue( out, ", LLC misses/comp-step", has_llc, "%.4f",
+                counts->value[ PERF_LLC_MISSES ] / work );
+    printValue( out, ", branch misses/comp-step", has_branch, "%.4f",
+                counts->value[ PERF_BRANCH_MISSES ] / work );
+  } else {
+    printValue( out, ", LLC misses", has_llc, "%.0f",
+                (double) counts->value[ PERF_LLC_MISSES ] );
+    printValue( out, ", branch misses", has_branch, "%.0f",
+                (double) counts->value[ PERF_BRANCH_MISSES ] );
+  }
+  fprintf( out, "\n" );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+void perfCountersPrintPhases( FILE *out, const PerfCounters *perf )
+{
+  char label[32];
+  int p;
+
+  if (perf->valid == 0) {
+    return;
+  }
+
+  fprintf( out, "Counters by phase:\n" );
+  for (p = 0; p < NUM_PHASES; p++) {
+    snprintf( label, sizeof(label), "  %-10s", phaseName( p ) );
+    perfCountsPrint( out, label, &perf->phase[p], 0 );
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+void perfCountersClose( PerfCounters *perf )
+{
+  int e;
+
+  if (by_phase == perf) {
+    phase_hook = NULL;
+    by_phase   = NULL;
+  }
+
+  for (e = 0; e < NUM_PERF_EVENTS; e++) {
+    if (perf->fd[e] >= 0) {
+      close( perf->fd[e] );
+    }
+    perf->fd[e] = -1;
+  }
+  perf->valid = 0;
+}
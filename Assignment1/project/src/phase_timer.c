@@ -0,0 +1,206 @@
+#include "phase_timer.h"
+
+#include <time.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+// Most threads that can have accumulators.
+#define MAX_THREADS 256
+
+int phase_timers_on = 0;
+_Thread_local PhaseLocal *phase_local = NULL;
+void (*phase_hook)( Phase prev ) = NULL;
+
+// Accumulators of every thread, so that they can be collected.
+static PhaseLocal *threads[ MAX_THREADS ];
+static int num_threads = 0;
+static pthread_mutex_t threads_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Clock readings taken by phaseTimersStart, to convert ticks to seconds.
+static uint64_t start_ticks;
+static double start_ns;
+
+static const char *phase_names[ NUM_PHASES ] = {
+  "other", "setup", "dendrites", "rng", "soma", "spikes", "comm", "output"
+};
+
+/**
+ * Name: wallNs
+ *
+ * Description:
+ * Monotonic clock in nanoseconds.
+ */
+static double wallNs( void )
+{
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+PhaseLocal *phaseRegister( void )
+{
+  PhaseLocal *local = calloc( 1, sizeof(PhaseLocal) );
+  if (local == NULL) {
+    // Keep going untimed rather than fail the simulation.
+    static _Thread_local PhaseLocal fallback;
+    local = &fallback;
+  }
+
+  local->current = PHASE_OTHER;
+  local->start   = phaseNow();
+
+  pthread_mutex_lock( &threads_lock );
+  if (num_threads < MAX_THREADS) {
+    threads[ num_threads++ ] = local;
+  }
+  pthread_mutex_unlock( &threads_lock );
+
+  phase_local = local;
+  return local;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+int phaseTimersStart( void )
+{
+#ifdef PHASE_TIMERS
+  start_ns    = wallNs();
+  start_ticks = phaseNow();
+  phase_timers_on = 1;
+
+  // Time spent before the first phase is charged to `other'.
+  phaseRegister();
+  return 1;
+#else
+  fprintf( stderr, "Phase timers were not compiled in (PHASE_TIMERS)!\n" );
+  return 0;
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+void phaseTimersCollect( PhaseTimes *times )
+{
+  uint64_t ticks[ NUM_PHASES ] = { 0 };
+  double ns_per_tick;
+  int i, p;
+
+  for (p = 0; p < NUM_PHASES; p++) {
+    times->seconds[p] = 0.0;
+    times->calls[p]   = 0;
+  }
+  times->total = 0.0;
+
+  if (!phase_timers_on) {
+    return;
+  }
+
+  // Close the interval the calling thread is in.
+  phaseSwitch( phase_local->current, 0 );
+  phase_timers_on = 0;
+
+  ns_per_tick = (wallNs() - start_ns) / (double) (phaseNow() - start_ticks);
+
+  pthread_mutex_lock( &threads_lock );
+  for (i = 0; i < num_threads; i++) {
+    for (p = 0; p < NUM_PHASES; p++) {
+      ticks[p]        += threads[i]->ticks[p];
+      times->calls[p] += threads[i]->calls[p];
+    }
+  }
+  pthread_mutex_unlock( &threads_lock );
+
+  for (p = 0; p < NUM_PHASES; p++) {
+    times->seconds[p] = ticks[p] * ns_per_tick * 1e-9;
+    times->total     += times->seconds[p];
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+const char *phaseName( Phase phase )
+{
+  return phase >= 0 && phase < NUM_PHASES ? phase_names[ phase ] : "?";
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+void phaseTimersPrint( FILE *out, const PhaseTimes *times, int count )
+{
+  double mean, max, total = 0.0;
+  long calls;
+  int i, p;
+
+  for (i = 0; i < count; i++) {
+    total += times[i].total / count;
+  }
+
+  if (count > 1) {
+    fprintf( out, "\n%-10s %12s %12s %12s %7s\n",
+             "Phase", "Calls", "Mean (s)", "Max (s)", "Share" );
+  } else {
+    fprintf( out, "\n%-10s %12s %12s %7s\n",
+             "Phase", "Calls", "Time (s)", "Share" );
+  }
+
+  for (p = 0; p < NUM_PHASES; p++) {
+    mean = max = 0.0;
+    calls = 0;
+    for (i = 0; i < count; i++) {
+      mean  += times[i].seconds[p] / count;
+      calls += times[i].calls[p];
+      if (times[i].seconds[p] > max) {
+        max = times[i].seconds[p];
+      }
+    }
+
+    if (count > 1) {
+      fprintf( out, "%-10s %12ld %12.6f %12.6f %6.2f%%\n", phase_names[p],
+               calls, mean, max, total > 0 ? 100.0 * mean / total : 0.0 );
+    } else {
+      fprintf( out, "%-10s %12ld %12.6f %6.2f%%\n", phase_names[p],
+               calls, mean, total > 0 ? 100.0 * mean / total : 0.0 );
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+int phaseTimersWriteJson( const char *path, const PhaseTimes *times,
+                          int count )
+{
+  FILE *out;
+  int i, p;
+
+  if ((out = fopen( path, "w" )) == NULL) {
+    fprintf( stderr, "Can't open %s file!\n", path );
+    return 0;
+  }
+
+  fprintf( out, "{\n  \"phases\": [" );
+  for (p = 0; p < NUM_PHASES; p++) {
+    fprintf( out, "%s\"%s\"", p ? ", " : " ", phase_names[p] );
+  }
+  fprintf( out, " ],\n  \"processes\": [\n" );
+
+  for (i = 0; i < count; i++) {
+    fprintf( out, "    { \"total\": %.9f,\n      \"seconds\": [",
+             times[i].total );
+    for (p = 0; p < NUM_PHASES; p++) {
+      fprintf( out, "%s%.9f", p ? ", " : " ", times[i].seconds[p] );
+    }
+    fprintf( out, " ],\n      \"calls\": [" );
+    for (p = 0; p < NUM_PHASES; p++) {
+      fprintf( out, "%s%ld", p ? ", " : " ", times[i].calls[p] );
+    }
+    fprintf( out, " ] }%s\n", i + 1 < count ? "," : "" );
+  }
+
+  fprintf( out, "  ]\n}\n" );
+  fclose( out );
+
+  return 1;
+}
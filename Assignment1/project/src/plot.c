@@ -1,11 +1,67 @@
 #include "plot.h"
+#include "constants.h"
 
 #include <stdio.h>
+#include <string.h>
+
+/**
+ * Name: plotTitle
+ *
+ * Description:
+ * Builds the title of a plot from `pinfo', with gnuplot "\n" escapes between
+ * its lines.
+ */
+static void plotTitle( const PlotInfo *pinfo, char *title, size_t size )
+{
+  size_t len;
+  int p;
+
+  len = snprintf( title, size, "Membrane Potential\\n"
+                  "Simulation time: %d ms, Integration step: %f ms,\\n"
+                  "Compartments: %d, Dendrites: %d, Execution time: %f s,\\n"
+                  "Slave processes: %d",
+                  pinfo->sim_time, pinfo->int_step,
+                  pinfo->num_comps, pinfo->num_dendrs,
+                  pinfo->exec_time, pinfo->slaves );
+  if (pinfo->phases) {
+    // Split of the execution time, as a share of the timed run of all ranks.
+    len += snprintf( title + len, len < size ? size - len : 0, "\\n" );
+    for (p = 0; p < NUM_PHASES; p++) {
+      len += snprintf( title + len, len < size ? size - len : 0, "%s%s %.1f%%",
+                       p ? ", " : "", phaseName( p ),
+                       pinfo->phases->total > 0 ? 100.0 *
+                       pinfo->phases->seconds[p] / pinfo->phases->total : 0.0 );
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+void plotWrite( FILE *gnuplot, const char *title, const char *data_name,
+                const char *image_name )
+{
+  if (image_name) {
+    fprintf( gnuplot, "set terminal png\n" );
+    fprintf( gnuplot, "set output '%s'\n", image_name );
+  }
+
+  fprintf( gnuplot, "set title \"%s\"\n", title );
+  fprintf( gnuplot, "set xlabel 'Time, ms'\n" );
+  fprintf( gnuplot, "set ylabel 'Vm, mV'\n" );
+  fprintf( gnuplot, "unset key\n" );
+  fprintf( gnuplot, "plot '%s' using 1:2 with lines\n", data_name );
+
+  // Finish the image before the next plot reuses the terminal.
+  if (image_name) {
+    fprintf( gnuplot, "unset output\n" );
+  }
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
 void plotData( PlotInfo *pinfo, char *data_name, char *image_name )
 {
+  char title[ PLOT_TITLE_LEN ];
   FILE *pipe = popen("gnuplot -persist","w");
   if (pipe == NULL) {
     // Something went wrong.
@@ -13,21 +69,39 @@ void plotData( PlotInfo *pinfo, char *data_name, char *image_name )
     return;
   }
 
-  if (image_name) {
-    fprintf(pipe, "set terminal png\n");
-    fprintf(pipe, "set output '%s'\n", image_name);
+  plotTitle( pinfo, title, sizeof(title) );
+  plotWrite( pipe, title, data_name, image_name );
+  pclose( pipe );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+int plotDefer( PlotInfo *pinfo, const char *manifest, const char *data_name,
+               const char *image_name )
+{
+  char title[ PLOT_TITLE_LEN ];
+  char line[ 2 * FNAME_LEN + PLOT_TITLE_LEN + 8 ];
+  FILE *out;
+  int len;
+
+  plotTitle( pinfo, title, sizeof(title) );
+  len = snprintf( line, sizeof(line), "%s\t%s\t%s\n", image_name, data_name,
+                  title );
+  if (len >= (int) sizeof(line) || strchr( image_name, '\t' ) ||
+      strchr( data_name, '\t' )) {
+    fprintf( stderr, "Can't queue the plot of %s!\n", data_name );
+    return 0;
   }
 
-  fprintf( pipe, "set title \"Membrane Potential\\n"
-                 "Simulation time: %d ms, Integration step: %f ms,\\n"
-                 "Compartments: %d, Dendrites: %d, Execution time: %f s,\\n"
-                 "Slave processes: %d\"\n",
-           pinfo->sim_time, pinfo->int_step,
-           pinfo->num_comps, pinfo->num_dendrs,
-           pinfo->exec_time, pinfo->slaves );
-  fprintf( pipe, "set xlabel 'Time, ms'\n" );
-  fprintf( pipe, "set ylabel 'Vm, mV'\n" );
-  fprintf( pipe, "unset key\n" );
-  fprintf( pipe, "plot '%s' using 1:2 with lines\n", data_name );
-  pclose( pipe );
+  // The manifest is opened for appending and the line written in one go, so
+  // that lines from runs finishing together do not interleave.
+  if ((out = fopen( manifest, "a" )) == NULL) {
+    fprintf( stderr, "Can't open %s file!\n", manifest );
+    return 0;
+  }
+  setvbuf( out, NULL, _IONBF, 0 );
+  fwrite( line, 1, len, out );
+  fclose( out );
+
+  return 1;
 }
@@ -0,0 +1,225 @@
+#include "prec_guard.h"
+#include "lib_hh.h"
+#include "spikes.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Indices into the per-run arrays of the guard.
+#define RUN_MIXED  0
+#define RUN_SHADOW 1
+
+/**
+ * Name: recordCrossing
+ *
+ * Description:
+ * Records the time at which Vm crossed SPIKE_THRESHOLD upwards during the
+ * step ending at `t', if it did.
+ *
+ * Parameters:
+ * @param guard     (INOUT) guard
+ * @param run       (INPUT) RUN_MIXED or RUN_SHADOW
+ * @param t         (INPUT) simulated time at the end of the step, ms
+ * @param v         (INPUT) Vm at the end of the step
+ */
+static void recordCrossing( PrecGuard *guard, int run, double t, double v )
+{
+  double t_spike;
+
+  if (spikeCrossing( guard->v_prev[ run ], v, t, 1.0 / (double) STEPS,
+                     &t_spike ) &&
+      guard->num_spikes[ run ] < GUARD_MAX_SPIKES) {
+    guard->spikes[ run ][ guard->num_spikes[ run ]++ ] = t_spike;
+  }
+  guard->v_prev[ run ] = v;
+}
+
+/**
+ * Name: sampleDendrite
+ *
+ * Description:
+ * Returns the index of the `i'th sampled dendrite. The sample is spread evenly
+ * over all the dendrites and covers every one of them when there are no more
+ * than GUARD_SAMPLE.
+ *
+ * Parameters:
+ * @param guard     (INPUT) guard
+ * @param i         (INPUT) position in the sample
+ *
+ * Returns:
+ * @return int      dendrite index
+ */
+static int sampleDendrite( const PrecGuard *guard, int i )
+{
+  return (int) ((long) i * guard->num_dendrs / guard->sample);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+int precGuardOpen( PrecGuard *guard, int interval, int num_dendrs,
+                   int num_comps, double delta_t )
+{
+  guard->interval   = interval;
+  guard->active     = 0;
+  guard->num_dendrs = num_dendrs;
+  guard->num_comps  = num_comps;
+  guard->sample     = num_dendrs < GUARD_SAMPLE ? num_dendrs : GUARD_SAMPLE;
+  guard->shadow     = NULL;
+  guard->shadow_f   = NULL;
+  guard->checks     = 0;
+  guard->warnings   = 0;
+
+  guard->soma_params[0] = delta_t;
+  guard->soma_params[1] = 0.0;
+  guard->soma_params[2] = 0.0;
+
+  if (interval <= 0 || guard->sample == 0) {
+    return 1;
+  }
+
+  guard->shadow   = malloc( (size_t) guard->sample * num_comps *
+                            sizeof(double) );
+  guard->shadow_f = malloc( (size_t) guard->sample * num_comps *
+                            sizeof(float) );
+  if (guard->shadow == NULL || guard->shadow_f == NULL) {
+    fprintf( stderr, "Can't allocate the double precision shadow state!\n" );
+    precGuardClose( guard );
+    return 0;
+  }
+
+  return 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+void precGuardBegin( PrecGuard *guard, DendrStore *store, double *y,
+                     int t_ms )
+{
+  int i, comp;
+  size_t offset;
+  const float *volt;
+
+  if (guard->interval <= 0 || guard->shadow == NULL ||
+      (t_ms - 1) % guard->interval != 0) {
+    return;
+  }
+
+  // Restart the shadow from the mixed precision state of the sample, so that
+  // each check only measures the error accumulated during one millisecond.
+  for (i = 0; i < guard->sample; i++) {
+    volt   = dendrStoreRowF( store, sampleDendrite( guard, i ) );
+    offset = (size_t) i * guard->num_comps;
+    for (comp = 0; comp < guard->num_comps; comp++) {
+      guard->shadow[ offset + comp ]   = volt[ comp ];
+      guard->shadow_f[ offset + comp ] = volt[ comp ];
+    }
+  }
+  for (i = 0; i < NUMVAR; i++) {
+    guard->y[i] = y[i];
+  }
+
+  guard->active        = 1;
+  guard->max_dev       = 0.0;
+  guard->v_prev[0]     = y[0];
+  guard->v_prev[1]     = y[0];
+  guard->num_spikes[0] = 0;
+  guard->num_spikes[1] = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+void precGuardStep( PrecGuard *guard, int step, double t, double current,
+                    double v_m )
+{
+  int i, dendrite;
+  size_t offset;
+  double y0[NUMVAR], dydt[NUMVAR], *params = guard->soma_params;
+  double sum_double = 0.0, sum_float = 0.0;
+
+  if (!guard->active) {
+    return;
+  }
+
+  // Step the sample in both precisions, with the seeds of the main loop. The
+  // single precision copy repeats exactly what the main loop did for these
+  // dendrites, so the difference is their rounding error alone.
+  for (i = 0; i < guard->sample; i++) {
+    dendrite = sampleDendrite( guard, i );
+    offset   = (size_t) i * guard->num_comps;
+    sum_double += dendriteStep( guard->shadow + offset,
+                                step + dendrite + 1,
+                                guard->num_comps,
+                                params[0],
+                                guard->y[0] );
+    sum_float  += dendriteStepF( guard->shadow_f + offset,
+                                 step + dendrite + 1,
+                                 guard->num_comps,
+                                 params[0],
+                                 guard->v_prev[ RUN_MIXED ] );
+  }
+
+  // Correct the mixed precision current by the error of the sample, scaled
+  // up to all the dendrites.
+  params[2] = current + (sum_double - sum_float) *
+                        ((double) guard->num_dendrs / guard->sample);
+
+  y0[0] = guard->y[0]; y0[1] = guard->y[1];
+  y0[2] = guard->y[2]; y0[3] = guard->y[3];
+  soma(dydt, guard->y, params);
+  rk4Step(guard->y, y0, dydt, NUMVAR, params, 1, soma);
+
+  if (fabs( guard->y[0] - v_m ) > guard->max_dev) {
+    guard->max_dev = fabs( guard->y[0] - v_m );
+  }
+  recordCrossing( guard, RUN_MIXED, t, v_m );
+  recordCrossing( guard, RUN_SHADOW, t, guard->y[0] );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+void precGuardEnd( PrecGuard *guard, int t_ms )
+{
+  int i;
+  double spike_dev = 0.0;
+
+  if (!guard->active) {
+    return;
+  }
+  guard->active = 0;
+  guard->checks++;
+
+  if (guard->num_spikes[ RUN_MIXED ] != guard->num_spikes[ RUN_SHADOW ]) {
+    fprintf( stderr, "\nWARNING: mixed precision fired %d spike(s) at %d ms "
+                     "where double precision fired %d!\n",
+             guard->num_spikes[ RUN_MIXED ], t_ms,
+             guard->num_spikes[ RUN_SHADOW ] );
+    guard->warnings++;
+    return;
+  }
+
+  for (i = 0; i < guard->num_spikes[ RUN_MIXED ]; i++) {
+    double dev = fabs( guard->spikes[ RUN_MIXED ][i] -
+                       guard->spikes[ RUN_SHADOW ][i] );
+    if (dev > spike_dev) {
+      spike_dev = dev;
+    }
+  }
+
+  if (guard->max_dev > GUARD_VM_TOL || spike_dev > GUARD_SPIKE_TOL) {
+    fprintf( stderr, "\nWARNING: mixed precision deviates from double "
+                     "precision at %d ms: Vm by %f mV, spike times by %f ms!\n",
+             t_ms, guard->max_dev, spike_dev );
+    guard->warnings++;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+void precGuardClose( PrecGuard *guard )
+{
+  free( guard->shadow );
+  free( guard->shadow_f );
+  guard->shadow   = NULL;
+  guard->shadow_f = NULL;
+}
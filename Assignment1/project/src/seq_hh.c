@@ -7,13 +7,16 @@
 */
 
 #include "plot.h"
-#include "lib_hh.h"
+#include "hh_sim.h"
 #include "cmd_args.h"
 #include "constants.h"
+#include "phase_timer.h"
+#include "perf_counters.h"
 
 #include <time.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 
@@ -47,26 +50,40 @@ int main( int argc, char **argv )
 {
   CmdArgs cmd_args;                       // Command line arguments.
   int num_comps, num_dendrs;              // Simulation parameters.
-  int i, j, t_ms, step, dendrite;         // Various indexing variables.
+  int t_ms;                               // Various indexing variables.
   struct timeval start, stop, diff;       // Values used to measure time.
+  struct timeval loop_start;              // Start of the main computation.
 
   double exec_time;  // How long we take.
+  double loop_time;  // How long the main computation took.
+  double state_mb;   // Dendrite state moved by the main computation, in MB.
 
-  // Accumulators used during dendrite simulation.
-  // NOTE: We depend on the compiler to handle the use of double[] variables as
-  //       double*.
-  double current, **dendr_volt;
-  double res[COMPTIME], y[NUMVAR], y0[NUMVAR], dydt[NUMVAR], soma_params[3];
+  // The simulation and the soma Vm it produced at each millisecond.
+  HHConfig config;
+  HHSim *sim;
+  double res[COMPTIME];
+  int checks, warnings;  // Mixed precision accuracy checks.
 
   // Strings used to store filenames for the graph and data files.
   char time_str[14];
   char graph_fname[ FNAME_LEN ];
   char data_fname[ FNAME_LEN ];
+  char state_fname[ FNAME_LEN ];
+  char spike_fname[ FNAME_LEN ];
+  char phases_fname[ FNAME_LEN ];
 
   FILE *data_file;  // The output file where we store the soma potential values.
   FILE *graph_file; // File where graph will be saved.
+  FILE *spike_file; // The output file where we store the spike times.
+
+  int write_trace, write_spikes; // What the user asked us to write out.
+  int write_graph;               // Whether a PNG of the trace is plotted.
 
   PlotInfo pinfo;   // Info passed to the plotting functions.
+  PhaseTimes phases; // Where the time went, with '--timers'.
+  PerfCounters perf; // Hardware counters, with '--perf'.
+  PerfCounts loop_counts; // What the main computation counted.
+  Status status;     // Live progress for hh_top, with '--status'.
 
   //////////////////////////////////////////////////////////////////////////////
   // Parse command line arguments.
@@ -80,6 +97,9 @@ int main( int argc, char **argv )
   // Pull out the parameters so we don't need to type 'cmd_args.' all the time.
   num_dendrs = cmd_args.num_dendrs;
   num_comps  = cmd_args.num_comps;
+  write_trace  = (cmd_args.output & OUTPUT_TRACE) != 0;
+  write_spikes = (cmd_args.output & OUTPUT_SPIKES) != 0;
+  write_graph  = write_trace && ISDEF_PLOT_PNG && cmd_args.plot != PLOT_NONE;
 
   printf( "Simulating %d dendrites with %d compartments per dendrite.\n",
 		  num_dendrs, num_comps );
@@ -102,69 +122,110 @@ int main( int argc, char **argv )
 		   num_dendrs, num_comps, time_str );
   sprintf( data_fname,  "data/p1d%dc%d_%s.dat",
 		   num_dendrs, num_comps, time_str );
+  sprintf( spike_fname, "data/p1d%dc%d_%s.spk",
+		   num_dendrs, num_comps, time_str );
+  sprintf( phases_fname, "data/p1d%dc%d_%s.phases.json",
+		   num_dendrs, num_comps, time_str );
+  if (cmd_args.state_file[0] != '\0') {
+	strcpy( state_fname, cmd_args.state_file );
+  } else {
+	sprintf( state_fname, "data/p1d%dc%d_%s.state",
+			 num_dendrs, num_comps, time_str );
+  }
 
   // Verify that the graphs/ and data/ directories exist. Create them if they
   // don't.
   struct stat stat_buf;
-  stat( "graphs", &stat_buf );
-  if ((!S_ISDIR(stat_buf.st_mode)) && (mkdir( "graphs", 0700 ) != 0)) {
+  if ((stat( "graphs", &stat_buf ) != 0 || !S_ISDIR(stat_buf.st_mode)) &&
+	  (mkdir( "graphs", 0700 ) != 0)) {
 	fprintf( stderr, "Could not create 'graphs' directory!\n" );
 	exit(1);
   }
 
-  stat( "data", &stat_buf );
-  if ((!S_ISDIR(stat_buf.st_mode)) && (mkdir( "data", 0700 ) != 0)) {
+  if ((stat( "data", &stat_buf ) != 0 || !S_ISDIR(stat_buf.st_mode)) &&
+	  (mkdir( "data", 0700 ) != 0)) {
 	fprintf( stderr, "Could not create 'data' directory!\n" );
 	exit(1);
   }
   
   // Verify that we can open files where results will be stored.
-  if ((data_file = fopen(data_fname, "wb")) == NULL) {  
+  if (!write_trace) {
+	data_file = NULL;
+  } else if ((data_file = fopen(data_fname, "wb")) == NULL) {
 	fprintf(stderr, "Can't open %s file!\n", data_fname);
 	exit(1);
   } else {
 	printf( "\nData will be stored in %s\n", data_fname );
   }
-  
-  if (ISDEF_PLOT_PNG && (graph_file = fopen(graph_fname, "wb")) == NULL) {
+
+  if (!write_graph) {
+	// No graph to save.
+  } else if ((graph_file = fopen(graph_fname, "wb")) == NULL) {
 	fprintf(stderr, "Can't open %s file!\n", graph_fname);
 	exit(1);
   } else {
-	printf( "Graph will be stored in %s\n", graph_fname );
+	printf( "Graph will be %s %s\n",
+			cmd_args.plot == PLOT_DEFER ? "queued for" : "stored in", graph_fname );
 	fclose(graph_file);
   }
 
+  if (!write_spikes) {
+	spike_file = NULL;
+  } else if ((spike_file = fopen(spike_fname, "wb")) == NULL) {
+	fprintf(stderr, "Can't open %s file!\n", spike_fname);
+	exit(1);
+  } else {
+	printf( "Spikes will be stored in %s\n", spike_fname );
+  }
+
   //////////////////////////////////////////////////////////////////////////////
   // Initialize simulation parameters.
   //////////////////////////////////////////////////////////////////////////////
 
-  // The first compartment is a dummy and the last is connected to the soma.
-  num_comps = num_comps + 2;
-
-  // Initialize 'y' with precomputed values from the HH model.
-  y[0] = VREST;
-  y[1] = 0.037;
-  y[2] = 0.0148;
-  y[3] = 0.9959;
-
-  // Setup parameters for the soma.
-  soma_params[0] = 1.0 / (double) STEPS;  // dt
-  soma_params[1] = 0.0;  // Direct current injection into soma is always zero.
-  soma_params[2] = 0.0;  // Dendritic current injected into soma. This is the
-						 // value that our simulation will update at each step.
+  hh_config_default( &config );
+  config.num_dendrs     = num_dendrs;
+  config.num_comps      = num_comps;
+  config.storage        = cmd_args.storage;
+  config.state_file     = state_fname;
+  config.block_dendrs   = cmd_args.block_dendrs;
+  config.precision      = cmd_args.precision;
+  config.guard_interval = cmd_args.guard_interval;
+  config.spike_file     = spike_file;
+
+  // Every step is published for hh_top, if asked to.
+  if (cmd_args.status &&
+	  statusOpen( &status, 1, num_dendrs, num_comps, COMPTIME - 1 )) {
+	config.status = &status;
+	printf( "\nProgress is published in %s\n", status.name );
+  }
 
-  printf( "\nIntegration step dt = %f\n", soma_params[0]);
+  printf( "\nIntegration step dt = %f\n", 1.0 / (double) STEPS);
 
   // Start the clock.
   gettimeofday( &start, NULL );
+  if (cmd_args.timers && !phaseTimersStart()) {
+	cmd_args.timers = 0;
+  }
+
+  // Initialize the soma and the potential of each dendrite compartment to the
+  // rest voltage.
+  if ((sim = hh_sim_create( &config )) == NULL) {
+	exit(1);
+  }
 
-  // Initialize the potential of each dendrite compartment to the rest voltage.
-  dendr_volt = (double**) malloc( num_dendrs * sizeof(double*) );
-  for (i = 0; i < num_dendrs; i++) {
-	dendr_volt[i] = (double*) malloc( num_comps * sizeof(double) );
-	for (j = 0; j < num_comps; j++) {
-	  dendr_volt[i][j] = VREST;
+  if (cmd_args.precision == PREC_MIXED) {
+	printf( "Dendrite state is single precision" );
+	if (cmd_args.guard_interval > 0) {
+	  printf( ", checked against double precision every %d ms",
+			  cmd_args.guard_interval );
 	}
+	printf( "\n" );
+  }
+
+  if (cmd_args.storage == STORE_MMAP) {
+	printf( "Dendrite state (%zu MB) is mapped from %s, %d dendrites per "
+			"block\n", hh_sim_dendrites( sim )->bytes >> 20, state_fname,
+			hh_sim_dendrites( sim )->block_dendrs );
   }
 
   //////////////////////////////////////////////////////////////////////////////
@@ -172,43 +233,37 @@ int main( int argc, char **argv )
   //////////////////////////////////////////////////////////////////////////////
 
   // Record the initial potential value in our results array.
-  res[0] = y[0];
+  res[0] = hh_sim_soma( sim )[0];
+
+  gettimeofday( &loop_start, NULL );
+
+  if (cmd_args.perf) {
+	perfCountersOpen( &perf );
+	if (cmd_args.timers) {
+	  perfCountersByPhase( &perf );
+	}
+	perfCountersRead( &perf, &loop_counts );
+  }
 
   // Loop over milliseconds.
   for (t_ms = 1; t_ms < COMPTIME; t_ms++) {
-  
-    // Loop over integration time steps in each millisecond.
-	 for (step = 0; step < STEPS; step++) {
-	  soma_params[2] = 0.0;
-
-	  // Loop over all the dendrites.
-	  for (dendrite = 0; dendrite < num_dendrs; dendrite++) {
-		  // This will update Vm in all compartments and will give a new injected
-		  // current value from last compartment into the soma.
-		  current = dendriteStep( dendr_volt[ dendrite ],
-								step + dendrite + 1,
-								num_comps,
-								soma_params[0],
-								y[0] );
-
-		  // Accumulate the current generated by the dendrite.
-		  soma_params[2] += current;
-	  }
-
-	  // Store previous HH model parameters.
-	  y0[0] = y[0]; y0[1] = y[1]; y0[2] = y[2]; y0[3] = y[3];
-
-	  // This is the main HH computation. It updates the potential, Vm, of the
-	  // soma, injects current, and calculates action potential. Good stuff.
-	  soma(dydt, y, soma_params);
-	  rk4Step(y, y0, dydt, NUMVAR, soma_params, 1, soma);
-	}
+	hh_sim_advance( sim, STEPS );
 
 	// Record the membrane potential of the soma at this simulation step.
 	// Let's show where we are in terms of computation.
 	printf("\r%02d ms",t_ms); fflush(stdout);
 
-	res[t_ms] = y[0];
+	res[t_ms] = hh_sim_soma( sim )[0];
+  }
+
+  if (config.status != NULL) {
+	statusClose( config.status );
+  }
+
+  if (cmd_args.perf) {
+	PerfCounts end;
+	perfCountersRead( &perf, &end );
+	perfCountsDiff( &end, &loop_counts, &loop_counts );
   }
 
   //////////////////////////////////////////////////////////////////////////////
@@ -222,45 +277,98 @@ int main( int argc, char **argv )
   exec_time = (double) (diff.tv_sec) + (double) (diff.tv_usec) * 0.000001;
   printf("\n\nExecution time: %f seconds.\n", exec_time);
 
+  // Every step reads and writes back the whole dendrite state.
+  timersub( &stop, &loop_start, &diff );
+  loop_time = (double) (diff.tv_sec) + (double) (diff.tv_usec) * 0.000001;
+  state_mb  = 2.0 * (double) hh_sim_dendrites( sim )->bytes *
+			  (COMPTIME - 1) * STEPS / 1e6;
+  printf("Dendrite state bandwidth (%s): %f MB/s\n",
+		 cmd_args.storage == STORE_MMAP ? "mmap" : "mem", state_mb / loop_time);
+
+  PHASE_BEGIN( PHASE_OUTPUT );
+  if (write_spikes) {
+	spikeStatsReport( hh_sim_spikes( sim ), stdout, "", COMPTIME - 1 );
+	spikeStatsReport( hh_sim_spikes( sim ), spike_file, "# ", COMPTIME - 1 );
+	fclose( spike_file );
+  }
+
+  hh_sim_guard( sim, &checks, &warnings );
+  if (checks > 0) {
+	printf("Mixed precision checks: %d, out of tolerance: %d\n",
+		   checks, warnings);
+  }
+
+  if (cmd_args.perf) {
+	perfCountsPrint( stdout, "Main loop", &loop_counts,
+					 (double) num_dendrs * num_comps * (COMPTIME - 1) * STEPS );
+  }
+
   // Record the parameters for this simulation as well as data for gnuplot.
-  fprintf( data_file,
-		   "# Vm for HH model. "
-		   "Simulation time: %d ms, Integration step: %f ms, "
-		   "Compartments: %d, Dendrites: %d, Execution time: %f s, "
-		   "Slave processes: %d\n",
-		   COMPTIME, soma_params[0], num_comps - 2, num_dendrs, exec_time,
-		   0 );
-  fprintf( data_file, "# X Y\n");
-
-  for (t_ms = 0; t_ms < COMPTIME; t_ms++) {
-	fprintf(data_file, "%d %f\n", t_ms, res[t_ms]);
+  if (write_trace) {
+	fprintf( data_file,
+			 "# Vm for HH model. "
+			 "Simulation time: %d ms, Integration step: %f ms, "
+			 "Compartments: %d, Dendrites: %d, Execution time: %f s, "
+			 "Slave processes: %d\n",
+			 COMPTIME, 1.0 / (double) STEPS, num_comps, num_dendrs, exec_time,
+			 0 );
+	fprintf( data_file, "# X Y\n");
+
+	for (t_ms = 0; t_ms < COMPTIME; t_ms++) {
+	  fprintf(data_file, "%d %f\n", t_ms, res[t_ms]);
+	}
+	fflush(data_file);  // Flush and close the data file so that gnuplot will
+	fclose(data_file);  // see it.
+  }
+  PHASE_END( PHASE_OUTPUT );
+
+  // Report where the time went. Plotting is not timed, so that the split can
+  // go into the plot.
+  if (cmd_args.timers) {
+	phaseTimersCollect( &phases );
+	phaseTimersPrint( stdout, &phases, 1 );
+	if (phaseTimersWriteJson( phases_fname, &phases, 1 )) {
+	  printf( "Phase times stored in %s\n", phases_fname );
+	}
+  }
+  if (cmd_args.perf) {
+	if (cmd_args.timers) {
+	  perfCountersPrintPhases( stdout, &perf );
+	}
+	perfCountersClose( &perf );
   }
-  fflush(data_file);  // Flush and close the data file so that gnuplot will
-  fclose(data_file);  // see it.
 
   //////////////////////////////////////////////////////////////////////////////
   // Plot results if approriate macro was defined.
   //////////////////////////////////////////////////////////////////////////////
   if (ISDEF_PLOT_PNG || ISDEF_PLOT_SCREEN) {
 	pinfo.sim_time = COMPTIME;
-	pinfo.int_step = soma_params[0];
-	pinfo.num_comps = num_comps - 2;
+	pinfo.int_step = 1.0 / (double) STEPS;
+	pinfo.num_comps = num_comps;
 	pinfo.num_dendrs = num_dendrs;
 	pinfo.exec_time = exec_time;
 	pinfo.slaves = 0;
+	pinfo.phases = cmd_args.timers ? &phases : NULL;
   }
 
-  if (ISDEF_PLOT_PNG) {    plotData( &pinfo, data_fname, graph_fname ); }
-  if (ISDEF_PLOT_SCREEN) { plotData( &pinfo, data_fname, NULL ); }
+  // There is nothing to plot without a trace. Deferred plots are left to
+  // hh_plot.
+  if (write_graph && cmd_args.plot == PLOT_DEFER) {
+	if (plotDefer( &pinfo, PLOT_MANIFEST, data_fname, graph_fname )) {
+	  printf( "Plot queued in %s, render it with hh_plot\n", PLOT_MANIFEST );
+	}
+  } else if (write_graph) {
+	plotData( &pinfo, data_fname, graph_fname );
+  }
+  if (write_trace && ISDEF_PLOT_SCREEN && cmd_args.plot == PLOT_NOW) {
+	plotData( &pinfo, data_fname, NULL );
+  }
 
   //////////////////////////////////////////////////////////////////////////////
   // Free up allocated memory.
   //////////////////////////////////////////////////////////////////////////////
 
-  for(i = 0; i < num_dendrs; i++) {
-	free(dendr_volt[i]);
-  }
-  free(dendr_volt);
+  hh_sim_destroy( sim );
   
   return 0;
 }
@@ -0,0 +1,73 @@
+#include "spikes.h"
+
+#include <math.h>
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+void spikeStatsInit( SpikeStats *stats, FILE *events, double v0 )
+{
+  stats->events   = events;
+  stats->v_prev   = v0;
+  stats->count    = 0;
+  stats->first    = 0.0;
+  stats->last     = 0.0;
+  stats->isi_mean = 0.0;
+  stats->isi_m2   = 0.0;
+  stats->isi_min  = 0.0;
+  stats->isi_max  = 0.0;
+
+  if (events) {
+    fprintf( events, "# Soma spikes (upward crossings of %d mV)\n",
+             SPIKE_THRESHOLD );
+    fprintf( events, "# N T_ms\n" );
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+void spikeStatsAdd( SpikeStats *stats, double t )
+{
+  double isi, delta;
+
+  if (stats->count == 0) {
+    stats->first = t;
+  } else {
+    // Welford's update of the ISI mean and variance.
+    isi   = t - stats->last;
+    delta = isi - stats->isi_mean;
+    stats->isi_mean += delta / (double) stats->count;
+    stats->isi_m2   += delta * (isi - stats->isi_mean);
+
+    if (stats->count == 1 || isi < stats->isi_min) {
+      stats->isi_min = isi;
+    }
+    if (stats->count == 1 || isi > stats->isi_max) {
+      stats->isi_max = isi;
+    }
+  }
+
+  stats->last = t;
+  stats->count++;
+
+  if (stats->events) {
+    fprintf( stats->events, "%ld %f\n", stats->count, t );
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+void spikeStatsReport( const SpikeStats *stats, FILE *out, const char *prefix,
+                       double sim_time )
+{
+  long num_isi = stats->count - 1;
+  double isi_sd = num_isi > 1 ? sqrt( stats->isi_m2 / (num_isi - 1) ) : 0.0;
+
+  fprintf( out, "%sSpikes: %ld, firing rate: %f Hz\n", prefix, stats->count,
+           1000.0 * stats->count / sim_time );
+
+  if (num_isi > 0) {
+    fprintf( out, "%sISI mean: %f ms, sd: %f ms, CV: %f, min: %f ms, "
+                  "max: %f ms\n", prefix, stats->isi_mean, isi_sd,
+             isi_sd / stats->isi_mean, stats->isi_min, stats->isi_max );
+  }
+}
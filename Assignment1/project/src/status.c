@@ -0,0 +1,108 @@
+#include "status.h"
+#include "constants.h"
+
+#include <time.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/**
+ * Name: clockNs
+ *
+ * Description:
+ * Monotonic clock in nanoseconds.
+ */
+static double clockNs( void )
+{
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+int statusOpen( Status *status, int ranks, int num_dendrs, int num_comps,
+                int sim_ms )
+{
+  StatusShared *shared;
+  struct timespec now;
+  int fd;
+
+  memset( status, 0, sizeof(Status) );
+  snprintf( status->name, sizeof(status->name), "%s%d", STATUS_PREFIX,
+            (int) getpid() );
+
+  // A segment left behind by a crashed run with the same pid is stale.
+  shm_unlink( status->name );
+  fd = shm_open( status->name, O_CREAT | O_EXCL | O_RDWR, 0644 );
+  if (fd < 0 || ftruncate( fd, sizeof(StatusShared) ) != 0) {
+    fprintf( stderr, "Can't create status segment %s (%s)!\n", status->name,
+             strerror( errno ) );
+    if (fd >= 0) {
+      close( fd );
+      shm_unlink( status->name );
+    }
+    return 0;
+  }
+
+  shared = mmap( NULL, sizeof(StatusShared), PROT_READ | PROT_WRITE,
+                 MAP_SHARED, fd, 0 );
+  close( fd );
+  if (shared == MAP_FAILED) {
+    fprintf( stderr, "Can't map status segment %s!\n", status->name );
+    shm_unlink( status->name );
+    return 0;
+  }
+
+  clock_gettime( CLOCK_REALTIME, &now );
+  shared->version      = STATUS_VERSION;
+  shared->pid          = getpid();
+  shared->ranks        = ranks;
+  shared->num_dendrs   = num_dendrs;
+  shared->num_comps    = num_comps;
+  shared->sim_ms       = sim_ms;
+  shared->steps_per_ms = STEPS;
+  shared->started      = now.tv_sec + now.tv_nsec * 1e-9;
+
+  // The counters start at 0 (ftruncate zero-fills). Readers check the magic
+  // before trusting the fields above.
+  atomic_store_explicit( &shared->magic, STATUS_MAGIC, memory_order_release );
+
+  status->shared  = shared;
+  status->rate_ns = clockNs();
+  return 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+void statusRate( Status *status, int64_t step )
+{
+  double now = clockNs();
+
+  if (now > status->rate_ns) {
+    atomic_store_explicit( &status->shared->steps_per_sec,
+                           1e9 * (step - status->rate_step) /
+                           (now - status->rate_ns),
+                           memory_order_relaxed );
+  }
+  status->rate_step = step;
+  status->rate_ns   = now;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+void statusClose( Status *status )
+{
+  if (status->shared == NULL) {
+    return;
+  }
+
+  atomic_store_explicit( &status->shared->done, 1, memory_order_release );
+  munmap( status->shared, sizeof(StatusShared) );
+  shm_unlink( status->name );
+  status->shared = NULL;
+}
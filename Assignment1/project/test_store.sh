@@ -0,0 +1,90 @@
+#!/bin/bash
+#
+# Runs mpi_hh with every dendrite storage backend on more ranks than there are
+# dendrites, so that some ranks own no dendrites at all, and checks that
+#
+#   - every run finishes and reports its execution time,
+#   - every backend fires the same spikes as '-s mem',
+#   - no '-s mmap' state file is left behind.
+#
+# Then '--rebalance' is checked with the mmap store, which gets replaced when
+# dendrites move. With every dendrite alone on its rank there is nothing to
+# gain from moving them, so this uses a fixed problem of 9 dendrites of
+# differing compartment counts on 4 ranks, which the first rebalancing splits
+# anew.
+#
+# Runs write their spike files under the work directory; no traces or plots
+# are written.
+#
+# Usage: ./test_store.sh [-n RANKS] [-d DENDRITES] [-c COMPARTMENTS]
+#                        [-w WORK_DIR]
+#
+# Extra mpirun options (e.g. '--oversubscribe') can be passed in MPIRUN_ARGS.
+
+ranks=4
+dendrites=2
+comps=2
+work=test_store_runs
+
+while getopts "n:d:c:w:h" opt; do
+  case $opt in
+    n) ranks=$OPTARG ;;
+    d) dendrites=$OPTARG ;;
+    c) comps=$OPTARG ;;
+    w) work=$OPTARG ;;
+    *) sed -n '2,22p' "$0"; exit 1 ;;
+  esac
+done
+
+if [ "$ranks" -le "$dendrites" ]; then
+  echo "Need more ranks than dendrites, got $ranks and $dendrites!" >&2
+  exit 1
+fi
+
+bin=$(cd "$(dirname "$0")" && pwd)
+mkdir -p "$work" || exit 1
+cd "$work" || exit 1
+
+failed=0
+expected=""
+
+# Runs one configuration and compares its spikes with the '-s mem' ones.
+check() {
+  local out spikes
+  out=$(mpirun $MPIRUN_ARGS -np "$ranks" "$bin/mpi_hh" -d "$dendrites" \
+               -c "$comps" -o spikes --plot none "$@" 2>&1)
+  spikes=$(echo "$out" | grep '^Spikes:')
+
+  if ! echo "$out" | grep -q '^Execution time:'; then
+    echo "FAIL $*: run did not finish"
+    echo "$out" | tail -5 | sed 's/^/  /'
+    failed=1
+  elif [ -n "$expected" ] && [ "$spikes" != "$expected" ]; then
+    echo "FAIL $*: '$spikes', expected '$expected'"
+    failed=1
+  elif ls data/*.state.* >/dev/null 2>&1; then
+    echo "FAIL $*: state files left in data/"
+    rm -f data/*.state.*
+    failed=1
+  else
+    echo "ok   $*"
+  fi
+
+  [ -n "$expected" ] || expected=$spikes
+}
+
+echo "# $ranks ranks, $dendrites dendrites of $comps compartments"
+check -s mem
+check -s mmap
+check -s mmap -b 1
+check -s mem -m shm
+
+ranks=4
+dendrites=9
+comps=10
+expected=""
+echo "# $ranks ranks, $dendrites dendrites of about $comps compartments"
+check -s mem --comp-spread 0.8
+check -s mmap --comp-spread 0.8 --rebalance 30
+
+exit $failed
@@ -0,0 +1,18 @@
+#ifndef __ALLOCS_H__
+#define __ALLOCS_H__
+
+//Linking allocs.cpp into a program replaces the global operator new and
+//delete with ones that count the allocations of every thread, so that
+//the heap traffic of rendering a frame can be measured. Memory taken
+//with malloc directly, or by new with an alignment above the default, is
+//not counted.
+
+//This function returns how many allocations operator new has made since
+//the program started.
+//
+//Inputs: None
+//
+//Outputs: the number of allocations
+long allocationCount();
+
+#endif
@@ -0,0 +1,125 @@
+#ifndef __BVH_H__
+#define __BVH_H__
+
+#include <vector>
+
+#include "scene.h"
+#include "triangles.h"
+
+//Bins per axis when looking for the best split.
+#define BVH_BINS 16
+
+//A node with more primitives than this, or than the triangle kernel tests
+//at a time if that is more, is always split.
+#define BVH_MAX_LEAF 8
+
+//Deepest a node may be; it also bounds the traversal stack.
+#define BVH_MAX_DEPTH 64
+
+//1 + 2 * gamma(3), the bound on the relative rounding error of the slab
+//distances.
+#define BOX_ROUNDING 1.00000036f
+
+//A node of the hierarchy, 32 bytes. The two children of an inner node
+//are next to each other, so one index finds both.
+struct BVHNode
+{
+    float lower[3];         //Bounding box.
+    float upper[3];
+    int first;              //Inner node: the left child, the right one is
+                            //first + 1. Leaf: the first of its entries
+                            //in BVH::prims.
+    unsigned short count;   //Primitives in a leaf, 0 for an inner node.
+    unsigned short axis;    //Axis an inner node was split along.
+};
+
+//A bounding volume hierarchy over the triangles and spheres of a scene,
+//built with the surface area heuristic over BVH_BINS bins per axis.
+struct BVH
+{
+    std::vector<BVHNode> nodes;    //The root is nodes[0].
+    std::vector<int> prims;        //Primitives, in the order of the leaves.
+    TriangleSoA triangles;         //The triangles of prims, slot for slot.
+    int leaves;
+    int depth;
+};
+
+//The closest hit along a ray.
+struct Hit
+{
+    float t;      //Distance along the ray.
+    int prim;     //The primitive hit, -1 if nothing was.
+};
+
+//What tracing rays took, added up over the rays.
+struct TraceStats
+{
+    long rays;
+    long nodes;   //Nodes visited.
+    long prims;   //Primitives tested.
+};
+
+//This function builds the hierarchy of a scene. Subtrees of more than
+//a few thousand primitives are built on threads of their own.
+//
+//Inputs:
+//    scene - the scene.
+//    threads - the number of threads that may build, the caller included.
+//    bvh - set to the hierarchy.
+//
+//Outputs: None
+void buildBVH(const Scene* scene, int threads, BVH* bvh);
+
+//This function intersects a ray with one primitive.
+//
+//Inputs:
+//    scene - the scene.
+//    prim - the primitive.
+//    ray - the ray.
+//    tMax - only hits closer than this count.
+//    t - set to the distance of the hit.
+//
+//Outputs: true if the ray hits the primitive before tMax
+bool intersectPrimitive(const Scene* scene, int prim, const Ray& ray, float tMax, float* t);
+
+//This function finds the closest primitive a ray hits. The nearer child
+//is visited first, and nodes further away than the closest hit so far
+//are skipped. The triangles of a leaf are tested together by
+//intersectTriangles. Only the closest hit so far is kept, in a stack of
+//BVH_MAX_DEPTH nodes: tracing a ray allocates nothing.
+//
+//Inputs:
+//    scene - the scene.
+//    bvh - its hierarchy.
+//    ray - the ray.
+//    hit - set to the closest hit.
+//    stats - what the ray took is added here, may be NULL.
+//
+//Outputs: true if the ray hits anything
+bool traceClosest(const Scene* scene, const BVH* bvh, const Ray& ray, Hit* hit, TraceStats* stats);
+
+//This function finds whether a ray hits anything before a distance, for
+//shadow rays. It stops at the first hit, whichever it is.
+//
+//Inputs:
+//    scene - the scene.
+//    bvh - its hierarchy.
+//    ray - the ray.
+//    tMax - only hits closer than this count.
+//    stats - what the ray took is added here, may be NULL.
+//
+//Outputs: true if the ray hits anything before tMax
+bool traceAny(const Scene* scene, const BVH* bvh, const Ray& ray, float tMax, TraceStats* stats);
+
+//This function finds the closest primitive a ray hits by testing every
+//one of them, to check traceClosest against.
+//
+//Inputs:
+//    scene - the scene.
+//    ray - the ray.
+//    hit - set to the closest hit.
+//
+//Outputs: true if the ray hits anything
+bool traceBruteForce(const Scene* scene, const Ray& ray, Hit* hit);
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include "scene.h"
+#include "bvh.h"
+
+//Bumped whenever the layout of the file or of a record in it changes.
+#define SCENE_CACHE_VERSION 1
+
+//Every section of the file starts at a multiple of this, so that a
+//mapping of the file can be used in place.
+#define SCENE_CACHE_ALIGN 64
+
+//A scene cache holds a loaded scene and its hierarchy as they are in
+//memory, so that later runs skip parsing the configuration and .obj
+//files, applying the matrices and building the hierarchy. The file is a
+//header followed by sections, each an array of records:
+//
+//    header    magic "RTSCENE", SCENE_CACHE_VERSION, the triangle width the
+//              hierarchy was built for, the sizes of the records, the
+//              FNV-1a hash of the sources and the offset and size of every
+//              section
+//    sections  the source paths, the scene ID, the camera, the background,
+//              the lights, materials, triangles, spheres and their
+//              materials, the nodes, primitives and triangle arrays of the
+//              hierarchy
+//
+//Records are written as the compiler lays them out, so a cache is only
+//read by the same build on the same kind of machine; the sizes in the
+//header catch a build whose records differ.
+
+//This function loads a scene and its hierarchy from a cache, if the cache
+//can be used: it exists, has this version, triangle width and layout, was
+//made from the same configuration, and the hash of the contents of all
+//its sources is still the same. The file is mapped and its sections
+//copied out whole.
+//
+//Inputs:
+//    path - the path of the cache.
+//    config - the path of the configuration file, as given to -c.
+//    scene - set to the scene, if the cache is used.
+//    bvh - set to its hierarchy, if the cache is used.
+//
+//Outputs: true if the cache cannot be used; otherwise, false
+bool readSceneCache(const char* path, const char* config, Scene* scene, BVH* bvh);
+
+//This function writes a scene and its hierarchy to a cache. The file is
+//written under another name and renamed, so that another process never
+//reads half of it.
+//
+//Inputs:
+//    path - the path of the cache.
+//    scene - the scene, as loadScene loaded it.
+//    bvh - its hierarchy.
+//
+//Outputs: true if the cache could not be written; otherwise, false
+bool writeSceneCache(const char* path, const Scene* scene, const BVH* bvh);
+
+#endif
@@ -2,15 +2,17 @@
 #define __MASTER_PROCESS_H__
 
 #include "RayTrace.h"
+#include "options.h"
 
 //This function is the main that only the master process
 //will run.
 //
 //Inputs:
 //    data - the ConfigData that holds the scene information.
+//    options - our own options.
 //
 //Outputs: None
-void masterMain( ConfigData *data );
+void masterMain( ConfigData *data, const Options *options );
 
 //This function will perform ray tracing when no MPI use was
 //given.
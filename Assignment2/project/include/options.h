@@ -0,0 +1,24 @@
+#ifndef __OPTIONS_H__
+#define __OPTIONS_H__
+
+//Options of our own, on top of the ones initialize() understands.
+struct Options
+{
+    bool steal;    //--steal: use work stealing for -p dynamic.
+    int threads;   //--threads N: render threads per process.
+    bool allocs;   //--allocs: print the allocations rendering made.
+};
+
+//This function takes our own options out of the command line, so that
+//initialize() only sees the ones it knows. It must be called before
+//initialize().
+//
+//Inputs:
+//    argc - the number of command line arguments, updated.
+//    argv - the command line arguments, updated.
+//    options - set from the options found.
+//
+//Outputs: true if an option was given a bad value
+bool parseOptions(int* argc, char** argv, Options* options);
+
+#endif
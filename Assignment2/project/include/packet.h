@@ -0,0 +1,83 @@
+#ifndef __PACKET_H__
+#define __PACKET_H__
+
+#include "scene.h"
+#include "bvh.h"
+
+//Side of the square of pixels a packet of primary rays covers, unless it
+//is set otherwise.
+#define PACKET_SIDE 8
+
+//Most rays a packet may hold: a square of 16 x 16 pixels.
+#define PACKET_MAX_RAYS 256
+
+//Rays of a packet that are tested together, one per lane of an SSE
+//register. A packet holds a multiple of this.
+#define PACKET_LANES 4
+
+//Rays that are traced together, stored a coordinate per array so that
+//consecutive rays fill the lanes of a vector.
+struct RayPacket
+{
+    int count;
+    alignas(16) float ox[PACKET_MAX_RAYS];
+    alignas(16) float oy[PACKET_MAX_RAYS];
+    alignas(16) float oz[PACKET_MAX_RAYS];
+    alignas(16) float dx[PACKET_MAX_RAYS];
+    alignas(16) float dy[PACKET_MAX_RAYS];
+    alignas(16) float dz[PACKET_MAX_RAYS];
+};
+
+//The closest hit of every ray of a packet.
+struct PacketHits
+{
+    alignas(16) float t[PACKET_MAX_RAYS];
+    int prim[PACKET_MAX_RAYS];
+};
+
+//What tracing packets took, added up over the packets.
+struct PacketStats
+{
+    long packets;
+    long singles;   //Packets that diverged and were traced a ray at a time.
+    long nodes;     //Nodes visited by whole packets.
+    long culled;    //Of those, skipped by the frustum test alone.
+};
+
+//This function fills a packet with the primary rays of a square of
+//pixels, row by row. Pixels past the edge of the image repeat the last
+//one inside, so that a packet is always full.
+//
+//Inputs:
+//    camera - the camera of the scene.
+//    width - the width of the image.
+//    height - the height of the image.
+//    row - the top row of the square.
+//    col - the left column of the square.
+//    side - the side of the square; side * side is a multiple of
+//        PACKET_LANES and at most PACKET_MAX_RAYS.
+//    packet - set to the rays.
+//
+//Outputs: None
+void primaryPacket(const SceneCamera& camera, int width, int height, int row, int col, int side, RayPacket* packet);
+
+//This function finds the closest primitive every ray of a packet hits.
+//The packet goes down the hierarchy together: a node is skipped if the
+//interval of all the rays misses its box, and otherwise the rays are
+//tested against it a vector at a time and only those that hit it go on.
+//Leaves test every triangle against the rays in vectors too. Packets
+//whose directions do not all point the same way along each axis, and so
+//would not stay together, are traced a ray at a time with traceClosest.
+//
+//Inputs:
+//    scene - the scene.
+//    bvh - its hierarchy.
+//    packet - the rays.
+//    hits - set to the closest hit of every ray; t is INFINITY and prim is
+//        -1 where a ray hits nothing.
+//    stats - what the packet took is added here, may be NULL.
+//
+//Outputs: None
+void tracePacket(const Scene* scene, const BVH* bvh, const RayPacket* packet, PacketHits* hits, PacketStats* stats);
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef __REGIONS_H__
+#define __REGIONS_H__
+
+#include <vector>
+#include <mpi.h>
+
+#include "RayTrace.h"
+#include "tiles.h"
+
+//Largest chunk, in pixels, that a slave sends as soon as it is rendered.
+#define STREAM_CHUNK_PIXELS 16384
+
+//Under the static schemes every rank owns a fixed region of the image,
+//described as a list of tiles. A rank renders its tiles one after the
+//other, row by row, into a compact buffer, and the master receives that
+//buffer straight into the image through a datatype that scatters it to
+//the right pixels, so nobody needs a copy of the whole image. The buffer
+//is sent in chunks as it fills up.
+
+//This function returns the region a rank renders under the static
+//partitioning scheme of the scene:
+//    static_strips_horizontal - width / procs columns, all rows.
+//    static_blocks - one block of a grid of procs blocks.
+//    static_cycles_vertical - every procs-th band of cycleSize rows.
+//
+//Inputs:
+//    data - the ConfigData that holds the scene information.
+//    rank - the rank.
+//
+//Outputs: the tiles of the region, empty if the rank has no pixels.
+std::vector<Tile> regionTiles(const ConfigData* data, int rank);
+
+//This function returns the number of floats a region takes up in a
+//compact buffer.
+//
+//Inputs:
+//    tiles - the region.
+//
+//Outputs: the number of floats
+int regionSize(const std::vector<Tile>& tiles);
+
+//This function cuts a region into chunks of whole rows of its tiles,
+//of at most STREAM_CHUNK_PIXELS pixels unless a single row is longer.
+//The chunks cover the region in the same order as its compact buffer,
+//so they can be streamed one after the other.
+//
+//Inputs:
+//    tiles - the region.
+//
+//Outputs: the chunks, as tiles.
+std::vector<Tile> regionChunks(const std::vector<Tile>& tiles);
+
+//This function creates the datatype that puts the compact buffer of a
+//region in its place in the image. One tile gives a subarray of the
+//image; several give a list of the runs of pixels they cover.
+//
+//Inputs:
+//    data - the ConfigData that holds the scene information.
+//    tiles - the region, not empty.
+//
+//Outputs: the committed datatype, to be freed with MPI_Type_free
+MPI_Datatype regionType(const ConfigData* data, const std::vector<Tile>& tiles);
+
+#endif
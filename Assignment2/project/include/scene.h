@@ -0,0 +1,130 @@
+#ifndef __SCENE_H__
+#define __SCENE_H__
+
+#include <string>
+#include <vector>
+
+#include "vecmath.h"
+
+//Closest a hit may be to the origin of the ray, so that rays leaving a
+//surface do not hit it again.
+#define HIT_EPSILON 1e-4f
+
+//libraytrace keeps its scene to itself, so the in-tree acceleration code
+//reads the same configuration and .obj files into flat arrays of its own.
+//Meshes are flattened into their triangles and every matrix is applied
+//while loading, so the geometry is in world space.
+
+//The camera of a configuration, as its <Camera> element gives it.
+struct SceneCamera
+{
+    Vec3 eye;
+    Vec3 lookAt;
+    Vec3 up;
+    float frameWidth;
+    float frameHeight;
+    float focalDistance;
+};
+
+struct Triangle
+{
+    Vec3 a;
+    Vec3 b;
+    Vec3 c;
+};
+
+struct Sphere
+{
+    Vec3 center;
+    float radius;
+};
+
+//A point light, with the colors it lights with.
+struct SceneLight
+{
+    Vec3 position;
+    Color ambient;
+    Color diffuse;
+    Color specular;
+};
+
+//How a surface is lit: the material of its .mtl file combined with the
+//illumination model of its <Model>.
+struct Material
+{
+    Color ambient;        //Ka, times Ka of a PhongBlinn model.
+    Color diffuse;        //Kd, times Kd of a PhongBlinn model.
+    Color specular;       //Ks, times Ks of a PhongBlinn model.
+    Color reflective;     //Kr.
+    Color transmissive;   //Tf.
+    float shininess;      //Ns.
+    float refraction;     //Ni, the index of refraction.
+    float checkSize;      //Side of the squares of a CheckerBoardXZ model,
+    Color checks[2];      //whose two colors multiply ambient and diffuse;
+                          //0 for other models.
+};
+
+struct Ray
+{
+    Vec3 origin;
+    Vec3 direction;
+};
+
+//The geometry of a scene. Primitives are numbered with the triangles
+//first and the spheres after them.
+struct Scene
+{
+    std::string id;
+    SceneCamera camera;
+    Color background;
+    std::vector<SceneLight> lights;
+    std::vector<Material> materials;
+    std::vector<Triangle> triangles;
+    std::vector<Sphere> spheres;
+    std::vector<int> triangleMaterials;   //Index into materials, per triangle.
+    std::vector<int> sphereMaterials;     //And per sphere.
+    std::vector<std::string> sources;     //The files it was read from, the
+                                          //configuration first, missing
+                                          //ones included.
+};
+
+//This function loads the geometry, materials and lights of a scene.
+//
+//Inputs:
+//    config - the path of the configuration file, as given to -c.
+//    scene - filled in with the scene.
+//
+//Outputs: true if there was an error in the processing; otherwise, false
+bool loadScene(const char* config, Scene* scene);
+
+//This function returns the number of primitives of a scene.
+//
+//Inputs:
+//    scene - the scene.
+//
+//Outputs: the number of triangles and spheres
+int primitiveCount(const Scene* scene);
+
+//This function returns the material of a primitive.
+//
+//Inputs:
+//    scene - the scene.
+//    prim - the primitive.
+//
+//Outputs: the material
+const Material& materialOf(const Scene* scene, int prim);
+
+//This function returns the ray through the middle of a pixel, the same
+//ray Camera::renderPixel starts with when there is no supersampling.
+//
+//Inputs:
+//    camera - the camera of the scene.
+//    width - the width of the image.
+//    height - the height of the image.
+//    row - the row of the pixel.
+//    col - the column of the pixel.
+//
+//Outputs: the ray, with a direction of length 1
+Ray cameraRay(const SceneCamera& camera, int width, int height, int row, int col);
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef __SHADE_H__
+#define __SHADE_H__
+
+#include <cstddef>
+
+#include "scene.h"
+#include "bvh.h"
+
+//Bounces a ray may take after the primary one.
+#define SHADE_MAX_DEPTH 5
+
+//How far rays spawned at a surface start off it, relative to the size of
+//the coordinates there.
+#define SHADE_OFFSET 1e-4f
+
+//Side of the square tiles the wavefront renderer batches.
+#define WAVEFRONT_TILE 16
+
+//Tiles of a batch, unless it is set otherwise.
+#define WAVEFRONT_BATCH 16
+
+//Cells per axis of the grid over the scene that rays are sorted by.
+#define SORT_CELLS 16
+
+//What rendering an image took.
+struct ShadeStats
+{
+    long rays;          //Primary, reflected and refracted rays traced.
+    long shadowRays;
+    long batches;       //Wavefront only: batches of tiles rendered,
+    long peakRays;      //the most rays queued at once,
+    size_t peakBytes;   //and the most memory the queues held.
+};
+
+//This function renders an image with Whitted ray tracing, depth first:
+//every ray is shaded as soon as it hits, and the reflected and refracted
+//rays it spawns are traced before the next pixel is started.
+//
+//Inputs:
+//    scene - the scene.
+//    bvh - its hierarchy.
+//    width - the width of the image.
+//    height - the height of the image.
+//    pixels - set to the image, RGB, row by row.
+//    stats - what the image took is added here.
+//
+//Outputs: None
+void renderRecursive(const Scene* scene, const BVH* bvh, int width, int height, float* pixels, ShadeStats* stats);
+
+//This function renders the same image a bounce at a time over batches of
+//tiles. All the rays of a bounce are queued, sorted by the cell of their
+//origin and the octant of their direction, and intersected together;
+//shading them is a stage of its own that queues the shadow rays and the
+//rays of the next bounce. The queues hold the rays of one batch, so their
+//memory is bounded by the size of the batch.
+//
+//Inputs:
+//    scene - the scene.
+//    bvh - its hierarchy.
+//    width - the width of the image.
+//    height - the height of the image.
+//    batch - tiles of WAVEFRONT_TILE x WAVEFRONT_TILE pixels per batch.
+//    pixels - set to the image, RGB, row by row.
+//    stats - what the image took is added here.
+//
+//Outputs: None
+void renderWavefront(const Scene* scene, const BVH* bvh, int width, int height, int batch, float* pixels,
+                     ShadeStats* stats);
+
+#endif
@@ -2,7 +2,8 @@
 #define __SLAVE_PROCESS_H__
 
 #include "RayTrace.h"
+#include "options.h"
 
-void slaveMain( ConfigData *data );
+void slaveMain( ConfigData *data, const Options *options );
 
 #endif
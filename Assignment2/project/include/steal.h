@@ -0,0 +1,39 @@
+#ifndef __STEAL_H__
+#define __STEAL_H__
+
+#include "RayTrace.h"
+
+//Message tags of work stealing, after the ones in tiles.h.
+#define MPI_STEAL_TAG     5    //Thief asks for work, no data.
+#define MPI_LOOT_TAG      6    //Victim answers, a range of tiles (2 ints).
+#define MPI_TOKEN_TAG     7    //Termination token, tiles counted (1 int).
+#define MPI_TERMINATE_TAG 8    //Every tile is done, no data.
+
+//What a rank did during a work stealing render.
+struct StealStats
+{
+    int tiles;                 //Tiles rendered.
+    int steals;                //Steal requests that brought back tiles.
+    int attempts;              //Steal requests sent.
+    double computationTime;    //Seconds spent shading.
+    double idleTime;           //Seconds spent without a tile to render.
+};
+
+//This function renders the image with work stealing; every rank calls
+//it. The tiles of tiles.h start out split into one contiguous range per
+//rank, so that neighbouring tiles are rendered by the same rank. A rank
+//renders its range from the front; once it is empty, it asks random
+//ranks for work until one gives it the back half of its range. A token
+//passed around the ring by idle ranks adds up the tiles they rendered;
+//when rank 0 finds they add up to all of the tiles, it tells everyone to
+//stop. The tiles are then received straight into the image on rank 0.
+//
+//Inputs:
+//    data - the ConfigData that holds the scene information.
+//    pixels - the image on rank 0, NULL on the other ranks.
+//    stats - set to what this rank did.
+//
+//Outputs: None
+void renderStealing(ConfigData* data, float* pixels, StealStats* stats);
+
+#endif
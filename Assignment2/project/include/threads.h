@@ -0,0 +1,68 @@
+#ifndef __THREADS_H__
+#define __THREADS_H__
+
+#include "RayTrace.h"
+#include "tiles.h"
+
+//Edge, in pixels, of the sub-tiles the render threads share out.
+#define RENDER_TILE_SIZE 16
+
+//Rendering on several threads relies on what shadePixel touches. It was
+//checked on objs/x86_64/libraytrace.a as follows (see README.txt,
+//THREADS, for the commands):
+//  - The library has no writable globals besides the static strings of
+//    Camera, which are only read when saving.
+//  - Along shadePixel -> Camera::renderPixel(SuperSampling) ->
+//    World::spawnRay -> the hit() of the objects and the illumination
+//    models, stores go to the stack (the hit records and shade record
+//    are locals) or to the output pixel, with two exceptions:
+//  - TriangleMesh::hit keeps the nearest triangle it found in the mesh,
+//    and TriangleMesh::getNormal reads it back when shading; it also
+//    builds the bounding box of the mesh on its first call. A World can
+//    therefore not be shared: two threads hitting the same mesh get each
+//    other's normals. Every worker loads a scene of its own from the same
+//    arguments instead, and only the caller uses the ConfigData it passes
+//    in.
+//  - rand(), which supersampling calls twice per sample. With Size="1"
+//    the result is thrown away, but glibc's rand() still takes a
+//    process-wide lock. threads.cpp gives every thread its own rand()
+//    state instead, so threads neither contend nor race on it.
+//Rendering with any number of threads gives the same image as
+//raytrace_seq.
+
+//This function starts the render threads and loads a scene for each of
+//them. With 1 thread (the default) everything is rendered on the calling
+//thread and no thread is started.
+//
+//Inputs:
+//    threads - the number of threads rendering, the caller included.
+//    argc - the number of arguments initialize() was given.
+//    argv - the arguments initialize() was given.
+//
+//Outputs: true if a scene could not be loaded; otherwise, false
+bool startRenderThreads(int threads, int argc, char** argv);
+
+//This function stops the render threads and frees their scenes.
+//
+//Inputs: None
+//
+//Outputs: None
+void stopRenderThreads();
+
+//This function renders a rectangle of the image on the render threads;
+//the caller renders too. The rectangle is cut into sub-tiles of
+//RENDER_TILE_SIZE pixels, dealt out in one contiguous run per thread.
+//Each thread renders its sub-tiles into a buffer of its own and copies
+//them out, and a thread that runs out steals the back half of the run
+//of another one.
+//
+//Inputs:
+//    data - the ConfigData that holds the scene information.
+//    area - the rectangle to render.
+//    pixels - where pixel (area.row, area.col) goes, 3 floats per pixel.
+//    stride - the pixels from one row of `pixels' to the next.
+//
+//Outputs: None
+void renderArea(ConfigData* data, const Tile& area, float* pixels, int stride);
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef __TILES_H__
+#define __TILES_H__
+
+#include "RayTrace.h"
+
+//Message tags of the dynamic partitioning. MPI_BUFFER_TAG (1) is
+//left to the static schemes.
+#define MPI_REQUEST_TAG 2    //Worker asks for a tile, no data.
+#define MPI_TILE_TAG    3    //Master hands out a tile, one int (-1 = stop).
+#define MPI_RESULT_TAG  4    //Worker returns the pixels of its oldest tile.
+
+//Number of tile requests every worker keeps outstanding, so that it
+//already holds its next tile while the master is busy rendering.
+#define TILES_IN_FLIGHT 2
+
+//A rectangle of the image. Tiles are numbered row by row, left to
+//right, in steps of dynamicBlockWidth x dynamicBlockHeight; the
+//tiles on the right and bottom edges may be smaller.
+struct Tile
+{
+    int row;       //First row.
+    int col;       //First column.
+    int height;    //Rows in the tile.
+    int width;     //Columns in the tile.
+};
+
+//This function returns the number of tiles the image is cut into.
+//
+//Inputs:
+//    data - the ConfigData that holds the scene information.
+//
+//Outputs: the number of tiles
+int tileCount(const ConfigData* data);
+
+//This function returns the bounds of a tile.
+//
+//Inputs:
+//    data - the ConfigData that holds the scene information.
+//    index - the number of the tile, from 0 to tileCount(data) - 1.
+//
+//Outputs: the tile
+Tile tileBounds(const ConfigData* data, int index);
+
+//This function shades the pixels of a tile into a buffer that holds
+//only that tile, 3 floats per pixel, row by row, on the render threads.
+//
+//Inputs:
+//    data - the ConfigData that holds the scene information.
+//    tile - the tile to render.
+//    buffer - at least 3 * tile.width * tile.height floats.
+//
+//Outputs: None
+void renderTile(ConfigData* data, const Tile& tile, float* buffer);
+
+//This function copies a tile rendered by renderTile into the image.
+//
+//Inputs:
+//    data - the ConfigData that holds the scene information.
+//    tile - the tile in the buffer.
+//    buffer - the pixels of the tile.
+//    pixels - the whole image, 3 floats per pixel.
+//
+//Outputs: None
+void storeTile(const ConfigData* data, const Tile& tile, const float* buffer, float* pixels);
+
+#endif
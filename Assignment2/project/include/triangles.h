@@ -0,0 +1,80 @@
+#ifndef __TRIANGLES_H__
+#define __TRIANGLES_H__
+
+#include <vector>
+
+#include "scene.h"
+
+//Slots past the last one that are always there, so that the widest
+//kernel can load a whole vector at any slot.
+#define TRIANGLE_PADDING 16
+
+//The triangles of a scene in the order of the leaves of its hierarchy,
+//as a structure of arrays: one array per coordinate of the first corner
+//and of the two edges leaving it, so that a kernel loads the same
+//coordinate of consecutive triangles with one instruction. Slot i holds
+//the primitive BVH::prims[i]; the slots of spheres hold a degenerate
+//triangle that nothing hits.
+struct TriangleSoA
+{
+    std::vector<float> x;     //First corner.
+    std::vector<float> y;
+    std::vector<float> z;
+    std::vector<float> e1x;   //Second corner - first corner.
+    std::vector<float> e1y;
+    std::vector<float> e1z;
+    std::vector<float> e2x;   //Third corner - first corner.
+    std::vector<float> e2y;
+    std::vector<float> e2z;
+};
+
+//This function fills the structure of arrays of a scene.
+//
+//Inputs:
+//    scene - the scene.
+//    prims - the primitive of every slot.
+//    soa - set to the triangles.
+//
+//Outputs: None
+void fillTriangleSoA(const Scene* scene, const std::vector<int>& prims, TriangleSoA* soa);
+
+//This function finds the closest triangle a ray hits among slots
+//[begin, end), with the Moller-Trumbore test. The kernel used tests 1, 4
+//(SSE2), 8 (AVX2) or 16 (AVX-512F) triangles at a time; by default it is
+//the widest the processor runs. Every width rounds exactly like
+//intersectPrimitive, so they all find the same hit.
+//
+//Inputs:
+//    soa - the triangles.
+//    begin - the first slot.
+//    end - one past the last slot.
+//    ray - the ray.
+//    tMax - only hits closer than this count.
+//    t - set to the distance of the hit.
+//
+//Outputs: the slot of the closest hit, or -1 if there is none
+int intersectTriangles(const TriangleSoA* soa, int begin, int end, const Ray& ray, float tMax, float* t);
+
+//This function returns the widest kernel the processor can run.
+//
+//Inputs: None
+//
+//Outputs: 16, 8, 4 or 1
+int widestTriangleWidth();
+
+//This function returns the width of the kernel intersectTriangles uses.
+//
+//Inputs: None
+//
+//Outputs: 16, 8, 4 or 1
+int triangleWidth();
+
+//This function picks the kernel intersectTriangles uses.
+//
+//Inputs:
+//    width - 1, 4, 8 or 16.
+//
+//Outputs: true if the processor cannot run that width; otherwise, false
+bool setTriangleWidth(int width);
+
+#endif
@@ -0,0 +1,292 @@
+#ifndef __VECMATH_H__
+#define __VECMATH_H__
+
+#include <cmath>
+
+//The vector and matrix math of the in-tree code. libraytrace's Point3,
+//Vector3, Color and Matrix44 are out-of-line calls, many of them through
+//non-const references; everything here is inline, and constexpr where the
+//standard library allows it, so that the compiler sees through it and can
+//fold constants.
+//
+//Vec3 is the packed storage of geometry: 12 bytes, so that triangles and
+//rays stay small. A Vec4 is 4 floats, 16 byte aligned, and a Mat4 is 4
+//such columns; both use SSE when the compiler targets it, unless
+//VECMATH_NO_SSE is defined. Both round exactly alike: the SSE code does
+//the same operations in the same order as the scalar code, a lane at a
+//time.
+#if defined(__SSE2__) && !defined(VECMATH_NO_SSE)
+#define VECMATH_SSE
+#include <emmintrin.h>
+#endif
+
+//A point or direction of the in-tree geometry.
+struct Vec3
+{
+    float x;
+    float y;
+    float z;
+};
+
+//Four floats that load as one SSE register.
+struct alignas(16) Vec4
+{
+    float x;
+    float y;
+    float z;
+    float w;
+};
+
+//An RGB color; w is not used and kept 0.
+typedef Vec4 Color;
+
+//A matrix that transforms column vectors, stored by column, so that
+//transforming a vector adds up the columns scaled by its coordinates.
+struct Mat4
+{
+    Vec4 columns[4];
+};
+
+constexpr Vec3 makeVec3(float x, float y, float z)
+{
+    return Vec3{ x, y, z };
+}
+
+constexpr Vec3 operator+(const Vec3& a, const Vec3& b)
+{
+    return makeVec3(a.x + b.x, a.y + b.y, a.z + b.z);
+}
+
+constexpr Vec3 operator-(const Vec3& a, const Vec3& b)
+{
+    return makeVec3(a.x - b.x, a.y - b.y, a.z - b.z);
+}
+
+constexpr Vec3 operator*(const Vec3& a, float s)
+{
+    return makeVec3(a.x * s, a.y * s, a.z * s);
+}
+
+constexpr float dot(const Vec3& a, const Vec3& b)
+{
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+constexpr Vec3 cross(const Vec3& a, const Vec3& b)
+{
+    return makeVec3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+}
+
+inline Vec3 normalize(const Vec3& a)
+{
+    return a * (1.0f / sqrtf(dot(a, a)));
+}
+
+constexpr float component(const Vec3& a, int axis)
+{
+    return axis == 0 ? a.x : (axis == 1 ? a.y : a.z);
+}
+
+inline Vec3 vmin(const Vec3& a, const Vec3& b)
+{
+    return makeVec3(fminf(a.x, b.x), fminf(a.y, b.y), fminf(a.z, b.z));
+}
+
+inline Vec3 vmax(const Vec3& a, const Vec3& b)
+{
+    return makeVec3(fmaxf(a.x, b.x), fmaxf(a.y, b.y), fmaxf(a.z, b.z));
+}
+
+constexpr Vec4 makeVec4(float x, float y, float z, float w)
+{
+    return Vec4{ x, y, z, w };
+}
+
+constexpr Vec4 toVec4(const Vec3& a, float w)
+{
+    return makeVec4(a.x, a.y, a.z, w);
+}
+
+constexpr Vec3 toVec3(const Vec4& a)
+{
+    return makeVec3(a.x, a.y, a.z);
+}
+
+constexpr Color makeColor(float r, float g, float b)
+{
+    return makeVec4(r, g, b, 0.0f);
+}
+
+//The SSE code only runs outside of constant expressions, which it cannot
+//be part of.
+#ifdef VECMATH_SSE
+#define VECMATH_RUNTIME (!__builtin_is_constant_evaluated())
+
+inline __m128 loadVec4(const Vec4& a)
+{
+    return _mm_load_ps(&a.x);
+}
+
+inline Vec4 storeVec4(__m128 v)
+{
+    Vec4 a;
+    _mm_store_ps(&a.x, v);
+    return a;
+}
+#endif
+
+constexpr Vec4 operator+(const Vec4& a, const Vec4& b)
+{
+#ifdef VECMATH_SSE
+    if( VECMATH_RUNTIME )
+    {
+        return storeVec4(_mm_add_ps(loadVec4(a), loadVec4(b)));
+    }
+#endif
+    return makeVec4(a.x + b.x, a.y + b.y, a.z + b.z, a.w + b.w);
+}
+
+constexpr Vec4 operator-(const Vec4& a, const Vec4& b)
+{
+#ifdef VECMATH_SSE
+    if( VECMATH_RUNTIME )
+    {
+        return storeVec4(_mm_sub_ps(loadVec4(a), loadVec4(b)));
+    }
+#endif
+    return makeVec4(a.x - b.x, a.y - b.y, a.z - b.z, a.w - b.w);
+}
+
+constexpr Vec4 operator*(const Vec4& a, float s)
+{
+#ifdef VECMATH_SSE
+    if( VECMATH_RUNTIME )
+    {
+        return storeVec4(_mm_mul_ps(loadVec4(a), _mm_set1_ps(s)));
+    }
+#endif
+    return makeVec4(a.x * s, a.y * s, a.z * s, a.w * s);
+}
+
+//Component by component, for colors.
+constexpr Vec4 operator*(const Vec4& a, const Vec4& b)
+{
+#ifdef VECMATH_SSE
+    if( VECMATH_RUNTIME )
+    {
+        return storeVec4(_mm_mul_ps(loadVec4(a), loadVec4(b)));
+    }
+#endif
+    return makeVec4(a.x * b.x, a.y * b.y, a.z * b.z, a.w * b.w);
+}
+
+//Of x, y and z only, like the dot of a Vec3.
+constexpr float dot(const Vec4& a, const Vec4& b)
+{
+#ifdef VECMATH_SSE
+    if( VECMATH_RUNTIME )
+    {
+        __m128 products = _mm_mul_ps(loadVec4(a), loadVec4(b));
+        __m128 sum = _mm_add_ss(products, _mm_shuffle_ps(products, products, _MM_SHUFFLE(1, 1, 1, 1)));
+        sum = _mm_add_ss(sum, _mm_shuffle_ps(products, products, _MM_SHUFFLE(2, 2, 2, 2)));
+        return _mm_cvtss_f32(sum);
+    }
+#endif
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+//Of x, y and z; w is 0.
+constexpr Vec4 cross(const Vec4& a, const Vec4& b)
+{
+#ifdef VECMATH_SSE
+    if( VECMATH_RUNTIME )
+    {
+        __m128 va = loadVec4(a);
+        __m128 vb = loadVec4(b);
+        __m128 left = _mm_mul_ps(_mm_shuffle_ps(va, va, _MM_SHUFFLE(3, 0, 2, 1)),
+                                 _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(3, 1, 0, 2)));
+        __m128 right = _mm_mul_ps(_mm_shuffle_ps(va, va, _MM_SHUFFLE(3, 1, 0, 2)),
+                                  _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(3, 0, 2, 1)));
+        __m128 c = _mm_sub_ps(left, right);
+        return storeVec4(_mm_and_ps(c, _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1))));
+    }
+#endif
+    return makeVec4(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x, 0.0f);
+}
+
+//To a length of 1 over x, y and z; w is scaled alike.
+inline Vec4 normalize(const Vec4& a)
+{
+    return a * (1.0f / sqrtf(dot(a, a)));
+}
+
+constexpr Mat4 identityMatrix()
+{
+    return Mat4{ { makeVec4(1.0f, 0.0f, 0.0f, 0.0f), makeVec4(0.0f, 1.0f, 0.0f, 0.0f),
+                   makeVec4(0.0f, 0.0f, 1.0f, 0.0f), makeVec4(0.0f, 0.0f, 0.0f, 1.0f) } };
+}
+
+constexpr Mat4 scaleMatrix(const Vec3& s)
+{
+    return Mat4{ { makeVec4(s.x, 0.0f, 0.0f, 0.0f), makeVec4(0.0f, s.y, 0.0f, 0.0f),
+                   makeVec4(0.0f, 0.0f, s.z, 0.0f), makeVec4(0.0f, 0.0f, 0.0f, 1.0f) } };
+}
+
+constexpr Mat4 translateMatrix(const Vec3& t)
+{
+    return Mat4{ { makeVec4(1.0f, 0.0f, 0.0f, 0.0f), makeVec4(0.0f, 1.0f, 0.0f, 0.0f),
+                   makeVec4(0.0f, 0.0f, 1.0f, 0.0f), makeVec4(t.x, t.y, t.z, 1.0f) } };
+}
+
+constexpr Vec4 operator*(const Mat4& m, const Vec4& v)
+{
+#ifdef VECMATH_SSE
+    if( VECMATH_RUNTIME )
+    {
+        __m128 vv = loadVec4(v);
+        __m128 sum = _mm_mul_ps(loadVec4(m.columns[0]), _mm_shuffle_ps(vv, vv, _MM_SHUFFLE(0, 0, 0, 0)));
+        sum = _mm_add_ps(sum, _mm_mul_ps(loadVec4(m.columns[1]), _mm_shuffle_ps(vv, vv, _MM_SHUFFLE(1, 1, 1, 1))));
+        sum = _mm_add_ps(sum, _mm_mul_ps(loadVec4(m.columns[2]), _mm_shuffle_ps(vv, vv, _MM_SHUFFLE(2, 2, 2, 2))));
+        sum = _mm_add_ps(sum, _mm_mul_ps(loadVec4(m.columns[3]), _mm_shuffle_ps(vv, vv, _MM_SHUFFLE(3, 3, 3, 3))));
+        return storeVec4(sum);
+    }
+#endif
+    return m.columns[0] * v.x + m.columns[1] * v.y + m.columns[2] * v.z + m.columns[3] * v.w;
+}
+
+//b first, then a.
+constexpr Mat4 operator*(const Mat4& a, const Mat4& b)
+{
+    return Mat4{ { a * b.columns[0], a * b.columns[1], a * b.columns[2], a * b.columns[3] } };
+}
+
+//The coordinates go to the lanes straight from the Vec3: a Vec4 stored
+//a float at a time and loaded whole would stall the load.
+constexpr Vec3 transformPoint(const Mat4& m, const Vec3& p)
+{
+#ifdef VECMATH_SSE
+    if( VECMATH_RUNTIME )
+    {
+        __m128 sum = _mm_mul_ps(loadVec4(m.columns[0]), _mm_set1_ps(p.x));
+        sum = _mm_add_ps(sum, _mm_mul_ps(loadVec4(m.columns[1]), _mm_set1_ps(p.y)));
+        sum = _mm_add_ps(sum, _mm_mul_ps(loadVec4(m.columns[2]), _mm_set1_ps(p.z)));
+        return toVec3(storeVec4(_mm_add_ps(sum, loadVec4(m.columns[3]))));
+    }
+#endif
+    return toVec3(m.columns[0] * p.x + m.columns[1] * p.y + m.columns[2] * p.z + m.columns[3]);
+}
+
+constexpr Vec3 transformDirection(const Mat4& m, const Vec3& d)
+{
+#ifdef VECMATH_SSE
+    if( VECMATH_RUNTIME )
+    {
+        __m128 sum = _mm_mul_ps(loadVec4(m.columns[0]), _mm_set1_ps(d.x));
+        sum = _mm_add_ps(sum, _mm_mul_ps(loadVec4(m.columns[1]), _mm_set1_ps(d.y)));
+        return toVec3(storeVec4(_mm_add_ps(sum, _mm_mul_ps(loadVec4(m.columns[2]), _mm_set1_ps(d.z)))));
+    }
+#endif
+    return toVec3(m.columns[0] * d.x + m.columns[1] * d.y + m.columns[2] * d.z);
+}
+
+#endif
@@ -64,3 +64,7 @@ module load openmpi
 # srun --mem-per-cpu=2G -n 64 raytrace_mpi -h 5000 -w 5000 -c configs/twhitted.xml -p static_blocks 
 # Dynamic
 # srun --mem-per-cpu=2G -n $SLURM_NPROCS raytrace_mpi -h 100 -w 100 -c configs/twhitted.xml -p dynamic -bh 1 -bw 1 
+# Work Stealing
+# srun --mem-per-cpu=2G -n $SLURM_NPROCS raytrace_mpi -h 100 -w 100 -c configs/twhitted.xml -p dynamic -bh 10 -bw 10 --steal
+# Threads (one rank per node, -c cores each)
+# srun --mem-per-cpu=2G -n $SLURM_NNODES -c 16 raytrace_mpi -h 5000 -w 5000 -c configs/box.xml -p dynamic -bh 50 -bw 50 --threads 16
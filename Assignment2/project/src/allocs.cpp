@@ -0,0 +1,87 @@
+//This file contains the replacements of the global operator new and
+//delete that count allocations.
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include "allocs.h"
+
+//Allocations made so far. Only the total matters, so the threads need
+//not order their updates.
+static std::atomic<long> allocations(0);
+
+//Primatives
+static void* allocate(std::size_t size);
+
+//This function allocates memory and counts it.
+//
+//Inputs:
+//    size - the size of the memory, in bytes.
+//
+//Outputs: the memory, or NULL if there is none
+static void* allocate(std::size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return malloc(size == 0 ? 1 : size);
+}
+
+long allocationCount()
+{
+    return allocations.load(std::memory_order_relaxed);
+}
+
+void* operator new(std::size_t size)
+{
+    void* memory = allocate(size);
+    if( memory == NULL )
+    {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+void* operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    return allocate(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+    return allocate(size);
+}
+
+void operator delete(void* memory) noexcept
+{
+    free(memory);
+}
+
+void operator delete[](void* memory) noexcept
+{
+    free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept
+{
+    free(memory);
+}
+
+void operator delete[](void* memory, std::size_t) noexcept
+{
+    free(memory);
+}
+
+void operator delete(void* memory, const std::nothrow_t&) noexcept
+{
+    free(memory);
+}
+
+void operator delete[](void* memory, const std::nothrow_t&) noexcept
+{
+    free(memory);
+}
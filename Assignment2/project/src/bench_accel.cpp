@@ -0,0 +1,566 @@
+//This file contains bench_accel, the microbenchmarks of the kernels of the
+//in-tree acceleration code.
+//
+//The triangle kernel is timed over a grid of batch sizes: the number of
+//triangles one call tests. The vector math of vecmath.h (dot, cross,
+//normalize and transform) is timed over arrays of BENCH_VECTORS vectors,
+//three ways: through calls the compiler cannot see into, as libraytrace's
+//Vector3 and Matrix44 are, inline on Vec3 and inline on Vec4. After a few
+//warmup samples each configuration is sampled repeatedly and the median
+//and 10th/90th percentiles are reported as CSV, one line per
+//configuration:
+//
+//    kernel,width,batch,samples,ns_p10,ns_median,ns_p90,mops,speedup
+//
+//ns_* are nanoseconds per triangle tested or vector operation, mops the
+//millions of them per second at the median and speedup the median of the
+//baseline over this one's. The baseline is the 1 wide triangle kernel, and
+//the out-of-line calls (kernel "<op>-call", width 3) for the math; the
+//width of the math is that of the vector type.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "scene.h"
+#include "triangles.h"
+#include "vecmath.h"
+
+//Shortest a sample may be; rounds are repeated within a sample until it
+//lasts at least this long so that the clock resolution does not matter.
+#define MIN_SAMPLE_NS 500000.0
+
+//Triangles and rays every round goes through.
+#define BENCH_TRIANGLES 4096
+#define BENCH_RAYS 64
+
+//Vectors every round of the math goes through; the inputs and outputs of
+//both vector types fit in the L1 cache.
+#define BENCH_VECTORS 256
+
+//Grid of the benchmark.
+static const int gridWidths[] = { 1, 4, 8, 16 };
+static const int gridBatches[] = { 4, 8, 16, 64 };
+
+#define GRID_LEN(a) ((int)(sizeof(a) / sizeof((a)[0])))
+
+//What every configuration is timed on.
+struct BenchData
+{
+    Scene scene;
+    std::vector<int> prims;
+    TriangleSoA soa;
+    std::vector<Ray> rays;
+};
+
+//The vectors the math is timed on, the same values in both types.
+struct MathData
+{
+    Vec3 a3[BENCH_VECTORS];
+    Vec3 b3[BENCH_VECTORS];
+    Vec3 out3[BENCH_VECTORS];
+    Vec4 a4[BENCH_VECTORS];
+    Vec4 b4[BENCH_VECTORS];
+    Vec4 out4[BENCH_VECTORS];
+    float dots[BENCH_VECTORS];
+    Mat4 matrix;
+};
+
+//The math is constexpr: a scale and a translation compose and transform a
+//point at compile time.
+static_assert(dot(makeVec3(1.0f, 2.0f, 3.0f), makeVec3(4.0f, 5.0f, 6.0f)) == 32.0f, "dot is not constexpr");
+static_assert(cross(makeVec4(1.0f, 0.0f, 0.0f, 0.0f), makeVec4(0.0f, 1.0f, 0.0f, 0.0f)).z == 1.0f,
+              "cross is not constexpr");
+static_assert(transformPoint(translateMatrix(makeVec3(1.0f, 2.0f, 3.0f)) * scaleMatrix(makeVec3(2.0f, 2.0f, 2.0f)),
+                             makeVec3(1.0f, 1.0f, 1.0f)).z == 5.0f, "transform is not constexpr");
+
+//Keeps the compiler from dropping the results of the kernels.
+static volatile float sink;
+
+//Primatives
+static float randomFloat(unsigned int* state);
+static Vec3 randomPoint(unsigned int* state);
+static void makeData(BenchData* data);
+static void makeMath(MathData* math);
+static double runTriangles(const BenchData* data, int batch, long iters);
+template <typename Op>
+static double runMath(Op op, long iters);
+static bool checkWidths(const BenchData* data);
+static bool checkMath(MathData* math);
+template <typename Run>
+static double sample(Run run, int warmup, int reps, double work, std::vector<double>* samples);
+static void writeLine(FILE* out, const char* kernel, int width, int batch, const std::vector<double>& samples,
+                      double baseline);
+static void benchTriangles(FILE* out, const BenchData* data, int width, int batch, int warmup, int reps, double* scalar);
+static float callDot(const Vec3& a, const Vec3& b);
+static Vec3 callCross(const Vec3& a, const Vec3& b);
+static Vec3 callNormalize(const Vec3& a);
+static Vec3 callTransform(const Mat4& m, const Vec3& p);
+static void benchMath(FILE* out, MathData* math, int warmup, int reps);
+static void usage(const char* name);
+
+//This function returns a random number.
+//
+//Inputs:
+//    state - the state of the generator, updated.
+//
+//Outputs: a number in [0, 1)
+static float randomFloat(unsigned int* state)
+{
+    *state = *state * 1664525u + 1013904223u;
+    return (*state >> 8) / 16777216.0f;
+}
+
+//This function returns a random point of the cube [-1, 1]^3.
+//
+//Inputs:
+//    state - the state of the generator, updated.
+//
+//Outputs: the point
+static Vec3 randomPoint(unsigned int* state)
+{
+    float x = randomFloat(state) * 2.0f - 1.0f;
+    float y = randomFloat(state) * 2.0f - 1.0f;
+    float z = randomFloat(state) * 2.0f - 1.0f;
+    return makeVec3(x, y, z);
+}
+
+//This function makes the triangles and rays of the benchmark: small
+//triangles in a cube, and rays from outside of it through its middle, so
+//that some but not most tests hit, as in the leaves of a hierarchy.
+//
+//Inputs:
+//    data - set to the triangles and rays.
+//
+//Outputs: None
+static void makeData(BenchData* data)
+{
+    unsigned int state = 12345;
+    for( int i = 0; i < BENCH_TRIANGLES; ++i )
+    {
+        Triangle tri;
+        tri.a = randomPoint(&state);
+        tri.b = tri.a + randomPoint(&state) * 0.25f;
+        tri.c = tri.a + randomPoint(&state) * 0.25f;
+        data->scene.triangles.push_back(tri);
+        data->prims.push_back(i);
+    }
+    fillTriangleSoA(&data->scene, data->prims, &data->soa);
+
+    for( int i = 0; i < BENCH_RAYS; ++i )
+    {
+        Ray ray;
+        ray.origin = normalize(randomPoint(&state)) * 4.0f;
+        ray.direction = normalize(randomPoint(&state) * 0.5f - ray.origin);
+        data->rays.push_back(ray);
+    }
+}
+
+//This function makes the vectors the math is timed on: random points
+//and directions, and a matrix that scales and translates.
+//
+//Inputs:
+//    math - set to the vectors.
+//
+//Outputs: None
+static void makeMath(MathData* math)
+{
+    unsigned int state = 54321;
+    for( int i = 0; i < BENCH_VECTORS; ++i )
+    {
+        math->a3[i] = randomPoint(&state);
+        math->b3[i] = randomPoint(&state);
+        math->a4[i] = toVec4(math->a3[i], 0.0f);
+        math->b4[i] = toVec4(math->b3[i], 0.0f);
+    }
+    math->matrix = translateMatrix(makeVec3(1.0f, -2.0f, 0.5f)) * scaleMatrix(makeVec3(2.0f, 3.0f, 0.25f));
+}
+
+//This function runs rounds of the triangle kernel: every ray against all
+//the triangles, batch triangles per call.
+//
+//Inputs:
+//    data - the triangles and rays.
+//    batch - triangles per call.
+//    iters - rounds to run.
+//
+//Outputs: the elapsed nanoseconds
+static double runTriangles(const BenchData* data, int batch, long iters)
+{
+    float acc = 0.0f;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for( long it = 0; it < iters; ++it )
+    {
+        for( int r = 0; r < BENCH_RAYS; ++r )
+        {
+            for( int first = 0; first < BENCH_TRIANGLES; first += batch )
+            {
+                float t;
+                if( intersectTriangles(&data->soa, first, first + batch, data->rays[r], INFINITY, &t) >= 0 )
+                {
+                    acc += t;
+                }
+            }
+        }
+    }
+    std::chrono::steady_clock::time_point stop = std::chrono::steady_clock::now();
+
+    sink = acc;
+    return std::chrono::duration<double, std::nano>(stop - start).count();
+}
+
+//This function runs rounds of a vector operation over all the vectors.
+//
+//Inputs:
+//    op - the operation; called with the index of every vector.
+//    iters - rounds to run.
+//
+//Outputs: the elapsed nanoseconds
+template <typename Op>
+static double runMath(Op op, long iters)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for( long it = 0; it < iters; ++it )
+    {
+        for( int i = 0; i < BENCH_VECTORS; ++i )
+        {
+            op(i);
+        }
+    }
+    std::chrono::steady_clock::time_point stop = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(stop - start).count();
+}
+
+//This function checks that every width the processor runs finds the same
+//hits as the 1 wide kernel.
+//
+//Inputs:
+//    data - the triangles and rays.
+//
+//Outputs: true if a width differs; otherwise, false
+static bool checkWidths(const BenchData* data)
+{
+    int widest = widestTriangleWidth();
+    bool wrong = false;
+    for( int r = 0; r < BENCH_RAYS; ++r )
+    {
+        for( int first = 0; first < BENCH_TRIANGLES; first += 64 )
+        {
+            //Ragged ranges, so that the tails of the vectors are tested too.
+            int end = std::min(BENCH_TRIANGLES, first + 64 - r % 16);
+            float expectedT = 0.0f;
+            setTriangleWidth(1);
+            int expected = intersectTriangles(&data->soa, first, end, data->rays[r], INFINITY, &expectedT);
+            for( int w = 1; w < GRID_LEN(gridWidths); ++w )
+            {
+                if( gridWidths[w] > widest )
+                {
+                    continue;
+                }
+                float t = 0.0f;
+                setTriangleWidth(gridWidths[w]);
+                int slot = intersectTriangles(&data->soa, first, end, data->rays[r], INFINITY, &t);
+                if( slot != expected || (slot >= 0 && t != expectedT) )
+                {
+                    std::cerr << "ERROR: the " << gridWidths[w] << " wide kernel differs on ray " << r
+                              << ", slots " << first << " to " << end << std::endl;
+                    wrong = true;
+                }
+            }
+        }
+    }
+    setTriangleWidth(widest);
+    return wrong;
+}
+
+//This function checks that the math gives the same results on Vec3, on
+//Vec4 and through the out-of-line calls.
+//
+//Inputs:
+//    math - the vectors; the outputs are overwritten.
+//
+//Outputs: true if a result differs; otherwise, false
+static bool checkMath(MathData* math)
+{
+    int wrong = 0;
+    for( int i = 0; i < BENCH_VECTORS; ++i )
+    {
+        const Vec3& a = math->a3[i];
+        const Vec3& b = math->b3[i];
+        const Vec4& a4 = math->a4[i];
+        const Vec4& b4 = math->b4[i];
+        Vec3 results[4][3] = {
+            { makeVec3(dot(a, b), 0.0f, 0.0f), makeVec3(dot(a4, b4), 0.0f, 0.0f), makeVec3(callDot(a, b), 0.0f, 0.0f) },
+            { cross(a, b), toVec3(cross(a4, b4)), callCross(a, b) },
+            { normalize(a), toVec3(normalize(a4)), callNormalize(a) },
+            { transformPoint(math->matrix, a), toVec3(math->matrix * toVec4(a, 1.0f)), callTransform(math->matrix, a) },
+        };
+        for( int op = 0; op < 4; ++op )
+        {
+            for( int k = 1; k < 3; ++k )
+            {
+                if( memcmp(&results[op][0], &results[op][k], sizeof(Vec3)) != 0 )
+                {
+                    ++wrong;
+                }
+            }
+        }
+    }
+    if( wrong > 0 )
+    {
+        std::cerr << "ERROR: the vector types differ in " << wrong << " results." << std::endl;
+    }
+    return wrong > 0;
+}
+
+//This function samples a benchmark: the rounds a sample runs are doubled
+//until it lasts MIN_SAMPLE_NS, which doubles as the first warmup sample.
+//
+//Inputs:
+//    run - runs the given number of rounds and returns the nanoseconds.
+//    warmup - untimed samples.
+//    reps - timed samples.
+//    work - operations per round.
+//    samples - set to the nanoseconds per operation of every sample,
+//        sorted.
+//
+//Outputs: the median
+template <typename Run>
+static double sample(Run run, int warmup, int reps, double work, std::vector<double>* samples)
+{
+    long iters = 1;
+    while( run(iters) < MIN_SAMPLE_NS )
+    {
+        iters *= 2;
+    }
+
+    for( int r = 0; r < warmup; ++r )
+    {
+        run(iters);
+    }
+    samples->resize(reps);
+    for( int r = 0; r < reps; ++r )
+    {
+        (*samples)[r] = run(iters) / (iters * work);
+    }
+    std::sort(samples->begin(), samples->end());
+    return (*samples)[reps / 2];
+}
+
+//This function writes the CSV line of a configuration.
+//
+//Inputs:
+//    out - where the CSV line goes.
+//    kernel - the name of the kernel.
+//    width - the width of the kernel or vector type.
+//    batch - triangles per call, or vectors per round.
+//    samples - the nanoseconds per operation of every sample, sorted.
+//    baseline - the median of the baseline of this configuration.
+//
+//Outputs: None
+static void writeLine(FILE* out, const char* kernel, int width, int batch, const std::vector<double>& samples,
+                      double baseline)
+{
+    int reps = (int)samples.size();
+    double median = samples[reps / 2];
+    fprintf(out, "%s,%d,%d,%d,%.3f,%.3f,%.3f,%.1f,%.2f\n", kernel, width, batch, reps,
+            samples[reps / 10], median, samples[(reps * 9) / 10], 1e3 / median, baseline / median);
+    fflush(out);
+}
+
+//This function benchmarks one configuration of the triangle kernel and
+//writes its CSV line.
+//
+//Inputs:
+//    out - where the CSV line goes.
+//    data - the triangles and rays.
+//    width - the width of the kernel.
+//    batch - triangles per call.
+//    warmup - untimed samples.
+//    reps - timed samples.
+//    scalar - the median of the 1 wide kernel at this batch size; set
+//        when width is 1.
+//
+//Outputs: None
+static void benchTriangles(FILE* out, const BenchData* data, int width, int batch, int warmup, int reps, double* scalar)
+{
+    setTriangleWidth(width);
+    std::vector<double> samples;
+    double median = sample([=](long iters) { return runTriangles(data, batch, iters); }, warmup, reps,
+                           (double)BENCH_RAYS * BENCH_TRIANGLES, &samples);
+    if( width == 1 )
+    {
+        *scalar = median;
+    }
+    writeLine(out, "triangles", width, batch, samples, *scalar);
+}
+
+//These functions call the math out of line, as libraytrace does; noipa
+//keeps the compiler from looking into them from the loops.
+__attribute__((noipa)) static float callDot(const Vec3& a, const Vec3& b)
+{
+    return dot(a, b);
+}
+
+__attribute__((noipa)) static Vec3 callCross(const Vec3& a, const Vec3& b)
+{
+    return cross(a, b);
+}
+
+__attribute__((noipa)) static Vec3 callNormalize(const Vec3& a)
+{
+    return normalize(a);
+}
+
+__attribute__((noipa)) static Vec3 callTransform(const Mat4& m, const Vec3& p)
+{
+    return transformPoint(m, p);
+}
+
+//This function benchmarks dot, cross, normalize and transform out of
+//line, on Vec3 and on Vec4, and writes their CSV lines.
+//
+//Inputs:
+//    out - where the CSV lines go.
+//    math - the vectors; the outputs are overwritten.
+//    warmup - untimed samples.
+//    reps - timed samples.
+//
+//Outputs: None
+static void benchMath(FILE* out, MathData* math, int warmup, int reps)
+{
+    MathData* m = math;
+    std::vector<double> samples;
+    double call;
+
+    call = sample([=](long iters) { return runMath([=](int i) { m->dots[i] = callDot(m->a3[i], m->b3[i]); }, iters); },
+                  warmup, reps, BENCH_VECTORS, &samples);
+    writeLine(out, "dot-call", 3, BENCH_VECTORS, samples, call);
+    sample([=](long iters) { return runMath([=](int i) { m->dots[i] = dot(m->a3[i], m->b3[i]); }, iters); },
+           warmup, reps, BENCH_VECTORS, &samples);
+    writeLine(out, "dot", 3, BENCH_VECTORS, samples, call);
+    sample([=](long iters) { return runMath([=](int i) { m->dots[i] = dot(m->a4[i], m->b4[i]); }, iters); },
+           warmup, reps, BENCH_VECTORS, &samples);
+    writeLine(out, "dot", 4, BENCH_VECTORS, samples, call);
+
+    call = sample([=](long iters) { return runMath([=](int i) { m->out3[i] = callCross(m->a3[i], m->b3[i]); }, iters); },
+                  warmup, reps, BENCH_VECTORS, &samples);
+    writeLine(out, "cross-call", 3, BENCH_VECTORS, samples, call);
+    sample([=](long iters) { return runMath([=](int i) { m->out3[i] = cross(m->a3[i], m->b3[i]); }, iters); },
+           warmup, reps, BENCH_VECTORS, &samples);
+    writeLine(out, "cross", 3, BENCH_VECTORS, samples, call);
+    sample([=](long iters) { return runMath([=](int i) { m->out4[i] = cross(m->a4[i], m->b4[i]); }, iters); },
+           warmup, reps, BENCH_VECTORS, &samples);
+    writeLine(out, "cross", 4, BENCH_VECTORS, samples, call);
+
+    call = sample([=](long iters) { return runMath([=](int i) { m->out3[i] = callNormalize(m->a3[i]); }, iters); },
+                  warmup, reps, BENCH_VECTORS, &samples);
+    writeLine(out, "normalize-call", 3, BENCH_VECTORS, samples, call);
+    sample([=](long iters) { return runMath([=](int i) { m->out3[i] = normalize(m->a3[i]); }, iters); },
+           warmup, reps, BENCH_VECTORS, &samples);
+    writeLine(out, "normalize", 3, BENCH_VECTORS, samples, call);
+    sample([=](long iters) { return runMath([=](int i) { m->out4[i] = normalize(m->a4[i]); }, iters); },
+           warmup, reps, BENCH_VECTORS, &samples);
+    writeLine(out, "normalize", 4, BENCH_VECTORS, samples, call);
+
+    call = sample([=](long iters)
+                  { return runMath([=](int i) { m->out3[i] = callTransform(m->matrix, m->a3[i]); }, iters); },
+                  warmup, reps, BENCH_VECTORS, &samples);
+    writeLine(out, "transform-call", 3, BENCH_VECTORS, samples, call);
+    sample([=](long iters) { return runMath([=](int i) { m->out3[i] = transformPoint(m->matrix, m->a3[i]); }, iters); },
+           warmup, reps, BENCH_VECTORS, &samples);
+    writeLine(out, "transform", 3, BENCH_VECTORS, samples, call);
+    sample([=](long iters) { return runMath([=](int i) { m->out4[i] = m->matrix * m->a4[i]; }, iters); },
+           warmup, reps, BENCH_VECTORS, &samples);
+    writeLine(out, "transform", 4, BENCH_VECTORS, samples, call);
+}
+
+//This function prints how bench_accel is used.
+//
+//Inputs:
+//    name - the name of the program.
+//
+//Outputs: None
+static void usage(const char* name)
+{
+    std::cerr << "Usage: " << name << " [-w <warmup>] [-r <reps>] [-o <file>]" << std::endl;
+    std::cerr << "    Times the kernels of the acceleration code over a grid of batch sizes, and the" << std::endl;
+    std::cerr << "    vector math out of line and inline on Vec3 and Vec4, and writes the median and" << std::endl;
+    std::cerr << "    10th/90th percentile time per triangle or operation (ns), the millions of them" << std::endl;
+    std::cerr << "    per second and the speedup over the 1 wide kernel or out-of-line call as CSV." << std::endl;
+    std::cerr << "    -w - untimed samples per configuration (3)." << std::endl;
+    std::cerr << "    -r - timed samples per configuration (21)." << std::endl;
+    std::cerr << "    -o - write the CSV to a file instead of the standard output." << std::endl;
+}
+
+int main( int argc, char* argv[] )
+{
+    int warmup = 3;
+    int reps = 21;
+    FILE* out = stdout;
+
+    for( int i = 1; i < argc; i += 2 )
+    {
+        if( i + 1 >= argc )
+        {
+            usage(argv[0]);
+            return 1;
+        }
+        else if( strcmp(argv[i], "-w") == 0 )
+        {
+            warmup = std::max(0, atoi(argv[i + 1]));
+        }
+        else if( strcmp(argv[i], "-r") == 0 )
+        {
+            reps = std::max(1, atoi(argv[i + 1]));
+        }
+        else if( strcmp(argv[i], "-o") == 0 )
+        {
+            out = fopen(argv[i + 1], "w");
+            if( out == NULL )
+            {
+                std::cerr << "ERROR: " << argv[i + 1] << " could not be opened." << std::endl;
+                return 1;
+            }
+        }
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    BenchData data;
+    makeData(&data);
+    static MathData math;
+    makeMath(&math);
+    if( checkWidths(&data) || checkMath(&math) )
+    {
+        return 1;
+    }
+
+    fprintf(out, "kernel,width,batch,samples,ns_p10,ns_median,ns_p90,mops,speedup\n");
+    for( int b = 0; b < GRID_LEN(gridBatches); ++b )
+    {
+        double scalar = 0.0;
+        for( int w = 0; w < GRID_LEN(gridWidths); ++w )
+        {
+            if( gridWidths[w] <= widestTriangleWidth() )
+            {
+                benchTriangles(out, &data, gridWidths[w], gridBatches[b], warmup, reps, &scalar);
+            }
+        }
+    }
+    benchMath(out, &math, warmup, reps);
+
+    if( out != stdout )
+    {
+        fclose(out);
+    }
+    return 0;
+}
@@ -0,0 +1,571 @@
+//This file contains the construction and traversal of the bounding volume
+//hierarchy over the primitives of a scene.
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+#include "scene.h"
+#include "bvh.h"
+#include "triangles.h"
+
+//Primitives a subtree needs before it is worth a thread of its own.
+#define PARALLEL_BUILD_MIN 4096
+
+//Cost of visiting a node, relative to testing one primitive.
+#define TRAVERSAL_COST 1.0f
+
+//An axis aligned box.
+struct Box
+{
+    Vec3 lower;
+    Vec3 upper;
+};
+
+//What the threads building the hierarchy share.
+struct BuildContext
+{
+    const Scene* scene;
+    std::vector<Box> bounds;       //Of every primitive.
+    std::vector<Vec3> centers;     //Of the bounds of every primitive.
+    BVH* bvh;
+    std::atomic<int> nextNode;     //Next free pair of nodes.
+    std::atomic<int> spareThreads; //Threads that may still be started.
+    int width;                     //Triangles a leaf tests at a time.
+    int maxLeaf;                   //Most primitives a leaf may hold.
+};
+
+//Primatives
+static Box emptyBox();
+static void grow(Box* box, const Box& other);
+static float area(const Box& box);
+static Box primitiveBounds(const Scene* scene, int prim);
+static float leafTests(const BuildContext* ctx, int count);
+static void makeLeaf(BVHNode* node, int begin, int end);
+static void buildNode(BuildContext* ctx, int index, int begin, int end, int depth);
+static bool hitBox(const BVHNode& node, const Ray& ray, const float* inverse, float tMax);
+static void traverse(const Scene* scene, const BVH* bvh, const Ray& ray, bool any, Hit* hit, TraceStats* stats);
+static void measure(BVH* bvh);
+
+//This function returns a box that contains nothing.
+//
+//Inputs: None
+//
+//Outputs: the box
+static Box emptyBox()
+{
+    Box box;
+    box.lower = makeVec3(INFINITY, INFINITY, INFINITY);
+    box.upper = makeVec3(-INFINITY, -INFINITY, -INFINITY);
+    return box;
+}
+
+//This function grows a box to contain another.
+//
+//Inputs:
+//    box - the box.
+//    other - the box to contain.
+//
+//Outputs: None
+static void grow(Box* box, const Box& other)
+{
+    box->lower = vmin(box->lower, other.lower);
+    box->upper = vmax(box->upper, other.upper);
+}
+
+//This function returns the surface area of a box, 0 if it is empty.
+//
+//Inputs:
+//    box - the box.
+//
+//Outputs: the area
+static float area(const Box& box)
+{
+    Vec3 d = box.upper - box.lower;
+    if( d.x < 0.0f || d.y < 0.0f || d.z < 0.0f )
+    {
+        return 0.0f;
+    }
+    return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+//This function returns the bounding box of a primitive.
+//
+//Inputs:
+//    scene - the scene.
+//    prim - the primitive.
+//
+//Outputs: the box
+static Box primitiveBounds(const Scene* scene, int prim)
+{
+    Box box;
+    int triangles = (int)scene->triangles.size();
+    if( prim < triangles )
+    {
+        const Triangle& t = scene->triangles[prim];
+        box.lower = vmin(t.a, vmin(t.b, t.c));
+        box.upper = vmax(t.a, vmax(t.b, t.c));
+    }
+    else
+    {
+        const Sphere& s = scene->spheres[prim - triangles];
+        Vec3 r = makeVec3(s.radius, s.radius, s.radius);
+        box.lower = s.center - r;
+        box.upper = s.center + r;
+    }
+    return box;
+}
+
+//This function returns what testing the primitives of a leaf costs, in
+//single tests: a vector of triangles costs about as much as one of them.
+//
+//Inputs:
+//    ctx - the build.
+//    count - the primitives in the leaf.
+//
+//Outputs: the cost
+static float leafTests(const BuildContext* ctx, int count)
+{
+    return (float)((count + ctx->width - 1) / ctx->width);
+}
+
+//This function turns a node into a leaf.
+//
+//Inputs:
+//    node - the node, with its bounds set.
+//    begin - its first entry in BVH::prims.
+//    end - one past its last entry.
+//
+//Outputs: None
+static void makeLeaf(BVHNode* node, int begin, int end)
+{
+    node->first = begin;
+    node->count = (unsigned short)(end - begin);
+    node->axis = 0;
+}
+
+//This function builds the subtree over BVH::prims[begin, end). The split
+//is the best of BVH_BINS - 1 planes per axis by the surface area
+//heuristic; a node is a leaf if splitting costs more than testing all of
+//its primitives, as long as it has no more than BVH_MAX_LEAF.
+//
+//Inputs:
+//    ctx - what the builders share.
+//    index - the node of the subtree.
+//    begin - the first primitive of the subtree in BVH::prims.
+//    end - one past the last one.
+//    depth - the depth of the node.
+//
+//Outputs: None
+static void buildNode(BuildContext* ctx, int index, int begin, int end, int depth)
+{
+    std::vector<int>& prims = ctx->bvh->prims;
+    BVHNode* node = &(ctx->bvh->nodes[index]);
+    int count = end - begin;
+
+    Box bounds = emptyBox();
+    Box centers = emptyBox();
+    for( int i = begin; i < end; ++i )
+    {
+        grow(&bounds, ctx->bounds[prims[i]]);
+        Box center = { ctx->centers[prims[i]], ctx->centers[prims[i]] };
+        grow(&centers, center);
+    }
+    node->lower[0] = bounds.lower.x;
+    node->lower[1] = bounds.lower.y;
+    node->lower[2] = bounds.lower.z;
+    node->upper[0] = bounds.upper.x;
+    node->upper[1] = bounds.upper.y;
+    node->upper[2] = bounds.upper.z;
+
+    if( count <= 1 || depth >= BVH_MAX_DEPTH - 1 )
+    {
+        makeLeaf(node, begin, end);
+        return;
+    }
+
+    //Find the best split over the bins of each axis.
+    float bestCost = INFINITY;
+    int bestAxis = -1;
+    int bestSplit = 0;
+    for( int axis = 0; axis < 3; ++axis )
+    {
+        float low = component(centers.lower, axis);
+        float extent = component(centers.upper, axis) - low;
+        if( extent <= 0.0f )
+        {
+            continue;
+        }
+
+        int binCount[BVH_BINS] = { 0 };
+        Box binBounds[BVH_BINS];
+        for( int b = 0; b < BVH_BINS; ++b )
+        {
+            binBounds[b] = emptyBox();
+        }
+        for( int i = begin; i < end; ++i )
+        {
+            int b = std::min(BVH_BINS - 1, (int)((component(ctx->centers[prims[i]], axis) - low) * (BVH_BINS / extent)));
+            ++binCount[b];
+            grow(&binBounds[b], ctx->bounds[prims[i]]);
+        }
+
+        //Sweep from the right, then from the left: splitting after bin s
+        //puts bins [0, s] on the left.
+        float rightCost[BVH_BINS];
+        Box right = emptyBox();
+        int rightCount = 0;
+        for( int b = BVH_BINS - 1; b > 0; --b )
+        {
+            grow(&right, binBounds[b]);
+            rightCount += binCount[b];
+            rightCost[b - 1] = area(right) * leafTests(ctx, rightCount);
+        }
+        Box left = emptyBox();
+        int leftCount = 0;
+        for( int s = 0; s < BVH_BINS - 1; ++s )
+        {
+            grow(&left, binBounds[s]);
+            leftCount += binCount[s];
+            float cost = area(left) * leafTests(ctx, leftCount) + rightCost[s];
+            if( leftCount > 0 && leftCount < count && cost < bestCost )
+            {
+                bestCost = cost;
+                bestAxis = axis;
+                bestSplit = s;
+            }
+        }
+    }
+
+    float parentArea = area(bounds);
+    float leafCost = leafTests(ctx, count);
+    float splitCost = TRAVERSAL_COST + (parentArea > 0.0f ? bestCost / parentArea : 0.0f);
+    if( count <= ctx->maxLeaf && (bestAxis < 0 || splitCost >= leafCost) )
+    {
+        makeLeaf(node, begin, end);
+        return;
+    }
+
+    int mid;
+    if( bestAxis >= 0 )
+    {
+        float low = component(centers.lower, bestAxis);
+        float scale = BVH_BINS / (component(centers.upper, bestAxis) - low);
+        int* split = std::partition(&prims[begin], &prims[begin] + count, [&](int prim)
+        {
+            int b = std::min(BVH_BINS - 1, (int)((component(ctx->centers[prim], bestAxis) - low) * scale));
+            return b <= bestSplit;
+        });
+        mid = (int)(split - &prims[0]);
+    }
+    else
+    {
+        //Every center is in the same place: split the list in half.
+        bestAxis = 0;
+        mid = begin + count / 2;
+    }
+
+    int left = ctx->nextNode.fetch_add(2);
+    node->first = left;
+    node->count = 0;
+    node->axis = (unsigned short)bestAxis;
+
+    //Build the left subtree on a thread of its own if one is spare.
+    bool spawn = false;
+    if( count >= PARALLEL_BUILD_MIN )
+    {
+        spawn = ctx->spareThreads.fetch_sub(1) > 0;
+        if( !spawn )
+        {
+            ctx->spareThreads.fetch_add(1);
+        }
+    }
+
+    if( spawn )
+    {
+        std::thread builder(buildNode, ctx, left, begin, mid, depth + 1);
+        buildNode(ctx, left + 1, mid, end, depth + 1);
+        builder.join();
+        ctx->spareThreads.fetch_add(1);
+    }
+    else
+    {
+        buildNode(ctx, left, begin, mid, depth + 1);
+        buildNode(ctx, left + 1, mid, end, depth + 1);
+    }
+}
+
+//This function finds the number of leaves and the depth of a hierarchy.
+//
+//Inputs:
+//    bvh - the hierarchy.
+//
+//Outputs: None
+static void measure(BVH* bvh)
+{
+    bvh->leaves = 0;
+    bvh->depth = 0;
+
+    std::vector<std::pair<int, int> > stack(1, std::make_pair(0, 1));
+    while( !stack.empty() )
+    {
+        std::pair<int, int> entry = stack.back();
+        stack.pop_back();
+        const BVHNode& node = bvh->nodes[entry.first];
+        bvh->depth = std::max(bvh->depth, entry.second);
+        if( node.count > 0 || bvh->prims.empty() )
+        {
+            ++bvh->leaves;
+        }
+        else
+        {
+            stack.push_back(std::make_pair(node.first, entry.second + 1));
+            stack.push_back(std::make_pair(node.first + 1, entry.second + 1));
+        }
+    }
+}
+
+void buildBVH(const Scene* scene, int threads, BVH* bvh)
+{
+    int count = primitiveCount(scene);
+
+    BuildContext ctx;
+    ctx.scene = scene;
+    ctx.bvh = bvh;
+    ctx.nextNode = 1;
+    ctx.spareThreads = std::max(0, threads - 1);
+    ctx.width = triangleWidth();
+    ctx.maxLeaf = std::max(BVH_MAX_LEAF, ctx.width);
+    ctx.bounds.resize(count);
+    ctx.centers.resize(count);
+    for( int i = 0; i < count; ++i )
+    {
+        ctx.bounds[i] = primitiveBounds(scene, i);
+        ctx.centers[i] = (ctx.bounds[i].lower + ctx.bounds[i].upper) * 0.5f;
+    }
+
+    //A tree with n leaves has at most 2n - 1 nodes.
+    bvh->nodes.assign(std::max(1, 2 * count - 1), BVHNode());
+    bvh->prims.resize(count);
+    for( int i = 0; i < count; ++i )
+    {
+        bvh->prims[i] = i;
+    }
+
+    buildNode(&ctx, 0, 0, count, 0);
+    bvh->nodes.resize(ctx.nextNode);
+    fillTriangleSoA(scene, bvh->prims, &bvh->triangles);
+    measure(bvh);
+}
+
+bool intersectPrimitive(const Scene* scene, int prim, const Ray& ray, float tMax, float* t)
+{
+    int triangles = (int)scene->triangles.size();
+    if( prim < triangles )
+    {
+        //Moller-Trumbore.
+        const Triangle& tri = scene->triangles[prim];
+        Vec3 e1 = tri.b - tri.a;
+        Vec3 e2 = tri.c - tri.a;
+        Vec3 p = cross(ray.direction, e2);
+        float det = dot(e1, p);
+        if( fabsf(det) < 1e-12f )
+        {
+            return false;
+        }
+        float inv = 1.0f / det;
+        Vec3 s = ray.origin - tri.a;
+        float u = dot(s, p) * inv;
+        if( u < 0.0f || u > 1.0f )
+        {
+            return false;
+        }
+        Vec3 q = cross(s, e1);
+        float v = dot(ray.direction, q) * inv;
+        if( v < 0.0f || u + v > 1.0f )
+        {
+            return false;
+        }
+        float d = dot(e2, q) * inv;
+        if( d <= HIT_EPSILON || d >= tMax )
+        {
+            return false;
+        }
+        *t = d;
+        return true;
+    }
+
+    //The direction has length 1, so the quadratic is t^2 + 2bt + c.
+    const Sphere& sphere = scene->spheres[prim - triangles];
+    Vec3 oc = ray.origin - sphere.center;
+    float b = dot(oc, ray.direction);
+    float c = dot(oc, oc) - sphere.radius * sphere.radius;
+    float disc = b * b - c;
+    if( disc < 0.0f )
+    {
+        return false;
+    }
+    float root = sqrtf(disc);
+    float d = -b - root;
+    if( d <= HIT_EPSILON )
+    {
+        d = -b + root;
+    }
+    if( d <= HIT_EPSILON || d >= tMax )
+    {
+        return false;
+    }
+    *t = d;
+    return true;
+}
+
+//This function tests a ray against the bounding box of a node.
+//
+//Inputs:
+//    node - the node.
+//    ray - the ray.
+//    inverse - 1 / the direction of the ray, per axis.
+//    tMax - only boxes entered before this count.
+//
+//Outputs: true if the ray passes through the box before tMax
+static bool hitBox(const BVHNode& node, const Ray& ray, const float* inverse, float tMax)
+{
+    const float origin[3] = { ray.origin.x, ray.origin.y, ray.origin.z };
+    float tNear = 0.0f;
+    float tFar = tMax;
+    for( int a = 0; a < 3; ++a )
+    {
+        float t0 = (node.lower[a] - origin[a]) * inverse[a];
+        float t1 = (node.upper[a] - origin[a]) * inverse[a];
+        tNear = fmaxf(tNear, fminf(t0, t1));
+        tFar = fminf(tFar, fmaxf(t0, t1));
+    }
+
+    //Widen the far side by the rounding error of the products, or a ray
+    //can slip past a flat box, such as the floor's, that its triangle is
+    //hit in (Pharr et al., "Robust BVH Ray Traversal").
+    return tNear <= tFar * BOX_ROUNDING;
+}
+
+//This function walks the hierarchy for a ray. Only hits closer than
+//hit->t count, and each one found becomes the new limit, so the stack
+//holds all the state and nothing is allocated.
+//
+//Inputs:
+//    scene - the scene.
+//    bvh - its hierarchy.
+//    ray - the ray.
+//    any - stop at the first hit instead of looking for the closest.
+//    hit - the limit on entry; set to the hit found, if any.
+//    stats - what the ray took is added here, may be NULL.
+//
+//Outputs: None
+static void traverse(const Scene* scene, const BVH* bvh, const Ray& ray, bool any, Hit* hit, TraceStats* stats)
+{
+    const float inverse[3] = { 1.0f / ray.direction.x, 1.0f / ray.direction.y, 1.0f / ray.direction.z };
+    const int negative[3] = { ray.direction.x < 0.0f, ray.direction.y < 0.0f, ray.direction.z < 0.0f };
+    int triangles = (int)scene->triangles.size();
+    long nodes = 0;
+    long tested = 0;
+
+    int stack[BVH_MAX_DEPTH];
+    int top = 0;
+    int index = 0;
+    while( true )
+    {
+        const BVHNode& node = bvh->nodes[index];
+        ++nodes;
+
+        if( hitBox(node, ray, inverse, hit->t) )
+        {
+            if( node.count > 0 )
+            {
+                //The triangles of the leaf a vector at a time, then its
+                //spheres, whose slots no triangle test hits.
+                float t;
+                int end = node.first + node.count;
+                int slot = intersectTriangles(&bvh->triangles, node.first, end, ray, hit->t, &t);
+                if( slot >= 0 )
+                {
+                    hit->t = t;
+                    hit->prim = bvh->prims[slot];
+                }
+                for( int i = node.first; i < end; ++i )
+                {
+                    if( bvh->prims[i] >= triangles && intersectPrimitive(scene, bvh->prims[i], ray, hit->t, &t) )
+                    {
+                        hit->t = t;
+                        hit->prim = bvh->prims[i];
+                    }
+                }
+                tested += node.count;
+                if( any && hit->prim >= 0 )
+                {
+                    break;
+                }
+            }
+            else
+            {
+                //The left child holds the lower coordinates along the
+                //axis, so it is the nearer one unless the ray goes down.
+                int near = node.first + negative[node.axis];
+                stack[top++] = node.first + 1 - negative[node.axis];
+                index = near;
+                continue;
+            }
+        }
+
+        if( top == 0 )
+        {
+            break;
+        }
+        index = stack[--top];
+    }
+
+    if( stats != NULL )
+    {
+        ++stats->rays;
+        stats->nodes += nodes;
+        stats->prims += tested;
+    }
+}
+
+bool traceClosest(const Scene* scene, const BVH* bvh, const Ray& ray, Hit* hit, TraceStats* stats)
+{
+    hit->t = INFINITY;
+    hit->prim = -1;
+    if( !bvh->prims.empty() )
+    {
+        traverse(scene, bvh, ray, false, hit, stats);
+    }
+    return hit->prim >= 0;
+}
+
+bool traceAny(const Scene* scene, const BVH* bvh, const Ray& ray, float tMax, TraceStats* stats)
+{
+    Hit hit = { tMax, -1 };
+    if( !bvh->prims.empty() )
+    {
+        traverse(scene, bvh, ray, true, &hit, stats);
+    }
+    return hit.prim >= 0;
+}
+
+bool traceBruteForce(const Scene* scene, const Ray& ray, Hit* hit)
+{
+    hit->t = INFINITY;
+    hit->prim = -1;
+    int count = primitiveCount(scene);
+    for( int prim = 0; prim < count; ++prim )
+    {
+        float t;
+        if( intersectPrimitive(scene, prim, ray, hit->t, &t) )
+        {
+            hit->t = t;
+            hit->prim = prim;
+        }
+    }
+    return hit->prim >= 0;
+}
@@ -0,0 +1,312 @@
+//This file contains the scene cache: the scene and hierarchy of
+//raytrace_accel, saved as they are in memory.
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "scene.h"
+#include "bvh.h"
+#include "triangles.h"
+#include "cache.h"
+
+//The sections of the file, in the order they are written.
+#define CACHE_SOURCES 0              //The paths, each ended by a 0.
+#define CACHE_ID 1
+#define CACHE_CAMERA 2
+#define CACHE_BACKGROUND 3
+#define CACHE_LIGHTS 4
+#define CACHE_MATERIALS 5
+#define CACHE_TRIANGLES 6
+#define CACHE_SPHERES 7
+#define CACHE_TRIANGLE_MATERIALS 8
+#define CACHE_SPHERE_MATERIALS 9
+#define CACHE_NODES 10
+#define CACHE_PRIMS 11
+#define CACHE_SOA 12                 //The 9 arrays of the TriangleSoA.
+#define CACHE_SECTIONS 21
+
+//Records whose size is kept in the header.
+#define CACHE_RECORDS 6
+
+//Where a section is in the file, in bytes.
+struct CacheSection
+{
+    unsigned long long offset;
+    unsigned long long bytes;
+};
+
+struct CacheHeader
+{
+    char magic[8];
+    unsigned int version;
+    unsigned int width;                       //Triangles a leaf test takes.
+    unsigned int records[CACHE_RECORDS];
+    int leaves;
+    int depth;
+    unsigned long long hash;
+    CacheSection sections[CACHE_SECTIONS];
+};
+
+static const char cacheMagic[8] = "RTSCENE";
+
+//The arrays of a TriangleSoA, in the order of their sections.
+static std::vector<float> TriangleSoA::* const soaArrays[9] = {
+    &TriangleSoA::x, &TriangleSoA::y, &TriangleSoA::z, &TriangleSoA::e1x, &TriangleSoA::e1y, &TriangleSoA::e1z,
+    &TriangleSoA::e2x, &TriangleSoA::e2y, &TriangleSoA::e2z
+};
+
+//FNV-1a, 64 bits.
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+//Primatives
+static unsigned long long hashBytes(unsigned long long hash, const char* bytes, size_t count);
+static unsigned long long hashSources(const std::vector<std::string>& sources);
+static void recordSizes(unsigned int* records);
+static void writeSection(std::ofstream* file, CacheHeader* header, int section, const void* data, size_t bytes);
+template <typename T>
+static void readSection(const char* base, const CacheHeader* header, int section, std::vector<T>* array);
+
+//This function adds bytes to an FNV-1a hash.
+//
+//Inputs:
+//    hash - the hash so far.
+//    bytes - the bytes.
+//    count - the number of bytes.
+//
+//Outputs: the hash
+static unsigned long long hashBytes(unsigned long long hash, const char* bytes, size_t count)
+{
+    for( size_t i = 0; i < count; ++i )
+    {
+        hash ^= (unsigned char)bytes[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+//This function hashes the paths and contents of the sources of a scene.
+//A missing file hashes differently from an empty one, so that adding it
+//changes the hash too.
+//
+//Inputs:
+//    sources - the paths of the files.
+//
+//Outputs: the hash
+static unsigned long long hashSources(const std::vector<std::string>& sources)
+{
+    unsigned long long hash = FNV_OFFSET;
+    std::vector<char> buffer(1 << 16);
+    for( size_t i = 0; i < sources.size(); ++i )
+    {
+        hash = hashBytes(hash, sources[i].c_str(), sources[i].size() + 1);
+        std::ifstream file(sources[i].c_str(), std::ios::binary);
+        char present = file ? 1 : 0;
+        hash = hashBytes(hash, &present, 1);
+        while( file )
+        {
+            file.read(&buffer[0], buffer.size());
+            hash = hashBytes(hash, &buffer[0], (size_t)file.gcount());
+        }
+    }
+    return hash;
+}
+
+//This function lists the sizes of the records of the file.
+//
+//Inputs:
+//    records - set to the sizes.
+//
+//Outputs: None
+static void recordSizes(unsigned int* records)
+{
+    records[0] = sizeof(SceneCamera);
+    records[1] = sizeof(SceneLight);
+    records[2] = sizeof(Material);
+    records[3] = sizeof(Triangle);
+    records[4] = sizeof(Sphere);
+    records[5] = sizeof(BVHNode);
+}
+
+//This function writes a section at the next multiple of
+//SCENE_CACHE_ALIGN and notes where it is in the header.
+//
+//Inputs:
+//    file - the file.
+//    header - the header, updated.
+//    section - the section.
+//    data - its records.
+//    bytes - their size.
+//
+//Outputs: None
+static void writeSection(std::ofstream* file, CacheHeader* header, int section, const void* data, size_t bytes)
+{
+    static const char zeros[SCENE_CACHE_ALIGN] = { 0 };
+    unsigned long long offset = (unsigned long long)file->tellp();
+    unsigned long long padding = (SCENE_CACHE_ALIGN - offset % SCENE_CACHE_ALIGN) % SCENE_CACHE_ALIGN;
+    file->write(zeros, (std::streamsize)padding);
+    header->sections[section].offset = offset + padding;
+    header->sections[section].bytes = bytes;
+    file->write((const char*)data, (std::streamsize)bytes);
+}
+
+//This function copies a section out of a mapped file.
+//
+//Inputs:
+//    base - the start of the mapping.
+//    header - the header of the file, already checked.
+//    section - the section.
+//    array - set to its records.
+//
+//Outputs: None
+template <typename T>
+static void readSection(const char* base, const CacheHeader* header, int section, std::vector<T>* array)
+{
+    const T* first = (const T*)(base + header->sections[section].offset);
+    array->assign(first, first + header->sections[section].bytes / sizeof(T));
+}
+
+bool readSceneCache(const char* path, const char* config, Scene* scene, BVH* bvh)
+{
+    int fd = open(path, O_RDONLY);
+    if( fd < 0 )
+    {
+        return true;
+    }
+    struct stat status;
+    if( fstat(fd, &status) != 0 || (size_t)status.st_size < sizeof(CacheHeader) )
+    {
+        close(fd);
+        return true;
+    }
+    size_t size = (size_t)status.st_size;
+    void* mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if( mapping == MAP_FAILED )
+    {
+        return true;
+    }
+    const char* base = (const char*)mapping;
+    const CacheHeader* header = (const CacheHeader*)base;
+
+    //This version and layout, and sections that are whole and aligned.
+    unsigned int records[CACHE_RECORDS];
+    recordSizes(records);
+    bool usable = memcmp(header->magic, cacheMagic, sizeof(cacheMagic)) == 0 &&
+                  header->version == SCENE_CACHE_VERSION && (int)header->width == triangleWidth() &&
+                  memcmp(header->records, records, sizeof(records)) == 0;
+    for( int s = 0; usable && s < CACHE_SECTIONS; ++s )
+    {
+        const CacheSection& section = header->sections[s];
+        usable = section.offset % SCENE_CACHE_ALIGN == 0 && section.offset <= size && section.bytes <= size - section.offset;
+    }
+    usable = usable && header->sections[CACHE_CAMERA].bytes == sizeof(SceneCamera) &&
+             header->sections[CACHE_BACKGROUND].bytes == sizeof(Color);
+
+    //The same configuration, and sources that have not changed.
+    std::vector<std::string> sources;
+    if( usable )
+    {
+        const char* text = base + header->sections[CACHE_SOURCES].offset;
+        const char* end = text + header->sections[CACHE_SOURCES].bytes;
+        while( text < end )
+        {
+            size_t length = strnlen(text, end - text);
+            sources.push_back(std::string(text, length));
+            text += length + 1;
+        }
+        usable = !sources.empty() && sources[0] == config && hashSources(sources) == header->hash;
+    }
+
+    if( usable )
+    {
+        const char* id = base + header->sections[CACHE_ID].offset;
+        scene->id.assign(id, header->sections[CACHE_ID].bytes);
+        memcpy(&scene->camera, base + header->sections[CACHE_CAMERA].offset, sizeof(SceneCamera));
+        memcpy(&scene->background, base + header->sections[CACHE_BACKGROUND].offset, sizeof(Color));
+        readSection(base, header, CACHE_LIGHTS, &scene->lights);
+        readSection(base, header, CACHE_MATERIALS, &scene->materials);
+        readSection(base, header, CACHE_TRIANGLES, &scene->triangles);
+        readSection(base, header, CACHE_SPHERES, &scene->spheres);
+        readSection(base, header, CACHE_TRIANGLE_MATERIALS, &scene->triangleMaterials);
+        readSection(base, header, CACHE_SPHERE_MATERIALS, &scene->sphereMaterials);
+        scene->sources = sources;
+
+        readSection(base, header, CACHE_NODES, &bvh->nodes);
+        readSection(base, header, CACHE_PRIMS, &bvh->prims);
+        for( int k = 0; k < 9; ++k )
+        {
+            readSection(base, header, CACHE_SOA + k, &(bvh->triangles.*soaArrays[k]));
+        }
+        bvh->leaves = header->leaves;
+        bvh->depth = header->depth;
+    }
+
+    munmap(mapping, size);
+    return !usable;
+}
+
+bool writeSceneCache(const char* path, const Scene* scene, const BVH* bvh)
+{
+    CacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+    header.version = SCENE_CACHE_VERSION;
+    header.width = (unsigned int)triangleWidth();
+    recordSizes(header.records);
+    header.leaves = bvh->leaves;
+    header.depth = bvh->depth;
+    header.hash = hashSources(scene->sources);
+
+    std::string sources;
+    for( size_t i = 0; i < scene->sources.size(); ++i )
+    {
+        sources += scene->sources[i];
+        sources += '\0';
+    }
+
+    //Written under a name of this process's own, then renamed over the
+    //cache.
+    std::string temporary = std::string(path) + "." + std::to_string(getpid());
+    std::ofstream file(temporary.c_str(), std::ios::binary);
+    file.write((const char*)&header, sizeof(header));
+    writeSection(&file, &header, CACHE_SOURCES, sources.data(), sources.size());
+    writeSection(&file, &header, CACHE_ID, scene->id.data(), scene->id.size());
+    writeSection(&file, &header, CACHE_CAMERA, &scene->camera, sizeof(SceneCamera));
+    writeSection(&file, &header, CACHE_BACKGROUND, &scene->background, sizeof(Color));
+    writeSection(&file, &header, CACHE_LIGHTS, scene->lights.data(), scene->lights.size() * sizeof(SceneLight));
+    writeSection(&file, &header, CACHE_MATERIALS, scene->materials.data(), scene->materials.size() * sizeof(Material));
+    writeSection(&file, &header, CACHE_TRIANGLES, scene->triangles.data(), scene->triangles.size() * sizeof(Triangle));
+    writeSection(&file, &header, CACHE_SPHERES, scene->spheres.data(), scene->spheres.size() * sizeof(Sphere));
+    writeSection(&file, &header, CACHE_TRIANGLE_MATERIALS, scene->triangleMaterials.data(),
+                 scene->triangleMaterials.size() * sizeof(int));
+    writeSection(&file, &header, CACHE_SPHERE_MATERIALS, scene->sphereMaterials.data(),
+                 scene->sphereMaterials.size() * sizeof(int));
+    writeSection(&file, &header, CACHE_NODES, bvh->nodes.data(), bvh->nodes.size() * sizeof(BVHNode));
+    writeSection(&file, &header, CACHE_PRIMS, bvh->prims.data(), bvh->prims.size() * sizeof(int));
+    for( int k = 0; k < 9; ++k )
+    {
+        const std::vector<float>& array = bvh->triangles.*soaArrays[k];
+        writeSection(&file, &header, CACHE_SOA + k, array.data(), array.size() * sizeof(float));
+    }
+
+    //Now that the sections are placed, the header again.
+    file.seekp(0);
+    file.write((const char*)&header, sizeof(header));
+    file.close();
+    if( !file || rename(temporary.c_str(), path) != 0 )
+    {
+        std::cerr << "ERROR: the scene cache " << path << " could not be written." << std::endl;
+        remove(temporary.c_str());
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,373 @@
+//This file contains raytrace_accel, which loads the geometry of a scene,
+//builds its bounding volume hierarchy and traces the primary rays of an
+//image through it, to report what the hierarchy costs and saves.
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "allocs.h"
+#include "scene.h"
+#include "bvh.h"
+#include "cache.h"
+#include "triangles.h"
+#include "packet.h"
+#include "shade.h"
+
+//The arguments of raytrace_accel.
+struct AccelArgs
+{
+    const char* config;
+    int width;
+    int height;
+    int threads;
+    int simd;
+    int packet;
+    bool shade;
+    int batch;
+    const char* image;
+    bool check;
+    const char* cache;
+};
+
+//Primatives
+static bool parseArgs(int argc, char** argv, AccelArgs* args);
+static void usage();
+static bool writeImage(const char* path, const float* pixels, int width, int height);
+
+//This function reads the command line.
+//
+//Inputs:
+//    argc - the number of arguments.
+//    argv - the arguments.
+//    args - set from the arguments.
+//
+//Outputs: true if the command line is wrong; otherwise, false
+static bool parseArgs(int argc, char** argv, AccelArgs* args)
+{
+    args->config = NULL;
+    args->width = 500;
+    args->height = 500;
+    args->threads = 1;
+    args->simd = widestTriangleWidth();
+    args->packet = 0;
+    args->shade = false;
+    args->batch = WAVEFRONT_BATCH;
+    args->image = NULL;
+    args->check = false;
+    args->cache = NULL;
+
+    for( int i = 1; i < argc; ++i )
+    {
+        bool value = i + 1 < argc;
+        if( strcmp(argv[i], "-c") == 0 && value )
+        {
+            args->config = argv[++i];
+        }
+        else if( strcmp(argv[i], "-w") == 0 && value )
+        {
+            args->width = atoi(argv[++i]);
+        }
+        else if( strcmp(argv[i], "-h") == 0 && value )
+        {
+            args->height = atoi(argv[++i]);
+        }
+        else if( strcmp(argv[i], "--threads") == 0 && value )
+        {
+            args->threads = atoi(argv[++i]);
+        }
+        else if( strcmp(argv[i], "--simd") == 0 && value )
+        {
+            args->simd = atoi(argv[++i]);
+        }
+        else if( strcmp(argv[i], "--packet") == 0 && value )
+        {
+            args->packet = atoi(argv[++i]);
+        }
+        else if( strcmp(argv[i], "--shade") == 0 )
+        {
+            args->shade = true;
+        }
+        else if( strcmp(argv[i], "--batch") == 0 && value )
+        {
+            args->batch = atoi(argv[++i]);
+        }
+        else if( strcmp(argv[i], "--image") == 0 && value )
+        {
+            args->image = argv[++i];
+        }
+        else if( strcmp(argv[i], "--check") == 0 )
+        {
+            args->check = true;
+        }
+        else if( strcmp(argv[i], "--cache") == 0 && value )
+        {
+            args->cache = argv[++i];
+        }
+        else
+        {
+            return true;
+        }
+    }
+
+    //The rays of a packet fill whole vectors.
+    bool packet = args->packet == 0 || (args->packet > 0 && args->packet * args->packet <= PACKET_MAX_RAYS &&
+                                        (args->packet * args->packet) % PACKET_LANES == 0);
+    return args->config == NULL || args->width < 1 || args->height < 1 || args->threads < 1 || !packet ||
+           args->batch < 1;
+}
+
+//This function prints how raytrace_accel is used.
+//
+//Inputs: None
+//
+//Outputs: None
+static void usage()
+{
+    std::cerr << "Usage: raytrace_accel -c <config> [-w <width>] [-h <height>] [--threads <n>] [--simd <n>] [--packet <n>]" << std::endl;
+    std::cerr << "                      [--shade [--batch <n>] [--image <file>]] [--check] [--cache <file>]" << std::endl;
+    std::cerr << "    --threads - threads that build the hierarchy (1)." << std::endl;
+    std::cerr << "    --simd - triangles the leaves test at a time: 1, 4, 8 or 16 (the widest the processor runs)." << std::endl;
+    std::cerr << "    --packet - also trace the rays in packets of n x n pixels: 2, 4, ... 16 (" << PACKET_SIDE << ")." << std::endl;
+    std::cerr << "    --shade - also render the image with the recursive and the wavefront shader and compare." << std::endl;
+    std::cerr << "    --batch - tiles of " << WAVEFRONT_TILE << "x" << WAVEFRONT_TILE << " pixels the wavefront shader renders at a time ("
+              << WAVEFRONT_BATCH << ")." << std::endl;
+    std::cerr << "    --image - write the wavefront render to a binary PPM file." << std::endl;
+    std::cerr << "    --check - also test every ray against every primitive and compare." << std::endl;
+    std::cerr << "    --cache - load the scene and hierarchy from this file, or build them and write it if it is" << std::endl;
+    std::cerr << "        missing or its sources have changed." << std::endl;
+}
+
+//This function writes an image as a binary PPM file, each channel
+//clamped to [0, 1].
+//
+//Inputs:
+//    path - the path of the file.
+//    pixels - the image, RGB, row by row.
+//    width - the width of the image.
+//    height - the height of the image.
+//
+//Outputs: true if the file could not be written; otherwise, false
+static bool writeImage(const char* path, const float* pixels, int width, int height)
+{
+    std::ofstream file(path, std::ios::binary);
+    file << "P6\n" << width << " " << height << "\n255\n";
+    for( size_t i = 0; i < (size_t)width * height * 3; ++i )
+    {
+        file.put((char)(unsigned char)(fminf(1.0f, fmaxf(0.0f, pixels[i])) * 255.0f + 0.5f));
+    }
+    return !file;
+}
+
+int main( int argc, char* argv[] )
+{
+    AccelArgs args;
+    if( parseArgs(argc, argv, &args) )
+    {
+        usage();
+        return 1;
+    }
+    if( setTriangleWidth(args.simd) )
+    {
+        std::cerr << "ERROR: this processor cannot test " << args.simd << " triangles at a time." << std::endl;
+        return 1;
+    }
+
+    //From the cache if it is up to date, otherwise from the sources.
+    Scene scene;
+    BVH bvh;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    bool cached = args.cache != NULL && !readSceneCache(args.cache, args.config, &scene, &bvh);
+    if( !cached && loadScene(args.config, &scene) )
+    {
+        return 1;
+    }
+    std::chrono::steady_clock::time_point stop = std::chrono::steady_clock::now();
+    float loadTime = std::chrono::duration<float>(stop - start).count();
+
+    std::cout << "Scene: " << scene.id << std::endl;
+    std::cout << "Primitives: " << scene.triangles.size() << " triangles, " << scene.spheres.size() << " spheres" << std::endl;
+
+    //Build the hierarchy, unless it came with the cache.
+    if( cached )
+    {
+        std::cout << "Scene Cache: loaded " << args.cache << " in " << loadTime << " seconds" << std::endl;
+    }
+    else
+    {
+        std::cout << "Scene Load Time: " << loadTime << " seconds" << std::endl;
+        start = std::chrono::steady_clock::now();
+        buildBVH(&scene, args.threads, &bvh);
+        stop = std::chrono::steady_clock::now();
+        float buildTime = std::chrono::duration<float>(stop - start).count();
+        std::cout << "BVH Build Time: " << buildTime << " seconds (" << args.threads << " threads)" << std::endl;
+
+        if( args.cache != NULL )
+        {
+            if( writeSceneCache(args.cache, &scene, &bvh) )
+            {
+                return 1;
+            }
+            std::cout << "Scene Cache: wrote " << args.cache << std::endl;
+        }
+    }
+    std::cout << "BVH Nodes: " << bvh.nodes.size() << " (" << bvh.leaves << " leaves, depth " << bvh.depth << ", "
+              << sizeof(BVHNode) << " bytes each)" << std::endl;
+    std::cout << "Triangle Kernel: " << triangleWidth() << " wide" << std::endl;
+
+    //Trace a primary ray through every pixel.
+    TraceStats stats = { 0, 0, 0 };
+    long hits = 0;
+    long allocations = allocationCount();
+    start = std::chrono::steady_clock::now();
+    for( int row = 0; row < args.height; ++row )
+    {
+        for( int col = 0; col < args.width; ++col )
+        {
+            Hit hit;
+            Ray ray = cameraRay(scene.camera, args.width, args.height, row, col);
+            hits += traceClosest(&scene, &bvh, ray, &hit, &stats);
+        }
+    }
+    stop = std::chrono::steady_clock::now();
+    float traceTime = std::chrono::duration<float>(stop - start).count();
+    allocations = allocationCount() - allocations;
+
+    float rays = (float)stats.rays;
+    std::cout << "Primary Rays: " << stats.rays << " (" << hits << " hits)" << std::endl;
+    std::cout << "Trace Time: " << traceTime << " seconds (" << rays / traceTime / 1e6f << " Mrays/s, " << allocations
+              << " allocations)" << std::endl;
+    std::cout << "Nodes Visited per Ray: " << stats.nodes / rays << std::endl;
+    std::cout << "Primitives Tested per Ray: " << stats.prims / rays << " (of " << primitiveCount(&scene) << ")" << std::endl;
+
+    //Trace the same rays again in packets of pixels, keeping where they hit
+    //for the check.
+    std::vector<float> packetT;
+    if( args.packet > 0 )
+    {
+        int side = args.packet;
+        packetT.resize((size_t)args.width * args.height);
+        PacketStats packetStats = { 0, 0, 0, 0 };
+        RayPacket packet;
+        PacketHits packetHits;
+        start = std::chrono::steady_clock::now();
+        for( int row = 0; row < args.height; row += side )
+        {
+            for( int col = 0; col < args.width; col += side )
+            {
+                primaryPacket(scene.camera, args.width, args.height, row, col, side, &packet);
+                tracePacket(&scene, &bvh, &packet, &packetHits, &packetStats);
+                for( int i = 0; i < packet.count; ++i )
+                {
+                    int r = row + i / side;
+                    int c = col + i % side;
+                    if( r < args.height && c < args.width )
+                    {
+                        packetT[(size_t)r * args.width + c] = packetHits.t[i];
+                    }
+                }
+            }
+        }
+        stop = std::chrono::steady_clock::now();
+        float packetTime = std::chrono::duration<float>(stop - start).count();
+
+        long together = packetStats.packets - packetStats.singles;
+        std::cout << "Packets: " << packetStats.packets << " of " << side << "x" << side << " rays (" << packetStats.singles
+                  << " diverged and were traced a ray at a time)" << std::endl;
+        std::cout << "Packet Trace Time: " << packetTime << " seconds (" << rays / packetTime / 1e6f << " Mrays/s, "
+                  << traceTime / packetTime << " times single rays)" << std::endl;
+        if( together > 0 )
+        {
+            std::cout << "Nodes Visited per Packet: " << (float)packetStats.nodes / together << " ("
+                      << 100.0f * packetStats.culled / packetStats.nodes << "% culled by the frustum test)" << std::endl;
+        }
+    }
+
+    //Shade the image both ways.
+    if( args.shade )
+    {
+        size_t values = (size_t)args.width * args.height * 3;
+        std::vector<float> recursive(values);
+        std::vector<float> wavefront(values);
+        ShadeStats recursiveStats = { 0, 0, 0, 0, 0 };
+        ShadeStats wavefrontStats = { 0, 0, 0, 0, 0 };
+
+        long recursiveAllocations = allocationCount();
+        start = std::chrono::steady_clock::now();
+        renderRecursive(&scene, &bvh, args.width, args.height, &recursive[0], &recursiveStats);
+        stop = std::chrono::steady_clock::now();
+        float recursiveTime = std::chrono::duration<float>(stop - start).count();
+        recursiveAllocations = allocationCount() - recursiveAllocations;
+
+        long wavefrontAllocations = allocationCount();
+        start = std::chrono::steady_clock::now();
+        renderWavefront(&scene, &bvh, args.width, args.height, args.batch, &wavefront[0], &wavefrontStats);
+        stop = std::chrono::steady_clock::now();
+        float wavefrontTime = std::chrono::duration<float>(stop - start).count();
+        wavefrontAllocations = allocationCount() - wavefrontAllocations;
+
+        //The two add the light of the bounces up in different orders.
+        float difference = 0.0f;
+        for( size_t i = 0; i < values; ++i )
+        {
+            difference = fmaxf(difference, fabsf(recursive[i] - wavefront[i]));
+        }
+
+        std::cout << "Shaded Rays: " << recursiveStats.rays << " (" << recursiveStats.shadowRays << " shadow rays, depth "
+                  << SHADE_MAX_DEPTH << ")" << std::endl;
+        std::cout << "Recursive Shade Time: " << recursiveTime << " seconds (" << recursiveAllocations << " allocations)"
+                  << std::endl;
+        std::cout << "Wavefront Shade Time: " << wavefrontTime << " seconds (" << recursiveTime / wavefrontTime
+                  << " times recursive, " << wavefrontStats.batches << " batches of " << args.batch << " tiles)" << std::endl;
+        std::cout << "Wavefront Queues: at most " << wavefrontStats.peakRays << " rays, " << wavefrontStats.peakBytes / 1024
+                  << " KB (" << wavefrontAllocations << " allocations)" << std::endl;
+        std::cout << "Wavefront Difference: " << difference << " (largest in any channel)" << std::endl;
+
+        if( wavefrontStats.rays != recursiveStats.rays || wavefrontStats.shadowRays != recursiveStats.shadowRays )
+        {
+            std::cerr << "ERROR: the wavefront shader traced " << wavefrontStats.rays << " rays and " << wavefrontStats.shadowRays
+                      << " shadow rays." << std::endl;
+            return 1;
+        }
+        if( args.image != NULL && writeImage(args.image, &wavefront[0], args.width, args.height) )
+        {
+            std::cerr << "ERROR: " << args.image << " could not be written." << std::endl;
+            return 1;
+        }
+    }
+
+    if( args.check )
+    {
+        long wrong = 0;
+        for( int row = 0; row < args.height; ++row )
+        {
+            for( int col = 0; col < args.width; ++col )
+            {
+                Hit hit, expected;
+                Ray ray = cameraRay(scene.camera, args.width, args.height, row, col);
+                traceClosest(&scene, &bvh, ray, &hit, NULL);
+                traceBruteForce(&scene, ray, &expected);
+
+                //A ray through an edge shared by two triangles hits both at
+                //the same distance, and either may be reported.
+                wrong += (hit.t != expected.t);
+                if( !packetT.empty() )
+                {
+                    wrong += (packetT[(size_t)row * args.width + col] != expected.t);
+                }
+            }
+        }
+        std::cout << "Check: " << wrong << " rays differ from testing every primitive" << std::endl;
+        if( wrong > 0 )
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
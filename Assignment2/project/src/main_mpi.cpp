@@ -13,21 +13,33 @@ using namespace std;
 #include "RayTrace.h"
 #include "master.h"
 #include "slave.h"
+#include "options.h"
+#include "threads.h"
 
 int main( int argc, char* argv[] ) 
 {
     //Keep the data that will be used for the scene.
     ConfigData data;
+    Options options;
+
+    //Take out the options that initialize() does not know.
+    bool result = parseOptions(&argc, argv, &options);
     
     //Try to initialize the scene.
-    bool result = initialize(&argc, &argv, &data);
+    result = result || initialize(&argc, &argv, &data);
     //Make sure that the initialization was completed.	
     if( result )
     {
         MPI_Abort(MPI_COMM_WORLD, MPI_ERR_OTHER);
     }
 
-    MPI_Init(NULL, NULL);
+    //Only the main thread makes MPI calls; the render threads just shade.
+    int provided;
+    MPI_Init_thread(NULL, NULL, MPI_THREAD_FUNNELED, &provided);
+    if( startRenderThreads(options.threads, argc, argv) )
+    {
+        MPI_Abort(MPI_COMM_WORLD, MPI_ERR_OTHER);
+    }
 
     //Insert the MPI intialization code here.
     MPI_Comm_size(MPI_COMM_WORLD, &(data.mpi_procs));
@@ -60,13 +72,14 @@ int main( int argc, char* argv[] )
         std::cout << "Cycle Size: " << data.cycleSize << std::endl; 
 
         //Start the main processing for the ray tracer.
-        masterMain( &data );
+        masterMain( &data, &options );
     }
     else
     {
-        slaveMain( &data );
+        slaveMain( &data, &options );
     }
 
+    stopRenderThreads();
     MPI_Finalize();
 
     //Clean up the scene and other data.
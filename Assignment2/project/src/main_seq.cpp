@@ -4,6 +4,7 @@
 //application. MPI is not to be used with this file and it is provided as a reference
 //for you to understand the structure of the program for your code.
 
+#include <chrono>
 #include <ctime>
 #include <iostream>
 #include <ctime>
@@ -13,10 +14,14 @@
 using namespace std;
 
 #include "RayTrace.h"
+#include "allocs.h"
+#include "options.h"
+#include "threads.h"
 
 int main( int argc, char* argv[] ) 
 {
     ConfigData data;
+    Options options;
     
     //Create the output directory where all of the renders will be saved.
     struct stat stat_buf;
@@ -32,8 +37,11 @@ int main( int argc, char* argv[] )
         }
     }
     
+    //Take out the options that initialize() does not know.
+    bool result = parseOptions(&argc, argv, &options);
+
     //Try to initialize the scene.
-    bool result = initialize(&argc, &argv, &data);
+    result = result || initialize(&argc, &argv, &data);
     //Make sure that the initialization was completed.	
     if( result )
     {
@@ -50,32 +58,38 @@ int main( int argc, char* argv[] )
     std::cout << "Partitioning scheme: " << data.partitioningMode << std::endl;
     std::cout << "Number of Processes: " << 1 << std::endl;
 
+    //Load the scenes of the render threads.
+    if( startRenderThreads(options.threads, argc, argv) )
+    {
+        shutdown(&data);
+        return 1;
+    }
+
     //Allocate enough space.
     float* pixels = new float[ 3 * data.width * data.height ];
-    clock_t start = clock();
-
-    //Render the scene.
-    for( int i = 0; i < data.height; ++i )
-    {
-        for( int j = 0; j < data.width; ++j )
-        {
-            int row = i;
-            int column = j;
 
-            //Calculate the index into the array.
-            int baseIndex = 3 * ( row * data.width + column );
+    //Wall clock time: clock() would add up the time of all the threads.
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    long allocations = allocationCount();
 
-            //Call the function to shade the pixel.
-            shadePixel(&(pixels[baseIndex]),row,j,&data);
-        }
-    }
+    //Render the scene.
+    Tile image = { 0, 0, data.height, data.width };
+    renderArea(&data, image, pixels, data.width);
 
     //Stop the timing.
-    clock_t stop = clock();
+    std::chrono::steady_clock::time_point stop = std::chrono::steady_clock::now();
+    allocations = allocationCount() - allocations;
+    stopRenderThreads();
 
     //Figure out how much time was taken.
-    float time = (float)(stop - start) / (float)CLOCKS_PER_SEC;
-    std::cout << "Execution Time: " << time << " seconds" << std::endl << std::endl;
+    float time = std::chrono::duration<float>(stop - start).count();
+    std::cout << "Execution Time: " << time << " seconds" << std::endl;
+    if( options.allocs )
+    {
+        std::cout << "Allocations: " << allocations << " ("
+                  << (double)allocations / ((double)data.width * data.height) << " per pixel)" << std::endl;
+    }
+    std::cout << std::endl;
 
     //Now save the image.
     std::cout << "Image will be save to: ";
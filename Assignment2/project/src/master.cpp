@@ -3,18 +3,24 @@
 #include <iostream>
 #include <mpi.h>
 #include <iomanip>
+#include <deque>
+#include <vector>
 
 #include "RayTrace.h"
 #include "master.h"
+#include "tiles.h"
+#include "regions.h"
+#include "steal.h"
+#include "threads.h"
 
 //Primatives
 
 void masterSequential(ConfigData* data, float* pixels);
-void masterStaticStripsHorizontal(ConfigData* data, float* pixels);
-void masterStaticBlock(ConfigData* data, float* pixels);
-void masterStaticCyclesVertical(ConfigData* data, float* pixels);
+void masterStatic(ConfigData* data, float* pixels);
+void masterDynamic(ConfigData* data, float* pixels);
+void masterStealing(ConfigData* data, float* pixels);
 
-void masterMain(ConfigData* data)
+void masterMain(ConfigData* data, const Options* options)
 {
     //Depending on the partitioning scheme, different things will happen.
     //You should have a different function for each of the required 
@@ -51,23 +57,33 @@ void masterMain(ConfigData* data)
         case PART_MODE_STATIC_STRIPS_HORIZONTAL:
             //Call the function that will handle this.
             startTime = MPI_Wtime();
-            masterStaticStripsHorizontal(data, pixels);
+            masterStatic(data, pixels);
             stopTime = MPI_Wtime();
             break;
         case PART_MODE_STATIC_STRIPS_VERTICAL:
             break;
         case PART_MODE_STATIC_BLOCKS:
             startTime = MPI_Wtime();
-            masterStaticBlock(data, pixels);
+            masterStatic(data, pixels);
             stopTime = MPI_Wtime();
         case PART_MODE_STATIC_CYCLES_HORIZONTAL:
             break;
         case PART_MODE_STATIC_CYCLES_VERTICAL:
         startTime = MPI_Wtime();
-            masterStaticCyclesVertical(data, pixels);
+            masterStatic(data, pixels);
             stopTime = MPI_Wtime();
             break;
         case PART_MODE_DYNAMIC:
+            startTime = MPI_Wtime();
+            if( options->steal )
+            {
+                masterStealing(data, pixels);
+            }
+            else
+            {
+                masterDynamic(data, pixels);
+            }
+            stopTime = MPI_Wtime();
             break;
         default:
             std::cout << "This mode (" << data->partitioningMode;
@@ -94,20 +110,8 @@ void masterSequential(ConfigData* data, float* pixels)
     double computationStart = MPI_Wtime();
 
     //Render the scene.
-    for( int i = 0; i < data->height; ++i )
-    {
-        for( int j = 0; j < data->width; ++j )
-        {
-            int row = i;
-            int column = j;
-
-            //Calculate the index into the array.
-            int baseIndex = 3 * ( row * data->width + column );
-
-            //Call the function to shade the pixel.
-            shadePixel(&(pixels[baseIndex]),row,j,data);
-        }
-    }
+    Tile image = { 0, 0, data->height, data->width };
+    renderArea(data, image, pixels, data->width);
 
     //Stop the comp. timer
     double computationStop = MPI_Wtime();
@@ -126,62 +130,67 @@ void masterSequential(ConfigData* data, float* pixels)
     std::cout << "C-to-C Ratio: " << c2cRatio << std::endl;
 }
 
-void masterStaticStripsHorizontal(ConfigData* data, float* pixels)
+void masterStatic(ConfigData* data, float* pixels)
 {
-    // Init Variables
-    int height = data->height;
     int width = data->width;
-    int rank = data->mpi_rank;
     int procs = data->mpi_procs;
-    float strip_width = width/procs;
+    float computationTime = 0.0;
+    float communicationTime = 0.0;
 
-    // Start computation timer
-    double computationStart = MPI_Wtime();
+    // Start communication timer
+    double communicationStart = MPI_Wtime();
 
-    /* Render the scene. */
-    for( int col = ( floor(strip_width) * rank ); col < ( ceil(strip_width) * (rank + 1) ); ++col )
+    /* Post a receive for every chunk the slaves will stream, straight
+       into the image, so they land while the master renders */
+    std::vector<MPI_Request> requests;
+    for(int p = 1; p < procs; ++p)
     {
-        for( int row = 0; row < height; ++row )
+        std::vector<Tile> chunks = regionChunks(regionTiles(data, p));
+        for( size_t c = 0; c < chunks.size(); ++c )
         {
-            int baseIndex = 3 * ( row * width + col );
-            shadePixel(&(pixels[baseIndex]), row, col, data);
+            MPI_Datatype type = regionType(data, std::vector<Tile>(1, chunks[c]));
+            requests.push_back(MPI_REQUEST_NULL);
+            MPI_Irecv(pixels, 1, type, p, MPI_BUFFER_TAG, MPI_COMM_WORLD, &requests.back());
+            MPI_Type_free(&type);
         }
     }
 
-    //Stop computation timer
-    double computationStop = MPI_Wtime();
-    float computationTime = (float)computationStop - (float)computationStart;
-
-    // Start communication timer
-    double communicationStart = MPI_Wtime();
+    //Stop communication timer
+    communicationTime += (float)(MPI_Wtime() - communicationStart);
 
-    /* Recieve slave process computations */
-    for(int p = 1; p < procs; ++p)
+    /* Render the scene. */
+    std::vector<Tile> chunks = regionChunks(regionTiles(data, data->mpi_rank));
+    for( size_t c = 0; c < chunks.size(); ++c )
     {
-        float* newpixels = new float[3 * width * height + 1];
+        // Start computation timer
+        double computationStart = MPI_Wtime();
 
-        MPI_Status status;
-        MPI_Recv(newpixels, 3 * width * height, MPI_FLOAT, p, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
+        int baseIndex = 3 * ( chunks[c].row * width + chunks[c].col );
+        renderArea(data, chunks[c], &(pixels[baseIndex]), width);
 
-        // After recieving the buffer, the last element will be the slaves communication time
-        computationTime += newpixels[3*width*height];
-        
-        // Copy the new data into the master pixel array
-        for( int col = ceil(strip_width) * p; col < floor(strip_width) * (p + 1); ++col )
-        {
-            for( int row = 0; row < height; ++row )
-            {
-                int baseIndex = 3 * ( row * width + col );
-                memcpy(&(pixels[baseIndex]), &(newpixels[baseIndex]), 3*sizeof(float));
-            }
-        }
+        //Stop computation timer
+        computationTime += (float)(MPI_Wtime() - computationStart);
 
-        delete[] newpixels;
+        // Let MPI move the chunks that have arrived
+        communicationStart = MPI_Wtime();
+        int flag;
+        MPI_Testall((int)requests.size(), requests.data(), &flag, MPI_STATUSES_IGNORE);
+        communicationTime += (float)(MPI_Wtime() - communicationStart);
     }
 
+    // Start communication timer
+    communicationStart = MPI_Wtime();
+
+    /* Wait for the chunks still on their way, in whatever order they come */
+    MPI_Waitall((int)requests.size(), requests.data(), MPI_STATUSES_IGNORE);
+
+    // Add the slaves' computation times
+    float localTime = 0.0, slaveTime = 0.0;
+    MPI_Reduce(&localTime, &slaveTime, 1, MPI_FLOAT, MPI_SUM, 0, MPI_COMM_WORLD);
+    computationTime += slaveTime;
+
     //Stop communication timer
-    double communicationStop = MPI_Wtime();
-    float communicationTime = (float)communicationStop - (float)communicationStart;
+    communicationTime += (float)(MPI_Wtime() - communicationStart);
 
     //Print the times and the c-to-c ratio
     std::cout << "Total Computation Time: " << computationTime << " seconds" << std::endl;
@@ -190,137 +199,155 @@ void masterStaticStripsHorizontal(ConfigData* data, float* pixels)
     std::cout << "C-to-C Ratio: " << c2cRatio << std::endl;
 }
 
-void masterStaticBlock(ConfigData* data, float* pixels){
-    int height = data->height;
-    int width = data->width;
-    int rank = data->mpi_rank;
+void masterDynamic(ConfigData* data, float* pixels)
+{
     int procs = data->mpi_procs;
-    int factor = sqrt(procs);
-    float block_width = width/procs * factor;
-    float block_height = height/procs * factor;
-
-    // Start computation timer
-    double computationStart = MPI_Wtime();
-    
-    /* Render the scene. */
-    for( int col = (floor(block_width) * (rank % factor) ); col < (ceil(block_width) * ((rank % factor) + 1)); ++col )
+    int numTiles = tileCount(data);
+    int nextTile = 0;
+    int tilesDone = 0;
+    int stopsSent = 0;
+    float* buffer = new float[3 * data->dynamicBlockWidth * data->dynamicBlockHeight];
+
+    //Tiles handed to each worker and not returned yet, oldest first. A
+    //worker renders its tiles in the order it got them and MPI keeps the
+    //order of the messages between two processes, so a result always
+    //holds the oldest tile of its sender.
+    std::vector< std::deque<int> > assigned(procs);
+
+    double computationTime = 0.0;
+    double communicationTime = 0.0;
+
+    //Every worker keeps TILES_IN_FLIGHT requests outstanding and gets a
+    //stop for each of them once the tiles run out.
+    while( tilesDone < numTiles || stopsSent < TILES_IN_FLIGHT * (procs - 1) )
     {
-        for( int row = (floor(block_height) * floor(rank/factor) ); row < (ceil(block_height) * (floor(rank/factor) + 1)); ++row )
+        double communicationStart = MPI_Wtime();
+        MPI_Status status;
+        int waiting = 1;
+
+        //While there are tiles left, only look for messages; once they are
+        //all handed out, block until the next one arrives.
+        if( nextTile < numTiles )
         {
-            int baseIndex = 3 * ( row * width + col );
-            shadePixel(&(pixels[baseIndex]), row, col, data);
+            MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &waiting, &status);
+        }
+        else
+        {
+            MPI_Probe(MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
         }
-    }
-
-    //Stop computation timer
-    double computationStop = MPI_Wtime();
-    float computationTime = (float)computationStop - (float)computationStart;
 
-    // Start communication timer
-    double communicationStart = MPI_Wtime();
+        if( waiting )
+        {
+            int worker = status.MPI_SOURCE;
 
-    /* Recieve slave process computations */
-    for(int p = 1; p < procs; ++p)
-    {
-        float* newpixels = new float[3 * width * height + 1];
+            if( status.MPI_TAG == MPI_RESULT_TAG )
+            {
+                Tile tile = tileBounds(data, assigned[worker].front());
+                assigned[worker].pop_front();
 
-        MPI_Status status;
-        MPI_Recv(newpixels, 3 * width * height, MPI_FLOAT, p, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
+                MPI_Recv(buffer, 3 * tile.width * tile.height, MPI_FLOAT, worker, MPI_RESULT_TAG, MPI_COMM_WORLD, &status);
+                storeTile(data, tile, buffer, pixels);
+                ++tilesDone;
+            }
+            else
+            {
+                MPI_Recv(NULL, 0, MPI_INT, worker, MPI_REQUEST_TAG, MPI_COMM_WORLD, &status);
+            }
 
-        // After recieving the buffer, the last element will be the slaves communication time
-        computationTime += newpixels[3*width*height];
-        
-        for( int col = (ceil(block_width) * (p % factor) ); col < (floor(block_width) * ((p % factor) + 1)); ++col )
-        {
-            for( int row = (ceil(block_height) * floor(p/factor) ); row < (floor(block_height) * (floor(p/factor) + 1)); ++row )
+            //A result also asks for the next tile.
+            int reply = -1;
+            if( nextTile < numTiles )
+            {
+                reply = nextTile++;
+                assigned[worker].push_back(reply);
+            }
+            else
             {
-                int baseIndex = 3 * ( row * width + col );
-                memcpy(&(pixels[baseIndex]), &(newpixels[baseIndex]), 3*sizeof(float));
+                ++stopsSent;
             }
+            MPI_Send(&reply, 1, MPI_INT, worker, MPI_TILE_TAG, MPI_COMM_WORLD);
+
+            communicationTime += MPI_Wtime() - communicationStart;
         }
+        else
+        {
+            communicationTime += MPI_Wtime() - communicationStart;
+
+            //Nobody is waiting, so render a tile here. The workers already
+            //hold their next tile and keep going in the meantime.
+            double computationStart = MPI_Wtime();
 
-        delete[] newpixels;
+            Tile tile = tileBounds(data, nextTile++);
+            renderTile(data, tile, buffer);
+            storeTile(data, tile, buffer, pixels);
+            ++tilesDone;
+
+            computationTime += MPI_Wtime() - computationStart;
+        }
     }
-    
-    //Stop communication timer
-    double communicationStop = MPI_Wtime();
-    float communicationTime = (float)communicationStop - (float)communicationStart;
+
+    delete[] buffer;
+
+    //Add the time the workers spent rendering.
+    double communicationStart = MPI_Wtime();
+    double localTime = 0.0, workerTime = 0.0;
+    MPI_Reduce(&localTime, &workerTime, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    communicationTime += MPI_Wtime() - communicationStart;
+
+    float totalComputation = (float)(computationTime + workerTime);
+    float totalCommunication = (float)communicationTime;
 
     //Print the times and the c-to-c ratio
-    std::cout << "Total Computation Time: " << computationTime << " seconds" << std::endl;
-    std::cout << "Total Communication Time: " << communicationTime << " seconds" << std::endl;
-    float c2cRatio = communicationTime / computationTime;
+    std::cout << "Total Computation Time: " << totalComputation << " seconds" << std::endl;
+    std::cout << "Total Communication Time: " << totalCommunication << " seconds" << std::endl;
+    float c2cRatio = totalCommunication / totalComputation;
     std::cout << "C-to-C Ratio: " << c2cRatio << std::endl;
-    
 }
 
-void masterStaticCyclesVertical(ConfigData* data, float* pixels)
+void masterStealing(ConfigData* data, float* pixels)
 {
-    int height = data->height;
-    int width = data->width;
-    int rank = data->mpi_rank;
     int procs = data->mpi_procs;
-    int cycle_height = data->cycleSize;
-    double slave_time[procs];
-    
-    // Start computation timer
-    double computationStart = MPI_Wtime();
-
-    /* Render the scene. */
-    for(int part = rank * cycle_height; part < height; part += (procs * cycle_height))
-    {
-        for(int col = 0; col < width; ++col)
-        {
-            for(int row = part; row < (part + cycle_height >= height ? height : part + cycle_height); ++row)
-            {
-                //Calculate the index into the array.
-                int baseIndex = 3 * ( row * width + col );
-
-                //Call the function to shade the pixel.
-                shadePixel(&(pixels[baseIndex]), row, col, data);
-            }
-        }
-    }
+    double startTime = MPI_Wtime();
 
-    //Stop computation timer
-    double computationStop = MPI_Wtime();
-    float computationTime = (float)computationStop - (float)computationStart;
+    StealStats stats;
+    renderStealing(data, pixels, &stats);
 
-    // Start communication timer
-    double communicationStart = MPI_Wtime();
+    //Collect what every rank did.
+    double local[5] = { (double)stats.tiles, (double)stats.steals, (double)stats.attempts,
+                        stats.computationTime, stats.idleTime };
+    double* all = new double[5 * procs];
+    MPI_Gather(local, 5, MPI_DOUBLE, all, 5, MPI_DOUBLE, 0, MPI_COMM_WORLD);
 
-    /* Recieve slave process computations */
-    for(int p = 1; p < procs; ++p)
+    //Everything the master did besides shading went into communication.
+    float computationTime = 0.0;
+    for( int p = 0; p < procs; ++p )
     {
-        float* newpixels = new float[3 * width * height + 1];
-
-        MPI_Status status;
-        MPI_Recv(newpixels, 3 * width * height, MPI_FLOAT, p, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
-        
-        // After recieving the buffer, the last element will be the slaves communication time
-        computationTime += newpixels[3*width*height];
-
-        for(int part = p * cycle_height; part < height; part += (procs * cycle_height))
-        {
-            for(int col = 0; col < width; ++col)
-            {
-                for(int row = part; row < (part + cycle_height >= height ? height : part + cycle_height); ++row)
-                {
-                    int baseIndex = 3 * ( row * width + col );
-                    memcpy(&(pixels[baseIndex]), &(newpixels[baseIndex]), 3*sizeof(float));
-                }
-            }
-        }
-        delete[] newpixels;
+        computationTime += all[5 * p + 3];
     }
-    
-    //Stop communication timer
-    double communicationStop = MPI_Wtime();
-    float communicationTime = (float)communicationStop - (float)communicationStart;
+    float communicationTime = (float)(MPI_Wtime() - startTime - stats.computationTime);
 
     //Print the times and the c-to-c ratio
     std::cout << "Total Computation Time: " << computationTime << " seconds" << std::endl;
     std::cout << "Total Communication Time: " << communicationTime << " seconds" << std::endl;
     float c2cRatio = communicationTime / computationTime;
     std::cout << "C-to-C Ratio: " << c2cRatio << std::endl;
+
+    //Then how the work ended up spread over the ranks, leaving the format
+    //of std::cout as it was.
+    std::ios::fmtflags flags = std::cout.flags();
+    std::streamsize precision = std::cout.precision();
+    std::cout << std::fixed << std::setprecision(4);
+    std::cout << std::setw(6) << "Rank" << std::setw(8) << "Tiles" << std::setw(8) << "Steals"
+              << std::setw(10) << "Attempts" << std::setw(14) << "Computation" << std::setw(10) << "Idle" << std::endl;
+    for( int p = 0; p < procs; ++p )
+    {
+        std::cout << std::setw(6) << p << std::setw(8) << (int)all[5 * p] << std::setw(8) << (int)all[5 * p + 1]
+                  << std::setw(10) << (int)all[5 * p + 2] << std::setw(14) << (float)all[5 * p + 3]
+                  << std::setw(10) << (float)all[5 * p + 4] << std::endl;
+    }
+
+    std::cout.flags(flags);
+    std::cout.precision(precision);
+
+    delete[] all;
 }
@@ -0,0 +1,46 @@
+//This file contains the parsing of the options that libraytrace does not
+//know about.
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include "options.h"
+
+bool parseOptions(int* argc, char** argv, Options* options)
+{
+    options->steal = false;
+    options->threads = 1;
+    options->allocs = false;
+
+    //Keep the program name and everything that is not ours.
+    int kept = 1;
+    for( int i = 1; i < *argc; ++i )
+    {
+        if( strcmp(argv[i], "--steal") == 0 )
+        {
+            options->steal = true;
+        }
+        else if( strcmp(argv[i], "--allocs") == 0 )
+        {
+            options->allocs = true;
+        }
+        else if( strcmp(argv[i], "--threads") == 0 )
+        {
+            options->threads = i + 1 < *argc ? atoi(argv[++i]) : 0;
+            if( options->threads < 1 )
+            {
+                std::cerr << "--threads needs a number of threads of at least 1!" << std::endl;
+                return true;
+            }
+        }
+        else
+        {
+            argv[kept++] = argv[i];
+        }
+    }
+
+    argv[kept] = NULL;
+    *argc = kept;
+    return false;
+}
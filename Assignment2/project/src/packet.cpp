@@ -0,0 +1,443 @@
+//This file contains the tracing of packets of coherent rays through the
+//bounding volume hierarchy.
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "scene.h"
+#include "bvh.h"
+#include "packet.h"
+
+//What a packet's rays have in common: the bounds of their origins and of
+//the inverses of their directions, per axis.
+struct PacketFrustum
+{
+    float originLow[3];
+    float originHigh[3];
+    float inverseLow[3];
+    float inverseHigh[3];
+    int negative[3];      //Whether every ray goes down the axis.
+};
+
+//1 / the direction of every ray of a packet.
+struct PacketInverse
+{
+    alignas(16) float x[PACKET_MAX_RAYS];
+    alignas(16) float y[PACKET_MAX_RAYS];
+    alignas(16) float z[PACKET_MAX_RAYS];
+};
+
+//Primatives
+static Ray packetRay(const RayPacket* packet, int i);
+static void traceSingles(const Scene* scene, const BVH* bvh, const RayPacket* packet, PacketHits* hits);
+static bool makeFrustum(const RayPacket* packet, PacketInverse* inverse, PacketFrustum* frustum);
+#if defined(__x86_64__)
+static bool frustumMisses(const BVHNode& node, const PacketFrustum& frustum, float tMax);
+static int hitBoxLanes(const BVHNode& node, const RayPacket* packet, const PacketInverse* inverse,
+                       const PacketHits* hits, int first);
+static void intersectLeaf(const Scene* scene, const BVH* bvh, const BVHNode& node, const RayPacket* packet,
+                          const PacketInverse* inverse, PacketHits* hits, int group, int mask);
+static float farthestHit(const PacketHits* hits, int count);
+#endif
+
+void primaryPacket(const SceneCamera& camera, int width, int height, int row, int col, int side, RayPacket* packet)
+{
+    packet->count = side * side;
+    for( int i = 0; i < packet->count; ++i )
+    {
+        int r = std::min(row + i / side, height - 1);
+        int c = std::min(col + i % side, width - 1);
+        Ray ray = cameraRay(camera, width, height, r, c);
+        packet->ox[i] = ray.origin.x;
+        packet->oy[i] = ray.origin.y;
+        packet->oz[i] = ray.origin.z;
+        packet->dx[i] = ray.direction.x;
+        packet->dy[i] = ray.direction.y;
+        packet->dz[i] = ray.direction.z;
+    }
+}
+
+//This function returns one ray of a packet.
+//
+//Inputs:
+//    packet - the rays.
+//    i - the ray.
+//
+//Outputs: the ray
+static Ray packetRay(const RayPacket* packet, int i)
+{
+    Ray ray;
+    ray.origin = makeVec3(packet->ox[i], packet->oy[i], packet->oz[i]);
+    ray.direction = makeVec3(packet->dx[i], packet->dy[i], packet->dz[i]);
+    return ray;
+}
+
+//This function traces the rays of a packet one at a time.
+//
+//Inputs:
+//    scene - the scene.
+//    bvh - its hierarchy.
+//    packet - the rays.
+//    hits - set to the closest hit of every ray.
+//
+//Outputs: None
+static void traceSingles(const Scene* scene, const BVH* bvh, const RayPacket* packet, PacketHits* hits)
+{
+    for( int i = 0; i < packet->count; ++i )
+    {
+        Hit hit;
+        traceClosest(scene, bvh, packetRay(packet, i), &hit, NULL);
+        hits->t[i] = hit.t;
+        hits->prim[i] = hit.prim;
+    }
+}
+
+//This function finds the inverse directions of the rays of a packet and
+//what they have in common.
+//
+//Inputs:
+//    packet - the rays.
+//    inverse - set to 1 / the direction of every ray.
+//    frustum - set to the bounds of the packet.
+//
+//Outputs: true if the rays go the same way along every axis, and none of
+//    them is parallel to one; otherwise, false
+static bool makeFrustum(const RayPacket* packet, PacketInverse* inverse, PacketFrustum* frustum)
+{
+    const float* origins[3] = { packet->ox, packet->oy, packet->oz };
+    const float* directions[3] = { packet->dx, packet->dy, packet->dz };
+    float* inverses[3] = { inverse->x, inverse->y, inverse->z };
+
+    for( int a = 0; a < 3; ++a )
+    {
+        frustum->negative[a] = directions[a][0] < 0.0f;
+        frustum->originLow[a] = frustum->originHigh[a] = origins[a][0];
+        frustum->inverseLow[a] = frustum->inverseHigh[a] = 1.0f / directions[a][0];
+        for( int i = 0; i < packet->count; ++i )
+        {
+            float d = directions[a][i];
+            if( d == 0.0f || (d < 0.0f) != (frustum->negative[a] != 0) )
+            {
+                return false;
+            }
+            inverses[a][i] = 1.0f / d;
+            frustum->originLow[a] = std::min(frustum->originLow[a], origins[a][i]);
+            frustum->originHigh[a] = std::max(frustum->originHigh[a], origins[a][i]);
+            frustum->inverseLow[a] = std::min(frustum->inverseLow[a], inverses[a][i]);
+            frustum->inverseHigh[a] = std::max(frustum->inverseHigh[a], inverses[a][i]);
+        }
+    }
+    return true;
+}
+
+#if defined(__x86_64__)
+
+//This function tests a packet against the bounding box of a node with
+//interval arithmetic: the distances at which the rays enter and leave
+//every slab are bounded from the bounds of their origins and inverse
+//directions. Subtraction and multiplication round monotonically, so the
+//bounds hold for the distances every ray computes in hitBox.
+//
+//Inputs:
+//    node - the node.
+//    frustum - the bounds of the packet.
+//    tMax - the farthest closest hit of the rays so far.
+//
+//Outputs: true if no ray of the packet can pass through the box
+static bool frustumMisses(const BVHNode& node, const PacketFrustum& frustum, float tMax)
+{
+    float tNear = 0.0f;
+    float tFar = tMax;
+    for( int a = 0; a < 3; ++a )
+    {
+        //Rays going down an axis enter its slab at the upper side.
+        float enter = frustum.negative[a] ? node.upper[a] : node.lower[a];
+        float leave = frustum.negative[a] ? node.lower[a] : node.upper[a];
+
+        float low = enter - frustum.originHigh[a];
+        float high = enter - frustum.originLow[a];
+        tNear = std::max(tNear, std::min(std::min(low * frustum.inverseLow[a], low * frustum.inverseHigh[a]),
+                                         std::min(high * frustum.inverseLow[a], high * frustum.inverseHigh[a])));
+
+        low = leave - frustum.originHigh[a];
+        high = leave - frustum.originLow[a];
+        tFar = std::min(tFar, std::max(std::max(low * frustum.inverseLow[a], low * frustum.inverseHigh[a]),
+                                       std::max(high * frustum.inverseLow[a], high * frustum.inverseHigh[a])));
+    }
+    return tNear > tFar * BOX_ROUNDING;
+}
+
+//This function tests PACKET_LANES rays of a packet against the bounding
+//box of a node, as hitBox does for one.
+//
+//Inputs:
+//    node - the node.
+//    packet - the rays.
+//    inverse - 1 / the direction of every ray.
+//    hits - the closest hits so far; boxes behind them are missed.
+//    first - the first of the rays.
+//
+//Outputs: a bit for every ray that passes through the box
+static int hitBoxLanes(const BVHNode& node, const RayPacket* packet, const PacketInverse* inverse,
+                       const PacketHits* hits, int first)
+{
+    const float* origins[3] = { packet->ox, packet->oy, packet->oz };
+    const float* inverses[3] = { inverse->x, inverse->y, inverse->z };
+
+    __m128 tNear = _mm_setzero_ps();
+    __m128 tFar = _mm_load_ps(&hits->t[first]);
+    for( int a = 0; a < 3; ++a )
+    {
+        __m128 origin = _mm_load_ps(&origins[a][first]);
+        __m128 scale = _mm_load_ps(&inverses[a][first]);
+        __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.lower[a]), origin), scale);
+        __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.upper[a]), origin), scale);
+        tNear = _mm_max_ps(_mm_min_ps(t0, t1), tNear);
+        tFar = _mm_min_ps(_mm_max_ps(t0, t1), tFar);
+    }
+    return _mm_movemask_ps(_mm_cmple_ps(tNear, _mm_mul_ps(tFar, _mm_set1_ps(BOX_ROUNDING))));
+}
+
+//This function tests the rays of a packet that pass through a leaf
+//against its primitives. Every triangle is tested against PACKET_LANES
+//rays at a time, rounding exactly as intersectPrimitive does.
+//
+//Inputs:
+//    scene - the scene.
+//    bvh - its hierarchy.
+//    node - the leaf.
+//    packet - the rays.
+//    inverse - 1 / the direction of every ray.
+//    hits - the closest hits so far, updated.
+//    group - the first vector of rays that passes through the leaf.
+//    mask - the rays of that vector that do.
+//
+//Outputs: None
+static void intersectLeaf(const Scene* scene, const BVH* bvh, const BVHNode& node, const RayPacket* packet,
+                          const PacketInverse* inverse, PacketHits* hits, int group, int mask)
+{
+    int groups = packet->count / PACKET_LANES;
+    int masks[PACKET_MAX_RAYS / PACKET_LANES];
+    masks[group] = mask;
+    for( int g = group + 1; g < groups; ++g )
+    {
+        masks[g] = hitBoxLanes(node, packet, inverse, hits, g * PACKET_LANES);
+    }
+
+    const TriangleSoA& tris = bvh->triangles;
+    int triangles = (int)scene->triangles.size();
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 tiny = _mm_set1_ps(1e-12f);
+    const __m128 epsilon = _mm_set1_ps(HIT_EPSILON);
+    const __m128 sign = _mm_set1_ps(-0.0f);
+
+    for( int slot = node.first; slot < node.first + node.count; ++slot )
+    {
+        int prim = bvh->prims[slot];
+        if( prim >= triangles )
+        {
+            //Spheres a ray at a time.
+            for( int g = group; g < groups; ++g )
+            {
+                for( int lane = 0; lane < PACKET_LANES; ++lane )
+                {
+                    int i = g * PACKET_LANES + lane;
+                    float t;
+                    if( ((masks[g] >> lane) & 1) && intersectPrimitive(scene, prim, packetRay(packet, i), hits->t[i], &t) )
+                    {
+                        hits->t[i] = t;
+                        hits->prim[i] = prim;
+                    }
+                }
+            }
+            continue;
+        }
+
+        const __m128 x = _mm_set1_ps(tris.x[slot]);
+        const __m128 y = _mm_set1_ps(tris.y[slot]);
+        const __m128 z = _mm_set1_ps(tris.z[slot]);
+        const __m128 e1x = _mm_set1_ps(tris.e1x[slot]);
+        const __m128 e1y = _mm_set1_ps(tris.e1y[slot]);
+        const __m128 e1z = _mm_set1_ps(tris.e1z[slot]);
+        const __m128 e2x = _mm_set1_ps(tris.e2x[slot]);
+        const __m128 e2y = _mm_set1_ps(tris.e2y[slot]);
+        const __m128 e2z = _mm_set1_ps(tris.e2z[slot]);
+
+        for( int g = group; g < groups; ++g )
+        {
+            if( masks[g] == 0 )
+            {
+                continue;
+            }
+            int i = g * PACKET_LANES;
+            __m128 dx = _mm_load_ps(&packet->dx[i]);
+            __m128 dy = _mm_load_ps(&packet->dy[i]);
+            __m128 dz = _mm_load_ps(&packet->dz[i]);
+
+            __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+            __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+            __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+            __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+            __m128 inv = _mm_div_ps(one, det);
+
+            __m128 sx = _mm_sub_ps(_mm_load_ps(&packet->ox[i]), x);
+            __m128 sy = _mm_sub_ps(_mm_load_ps(&packet->oy[i]), y);
+            __m128 sz = _mm_sub_ps(_mm_load_ps(&packet->oz[i]), z);
+            __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), inv);
+
+            __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+            __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+            __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+            __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), inv);
+            __m128 d = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inv);
+
+            __m128 tMax = _mm_load_ps(&hits->t[i]);
+            __m128 ok = _mm_cmpge_ps(_mm_andnot_ps(sign, det), tiny);
+            ok = _mm_and_ps(ok, _mm_cmpge_ps(u, zero));
+            ok = _mm_and_ps(ok, _mm_cmple_ps(u, one));
+            ok = _mm_and_ps(ok, _mm_cmpge_ps(v, zero));
+            ok = _mm_and_ps(ok, _mm_cmple_ps(_mm_add_ps(u, v), one));
+            ok = _mm_and_ps(ok, _mm_cmpgt_ps(d, epsilon));
+            ok = _mm_and_ps(ok, _mm_cmplt_ps(d, tMax));
+
+            int hit = _mm_movemask_ps(ok) & masks[g];
+            if( hit != 0 )
+            {
+                _mm_store_ps(&hits->t[i], _mm_or_ps(_mm_and_ps(ok, d), _mm_andnot_ps(ok, tMax)));
+                for( int lane = 0; lane < PACKET_LANES; ++lane )
+                {
+                    if( (hit >> lane) & 1 )
+                    {
+                        hits->prim[i + lane] = prim;
+                    }
+                }
+            }
+        }
+    }
+}
+
+//This function returns the farthest of the closest hits of a packet.
+//
+//Inputs:
+//    hits - the closest hits so far.
+//    count - the rays of the packet.
+//
+//Outputs: the distance, INFINITY if a ray has not hit anything yet
+static float farthestHit(const PacketHits* hits, int count)
+{
+    __m128 farthest = _mm_load_ps(&hits->t[0]);
+    for( int i = PACKET_LANES; i < count; i += PACKET_LANES )
+    {
+        farthest = _mm_max_ps(farthest, _mm_load_ps(&hits->t[i]));
+    }
+    float lanes[PACKET_LANES];
+    _mm_storeu_ps(lanes, farthest);
+    return std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+}
+
+#endif
+
+void tracePacket(const Scene* scene, const BVH* bvh, const RayPacket* packet, PacketHits* hits, PacketStats* stats)
+{
+    for( int i = 0; i < packet->count; ++i )
+    {
+        hits->t[i] = INFINITY;
+        hits->prim[i] = -1;
+    }
+    if( bvh->prims.empty() )
+    {
+        return;
+    }
+
+    PacketInverse inverse;
+    PacketFrustum frustum;
+    bool together = makeFrustum(packet, &inverse, &frustum);
+#if !defined(__x86_64__)
+    //The lanes are SSE registers; elsewhere every packet is traced a ray at
+    //a time.
+    together = false;
+#endif
+    if( !together )
+    {
+        traceSingles(scene, bvh, packet, hits);
+        if( stats != NULL )
+        {
+            ++stats->packets;
+            ++stats->singles;
+        }
+        return;
+    }
+
+#if defined(__x86_64__)
+    int groups = packet->count / PACKET_LANES;
+    float farthest = INFINITY;
+    long nodes = 0;
+    long culled = 0;
+
+    //Every entry of the stack keeps the first vector of rays that passed
+    //through its parent: the rays before it cannot pass through the child.
+    int stack[BVH_MAX_DEPTH];
+    int firsts[BVH_MAX_DEPTH];
+    int top = 0;
+    int index = 0;
+    int first = 0;
+    while( true )
+    {
+        const BVHNode& node = bvh->nodes[index];
+        ++nodes;
+
+        if( frustumMisses(node, frustum, farthest) )
+        {
+            ++culled;
+        }
+        else
+        {
+            //Inner nodes only need one ray through them to be entered.
+            int group = first;
+            int mask = 0;
+            while( group < groups && (mask = hitBoxLanes(node, packet, &inverse, hits, group * PACKET_LANES)) == 0 )
+            {
+                ++group;
+            }
+
+            if( group < groups )
+            {
+                if( node.count > 0 )
+                {
+                    intersectLeaf(scene, bvh, node, packet, &inverse, hits, group, mask);
+                    farthest = farthestHit(hits, packet->count);
+                }
+                else
+                {
+                    int near = node.first + frustum.negative[node.axis];
+                    stack[top] = node.first + 1 - frustum.negative[node.axis];
+                    firsts[top++] = group;
+                    index = near;
+                    first = group;
+                    continue;
+                }
+            }
+        }
+
+        if( top == 0 )
+        {
+            break;
+        }
+        --top;
+        index = stack[top];
+        first = firsts[top];
+    }
+
+    if( stats != NULL )
+    {
+        ++stats->packets;
+        stats->nodes += nodes;
+        stats->culled += culled;
+    }
+#endif
+}
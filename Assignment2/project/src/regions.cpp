@@ -0,0 +1,151 @@
+//This file contains the regions of the static partitioning schemes and
+//the datatypes used to move them into the image.
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <mpi.h>
+
+#include "RayTrace.h"
+#include "tiles.h"
+#include "regions.h"
+
+std::vector<Tile> regionTiles(const ConfigData* data, int rank)
+{
+    int height = data->height;
+    int width = data->width;
+    int procs = data->mpi_procs;
+    std::vector<Tile> tiles;
+    Tile tile;
+
+    switch (data->partitioningMode)
+    {
+        case PART_MODE_STATIC_STRIPS_HORIZONTAL:
+        {
+            //The leftover columns go one each to the last ranks.
+            tile.row = 0;
+            tile.height = height;
+            tile.col = (int)((long)width * rank / procs);
+            tile.width = (int)((long)width * (rank + 1) / procs) - tile.col;
+            tiles.push_back(tile);
+            break;
+        }
+        case PART_MODE_STATIC_BLOCKS:
+        {
+            //A grid of across x down blocks, with across the largest
+            //divisor of procs up to its square root, so that the grid is
+            //as square as procs allows.
+            int across = (int)sqrt(procs);
+            while( procs % across != 0 )
+            {
+                --across;
+            }
+            int down = procs / across;
+
+            int x = rank % across;
+            int y = rank / across;
+            tile.col = (int)((long)width * x / across);
+            tile.width = (int)((long)width * (x + 1) / across) - tile.col;
+            tile.row = (int)((long)height * y / down);
+            tile.height = (int)((long)height * (y + 1) / down) - tile.row;
+            tiles.push_back(tile);
+            break;
+        }
+        case PART_MODE_STATIC_CYCLES_VERTICAL:
+        {
+            int cycle_height = data->cycleSize;
+            for( int part = rank * cycle_height; part < height; part += procs * cycle_height )
+            {
+                tile.row = part;
+                tile.height = (part + cycle_height >= height ? height : part + cycle_height) - part;
+                tile.col = 0;
+                tile.width = width;
+                tiles.push_back(tile);
+            }
+            break;
+        }
+        default:
+            break;
+    }
+
+    //Drop empty tiles, so that they cost no messages.
+    std::vector<Tile> region;
+    for( size_t i = 0; i < tiles.size(); ++i )
+    {
+        if( tiles[i].width > 0 && tiles[i].height > 0 )
+        {
+            region.push_back(tiles[i]);
+        }
+    }
+
+    return region;
+}
+
+int regionSize(const std::vector<Tile>& tiles)
+{
+    int size = 0;
+    for( size_t i = 0; i < tiles.size(); ++i )
+    {
+        size += 3 * tiles[i].width * tiles[i].height;
+    }
+
+    return size;
+}
+
+std::vector<Tile> regionChunks(const std::vector<Tile>& tiles)
+{
+    std::vector<Tile> chunks;
+    for( size_t i = 0; i < tiles.size(); ++i )
+    {
+        int rows = std::max(1, STREAM_CHUNK_PIXELS / tiles[i].width);
+        for( int row = 0; row < tiles[i].height; row += rows )
+        {
+            Tile chunk = tiles[i];
+            chunk.row += row;
+            chunk.height = std::min(rows, tiles[i].height - row);
+            chunks.push_back(chunk);
+        }
+    }
+
+    return chunks;
+}
+
+MPI_Datatype regionType(const ConfigData* data, const std::vector<Tile>& tiles)
+{
+    MPI_Datatype type;
+
+    if( tiles.size() == 1 )
+    {
+        //The image as a height x 3 * width array of floats.
+        int sizes[2] = { data->height, 3 * data->width };
+        int subsizes[2] = { tiles[0].height, 3 * tiles[0].width };
+        int starts[2] = { tiles[0].row, 3 * tiles[0].col };
+        MPI_Type_create_subarray(2, sizes, subsizes, starts, MPI_ORDER_C, MPI_FLOAT, &type);
+    }
+    else
+    {
+        //One run per row of every tile; a tile as wide as the image is a
+        //single run.
+        std::vector<int> lengths;
+        std::vector<int> offsets;
+        for( size_t i = 0; i < tiles.size(); ++i )
+        {
+            const Tile& tile = tiles[i];
+            if( tile.width == data->width )
+            {
+                lengths.push_back(3 * tile.width * tile.height);
+                offsets.push_back(3 * tile.row * data->width);
+                continue;
+            }
+            for( int row = tile.row; row < tile.row + tile.height; ++row )
+            {
+                lengths.push_back(3 * tile.width);
+                offsets.push_back(3 * ( row * data->width + tile.col ));
+            }
+        }
+        MPI_Type_indexed((int)lengths.size(), lengths.data(), offsets.data(), MPI_FLOAT, &type);
+    }
+
+    MPI_Type_commit(&type);
+    return type;
+}
@@ -0,0 +1,814 @@
+//This file contains the loader of the scenes used by the in-tree
+//acceleration code: a small reader for the configuration XML and the
+//.obj and .mtl files it points to.
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "scene.h"
+
+//An element of the configuration file.
+struct XmlNode
+{
+    std::string name;
+    std::map<std::string, std::string> attributes;
+    std::string text;
+    std::vector<XmlNode> children;
+};
+
+//An <IlluminationModel>: PhongBlinn weighs the colors of the materials
+//it lights, CheckerBoardXZ paints them with squares of two colors.
+struct SceneModel
+{
+    float ka;
+    float kd;
+    float ks;
+    float checkSize;
+    Color checks[2];
+};
+
+//Primatives
+static bool readXml(const std::string& text, XmlNode* document);
+static void readTag(const std::string& tag, XmlNode* node);
+static const XmlNode* findChild(const XmlNode* node, const char* name);
+static std::string attribute(const XmlNode* node, const char* name);
+static std::string trimmed(const std::string& text);
+static bool readPoints(const XmlNode* list, std::map<std::string, Vec3>* points);
+static bool readColors(const XmlNode* list, std::map<std::string, Color>* colors);
+static bool readMatrices(const XmlNode* list, std::map<std::string, Mat4>* matrices);
+static bool readModels(const XmlNode* list, const std::map<std::string, Color>& colors,
+                       std::map<std::string, SceneModel>* models);
+template <typename T>
+static bool lookUp(const std::map<std::string, T>& points, const std::string& id, T* point);
+static Material defaultMaterial();
+static void loadMtl(const std::string& path, std::map<std::string, Material>* materials);
+static int addMaterial(const Material& material, const SceneModel& model, Scene* scene);
+static void loadObj(const std::string& path, const std::vector<Mat4>& matrices, const SceneModel& model,
+                    Scene* scene);
+
+//This function reads an XML document into a tree of nodes. Comments,
+//declarations and CDATA are skipped; entities are not expanded.
+//
+//Inputs:
+//    text - the document.
+//    document - filled in with the top level elements as its children.
+//
+//Outputs: true if the document is not well formed; otherwise, false
+static bool readXml(const std::string& text, XmlNode* document)
+{
+    //The elements that are still open, innermost last. Only the last
+    //child of an element can be open, so the pointers stay valid.
+    std::vector<XmlNode*> open;
+    open.push_back(document);
+
+    size_t pos = 0;
+    while( pos < text.size() )
+    {
+        size_t start = text.find('<', pos);
+        if( start == std::string::npos )
+        {
+            break;
+        }
+        open.back()->text += text.substr(pos, start - pos);
+
+        if( text.compare(start, 4, "<!--") == 0 )
+        {
+            size_t end = text.find("-->", start);
+            if( end == std::string::npos )
+            {
+                return true;
+            }
+            pos = end + 3;
+            continue;
+        }
+
+        size_t end = text.find('>', start);
+        if( end == std::string::npos )
+        {
+            return true;
+        }
+        std::string tag = text.substr(start + 1, end - start - 1);
+        pos = end + 1;
+
+        if( tag.empty() || tag[0] == '?' || tag[0] == '!' )
+        {
+            continue;
+        }
+        if( tag[0] == '/' )
+        {
+            if( open.size() < 2 || trimmed(tag.substr(1)) != open.back()->name )
+            {
+                return true;
+            }
+            open.pop_back();
+            continue;
+        }
+
+        bool closed = (tag[tag.size() - 1] == '/');
+        if( closed )
+        {
+            tag.erase(tag.size() - 1);
+        }
+
+        XmlNode* parent = open.back();
+        parent->children.push_back(XmlNode());
+        readTag(tag, &(parent->children.back()));
+        if( !closed )
+        {
+            open.push_back(&(parent->children.back()));
+        }
+    }
+
+    return open.size() != 1;
+}
+
+//This function reads the name and attributes of a start tag.
+//
+//Inputs:
+//    tag - what is between < and >.
+//    node - set to the name and attributes.
+//
+//Outputs: None
+static void readTag(const std::string& tag, XmlNode* node)
+{
+    const char* spaces = " \t\r\n";
+    size_t pos = tag.find_first_of(spaces);
+    node->name = tag.substr(0, pos);
+
+    while( pos != std::string::npos )
+    {
+        size_t nameStart = tag.find_first_not_of(spaces, pos);
+        size_t equals = tag.find('=', nameStart);
+        if( nameStart == std::string::npos || equals == std::string::npos )
+        {
+            break;
+        }
+        size_t open = tag.find_first_of("\"'", equals);
+        if( open == std::string::npos )
+        {
+            break;
+        }
+        size_t close = tag.find(tag[open], open + 1);
+        if( close == std::string::npos )
+        {
+            break;
+        }
+
+        std::string name = trimmed(tag.substr(nameStart, equals - nameStart));
+        node->attributes[name] = tag.substr(open + 1, close - open - 1);
+        pos = close + 1;
+    }
+}
+
+//This function returns the first child of an element with a name.
+//
+//Inputs:
+//    node - the element, may be NULL.
+//    name - the name of the child.
+//
+//Outputs: the child, or NULL if there is none
+static const XmlNode* findChild(const XmlNode* node, const char* name)
+{
+    if( node == NULL )
+    {
+        return NULL;
+    }
+    for( size_t i = 0; i < node->children.size(); ++i )
+    {
+        if( node->children[i].name == name )
+        {
+            return &(node->children[i]);
+        }
+    }
+    return NULL;
+}
+
+//This function returns an attribute of an element.
+//
+//Inputs:
+//    node - the element.
+//    name - the name of the attribute.
+//
+//Outputs: the value, empty if the attribute is not there
+static std::string attribute(const XmlNode* node, const char* name)
+{
+    std::map<std::string, std::string>::const_iterator found = node->attributes.find(name);
+    return found == node->attributes.end() ? std::string() : found->second;
+}
+
+//This function returns a string without the white space around it.
+//
+//Inputs:
+//    text - the string.
+//
+//Outputs: the trimmed string
+static std::string trimmed(const std::string& text)
+{
+    const char* spaces = " \t\r\n";
+    size_t first = text.find_first_not_of(spaces);
+    if( first == std::string::npos )
+    {
+        return std::string();
+    }
+    size_t last = text.find_last_not_of(spaces);
+    return text.substr(first, last - first + 1);
+}
+
+//This function reads the <Point> or <Vector> elements of a list.
+//
+//Inputs:
+//    list - the <Points> or <Vectors> element, may be NULL.
+//    points - the points found are added here by ID.
+//
+//Outputs: true if an element has no ID; otherwise, false
+static bool readPoints(const XmlNode* list, std::map<std::string, Vec3>* points)
+{
+    if( list == NULL )
+    {
+        return false;
+    }
+    for( size_t i = 0; i < list->children.size(); ++i )
+    {
+        const XmlNode* point = &(list->children[i]);
+        std::string id = attribute(point, "ID");
+        if( id.empty() )
+        {
+            std::cerr << "A <" << point->name << "> has no ID!" << std::endl;
+            return true;
+        }
+        (*points)[id] = makeVec3((float)atof(attribute(point, "X").c_str()),
+                                 (float)atof(attribute(point, "Y").c_str()),
+                                 (float)atof(attribute(point, "Z").c_str()));
+    }
+    return false;
+}
+
+//This function reads the <Color> elements of the configuration.
+//
+//Inputs:
+//    list - the <Colors> element, may be NULL.
+//    colors - the colors found are added here by ID, as R, G, B.
+//
+//Outputs: true if an element has no ID; otherwise, false
+static bool readColors(const XmlNode* list, std::map<std::string, Color>* colors)
+{
+    if( list == NULL )
+    {
+        return false;
+    }
+    for( size_t i = 0; i < list->children.size(); ++i )
+    {
+        const XmlNode* color = &(list->children[i]);
+        std::string id = attribute(color, "ID");
+        if( id.empty() )
+        {
+            std::cerr << "A <" << color->name << "> has no ID!" << std::endl;
+            return true;
+        }
+        (*colors)[id] = makeColor((float)atof(attribute(color, "R").c_str()),
+                                  (float)atof(attribute(color, "G").c_str()),
+                                  (float)atof(attribute(color, "B").c_str()));
+    }
+    return false;
+}
+
+//This function reads the <Matrix> elements of the configuration. Those
+//of the configurations only ever scale and translate, and that is all
+//this loader understands.
+//
+//Inputs:
+//    list - the <Matrices> element, may be NULL.
+//    matrices - the matrices found are added here by ID.
+//
+//Outputs: true if a matrix is not a Translate or Scale; otherwise, false
+static bool readMatrices(const XmlNode* list, std::map<std::string, Mat4>* matrices)
+{
+    if( list == NULL )
+    {
+        return false;
+    }
+    for( size_t i = 0; i < list->children.size(); ++i )
+    {
+        const XmlNode* matrix = &(list->children[i]);
+        std::string type = attribute(matrix, "Type");
+        bool scale = (type == "Scale");
+        if( !scale && type != "Translate" )
+        {
+            std::cerr << "Matrix " << attribute(matrix, "ID") << ": only Translate and Scale are supported!" << std::endl;
+            return true;
+        }
+
+        //A missing axis leaves it alone.
+        float values[3];
+        const char* axes[3] = { "X", "Y", "Z" };
+        for( int a = 0; a < 3; ++a )
+        {
+            const XmlNode* axis = findChild(matrix, axes[a]);
+            values[a] = axis != NULL ? (float)atof(axis->text.c_str()) : (scale ? 1.0f : 0.0f);
+        }
+
+        Vec3 v = makeVec3(values[0], values[1], values[2]);
+        (*matrices)[attribute(matrix, "ID")] = scale ? scaleMatrix(v) : translateMatrix(v);
+    }
+    return false;
+}
+
+//This function reads the <IlluminationModel> elements of the world.
+//
+//Inputs:
+//    list - the <IlluminationModels> element, may be NULL.
+//    colors - the colors of the configuration.
+//    models - the models found are added here by ID.
+//
+//Outputs: true if a model is not a PhongBlinn or CheckerBoardXZ, or
+//    names an unknown color; otherwise, false
+static bool readModels(const XmlNode* list, const std::map<std::string, Color>& colors,
+                       std::map<std::string, SceneModel>* models)
+{
+    if( list == NULL )
+    {
+        return false;
+    }
+    for( size_t i = 0; i < list->children.size(); ++i )
+    {
+        const XmlNode* node = &(list->children[i]);
+        std::string type = attribute(node, "Type");
+        SceneModel model = { 1.0f, 1.0f, 1.0f, 0.0f, { makeColor(1.0f, 1.0f, 1.0f), makeColor(1.0f, 1.0f, 1.0f) } };
+
+        if( type == "PhongBlinn" )
+        {
+            const char* names[3] = { "Ka", "Kd", "Ks" };
+            float* weights[3] = { &model.ka, &model.kd, &model.ks };
+            for( int k = 0; k < 3; ++k )
+            {
+                const XmlNode* weight = findChild(node, names[k]);
+                if( weight != NULL )
+                {
+                    *weights[k] = (float)atof(weight->text.c_str());
+                }
+            }
+        }
+        else if( type == "CheckerBoardXZ" )
+        {
+            const char* names[2] = { "Color1", "Color2" };
+            for( int k = 0; k < 2; ++k )
+            {
+                const XmlNode* color = findChild(node, names[k]);
+                std::map<std::string, Color>::const_iterator found = colors.find(color != NULL ? trimmed(color->text) : "");
+                if( found == colors.end() )
+                {
+                    std::cerr << "Illumination model " << attribute(node, "ID") << ": unknown " << names[k] << std::endl;
+                    return true;
+                }
+                model.checks[k] = found->second;
+            }
+            const XmlNode* size = findChild(node, "CheckSize");
+            model.checkSize = size != NULL ? (float)atof(size->text.c_str()) : 1.0f;
+        }
+        else
+        {
+            std::cerr << "Illumination model " << attribute(node, "ID") << ": only PhongBlinn and CheckerBoardXZ are supported!" << std::endl;
+            return true;
+        }
+        (*models)[attribute(node, "ID")] = model;
+    }
+    return false;
+}
+
+//This function looks up a point, vector or color by ID.
+//
+//Inputs:
+//    points - the points and vectors, or the colors, of the configuration.
+//    id - the ID.
+//    point - set to the point.
+//
+//Outputs: true if there is no such point; otherwise, false
+template <typename T>
+static bool lookUp(const std::map<std::string, T>& points, const std::string& id, T* point)
+{
+    typename std::map<std::string, T>::const_iterator found = points.find(id);
+    if( found == points.end() )
+    {
+        std::cerr << "Unknown point, vector or color: " << id << std::endl;
+        return true;
+    }
+    *point = found->second;
+    return false;
+}
+
+//This function returns the material of a surface that has none: white
+//and dull.
+//
+//Inputs: None
+//
+//Outputs: the material
+static Material defaultMaterial()
+{
+    Material material;
+    material.ambient = makeColor(1.0f, 1.0f, 1.0f);
+    material.diffuse = makeColor(1.0f, 1.0f, 1.0f);
+    material.specular = makeColor(0.0f, 0.0f, 0.0f);
+    material.reflective = makeColor(0.0f, 0.0f, 0.0f);
+    material.transmissive = makeColor(0.0f, 0.0f, 0.0f);
+    material.shininess = 1.0f;
+    material.refraction = 1.0f;
+    material.checkSize = 0.0f;
+    material.checks[0] = material.checks[1] = makeColor(1.0f, 1.0f, 1.0f);
+    return material;
+}
+
+//This function reads the materials of an .mtl file. A missing file is
+//reported and skipped; its materials are then the default one.
+//
+//Inputs:
+//    path - the path of the file.
+//    materials - the materials found are added here by name.
+//
+//Outputs: None
+static void loadMtl(const std::string& path, std::map<std::string, Material>* materials)
+{
+    std::ifstream file(path.c_str());
+    if( !file )
+    {
+        std::cerr << "ERROR: " << path << " could not be found. Make sure that it exists." << std::endl;
+        return;
+    }
+
+    Material* material = NULL;
+    std::string line;
+    while( std::getline(file, line) )
+    {
+        std::istringstream words(line);
+        std::string keyword;
+        words >> keyword;
+
+        if( keyword == "newmtl" )
+        {
+            std::string name;
+            words >> name;
+            material = &((*materials)[name]);
+            *material = defaultMaterial();
+            material->ambient = material->diffuse = makeColor(0.0f, 0.0f, 0.0f);
+            continue;
+        }
+        if( material == NULL )
+        {
+            continue;
+        }
+
+        Color* color = NULL;
+        if( keyword == "Ka" )
+        {
+            color = &(material->ambient);
+        }
+        else if( keyword == "Kd" )
+        {
+            color = &(material->diffuse);
+        }
+        else if( keyword == "Ks" )
+        {
+            color = &(material->specular);
+        }
+        else if( keyword == "Kr" )
+        {
+            color = &(material->reflective);
+        }
+        else if( keyword == "Tf" )
+        {
+            color = &(material->transmissive);
+        }
+        else if( keyword == "Ns" )
+        {
+            words >> material->shininess;
+        }
+        else if( keyword == "Ni" )
+        {
+            words >> material->refraction;
+        }
+
+        if( color != NULL )
+        {
+            words >> color->x >> color->y >> color->z;
+        }
+    }
+}
+
+//This function adds a material, lit by an illumination model, to a
+//scene.
+//
+//Inputs:
+//    material - the material of the .mtl file.
+//    model - the illumination model of the <Model>.
+//    scene - the scene.
+//
+//Outputs: the index of the material in the scene
+static int addMaterial(const Material& material, const SceneModel& model, Scene* scene)
+{
+    Material lit = material;
+    lit.ambient = material.ambient * model.ka;
+    lit.diffuse = material.diffuse * model.kd;
+    lit.specular = material.specular * model.ks;
+    lit.checkSize = model.checkSize;
+    lit.checks[0] = model.checks[0];
+    lit.checks[1] = model.checks[1];
+    scene->materials.push_back(lit);
+    return (int)scene->materials.size() - 1;
+}
+
+//This function adds the triangles and spheres of an .obj file, and their
+//materials, to a scene. Faces with more than 3 vertices are split into a
+//fan. A missing file is reported and skipped, as libraytrace does.
+//
+//Inputs:
+//    path - the path of the file.
+//    matrices - applied to the geometry in this order.
+//    model - the illumination model of the <Model>.
+//    scene - the scene.
+//
+//Outputs: None
+static void loadObj(const std::string& path, const std::vector<Mat4>& matrices, const SceneModel& model,
+                    Scene* scene)
+{
+    scene->sources.push_back(path);
+    std::ifstream file(path.c_str());
+    if( !file )
+    {
+        std::cerr << "ERROR: " << path << " could not be found. Make sure that it exists." << std::endl;
+        return;
+    }
+
+    //The .mtl files are next to the .obj file.
+    size_t slash = path.find_last_of('/');
+    std::string directory = slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+    std::map<std::string, Material> library;
+    std::map<std::string, int> used;
+    int material = -1;
+
+    std::vector<Vec3> vertices;
+    std::vector<Triangle> triangles;
+    std::vector<Sphere> spheres;
+    std::vector<int> triangleMaterials;
+    std::vector<int> sphereMaterials;
+    bool sphere = false;
+    Sphere next = { makeVec3(0.0f, 0.0f, 0.0f), 0.0f };
+
+    std::string line;
+    while( std::getline(file, line) )
+    {
+        std::istringstream words(line);
+        std::string keyword;
+        words >> keyword;
+
+        if( keyword == "mtllib" )
+        {
+            std::string name;
+            words >> name;
+            scene->sources.push_back(directory + name);
+            loadMtl(directory + name, &library);
+        }
+        else if( keyword == "usemtl" )
+        {
+            std::string name;
+            words >> name;
+            std::map<std::string, int>::const_iterator found = used.find(name);
+            if( found == used.end() )
+            {
+                std::map<std::string, Material>::const_iterator known = library.find(name);
+                int index = addMaterial(known != library.end() ? known->second : defaultMaterial(), model, scene);
+                found = used.insert(std::make_pair(name, index)).first;
+            }
+            material = found->second;
+        }
+        else if( keyword == "v" )
+        {
+            Vec3 v = makeVec3(0.0f, 0.0f, 0.0f);
+            words >> v.x >> v.y >> v.z;
+            vertices.push_back(v);
+        }
+        else if( keyword == "f" )
+        {
+            //Only the position index of v/vt/vn is used; negative indices
+            //count back from the last vertex.
+            std::vector<int> face;
+            std::string corner;
+            while( words >> corner )
+            {
+                int index = atoi(corner.c_str());
+                index = index < 0 ? (int)vertices.size() + index : index - 1;
+                if( index < 0 || index >= (int)vertices.size() )
+                {
+                    std::cerr << path << ": bad vertex index in: " << line << std::endl;
+                    face.clear();
+                    break;
+                }
+                face.push_back(index);
+            }
+            if( material < 0 && face.size() > 2 )
+            {
+                material = addMaterial(defaultMaterial(), model, scene);
+            }
+            for( size_t k = 2; k < face.size(); ++k )
+            {
+                Triangle t = { vertices[face[0]], vertices[face[k - 1]], vertices[face[k]] };
+                triangles.push_back(t);
+                triangleMaterials.push_back(material);
+            }
+        }
+        else if( keyword == "type" )
+        {
+            std::string type;
+            words >> type;
+            sphere = (type == "sphere");
+        }
+        else if( keyword == "sP" && sphere )
+        {
+            words >> next.center.x >> next.center.y >> next.center.z;
+        }
+        else if( keyword == "sR" && sphere )
+        {
+            words >> next.radius;
+            if( material < 0 )
+            {
+                material = addMaterial(defaultMaterial(), model, scene);
+            }
+            spheres.push_back(next);
+            sphereMaterials.push_back(material);
+        }
+    }
+
+    //Apply the matrices, one at a time so that every coordinate is
+    //rounded as the matrices list it. A sphere keeps its shape, so its
+    //radius follows the longest axis.
+    for( size_t m = 0; m < matrices.size(); ++m )
+    {
+        const Mat4& matrix = matrices[m];
+        float radiusScale = 0.0f;
+        for( int a = 0; a < 3; ++a )
+        {
+            radiusScale = fmaxf(radiusScale, sqrtf(dot(matrix.columns[a], matrix.columns[a])));
+        }
+
+        for( size_t i = 0; i < triangles.size(); ++i )
+        {
+            triangles[i].a = transformPoint(matrix, triangles[i].a);
+            triangles[i].b = transformPoint(matrix, triangles[i].b);
+            triangles[i].c = transformPoint(matrix, triangles[i].c);
+        }
+        for( size_t i = 0; i < spheres.size(); ++i )
+        {
+            spheres[i].center = transformPoint(matrix, spheres[i].center);
+            spheres[i].radius *= radiusScale;
+        }
+    }
+
+    scene->triangles.insert(scene->triangles.end(), triangles.begin(), triangles.end());
+    scene->spheres.insert(scene->spheres.end(), spheres.begin(), spheres.end());
+    scene->triangleMaterials.insert(scene->triangleMaterials.end(), triangleMaterials.begin(), triangleMaterials.end());
+    scene->sphereMaterials.insert(scene->sphereMaterials.end(), sphereMaterials.begin(), sphereMaterials.end());
+}
+
+bool loadScene(const char* config, Scene* scene)
+{
+    scene->sources.push_back(config);
+    std::ifstream file(config);
+    if( !file )
+    {
+        std::cerr << "Could not open the configuration file: " << config << std::endl;
+        return true;
+    }
+    std::stringstream contents;
+    contents << file.rdbuf();
+
+    XmlNode document;
+    if( readXml(contents.str(), &document) )
+    {
+        std::cerr << "The configuration file is not well formed: " << config << std::endl;
+        return true;
+    }
+
+    const XmlNode* root = findChild(&document, "Configuration");
+    const XmlNode* camera = findChild(root, "Camera");
+    const XmlNode* world = findChild(root, "World");
+    if( camera == NULL || world == NULL )
+    {
+        std::cerr << "The configuration needs a <Camera> and a <World>: " << config << std::endl;
+        return true;
+    }
+    scene->id = attribute(root, "Id");
+
+    std::map<std::string, Vec3> points;
+    std::map<std::string, Color> colors;
+    std::map<std::string, Mat4> matrices;
+    std::map<std::string, SceneModel> illumination;
+    if( readPoints(findChild(root, "Points"), &points) ||
+        readPoints(findChild(root, "Vectors"), &points) ||
+        readColors(findChild(root, "Colors"), &colors) ||
+        readMatrices(findChild(root, "Matrices"), &matrices) ||
+        readModels(findChild(world, "IlluminationModels"), colors, &illumination) )
+    {
+        return true;
+    }
+
+    SceneCamera& view = scene->camera;
+    if( lookUp(points, attribute(camera, "EyePoint"), &view.eye) ||
+        lookUp(points, attribute(camera, "LookAt"), &view.lookAt) ||
+        lookUp(points, attribute(camera, "Up"), &view.up) )
+    {
+        return true;
+    }
+    view.frameWidth = (float)atof(attribute(camera, "FrameWidth").c_str());
+    view.frameHeight = (float)atof(attribute(camera, "FrameHeight").c_str());
+    view.focalDistance = (float)atof(attribute(camera, "FocalDistance").c_str());
+
+    //Colors are looked up like points; a missing background is black.
+    scene->background = makeColor(0.0f, 0.0f, 0.0f);
+    if( !attribute(world, "Color").empty() && lookUp(colors, attribute(world, "Color"), &scene->background) )
+    {
+        return true;
+    }
+
+    const XmlNode* lights = findChild(world, "Lights");
+    for( size_t i = 0; lights != NULL && i < lights->children.size(); ++i )
+    {
+        const XmlNode* node = &(lights->children[i]);
+        SceneLight light;
+        if( lookUp(points, attribute(node, "Position"), &light.position) ||
+            lookUp(colors, attribute(node, "Ambient"), &light.ambient) ||
+            lookUp(colors, attribute(node, "Diffuse"), &light.diffuse) ||
+            lookUp(colors, attribute(node, "Specular"), &light.specular) )
+        {
+            return true;
+        }
+        scene->lights.push_back(light);
+    }
+
+    const XmlNode* models = findChild(world, "Models");
+    for( size_t i = 0; models != NULL && i < models->children.size(); ++i )
+    {
+        const XmlNode* model = &(models->children[i]);
+        const XmlNode* path = findChild(model, "Path");
+        if( attribute(model, "Type") != "File" || path == NULL )
+        {
+            std::cerr << "Only <Model Type=\"File\"> with a <Path> is supported!" << std::endl;
+            return true;
+        }
+
+        std::vector<Mat4> apply;
+        const XmlNode* list = findChild(model, "ApplyMatrices");
+        for( size_t k = 0; list != NULL && k < list->children.size(); ++k )
+        {
+            std::string id = attribute(&(list->children[k]), "ID");
+            std::map<std::string, Mat4>::const_iterator found = matrices.find(id);
+            if( found == matrices.end() )
+            {
+                std::cerr << "Unknown matrix: " << id << std::endl;
+                return true;
+            }
+            apply.push_back(found->second);
+        }
+
+        std::map<std::string, SceneModel>::const_iterator lit = illumination.find(attribute(model, "IlluminationModel"));
+        if( lit == illumination.end() )
+        {
+            std::cerr << "Unknown illumination model: " << attribute(model, "IlluminationModel") << std::endl;
+            return true;
+        }
+
+        loadObj(trimmed(path->text), apply, lit->second, scene);
+    }
+
+    return false;
+}
+
+int primitiveCount(const Scene* scene)
+{
+    return (int)(scene->triangles.size() + scene->spheres.size());
+}
+
+const Material& materialOf(const Scene* scene, int prim)
+{
+    int triangles = (int)scene->triangles.size();
+    return scene->materials[prim < triangles ? scene->triangleMaterials[prim] : scene->sphereMaterials[prim - triangles]];
+}
+
+Ray cameraRay(const SceneCamera& camera, int width, int height, int row, int col)
+{
+    //The camera looks down -w, with u to the right and v up.
+    Vec3 w = normalize(camera.eye - camera.lookAt);
+    Vec3 u = normalize(cross(camera.up, w));
+    Vec3 v = cross(w, u);
+
+    float x = -camera.frameWidth / 2.0f + (col + 0.5f) * (camera.frameWidth / width);
+    float y = camera.frameHeight / 2.0f - (row + 0.5f) * (camera.frameHeight / height);
+
+    Ray ray;
+    ray.origin = camera.eye;
+    ray.direction = normalize(u * x + v * y - w * camera.focalDistance);
+    return ray;
+}
@@ -0,0 +1,469 @@
+//This file contains the Whitted shading of the in-tree scenes: the depth
+//first renderer and the wavefront one, which share how a hit is lit.
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "scene.h"
+#include "bvh.h"
+#include "shade.h"
+
+//Where a ray hits, and how the surface there is lit.
+struct Surface
+{
+    Vec3 point;
+    Vec3 normal;          //Of length 1, on the side the ray comes from.
+    bool entering;        //Whether the ray goes into the primitive.
+    Color ambient;        //Of the material, checkers applied.
+    Color diffuse;
+    const Material* material;
+};
+
+//A ray of the wavefront renderer, with what its color adds to its pixel.
+struct QueuedRay
+{
+    Ray ray;
+    Color weight;
+    int pixel;            //In the batch.
+    int depth;
+    unsigned int key;
+};
+
+//A shadow ray, with the light its pixel gets if nothing is in the way.
+struct ShadowQuery
+{
+    Ray ray;
+    float distance;       //To the light.
+    Color color;
+    int pixel;
+    unsigned int key;
+};
+
+//The grid over the scene that rays are sorted by.
+struct SortGrid
+{
+    Vec3 lower;
+    Vec3 scale;           //Cells per unit, per axis.
+};
+
+//Primatives
+static bool isBlack(const Color& color);
+static Vec3 offsetPoint(const Surface& surface, float side);
+static Surface surfaceAt(const Scene* scene, const Ray& ray, const Hit& hit);
+static Color lightSurface(const SceneLight& light, const Surface& surface, const Ray& ray, Color* lit, Ray* shadow,
+                          float* distance);
+static bool occluded(const Scene* scene, const BVH* bvh, const Ray& shadow, float distance);
+static Ray reflectRay(const Surface& surface, const Ray& ray);
+static bool refractRay(const Surface& surface, const Ray& ray, Ray* refracted);
+static Color traceRecursive(const Scene* scene, const BVH* bvh, const Ray& ray, int depth, ShadeStats* stats);
+static SortGrid sortGrid(const BVH* bvh);
+static unsigned int rayKey(const Ray& ray, const SortGrid& grid);
+
+//This function returns whether a color adds nothing.
+//
+//Inputs:
+//    color - the color.
+//
+//Outputs: true if every channel is 0; otherwise, false
+static bool isBlack(const Color& color)
+{
+    return color.x == 0.0f && color.y == 0.0f && color.z == 0.0f;
+}
+
+//This function moves the point of a surface off it, so that a ray
+//leaving from there does not hit the surface again. The offset grows
+//with the size of the coordinates, as their rounding error does.
+//
+//Inputs:
+//    surface - the surface.
+//    side - 1 for the side of the normal, -1 for the other one.
+//
+//Outputs: the point
+static Vec3 offsetPoint(const Surface& surface, float side)
+{
+    const Vec3& p = surface.point;
+    float size = fmaxf(1.0f, fmaxf(fabsf(p.x), fmaxf(fabsf(p.y), fabsf(p.z))));
+    return p + surface.normal * (side * SHADE_OFFSET * size);
+}
+
+//This function finds the surface a ray hits.
+//
+//Inputs:
+//    scene - the scene.
+//    ray - the ray.
+//    hit - where it hits.
+//
+//Outputs: the surface
+static Surface surfaceAt(const Scene* scene, const Ray& ray, const Hit& hit)
+{
+    Surface surface;
+    surface.point = ray.origin + ray.direction * hit.t;
+    surface.material = &materialOf(scene, hit.prim);
+
+    //Triangles face the side their corners go around counterclockwise.
+    int triangles = (int)scene->triangles.size();
+    Vec3 outward;
+    if( hit.prim < triangles )
+    {
+        const Triangle& tri = scene->triangles[hit.prim];
+        outward = normalize(cross(tri.b - tri.a, tri.c - tri.a));
+    }
+    else
+    {
+        outward = normalize(surface.point - scene->spheres[hit.prim - triangles].center);
+    }
+    surface.entering = dot(ray.direction, outward) < 0.0f;
+    surface.normal = surface.entering ? outward : outward * -1.0f;
+
+    surface.ambient = surface.material->ambient;
+    surface.diffuse = surface.material->diffuse;
+    if( surface.material->checkSize > 0.0f )
+    {
+        int x = (int)floorf(surface.point.x / surface.material->checkSize);
+        int z = (int)floorf(surface.point.z / surface.material->checkSize);
+        const Color& check = surface.material->checks[(x + z) & 1];
+        surface.ambient = surface.ambient * check;
+        surface.diffuse = surface.diffuse * check;
+    }
+    return surface;
+}
+
+//This function lights a surface with one light, Phong-Blinn.
+//
+//Inputs:
+//    light - the light.
+//    surface - the surface.
+//    ray - the ray that hit the surface.
+//    lit - set to the diffuse and specular light, which only counts if
+//        nothing is between the surface and the light; black if the light
+//        is behind the surface.
+//    shadow - set to the ray towards the light, if lit is not black.
+//    distance - set to the distance to the light.
+//
+//Outputs: the ambient light, which always counts
+static Color lightSurface(const SceneLight& light, const Surface& surface, const Ray& ray, Color* lit, Ray* shadow,
+                          float* distance)
+{
+    Vec3 toLight = light.position - surface.point;
+    *distance = sqrtf(dot(toLight, toLight));
+    Vec3 direction = toLight * (1.0f / *distance);
+
+    *lit = makeColor(0.0f, 0.0f, 0.0f);
+    float diffuse = dot(surface.normal, direction);
+    if( diffuse > 0.0f )
+    {
+        Vec3 half = normalize(direction - ray.direction);
+        float specular = powf(fmaxf(0.0f, dot(surface.normal, half)), surface.material->shininess);
+        *lit = light.diffuse * surface.diffuse * diffuse + light.specular * surface.material->specular * specular;
+        shadow->origin = offsetPoint(surface, 1.0f);
+        shadow->direction = direction;
+    }
+    return light.ambient * surface.ambient;
+}
+
+//This function finds whether anything is between a point and a light.
+//The first occluder found will do, so this is traced with traceAny.
+//
+//Inputs:
+//    scene - the scene.
+//    bvh - its hierarchy.
+//    shadow - the ray from the point towards the light.
+//    distance - the distance to the light.
+//
+//Outputs: true if the light is blocked; otherwise, false
+static bool occluded(const Scene* scene, const BVH* bvh, const Ray& shadow, float distance)
+{
+    return traceAny(scene, bvh, shadow, distance, NULL);
+}
+
+//This function returns the ray a surface reflects.
+//
+//Inputs:
+//    surface - the surface.
+//    ray - the ray that hit it.
+//
+//Outputs: the reflected ray
+static Ray reflectRay(const Surface& surface, const Ray& ray)
+{
+    Ray reflected;
+    reflected.origin = offsetPoint(surface, 1.0f);
+    reflected.direction = ray.direction - surface.normal * (2.0f * dot(ray.direction, surface.normal));
+    return reflected;
+}
+
+//This function finds the ray a surface refracts, by Snell's law.
+//
+//Inputs:
+//    surface - the surface.
+//    ray - the ray that hit it.
+//    refracted - set to the refracted ray.
+//
+//Outputs: true if there is one; false if the ray is totally reflected
+static bool refractRay(const Surface& surface, const Ray& ray, Ray* refracted)
+{
+    float eta = surface.entering ? 1.0f / surface.material->refraction : surface.material->refraction;
+    float cosIn = -dot(ray.direction, surface.normal);
+    float k = 1.0f - eta * eta * (1.0f - cosIn * cosIn);
+    if( k < 0.0f )
+    {
+        return false;
+    }
+    refracted->origin = offsetPoint(surface, -1.0f);
+    refracted->direction = normalize(ray.direction * eta + surface.normal * (eta * cosIn - sqrtf(k)));
+    return true;
+}
+
+//This function finds the color a ray sees, tracing the rays it spawns
+//before it returns.
+//
+//Inputs:
+//    scene - the scene.
+//    bvh - its hierarchy.
+//    ray - the ray.
+//    depth - the bounces the ray has taken.
+//    stats - the rays traced are added here.
+//
+//Outputs: the color
+static Color traceRecursive(const Scene* scene, const BVH* bvh, const Ray& ray, int depth, ShadeStats* stats)
+{
+    ++stats->rays;
+    Hit hit;
+    if( !traceClosest(scene, bvh, ray, &hit, NULL) )
+    {
+        return scene->background;
+    }
+    Surface surface = surfaceAt(scene, ray, hit);
+
+    Color color = makeColor(0.0f, 0.0f, 0.0f);
+    for( size_t l = 0; l < scene->lights.size(); ++l )
+    {
+        Color lit;
+        Ray shadow;
+        float distance;
+        color = color + lightSurface(scene->lights[l], surface, ray, &lit, &shadow, &distance);
+        if( !isBlack(lit) )
+        {
+            ++stats->shadowRays;
+            if( !occluded(scene, bvh, shadow, distance) )
+            {
+                color = color + lit;
+            }
+        }
+    }
+
+    if( depth < SHADE_MAX_DEPTH )
+    {
+        const Material* material = surface.material;
+        Ray next;
+        if( !isBlack(material->reflective) )
+        {
+            color = color + material->reflective * traceRecursive(scene, bvh, reflectRay(surface, ray), depth + 1, stats);
+        }
+        if( !isBlack(material->transmissive) && refractRay(surface, ray, &next) )
+        {
+            color = color + material->transmissive * traceRecursive(scene, bvh, next, depth + 1, stats);
+        }
+    }
+    return color;
+}
+
+void renderRecursive(const Scene* scene, const BVH* bvh, int width, int height, float* pixels, ShadeStats* stats)
+{
+    for( int row = 0; row < height; ++row )
+    {
+        for( int col = 0; col < width; ++col )
+        {
+            Color color = traceRecursive(scene, bvh, cameraRay(scene->camera, width, height, row, col), 0, stats);
+            float* pixel = &pixels[((size_t)row * width + col) * 3];
+            pixel[0] = color.x;
+            pixel[1] = color.y;
+            pixel[2] = color.z;
+        }
+    }
+}
+
+//This function lays the sorting grid over the bounds of a scene.
+//
+//Inputs:
+//    bvh - the hierarchy of the scene.
+//
+//Outputs: the grid
+static SortGrid sortGrid(const BVH* bvh)
+{
+    SortGrid grid;
+    grid.lower = makeVec3(0.0f, 0.0f, 0.0f);
+    grid.scale = makeVec3(0.0f, 0.0f, 0.0f);
+    if( bvh->prims.empty() )
+    {
+        return grid;
+    }
+
+    const BVHNode& root = bvh->nodes[0];
+    grid.lower = makeVec3(root.lower[0], root.lower[1], root.lower[2]);
+    Vec3 extent = makeVec3(root.upper[0], root.upper[1], root.upper[2]) - grid.lower;
+    grid.scale = makeVec3(extent.x > 0.0f ? SORT_CELLS / extent.x : 0.0f,
+                          extent.y > 0.0f ? SORT_CELLS / extent.y : 0.0f,
+                          extent.z > 0.0f ? SORT_CELLS / extent.z : 0.0f);
+    return grid;
+}
+
+//This function returns the key rays are sorted by: the octant of the
+//direction, then the cell of the origin. Rays with the same key start
+//close together and go the same way, so they visit the same nodes in the
+//same order.
+//
+//Inputs:
+//    ray - the ray.
+//    grid - the sorting grid.
+//
+//Outputs: the key
+static unsigned int rayKey(const Ray& ray, const SortGrid& grid)
+{
+    unsigned int key = (ray.direction.x < 0.0f) << 2 | (ray.direction.y < 0.0f) << 1 | (ray.direction.z < 0.0f);
+    for( int a = 0; a < 3; ++a )
+    {
+        int cell = (int)((component(ray.origin, a) - component(grid.lower, a)) * component(grid.scale, a));
+        key = key * SORT_CELLS + std::min(SORT_CELLS - 1, std::max(0, cell));
+    }
+    return key;
+}
+
+void renderWavefront(const Scene* scene, const BVH* bvh, int width, int height, int batch, float* pixels,
+                     ShadeStats* stats)
+{
+    int tilesAcross = (width + WAVEFRONT_TILE - 1) / WAVEFRONT_TILE;
+    int tiles = tilesAcross * ((height + WAVEFRONT_TILE - 1) / WAVEFRONT_TILE);
+    SortGrid grid = sortGrid(bvh);
+
+    //Kept from batch to batch, so their memory is only taken once.
+    std::vector<int> image;          //Pixel of the image, per pixel of the batch.
+    std::vector<Color> colors;
+    std::vector<QueuedRay> rays;
+    std::vector<QueuedRay> next;
+    std::vector<Hit> hits;
+    std::vector<ShadowQuery> shadows;
+
+    for( int firstTile = 0; firstTile < tiles; firstTile += batch )
+    {
+        ++stats->batches;
+        image.clear();
+        rays.clear();
+
+        //The primary rays of the batch.
+        for( int tile = firstTile; tile < std::min(tiles, firstTile + batch); ++tile )
+        {
+            int top = (tile / tilesAcross) * WAVEFRONT_TILE;
+            int left = (tile % tilesAcross) * WAVEFRONT_TILE;
+            for( int row = top; row < std::min(height, top + WAVEFRONT_TILE); ++row )
+            {
+                for( int col = left; col < std::min(width, left + WAVEFRONT_TILE); ++col )
+                {
+                    QueuedRay queued;
+                    queued.ray = cameraRay(scene->camera, width, height, row, col);
+                    queued.weight = makeColor(1.0f, 1.0f, 1.0f);
+                    queued.pixel = (int)image.size();
+                    queued.depth = 0;
+                    rays.push_back(queued);
+                    image.push_back(row * width + col);
+                }
+            }
+        }
+        colors.assign(image.size(), makeColor(0.0f, 0.0f, 0.0f));
+
+        while( !rays.empty() )
+        {
+            //Intersect the whole bounce, sorted.
+            for( size_t i = 0; i < rays.size(); ++i )
+            {
+                rays[i].key = rayKey(rays[i].ray, grid);
+            }
+            std::sort(rays.begin(), rays.end(), [](const QueuedRay& a, const QueuedRay& b) { return a.key < b.key; });
+            hits.resize(rays.size());
+            for( size_t i = 0; i < rays.size(); ++i )
+            {
+                traceClosest(scene, bvh, rays[i].ray, &hits[i], NULL);
+            }
+            stats->rays += (long)rays.size();
+
+            //Shade it, queueing the shadow rays and the next bounce.
+            next.clear();
+            shadows.clear();
+            for( size_t i = 0; i < rays.size(); ++i )
+            {
+                const QueuedRay& queued = rays[i];
+                Color& color = colors[queued.pixel];
+                if( hits[i].prim < 0 )
+                {
+                    color = color + queued.weight * scene->background;
+                    continue;
+                }
+                Surface surface = surfaceAt(scene, queued.ray, hits[i]);
+
+                for( size_t l = 0; l < scene->lights.size(); ++l )
+                {
+                    ShadowQuery shadow;
+                    Color lit;
+                    color = color + queued.weight * lightSurface(scene->lights[l], surface, queued.ray, &lit,
+                                                                 &shadow.ray, &shadow.distance);
+                    if( !isBlack(lit) )
+                    {
+                        shadow.color = queued.weight * lit;
+                        shadow.pixel = queued.pixel;
+                        shadows.push_back(shadow);
+                    }
+                }
+
+                if( queued.depth < SHADE_MAX_DEPTH )
+                {
+                    const Material* material = surface.material;
+                    QueuedRay spawned;
+                    spawned.pixel = queued.pixel;
+                    spawned.depth = queued.depth + 1;
+                    if( !isBlack(material->reflective) )
+                    {
+                        spawned.ray = reflectRay(surface, queued.ray);
+                        spawned.weight = queued.weight * material->reflective;
+                        next.push_back(spawned);
+                    }
+                    if( !isBlack(material->transmissive) && refractRay(surface, queued.ray, &spawned.ray) )
+                    {
+                        spawned.weight = queued.weight * material->transmissive;
+                        next.push_back(spawned);
+                    }
+                }
+            }
+
+            //Then the shadow rays, sorted too.
+            for( size_t i = 0; i < shadows.size(); ++i )
+            {
+                shadows[i].key = rayKey(shadows[i].ray, grid);
+            }
+            std::sort(shadows.begin(), shadows.end(), [](const ShadowQuery& a, const ShadowQuery& b) { return a.key < b.key; });
+            for( size_t i = 0; i < shadows.size(); ++i )
+            {
+                if( !occluded(scene, bvh, shadows[i].ray, shadows[i].distance) )
+                {
+                    colors[shadows[i].pixel] = colors[shadows[i].pixel] + shadows[i].color;
+                }
+            }
+            stats->shadowRays += (long)shadows.size();
+
+            stats->peakRays = std::max(stats->peakRays, (long)(rays.size() + next.size() + shadows.size()));
+            rays.swap(next);
+        }
+
+        for( size_t i = 0; i < image.size(); ++i )
+        {
+            float* pixel = &pixels[(size_t)image[i] * 3];
+            pixel[0] = colors[i].x;
+            pixel[1] = colors[i].y;
+            pixel[2] = colors[i].z;
+        }
+
+        size_t bytes = image.capacity() * sizeof(int) + colors.capacity() * sizeof(Color) +
+                       (rays.capacity() + next.capacity()) * sizeof(QueuedRay) + hits.capacity() * sizeof(Hit) +
+                       shadows.capacity() * sizeof(ShadowQuery);
+        stats->peakBytes = std::max(stats->peakBytes, bytes);
+    }
+}
@@ -1,26 +1,25 @@
 //This file contains the code that the master process will execute.
 
 #include <iostream>
+#include <vector>
 #include <mpi.h>
 #include "RayTrace.h"
 #include "slave.h"
+#include "tiles.h"
+#include "regions.h"
+#include "steal.h"
 
 //primatives
-void slaveStaticStripsHorizontal(ConfigData* data, float* pixels);
-void slaveStaticBlock(ConfigData* data, float* pixels);
-void slaveStaticCyclesVertical(ConfigData* data, float* pixels);
+void slaveStatic(ConfigData* data);
+void slaveDynamic(ConfigData* data);
+void slaveStealing(ConfigData* data);
 
-void slaveMain(ConfigData* data)
+void slaveMain(ConfigData* data, const Options* options)
 {
     //Depending on the partitioning scheme, different things will happen.
     //You should have a different function for each of the required 
     //schemes that returns some values that you need to handle.
-    float* pixels = new float[3 * data->width * data->height + 1];
-    for(int i = 0; i < 3 * data->width * data->height; i++)
-    {
-        pixels[i] = 0;
-    }
-
+    //Each of them allocates only the pixels it renders.
     switch (data->partitioningMode)
     {
         case PART_MODE_NONE:
@@ -30,7 +29,7 @@ void slaveMain(ConfigData* data)
         {
             //Call the function that will handle this.
             //double startTime = MPI_Wtime();
-            slaveStaticStripsHorizontal(data, pixels);
+            slaveStatic(data);
             //double stopTime = MPI_Wtime();
             break;
         }
@@ -38,13 +37,25 @@ void slaveMain(ConfigData* data)
         {
             //Call the function that will handle blocks.
             //double startTime = MPI_Wtime();
-            slaveStaticBlock(data, pixels);
+            slaveStatic(data);
             //double stopTime = MPI_Wtime();
             break;
         }
         case PART_MODE_STATIC_CYCLES_VERTICAL:
         {
-            slaveStaticCyclesVertical(data, pixels);
+            slaveStatic(data);
+            break;
+        }
+        case PART_MODE_DYNAMIC:
+        {
+            if( options->steal )
+            {
+                slaveStealing(data);
+            }
+            else
+            {
+                slaveDynamic(data);
+            }
             break;
         }
         default:
@@ -54,112 +65,95 @@ void slaveMain(ConfigData* data)
             break;
         }
     }
-
-    delete[] pixels; 
 }
 
 
-void slaveStaticStripsHorizontal(ConfigData* data, float* pixels)
+void slaveStatic(ConfigData* data)
 {
-    int height = data->height;
-    int width = data->width;
-    int rank = data->mpi_rank;
-    int procs = data->mpi_procs;
-    float strip_width = width/procs;
+    // Only this rank's region is rendered, packed into a compact buffer
+    // and streamed to the master a chunk at a time
+    std::vector<Tile> chunks = regionChunks(regionTiles(data, data->mpi_rank));
+    float* pixels = new float[regionSize(chunks)];
+    std::vector<MPI_Request> requests(chunks.size());
+    float computationTime = 0.0;
+
+    float* chunk = pixels;
+    for( size_t c = 0; c < chunks.size(); ++c )
+    {
+        // Start computation timer
+        double computationStart = MPI_Wtime();
 
-    // Start computation timer
-    double computationStart = MPI_Wtime();
+        renderTile(data, chunks[c], chunk);
 
-    // Iterate over rows for this partition
-    for( int col = ( ceil(strip_width) * rank ); col < ( floor(strip_width) * (rank + 1) ); ++col )
-    {
-        // Iterate over all cols (strips span width)
-        for( int row = 0; row < data->height; ++row )
-        {
-            //Calculate the index into the array.
-            int baseIndex = 3 * ( row * width + col );
+        // Stop computation timer
+        computationTime += (float)(MPI_Wtime() - computationStart);
 
-            //Call the function to shade the pixel.
-            shadePixel(&(pixels[baseIndex]), row, col, data);
-        }
+        // Send the chunk while the next one is rendered
+        int size = 3 * chunks[c].width * chunks[c].height;
+        MPI_Isend(chunk, size, MPI_FLOAT, 0, MPI_BUFFER_TAG, MPI_COMM_WORLD, &requests[c]);
+        chunk += size;
     }
-    
-    // Stop computation timer
-    double computationStop = MPI_Wtime();
-    float computationTime = (float)computationStop - (float)computationStart;
-    
-    // Add computation time to the end of the buffer
-    pixels[3 * data->width * data->height] = computationTime;
-    
-    MPI_Send(pixels, 3 * width * height + 1, MPI_FLOAT, 0, MPI_BUFFER_TAG, MPI_COMM_WORLD);
-}
 
-void slaveStaticBlock(ConfigData* data, float* pixels){
-    int height = data->height;
-    int width = data->width;
-    int rank = data->mpi_rank;
-    int procs = data->mpi_procs;
-    int factor = sqrt(procs);
-    float block_width = (width/procs) * factor;
-    float block_height = (height/procs) * factor;
-    
-    // Start computation timer
-    double computationStart = MPI_Wtime();
-    
-    for( int col = (ceil(block_width) * (rank % factor) ); col < (floor(block_width) * ((rank % factor) + 1) ); ++col ){
-        // Iterate over all cols (strips span width)
-        for( int row = (ceil(block_height) * floor(rank/factor) ); row < (floor(block_height) * (floor(rank/factor) + 1) ); ++row ){
-            //Calculate the index into the array.
-            int baseIndex = 3 * ( row * width + col );
-
-            //Call the function to shade the pixel.
-            shadePixel(&(pixels[baseIndex]), row, col, data);
-        }
-    }
-    
-    // Stop computation timer
-    double computationStop = MPI_Wtime();
-    float computationTime = (float)computationStop - (float)computationStart;
-    
-    // Add computation time to the end of the buffer
-    pixels[3 * data->width * data->height] = computationTime;
-
-    MPI_Send(pixels, 3 * width * height, MPI_FLOAT, 0, MPI_BUFFER_TAG, MPI_COMM_WORLD);
+    MPI_Waitall((int)requests.size(), requests.data(), MPI_STATUSES_IGNORE);
+
+    // The master adds up the computation times
+    MPI_Reduce(&computationTime, NULL, 1, MPI_FLOAT, MPI_SUM, 0, MPI_COMM_WORLD);
+
+    delete[] pixels;
 }
 
-void slaveStaticCyclesVertical(ConfigData* data, float* pixels)
+void slaveDynamic(ConfigData* data)
 {
-    int height = data->height;
-    int width = data->width;
-    int rank = data->mpi_rank;
-    int procs = data->mpi_procs;
-    int cycle_height = data->cycleSize;
-    
-    // Start computation timer
-    double computationStart = MPI_Wtime();
-
-    // Process for this node
-    for(int part = rank * cycle_height; part < height; part += (procs * cycle_height))
+    float* buffer = new float[3 * data->dynamicBlockWidth * data->dynamicBlockHeight];
+    double computationTime = 0.0;
+
+    //Ask for the first tiles. From then on every result asks for one more,
+    //so the next tile is already here when the current one is done.
+    int outstanding = TILES_IN_FLIGHT;
+    for( int i = 0; i < TILES_IN_FLIGHT; ++i )
     {
-        for(int col = 0; col < width; ++col)
-        {
-            for(int row = part; row < ((part + cycle_height) >= height ? height : part + cycle_height); ++row)
-            {
-                //Calculate the index into the array.
-                int baseIndex = 3 * ( row * width + col );
+        MPI_Send(NULL, 0, MPI_INT, 0, MPI_REQUEST_TAG, MPI_COMM_WORLD);
+    }
 
-                //Call the function to shade the pixel.
-                shadePixel(&(pixels[baseIndex]), row, col, data);
-            }
+    //Each request is answered with a tile or a stop (-1).
+    while( outstanding > 0 )
+    {
+        int index;
+        MPI_Status status;
+        MPI_Recv(&index, 1, MPI_INT, 0, MPI_TILE_TAG, MPI_COMM_WORLD, &status);
+        --outstanding;
+
+        if( index < 0 )
+        {
+            continue;
         }
+
+        // Start computation timer
+        double computationStart = MPI_Wtime();
+
+        Tile tile = tileBounds(data, index);
+        renderTile(data, tile, buffer);
+
+        // Stop computation timer
+        computationTime += MPI_Wtime() - computationStart;
+
+        MPI_Send(buffer, 3 * tile.width * tile.height, MPI_FLOAT, 0, MPI_RESULT_TAG, MPI_COMM_WORLD);
+        ++outstanding;
     }
-    
-    // Stop computation timer
-    double computationStop = MPI_Wtime();
-    float computationTime = (float)computationStop - (float)computationStart;
-    
-    // Add computation time to the end of the buffer
-    pixels[3 * data->width * data->height] = computationTime;
-
-    MPI_Send(pixels, 3 * width * height, MPI_FLOAT, 0, MPI_BUFFER_TAG, MPI_COMM_WORLD);
+
+    delete[] buffer;
+
+    // The master adds up the computation times
+    MPI_Reduce(&computationTime, NULL, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+}
+
+void slaveStealing(ConfigData* data)
+{
+    StealStats stats;
+    renderStealing(data, NULL, &stats);
+
+    // The master reports what every rank did
+    double local[5] = { (double)stats.tiles, (double)stats.steals, (double)stats.attempts,
+                        stats.computationTime, stats.idleTime };
+    MPI_Gather(local, 5, MPI_DOUBLE, NULL, 5, MPI_DOUBLE, 0, MPI_COMM_WORLD);
 }
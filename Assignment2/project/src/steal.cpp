@@ -0,0 +1,297 @@
+//This file contains the work stealing renderer that every rank runs for
+//-p dynamic --steal.
+
+#include <cstdlib>
+#include <vector>
+#include <mpi.h>
+
+#include "RayTrace.h"
+#include "tiles.h"
+#include "regions.h"
+#include "steal.h"
+
+//The state of one rank while stealing.
+struct StealState
+{
+    int rank;
+    int procs;
+    int numTiles;
+
+    int first;             //The tiles left to render are [first, last).
+    int last;
+
+    bool asking;           //A steal request is waiting for its answer.
+    bool haveToken;        //This rank holds the termination token.
+    int tokenCount;        //Tiles counted by the token so far.
+    bool terminated;       //Every tile has been rendered.
+
+    unsigned int seed;     //For picking victims.
+};
+
+//This function receives one message of the stealing protocol and acts
+//on it.
+//
+//Inputs:
+//    state - the state of this rank.
+//    status - the probed message.
+//    stats - what this rank did.
+//
+//Outputs: None
+static void handleMessage(StealState* state, MPI_Status* status, StealStats* stats)
+{
+    int source = status->MPI_SOURCE;
+
+    switch (status->MPI_TAG)
+    {
+        case MPI_STEAL_TAG:
+        {
+            //Give away the back half of what is left, keeping the front,
+            //which is next to the tiles already rendered here.
+            MPI_Recv(NULL, 0, MPI_INT, source, MPI_STEAL_TAG, MPI_COMM_WORLD, status);
+            int loot[2];
+            loot[1] = state->last;
+            loot[0] = state->last - (state->last - state->first) / 2;
+            state->last = loot[0];
+            MPI_Send(loot, 2, MPI_INT, source, MPI_LOOT_TAG, MPI_COMM_WORLD);
+            break;
+        }
+        case MPI_LOOT_TAG:
+        {
+            int loot[2];
+            MPI_Recv(loot, 2, MPI_INT, source, MPI_LOOT_TAG, MPI_COMM_WORLD, status);
+            state->asking = false;
+            if( loot[0] < loot[1] )
+            {
+                state->first = loot[0];
+                state->last = loot[1];
+                ++stats->steals;
+            }
+            break;
+        }
+        case MPI_TOKEN_TAG:
+        {
+            MPI_Recv(&state->tokenCount, 1, MPI_INT, source, MPI_TOKEN_TAG, MPI_COMM_WORLD, status);
+            state->haveToken = true;
+            break;
+        }
+        case MPI_TERMINATE_TAG:
+        {
+            MPI_Recv(NULL, 0, MPI_INT, source, MPI_TERMINATE_TAG, MPI_COMM_WORLD, status);
+            state->terminated = true;
+            break;
+        }
+    }
+}
+
+//This function passes the termination token on; it is only called when
+//this rank has nothing left to render. The token goes around the ring
+//from rank 0, and each rank adds the tiles it has rendered. A rank may
+//render more tiles after it passed the token, so the count can only fall
+//short of the tiles actually done, never exceed it: when it comes back
+//to rank 0 with every tile counted, they really are all done. Otherwise
+//rank 0 starts another round.
+//
+//Inputs:
+//    state - the state of this rank.
+//    stats - what this rank did.
+//
+//Outputs: None
+static void passToken(StealState* state, StealStats* stats)
+{
+    if( state->rank == 0 )
+    {
+        if( state->tokenCount == state->numTiles )
+        {
+            for( int p = 1; p < state->procs; ++p )
+            {
+                MPI_Send(NULL, 0, MPI_INT, p, MPI_TERMINATE_TAG, MPI_COMM_WORLD);
+            }
+            state->terminated = true;
+            return;
+        }
+
+        //Start a new round.
+        state->tokenCount = stats->tiles;
+        if( state->procs == 1 )
+        {
+            return;
+        }
+    }
+    else
+    {
+        state->tokenCount += stats->tiles;
+    }
+
+    MPI_Send(&state->tokenCount, 1, MPI_INT, (state->rank + 1) % state->procs, MPI_TOKEN_TAG, MPI_COMM_WORLD);
+    state->haveToken = false;
+}
+
+void renderStealing(ConfigData* data, float* pixels, StealStats* stats)
+{
+    StealState state;
+    state.rank = data->mpi_rank;
+    state.procs = data->mpi_procs;
+    state.numTiles = tileCount(data);
+    state.first = (int)((long)state.numTiles * state.rank / state.procs);
+    state.last = (int)((long)state.numTiles * (state.rank + 1) / state.procs);
+    state.asking = false;
+    state.haveToken = (state.rank == 0);
+    state.tokenCount = -1;
+    state.terminated = false;
+    state.seed = state.rank + 1;
+
+    stats->tiles = 0;
+    stats->steals = 0;
+    stats->attempts = 0;
+    stats->computationTime = 0.0;
+    stats->idleTime = 0.0;
+
+    //Rank 0 renders straight into the image; the others keep their tiles,
+    //one after the other, until the end.
+    std::vector<int> done;
+    std::vector<float> results;
+    float* buffer = new float[3 * data->dynamicBlockWidth * data->dynamicBlockHeight];
+
+    while( !state.terminated )
+    {
+        MPI_Status status;
+
+        if( state.first < state.last )
+        {
+            double computationStart = MPI_Wtime();
+
+            int index = state.first++;
+            Tile tile = tileBounds(data, index);
+            renderTile(data, tile, buffer);
+            if( pixels != NULL )
+            {
+                storeTile(data, tile, buffer, pixels);
+            }
+            else
+            {
+                done.push_back(index);
+                results.insert(results.end(), buffer, buffer + 3 * tile.width * tile.height);
+            }
+            ++stats->tiles;
+
+            stats->computationTime += MPI_Wtime() - computationStart;
+
+            //Answer whoever asked for work in the meantime.
+            int waiting = 1;
+            while( waiting )
+            {
+                MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &waiting, &status);
+                if( waiting )
+                {
+                    handleMessage(&state, &status, stats);
+                }
+            }
+        }
+        else
+        {
+            double idleStart = MPI_Wtime();
+
+            if( state.haveToken )
+            {
+                passToken(&state, stats);
+            }
+
+            if( !state.terminated )
+            {
+                if( !state.asking && state.procs > 1 )
+                {
+                    int victim = rand_r(&state.seed) % (state.procs - 1);
+                    if( victim >= state.rank )
+                    {
+                        ++victim;
+                    }
+                    MPI_Send(NULL, 0, MPI_INT, victim, MPI_STEAL_TAG, MPI_COMM_WORLD);
+                    state.asking = true;
+                    ++stats->attempts;
+                }
+
+                if( state.procs > 1 )
+                {
+                    MPI_Probe(MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
+                    handleMessage(&state, &status, stats);
+                }
+            }
+
+            stats->idleTime += MPI_Wtime() - idleStart;
+        }
+    }
+
+    //Before leaving, wait for the answer to our own steal request, and
+    //keep answering the requests of the others (with nothing) until they
+    //have all had theirs: a rank only enters the barrier once it has no
+    //request left, so nothing is in flight once it completes.
+    double idleStart = MPI_Wtime();
+    MPI_Request barrier;
+    int passed = 0;
+    bool inBarrier = false;
+    while( !passed )
+    {
+        MPI_Status status;
+        int waiting;
+
+        if( !inBarrier && !state.asking )
+        {
+            MPI_Ibarrier(MPI_COMM_WORLD, &barrier);
+            inBarrier = true;
+        }
+        if( inBarrier )
+        {
+            MPI_Test(&barrier, &passed, MPI_STATUS_IGNORE);
+        }
+
+        MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &waiting, &status);
+        if( waiting )
+        {
+            handleMessage(&state, &status, stats);
+        }
+    }
+    stats->idleTime += MPI_Wtime() - idleStart;
+
+    delete[] buffer;
+
+    //Gather the tiles of the other ranks straight into the image: first
+    //which tiles each rank has, then their pixels, through a datatype
+    //that puts each tile in its place.
+    int count = (int)done.size();
+    std::vector<int> counts(pixels != NULL ? state.procs : 0);
+    MPI_Gather(&count, 1, MPI_INT, counts.data(), 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+    std::vector<int> offsets(counts.size());
+    std::vector<int> allDone;
+    for( size_t p = 0; p < counts.size(); ++p )
+    {
+        offsets[p] = (int)allDone.size();
+        allDone.resize(allDone.size() + counts[p]);
+    }
+    MPI_Gatherv(done.data(), count, MPI_INT, allDone.data(), counts.data(), offsets.data(), MPI_INT, 0, MPI_COMM_WORLD);
+
+    if( pixels != NULL )
+    {
+        for( int p = 1; p < state.procs; ++p )
+        {
+            if( counts[p] == 0 )
+            {
+                continue;
+            }
+
+            std::vector<Tile> tiles;
+            for( int i = 0; i < counts[p]; ++i )
+            {
+                tiles.push_back(tileBounds(data, allDone[offsets[p] + i]));
+            }
+
+            MPI_Datatype type = regionType(data, tiles);
+            MPI_Recv(pixels, 1, type, p, MPI_BUFFER_TAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+            MPI_Type_free(&type);
+        }
+    }
+    else if( count > 0 )
+    {
+        MPI_Send(results.data(), (int)results.size(), MPI_FLOAT, 0, MPI_BUFFER_TAG, MPI_COMM_WORLD);
+    }
+}
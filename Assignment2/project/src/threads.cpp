@@ -0,0 +1,333 @@
+//This file contains the pool of threads that renders the tiles of an area
+//of the image, with work stealing between the threads.
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+
+#include "RayTrace.h"
+#include "tiles.h"
+#include "threads.h"
+
+//The sub-tiles a thread has left, [first, last). The owner takes them
+//from the front, thieves from the back. Each deque has a cache line of
+//its own, so that threads do not slow each other down by touching their
+//own deques.
+struct alignas(64) TileDeque
+{
+    std::mutex lock;
+    int first;
+    int last;
+};
+
+//The area being rendered.
+struct RenderJob
+{
+    ConfigData* data;
+    Tile area;
+    float* pixels;
+    int stride;
+    int across;    //Sub-tiles per row of the area.
+};
+
+static int numThreads = 1;
+static std::vector<std::thread> workers;
+static TileDeque* deques = NULL;
+static ConfigData* scenes = NULL;    //The scene of each worker; see threads.h.
+
+//Handing out jobs to the workers.
+static std::mutex poolLock;
+static std::condition_variable jobStarted;
+static std::condition_variable jobFinished;
+static RenderJob job;
+static long generation = 0;    //Jobs started so far.
+static int running = 0;        //Workers still on the current job.
+static bool stopping = false;
+
+//The state of rand() of each thread; see threads.h. libraytrace calls
+//rand() from Camera::renderPixelSuperSampling, and the definitions below
+//take the place of the ones in the C library.
+static thread_local unsigned int randState = 1;
+
+extern "C" int rand(void) noexcept
+{
+    return rand_r(&randState);
+}
+
+extern "C" void srand(unsigned int seed) noexcept
+{
+    randState = seed;
+}
+
+//This function shades a rectangle straight into the pixels.
+//
+//Inputs:
+//    data - the ConfigData that holds the scene information.
+//    area - the rectangle to shade.
+//    pixels - where pixel (area.row, area.col) goes.
+//    stride - the pixels from one row of `pixels' to the next.
+//
+//Outputs: None
+static void shadeArea(ConfigData* data, const Tile& area, float* pixels, int stride)
+{
+    for( int i = 0; i < area.height; ++i )
+    {
+        for( int j = 0; j < area.width; ++j )
+        {
+            //Calculate the index into the array.
+            int baseIndex = 3 * ( i * stride + j );
+
+            //Call the function to shade the pixel.
+            shadePixel(&(pixels[baseIndex]), area.row + i, area.col + j, data);
+        }
+    }
+}
+
+//This function takes the next sub-tile for a thread: the front of its
+//own deque or, when that is empty, the back half of the deque of another
+//thread, tried in turn from a random one on.
+//
+//Inputs:
+//    self - the thread.
+//    seed - the state of the thread for picking victims.
+//    index - set to the sub-tile.
+//
+//Outputs: false once there are no sub-tiles left anywhere
+static bool nextTile(int self, unsigned int* seed, int* index)
+{
+    TileDeque& own = deques[self];
+    {
+        std::lock_guard<std::mutex> guard(own.lock);
+        if( own.first < own.last )
+        {
+            *index = own.first++;
+            return true;
+        }
+    }
+
+    int start = rand_r(seed) % numThreads;
+    for( int k = 0; k < numThreads; ++k )
+    {
+        int victim = (start + k) % numThreads;
+        if( victim == self )
+        {
+            continue;
+        }
+
+        int first, last;
+        {
+            std::lock_guard<std::mutex> guard(deques[victim].lock);
+            int left = deques[victim].last - deques[victim].first;
+            if( left <= 0 )
+            {
+                continue;
+            }
+            last = deques[victim].last;
+            first = last - (left + 1) / 2;
+            deques[victim].last = first;
+        }
+
+        //Keep the first of the loot and put the rest in our deque.
+        *index = first;
+        std::lock_guard<std::mutex> guard(own.lock);
+        own.first = first + 1;
+        own.last = last;
+        return true;
+    }
+
+    return false;
+}
+
+//This function renders sub-tiles of the current job until there are
+//none left.
+//
+//Inputs:
+//    self - the thread.
+//
+//Outputs: None
+static void renderShare(int self)
+{
+    //Sub-tiles are rendered here first, so that threads do not write
+    //next to each other in the image while they shade.
+    float buffer[3 * RENDER_TILE_SIZE * RENDER_TILE_SIZE];
+    unsigned int seed = self + 1;
+    const Tile& area = job.area;
+    ConfigData* data = (self == 0) ? job.data : &(scenes[self]);
+    int index;
+
+    while( nextTile(self, &seed, &index) )
+    {
+        Tile tile;
+        tile.row = area.row + (index / job.across) * RENDER_TILE_SIZE;
+        tile.col = area.col + (index % job.across) * RENDER_TILE_SIZE;
+        tile.height = std::min(RENDER_TILE_SIZE, area.row + area.height - tile.row);
+        tile.width = std::min(RENDER_TILE_SIZE, area.col + area.width - tile.col);
+
+        shadeArea(data, tile, buffer, tile.width);
+
+        for( int i = 0; i < tile.height; ++i )
+        {
+            int baseIndex = 3 * ( (tile.row - area.row + i) * job.stride + (tile.col - area.col) );
+            memcpy(&(job.pixels[baseIndex]), &(buffer[3 * i * tile.width]), 3 * tile.width * sizeof(float));
+        }
+    }
+}
+
+//This function is run by every worker: it waits for a job, renders its
+//share and steals from the others, and reports back.
+//
+//Inputs:
+//    self - the thread.
+//
+//Outputs: None
+static void workerMain(int self)
+{
+    long seen = 0;
+
+    while( true )
+    {
+        {
+            std::unique_lock<std::mutex> guard(poolLock);
+            jobStarted.wait(guard, [&seen] { return stopping || generation != seen; });
+            if( stopping )
+            {
+                return;
+            }
+            seen = generation;
+        }
+
+        renderShare(self);
+
+        std::lock_guard<std::mutex> guard(poolLock);
+        if( --running == 0 )
+        {
+            jobFinished.notify_all();
+        }
+    }
+}
+
+bool startRenderThreads(int threads, int argc, char** argv)
+{
+    numThreads = std::max(1, threads);
+    deques = new TileDeque[numThreads];
+    scenes = new ConfigData[numThreads];
+
+    //Load the scene again for every worker. The caller has already seen
+    //whatever the loader prints, so keep it quiet this time.
+    std::streambuf* screen = std::cout.rdbuf(NULL);
+    bool result = false;
+    int loaded = 1;
+    while( !result && loaded < numThreads )
+    {
+        int count = argc;
+        char** args = argv;
+        result = initialize(&count, &args, &(scenes[loaded]));
+        if( !result )
+        {
+            ++loaded;
+        }
+    }
+    std::cout.rdbuf(screen);
+    std::cout.clear();
+
+    if( result )
+    {
+        std::cerr << "Could not load the scene for the render threads!" << std::endl;
+        for( int i = 1; i < loaded; ++i )
+        {
+            shutdown(&(scenes[i]));
+        }
+        delete[] scenes;
+        scenes = NULL;
+        delete[] deques;
+        deques = NULL;
+        numThreads = 1;
+        return true;
+    }
+
+    for( int i = 1; i < numThreads; ++i )
+    {
+        workers.push_back(std::thread(workerMain, i));
+    }
+
+    return false;
+}
+
+void stopRenderThreads()
+{
+    {
+        std::lock_guard<std::mutex> guard(poolLock);
+        stopping = true;
+    }
+    jobStarted.notify_all();
+
+    for( size_t i = 0; i < workers.size(); ++i )
+    {
+        workers[i].join();
+    }
+    workers.clear();
+
+    for( int i = 1; i < numThreads; ++i )
+    {
+        shutdown(&(scenes[i]));
+    }
+    delete[] scenes;
+    scenes = NULL;
+    delete[] deques;
+    deques = NULL;
+    numThreads = 1;
+    stopping = false;
+}
+
+void renderArea(ConfigData* data, const Tile& area, float* pixels, int stride)
+{
+    int across = (area.width + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+    int down = (area.height + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+    int count = across * down;
+
+    //Not worth waking anybody up.
+    if( numThreads == 1 || count < 2 )
+    {
+        shadeArea(data, area, pixels, stride);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(poolLock);
+        job.data = data;
+        job.area = area;
+        job.pixels = pixels;
+        job.stride = stride;
+        job.across = across;
+
+        //The workers' scenes came from the same arguments; only what was
+        //filled in afterwards needs passing on.
+        for( int t = 1; t < numThreads; ++t )
+        {
+            scenes[t].mpi_rank = data->mpi_rank;
+            scenes[t].mpi_procs = data->mpi_procs;
+        }
+
+        //One contiguous run of sub-tiles per thread, so that each starts
+        //out on its own part of the area.
+        for( int t = 0; t < numThreads; ++t )
+        {
+            deques[t].first = (int)((long)count * t / numThreads);
+            deques[t].last = (int)((long)count * (t + 1) / numThreads);
+        }
+
+        running = numThreads - 1;
+        ++generation;
+    }
+    jobStarted.notify_all();
+
+    renderShare(0);
+
+    std::unique_lock<std::mutex> guard(poolLock);
+    jobFinished.wait(guard, [] { return running == 0; });
+}
@@ -0,0 +1,45 @@
+//This file contains the tile helpers shared by the master and the slaves
+//for dynamic partitioning.
+
+#include <algorithm>
+#include <cstring>
+
+#include "RayTrace.h"
+#include "tiles.h"
+#include "threads.h"
+
+int tileCount(const ConfigData* data)
+{
+    int across = (data->width + data->dynamicBlockWidth - 1) / data->dynamicBlockWidth;
+    int down = (data->height + data->dynamicBlockHeight - 1) / data->dynamicBlockHeight;
+
+    return across * down;
+}
+
+Tile tileBounds(const ConfigData* data, int index)
+{
+    int across = (data->width + data->dynamicBlockWidth - 1) / data->dynamicBlockWidth;
+    Tile tile;
+
+    tile.row = (index / across) * data->dynamicBlockHeight;
+    tile.col = (index % across) * data->dynamicBlockWidth;
+    tile.height = std::min(data->dynamicBlockHeight, data->height - tile.row);
+    tile.width = std::min(data->dynamicBlockWidth, data->width - tile.col);
+
+    return tile;
+}
+
+void renderTile(ConfigData* data, const Tile& tile, float* buffer)
+{
+    renderArea(data, tile, buffer, tile.width);
+}
+
+void storeTile(const ConfigData* data, const Tile& tile, const float* buffer, float* pixels)
+{
+    //Each row of the tile is contiguous in the image too.
+    for( int i = 0; i < tile.height; ++i )
+    {
+        int baseIndex = 3 * ( (tile.row + i) * data->width + tile.col );
+        memcpy(&(pixels[baseIndex]), &(buffer[3 * i * tile.width]), 3 * tile.width * sizeof(float));
+    }
+}
@@ -0,0 +1,453 @@
+//This file contains the kernels that test a ray against many triangles at
+//once, and the choice between them.
+
+#include <cmath>
+#include <vector>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "scene.h"
+#include "triangles.h"
+
+//A kernel: the signature of intersectTriangles.
+typedef int (*TriangleKernel)(const TriangleSoA* soa, int begin, int end, const Ray& ray, float tMax, float* t);
+
+//Primatives
+static int intersect1(const TriangleSoA* soa, int begin, int end, const Ray& ray, float tMax, float* t);
+static TriangleKernel kernelOfWidth(int width);
+#if defined(__x86_64__)
+static int closestLane(const float* dist, int mask, int first, float* tMax, int found);
+static int intersect4(const TriangleSoA* soa, int begin, int end, const Ray& ray, float tMax, float* t);
+static int intersect8(const TriangleSoA* soa, int begin, int end, const Ray& ray, float tMax, float* t);
+static int intersect16(const TriangleSoA* soa, int begin, int end, const Ray& ray, float tMax, float* t);
+#endif
+
+//The kernel intersectTriangles uses, the widest one unless set otherwise.
+static int width = widestTriangleWidth();
+static TriangleKernel kernel = kernelOfWidth(width);
+
+void fillTriangleSoA(const Scene* scene, const std::vector<int>& prims, TriangleSoA* soa)
+{
+    int slots = (int)prims.size() + TRIANGLE_PADDING;
+    std::vector<float>* arrays[9] = { &soa->x, &soa->y, &soa->z, &soa->e1x, &soa->e1y, &soa->e1z,
+                                      &soa->e2x, &soa->e2y, &soa->e2z };
+    for( int a = 0; a < 9; ++a )
+    {
+        arrays[a]->assign(slots, 0.0f);
+    }
+
+    int triangles = (int)scene->triangles.size();
+    for( int i = 0; i < (int)prims.size(); ++i )
+    {
+        if( prims[i] >= triangles )
+        {
+            continue;
+        }
+        const Triangle& tri = scene->triangles[prims[i]];
+        Vec3 e1 = tri.b - tri.a;
+        Vec3 e2 = tri.c - tri.a;
+        soa->x[i] = tri.a.x;
+        soa->y[i] = tri.a.y;
+        soa->z[i] = tri.a.z;
+        soa->e1x[i] = e1.x;
+        soa->e1y[i] = e1.y;
+        soa->e1z[i] = e1.z;
+        soa->e2x[i] = e2.x;
+        soa->e2y[i] = e2.y;
+        soa->e2z[i] = e2.z;
+    }
+}
+
+//This function tests one triangle at a time, the same way
+//intersectPrimitive does.
+//
+//Inputs:
+//    soa - the triangles.
+//    begin - the first slot.
+//    end - one past the last slot.
+//    ray - the ray.
+//    tMax - only hits closer than this count.
+//    t - set to the distance of the hit.
+//
+//Outputs: the slot of the closest hit, or -1 if there is none
+static int intersect1(const TriangleSoA* soa, int begin, int end, const Ray& ray, float tMax, float* t)
+{
+    int found = -1;
+    for( int i = begin; i < end; ++i )
+    {
+        Vec3 e1 = makeVec3(soa->e1x[i], soa->e1y[i], soa->e1z[i]);
+        Vec3 e2 = makeVec3(soa->e2x[i], soa->e2y[i], soa->e2z[i]);
+        Vec3 p = cross(ray.direction, e2);
+        float det = dot(e1, p);
+        if( fabsf(det) < 1e-12f )
+        {
+            continue;
+        }
+        float inv = 1.0f / det;
+        Vec3 s = ray.origin - makeVec3(soa->x[i], soa->y[i], soa->z[i]);
+        float u = dot(s, p) * inv;
+        if( u < 0.0f || u > 1.0f )
+        {
+            continue;
+        }
+        Vec3 q = cross(s, e1);
+        float v = dot(ray.direction, q) * inv;
+        if( v < 0.0f || u + v > 1.0f )
+        {
+            continue;
+        }
+        float d = dot(e2, q) * inv;
+        if( d <= HIT_EPSILON || d >= tMax )
+        {
+            continue;
+        }
+        tMax = d;
+        found = i;
+    }
+
+    if( found >= 0 )
+    {
+        *t = tMax;
+    }
+    return found;
+}
+
+#if defined(__x86_64__)
+
+//This function picks the closest of the lanes of a vector that were hit.
+//Lanes are taken in order and only a strictly closer one replaces the
+//hit so far, as intersect1 would.
+//
+//Inputs:
+//    dist - the distance of every lane.
+//    mask - a bit for every lane that was hit.
+//    first - the slot of lane 0.
+//    tMax - the closest hit so far, updated.
+//    found - the slot of the closest hit so far.
+//
+//Outputs: the slot of the closest hit
+static int closestLane(const float* dist, int mask, int first, float* tMax, int found)
+{
+    for( int lane = 0; mask != 0; ++lane, mask >>= 1 )
+    {
+        if( (mask & 1) && dist[lane] < *tMax )
+        {
+            *tMax = dist[lane];
+            found = first + lane;
+        }
+    }
+    return found;
+}
+
+//This function tests four triangles at a time with SSE2, which every
+//x86-64 processor has.
+//
+//Inputs:
+//    soa - the triangles.
+//    begin - the first slot.
+//    end - one past the last slot.
+//    ray - the ray.
+//    tMax - only hits closer than this count.
+//    t - set to the distance of the hit.
+//
+//Outputs: the slot of the closest hit, or -1 if there is none
+static int intersect4(const TriangleSoA* soa, int begin, int end, const Ray& ray, float tMax, float* t)
+{
+    const __m128 ox = _mm_set1_ps(ray.origin.x);
+    const __m128 oy = _mm_set1_ps(ray.origin.y);
+    const __m128 oz = _mm_set1_ps(ray.origin.z);
+    const __m128 dx = _mm_set1_ps(ray.direction.x);
+    const __m128 dy = _mm_set1_ps(ray.direction.y);
+    const __m128 dz = _mm_set1_ps(ray.direction.z);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 tiny = _mm_set1_ps(1e-12f);
+    const __m128 epsilon = _mm_set1_ps(HIT_EPSILON);
+    const __m128 sign = _mm_set1_ps(-0.0f);
+
+    int found = -1;
+    for( int i = begin; i < end; i += 4 )
+    {
+        __m128 e1x = _mm_loadu_ps(&soa->e1x[i]);
+        __m128 e1y = _mm_loadu_ps(&soa->e1y[i]);
+        __m128 e1z = _mm_loadu_ps(&soa->e1z[i]);
+        __m128 e2x = _mm_loadu_ps(&soa->e2x[i]);
+        __m128 e2y = _mm_loadu_ps(&soa->e2y[i]);
+        __m128 e2z = _mm_loadu_ps(&soa->e2z[i]);
+
+        __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+        __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+        __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+        __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+        __m128 inv = _mm_div_ps(one, det);
+
+        __m128 sx = _mm_sub_ps(ox, _mm_loadu_ps(&soa->x[i]));
+        __m128 sy = _mm_sub_ps(oy, _mm_loadu_ps(&soa->y[i]));
+        __m128 sz = _mm_sub_ps(oz, _mm_loadu_ps(&soa->z[i]));
+        __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), inv);
+
+        __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+        __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+        __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+        __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), inv);
+        __m128 d = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inv);
+
+        __m128 ok = _mm_cmpge_ps(_mm_andnot_ps(sign, det), tiny);
+        ok = _mm_and_ps(ok, _mm_cmpge_ps(u, zero));
+        ok = _mm_and_ps(ok, _mm_cmple_ps(u, one));
+        ok = _mm_and_ps(ok, _mm_cmpge_ps(v, zero));
+        ok = _mm_and_ps(ok, _mm_cmple_ps(_mm_add_ps(u, v), one));
+        ok = _mm_and_ps(ok, _mm_cmpgt_ps(d, epsilon));
+        ok = _mm_and_ps(ok, _mm_cmplt_ps(d, _mm_set1_ps(tMax)));
+
+        //Lanes past the end hold whatever follows, so they are dropped.
+        int mask = _mm_movemask_ps(ok);
+        if( end - i < 4 )
+        {
+            mask &= (1 << (end - i)) - 1;
+        }
+        if( mask != 0 )
+        {
+            float dist[4];
+            _mm_storeu_ps(dist, d);
+            found = closestLane(dist, mask, i, &tMax, found);
+        }
+    }
+
+    if( found >= 0 )
+    {
+        *t = tMax;
+    }
+    return found;
+}
+
+//This function tests eight triangles at a time with AVX2.
+//
+//Inputs:
+//    soa - the triangles.
+//    begin - the first slot.
+//    end - one past the last slot.
+//    ray - the ray.
+//    tMax - only hits closer than this count.
+//    t - set to the distance of the hit.
+//
+//Outputs: the slot of the closest hit, or -1 if there is none
+__attribute__((target("avx2")))
+static int intersect8(const TriangleSoA* soa, int begin, int end, const Ray& ray, float tMax, float* t)
+{
+    const __m256 ox = _mm256_set1_ps(ray.origin.x);
+    const __m256 oy = _mm256_set1_ps(ray.origin.y);
+    const __m256 oz = _mm256_set1_ps(ray.origin.z);
+    const __m256 dx = _mm256_set1_ps(ray.direction.x);
+    const __m256 dy = _mm256_set1_ps(ray.direction.y);
+    const __m256 dz = _mm256_set1_ps(ray.direction.z);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 tiny = _mm256_set1_ps(1e-12f);
+    const __m256 epsilon = _mm256_set1_ps(HIT_EPSILON);
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+
+    int found = -1;
+    for( int i = begin; i < end; i += 8 )
+    {
+        __m256 e1x = _mm256_loadu_ps(&soa->e1x[i]);
+        __m256 e1y = _mm256_loadu_ps(&soa->e1y[i]);
+        __m256 e1z = _mm256_loadu_ps(&soa->e1z[i]);
+        __m256 e2x = _mm256_loadu_ps(&soa->e2x[i]);
+        __m256 e2y = _mm256_loadu_ps(&soa->e2y[i]);
+        __m256 e2z = _mm256_loadu_ps(&soa->e2z[i]);
+
+        __m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+        __m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+        __m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+        __m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)), _mm256_mul_ps(e1z, pz));
+        __m256 inv = _mm256_div_ps(one, det);
+
+        __m256 sx = _mm256_sub_ps(ox, _mm256_loadu_ps(&soa->x[i]));
+        __m256 sy = _mm256_sub_ps(oy, _mm256_loadu_ps(&soa->y[i]));
+        __m256 sz = _mm256_sub_ps(oz, _mm256_loadu_ps(&soa->z[i]));
+        __m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sx, px), _mm256_mul_ps(sy, py)), _mm256_mul_ps(sz, pz)), inv);
+
+        __m256 qx = _mm256_sub_ps(_mm256_mul_ps(sy, e1z), _mm256_mul_ps(sz, e1y));
+        __m256 qy = _mm256_sub_ps(_mm256_mul_ps(sz, e1x), _mm256_mul_ps(sx, e1z));
+        __m256 qz = _mm256_sub_ps(_mm256_mul_ps(sx, e1y), _mm256_mul_ps(sy, e1x));
+        __m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)), inv);
+        __m256 d = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)), inv);
+
+        __m256 ok = _mm256_cmp_ps(_mm256_andnot_ps(sign, det), tiny, _CMP_GE_OQ);
+        ok = _mm256_and_ps(ok, _mm256_cmp_ps(u, zero, _CMP_GE_OQ));
+        ok = _mm256_and_ps(ok, _mm256_cmp_ps(u, one, _CMP_LE_OQ));
+        ok = _mm256_and_ps(ok, _mm256_cmp_ps(v, zero, _CMP_GE_OQ));
+        ok = _mm256_and_ps(ok, _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ));
+        ok = _mm256_and_ps(ok, _mm256_cmp_ps(d, epsilon, _CMP_GT_OQ));
+        ok = _mm256_and_ps(ok, _mm256_cmp_ps(d, _mm256_set1_ps(tMax), _CMP_LT_OQ));
+
+        int mask = _mm256_movemask_ps(ok);
+        if( end - i < 8 )
+        {
+            mask &= (1 << (end - i)) - 1;
+        }
+        if( mask != 0 )
+        {
+            float dist[8];
+            _mm256_storeu_ps(dist, d);
+            found = closestLane(dist, mask, i, &tMax, found);
+        }
+    }
+
+    if( found >= 0 )
+    {
+        *t = tMax;
+    }
+    return found;
+}
+
+//This function tests sixteen triangles at a time with AVX-512F, whose
+//comparisons give bit masks directly.
+//
+//Inputs:
+//    soa - the triangles.
+//    begin - the first slot.
+//    end - one past the last slot.
+//    ray - the ray.
+//    tMax - only hits closer than this count.
+//    t - set to the distance of the hit.
+//
+//Outputs: the slot of the closest hit, or -1 if there is none
+__attribute__((target("avx512f")))
+static int intersect16(const TriangleSoA* soa, int begin, int end, const Ray& ray, float tMax, float* t)
+{
+    const __m512 ox = _mm512_set1_ps(ray.origin.x);
+    const __m512 oy = _mm512_set1_ps(ray.origin.y);
+    const __m512 oz = _mm512_set1_ps(ray.origin.z);
+    const __m512 dx = _mm512_set1_ps(ray.direction.x);
+    const __m512 dy = _mm512_set1_ps(ray.direction.y);
+    const __m512 dz = _mm512_set1_ps(ray.direction.z);
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512 one = _mm512_set1_ps(1.0f);
+    const __m512 tiny = _mm512_set1_ps(1e-12f);
+    const __m512 epsilon = _mm512_set1_ps(HIT_EPSILON);
+
+    int found = -1;
+    for( int i = begin; i < end; i += 16 )
+    {
+        __m512 e1x = _mm512_loadu_ps(&soa->e1x[i]);
+        __m512 e1y = _mm512_loadu_ps(&soa->e1y[i]);
+        __m512 e1z = _mm512_loadu_ps(&soa->e1z[i]);
+        __m512 e2x = _mm512_loadu_ps(&soa->e2x[i]);
+        __m512 e2y = _mm512_loadu_ps(&soa->e2y[i]);
+        __m512 e2z = _mm512_loadu_ps(&soa->e2z[i]);
+
+        __m512 px = _mm512_sub_ps(_mm512_mul_ps(dy, e2z), _mm512_mul_ps(dz, e2y));
+        __m512 py = _mm512_sub_ps(_mm512_mul_ps(dz, e2x), _mm512_mul_ps(dx, e2z));
+        __m512 pz = _mm512_sub_ps(_mm512_mul_ps(dx, e2y), _mm512_mul_ps(dy, e2x));
+        __m512 det = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(e1x, px), _mm512_mul_ps(e1y, py)), _mm512_mul_ps(e1z, pz));
+        __m512 inv = _mm512_div_ps(one, det);
+
+        __m512 sx = _mm512_sub_ps(ox, _mm512_loadu_ps(&soa->x[i]));
+        __m512 sy = _mm512_sub_ps(oy, _mm512_loadu_ps(&soa->y[i]));
+        __m512 sz = _mm512_sub_ps(oz, _mm512_loadu_ps(&soa->z[i]));
+        __m512 u = _mm512_mul_ps(_mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(sx, px), _mm512_mul_ps(sy, py)), _mm512_mul_ps(sz, pz)), inv);
+
+        __m512 qx = _mm512_sub_ps(_mm512_mul_ps(sy, e1z), _mm512_mul_ps(sz, e1y));
+        __m512 qy = _mm512_sub_ps(_mm512_mul_ps(sz, e1x), _mm512_mul_ps(sx, e1z));
+        __m512 qz = _mm512_sub_ps(_mm512_mul_ps(sx, e1y), _mm512_mul_ps(sy, e1x));
+        __m512 v = _mm512_mul_ps(_mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(dx, qx), _mm512_mul_ps(dy, qy)), _mm512_mul_ps(dz, qz)), inv);
+        __m512 d = _mm512_mul_ps(_mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(e2x, qx), _mm512_mul_ps(e2y, qy)), _mm512_mul_ps(e2z, qz)), inv);
+
+        __mmask16 ok = _mm512_cmp_ps_mask(_mm512_abs_ps(det), tiny, _CMP_GE_OQ);
+        ok &= _mm512_cmp_ps_mask(u, zero, _CMP_GE_OQ);
+        ok &= _mm512_cmp_ps_mask(u, one, _CMP_LE_OQ);
+        ok &= _mm512_cmp_ps_mask(v, zero, _CMP_GE_OQ);
+        ok &= _mm512_cmp_ps_mask(_mm512_add_ps(u, v), one, _CMP_LE_OQ);
+        ok &= _mm512_cmp_ps_mask(d, epsilon, _CMP_GT_OQ);
+        ok &= _mm512_cmp_ps_mask(d, _mm512_set1_ps(tMax), _CMP_LT_OQ);
+
+        int mask = ok;
+        if( end - i < 16 )
+        {
+            mask &= (1 << (end - i)) - 1;
+        }
+        if( mask != 0 )
+        {
+            float dist[16];
+            _mm512_storeu_ps(dist, d);
+            found = closestLane(dist, mask, i, &tMax, found);
+        }
+    }
+
+    if( found >= 0 )
+    {
+        *t = tMax;
+    }
+    return found;
+}
+
+#endif
+
+//This function returns the kernel of a width.
+//
+//Inputs:
+//    width - 1, 4, 8 or 16.
+//
+//Outputs: the kernel, NULL if there is none of that width
+static TriangleKernel kernelOfWidth(int width)
+{
+    switch( width )
+    {
+        case 1:
+            return intersect1;
+#if defined(__x86_64__)
+        case 4:
+            return intersect4;
+        case 8:
+            return intersect8;
+        case 16:
+            return intersect16;
+#endif
+        default:
+            return NULL;
+    }
+}
+
+int intersectTriangles(const TriangleSoA* soa, int begin, int end, const Ray& ray, float tMax, float* t)
+{
+    return kernel(soa, begin, end, ray, tMax, t);
+}
+
+int widestTriangleWidth()
+{
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if( __builtin_cpu_supports("avx512f") )
+    {
+        return 16;
+    }
+    if( __builtin_cpu_supports("avx2") )
+    {
+        return 8;
+    }
+    return 4;
+#else
+    return 1;
+#endif
+}
+
+int triangleWidth()
+{
+    return width;
+}
+
+bool setTriangleWidth(int newWidth)
+{
+    //Every wider instruction set here includes the narrower ones.
+    if( kernelOfWidth(newWidth) == NULL || newWidth > widestTriangleWidth() )
+    {
+        return true;
+    }
+    width = newWidth;
+    kernel = kernelOfWidth(newWidth);
+    return false;
+}